@@ -17,6 +17,9 @@ namespace FallbackLayer
     enum AccelerationStructureLayoutType
     {
         BVH2 = 0,
+
+        // BVH2 with fp16 boxes, only produced on the CPU by CompressBVH
+        CompressedBVH2,
         NumAccelerationStructureLayoutTypes
     };
 
@@ -34,6 +34,52 @@ namespace FallbackLayer
         return *m_spBuilders[builderType];
     }
 
+    CpuBvh2Builder &AccelerationStructureBuilderFactory::GetCpuBvh2Builder()
+    {
+        if (!m_spCpuBuilder)
+        {
+            m_spCpuBuilder = std::unique_ptr<CpuBvh2Builder>(new CpuBvh2Builder(m_cpuBuildThreadCount));
+        }
+        return *m_spCpuBuilder;
+    }
+
+    CpuTopLevelBvh2Builder &AccelerationStructureBuilderFactory::GetCpuTopLevelBvh2Builder()
+    {
+        if (!m_spCpuTopLevelBuilder)
+        {
+            m_spCpuTopLevelBuilder = std::unique_ptr<CpuTopLevelBvh2Builder>(new CpuTopLevelBvh2Builder(m_cpuBuildThreadCount));
+        }
+        return *m_spCpuTopLevelBuilder;
+    }
+
+    void AccelerationStructureBuilderFactory::SetCpuBuildThreadCount(UINT threadCount)
+    {
+        if (threadCount != m_cpuBuildThreadCount)
+        {
+            // Recreated with the new pool size the next time they're requested
+            m_spCpuBuilder.reset();
+            m_spCpuTopLevelBuilder.reset();
+            m_cpuBuildThreadCount = threadCount;
+        }
+    }
+
+    void AccelerationStructureBuilderFactory::BuildRaytracingAccelerationStructureOnCpu(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Inout_ void *pData)
+    {
+        switch (pDesc->Type)
+        {
+        case D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL:
+            GetCpuBvh2Builder().BuildRaytracingAccelerationStructure(pDesc, pData);
+            break;
+        case D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL:
+            GetCpuTopLevelBvh2Builder().BuildRaytracingAccelerationStructure(pDesc, pData);
+            break;
+        default:
+            ThrowFailure(E_INVALIDARG, L"Unrecognized acceleration structure type");
+        }
+    }
+
 
     IAccelerationStructureBuilder *AccelerationStructureBuilderFactory::CreateBuilder(BuilderType type)
     {
@@ -15,10 +15,24 @@ namespace FallbackLayer
     class AccelerationStructureBuilderFactory
     {
     public:
-        AccelerationStructureBuilderFactory(ID3D12Device *pDevice, UINT nodeMask) : m_pDevice(pDevice), m_nodeMask(nodeMask) {}
+        AccelerationStructureBuilderFactory(ID3D12Device *pDevice, UINT nodeMask, UINT cpuBuildThreadCount = 0) :
+            m_pDevice(pDevice), m_nodeMask(nodeMask), m_cpuBuildThreadCount(cpuBuildThreadCount) {}
 
         IAccelerationStructureBuilder &GetAccelerationStructureBuilder();
 
+        // The CPU builders are created on first use with m_cpuBuildThreadCount threads,
+        // 0 uses one thread per hardware thread
+        CpuBvh2Builder &GetCpuBvh2Builder();
+        CpuTopLevelBvh2Builder &GetCpuTopLevelBvh2Builder();
+        void SetCpuBuildThreadCount(UINT threadCount);
+        UINT GetCpuBuildThreadCount() const { return m_cpuBuildThreadCount; }
+
+        // Builds into CPU memory with the CPU builder matching the desc's type.
+        // pDesc's geometry or instance addresses must be CPU pointers.
+        void BuildRaytracingAccelerationStructureOnCpu(
+            _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+            _Inout_ void *pData);
+
     private:
         enum BuilderType {
             GpuBvh2BuilderType = 0,
@@ -30,8 +44,11 @@ namespace FallbackLayer
         IAccelerationStructureBuilder *CreateBuilder(BuilderType type);
 
         std::unique_ptr<IAccelerationStructureBuilder> m_spBuilders[NumBuilders];
+        std::unique_ptr<CpuBvh2Builder> m_spCpuBuilder;
+        std::unique_ptr<CpuTopLevelBvh2Builder> m_spCpuTopLevelBuilder;
 
         UINT m_nodeMask;
+        UINT m_cpuBuildThreadCount;
         ID3D12Device *m_pDevice; 
     };
 }
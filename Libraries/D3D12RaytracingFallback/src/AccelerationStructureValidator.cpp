@@ -24,6 +24,12 @@ namespace FallbackLayer
                 return bvhValidator;
             }
 
+        case CompressedBVH2:
+            {
+                static CompressedBvhValidator compressedBvhValidator;
+                return compressedBvhValidator;
+            }
+
         default:
             ThrowInternalFailure(E_INVALIDARG);
             return *(IAccelerationStructureValidator*)nullptr;
@@ -51,145 +51,519 @@ namespace FallbackLayer
             v.z - TEST_EPSILON <= aabb.max.z;
     }
 
+    bool BvhValidator::IsTriangleEqual(const BvhValidator::Vertex *pVertices, const Triangle &triangle)
+    {
+        for (UINT vertexIndex = 0; vertexIndex < 3; vertexIndex++)
+        {
+            const Vertex v = { triangle.v[vertexIndex].x, triangle.v[vertexIndex].y, triangle.v[vertexIndex].z };
+            if (!IsVertexEqual(pVertices[vertexIndex], v))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool BvhValidator::ExpectedLeaves::IsContainedByBox(UINT leafIndex, const AABB &box) const
+    {
+        if (!m_bTriangles)
+        {
+            return IsChildContainedByParent(box, m_boxes[leafIndex]);
+        }
+
+        const Vertex *pVertices = &m_triangleVertices[leafIndex * 3];
+        return IsVertexContainedByAABB(box, pVertices[0]) &&
+            IsVertexContainedByAABB(box, pVertices[1]) &&
+            IsVertexContainedByAABB(box, pVertices[2]);
+    }
+
     bool IsChildNodeIndexValid(UINT nodeIndex)
     {
         return nodeIndex != 0;
     }
 
-    bool BvhValidator::VerifyBVHOutput(
-        std::vector<LeafNodePtr> &pExpectedLeafNodes,
-        const BYTE *pOutputCpuData,
-        std::wstring &errorMessage)
+    // Smallest number of nodes or leaves a thread validates at once
+    static const UINT VALIDATION_MIN_CHUNK_SIZE = 16 * 1024;
+
+    static const UINT INVALID_NODE_INDEX = (UINT)-1;
+
+    // An expected leaf's shallowest match, the matching leaf node's depth in
+    // the upper 32 bits and its index in the lower ones
+    static const UINT64 NO_MATCH = ~0ull;
+
+    static void RecordMatch(std::atomic<UINT64> &match, UINT depth, UINT nodeIndex)
     {
-#define ThrowError(msg) errorMessage = msg; throw false;
-#define ThrowErrorIfFalse(exp, msg) if(!(exp)) {ThrowError(msg);}
+        const UINT64 value = (UINT64)depth << 32 | nodeIndex;
+        UINT64 current = match.load(std::memory_order_relaxed);
+        while (value < current && !match.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // MurmurHash3's 64-bit finalizer
+    static UINT64 MixHash(UINT64 h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
 
-        try
+    static UINT64 HashTriangleBits(_In_reads_(9) const float *pVertices)
+    {
+        UINT64 hash = 0;
+        for (UINT i = 0; i < 9; i++)
         {
-            // Given the list of triangles used to construct the BVH,
-            // go through the tree layer by layer (breadth-first) ensuring that:
-            // 1. The child nodes are contained in the parent node
-            // 2. All leaves must be able to fit within at least one of the AABBs at that level 
-            //    (unless that leaf's node has already been found)
+            UINT32 bits;
+            memcpy(&bits, &pVertices[i], sizeof(bits));
+            hash = MixHash(hash + bits);
+        }
+        return hash;
+    }
 
-            const UINT verticesPerTriangle = 3;
-            const UINT floatsPerVertex = 3;
-            for (auto &pLeaf : pExpectedLeafNodes)
+    //
+    // Expected triangles that don't match an output triangle bit for bit are
+    // looked up by the grid cell their first vertex is in. A vertex within
+    // 2 * TEST_EPSILON of another is always in the same or the next cell
+    // along every axis.
+    //
+#define MATCH_CELL_SIZE (8 * TEST_EPSILON)
+
+    static INT64 GetMatchCell(float v)
+    {
+        // NaNs never compare equal, and values too large to be told apart
+        // at TEST_EPSILON all end up in the outermost cells
+        const double cell = floor(v / MATCH_CELL_SIZE);
+        return cell == cell ? (INT64)std::max(std::min(cell, 4.0e18), -4.0e18) : 0;
+    }
+
+    static UINT64 HashMatchCell(INT64 x, INT64 y, INT64 z)
+    {
+        return MixHash(MixHash(MixHash((UINT64)x) + (UINT64)y) + (UINT64)z);
+    }
+
+    //
+    // Indices of expected leaves grouped by the bucket their hash falls in,
+    // as one array sorted by bucket and the offset every bucket starts at
+    //
+    class LeafHashTable
+    {
+    public:
+        // pLeafIndices can be null when the leaves are [0, count)
+        void Build(UINT count, _In_reads_(count) const UINT64 *pHashes, _In_reads_opt_(count) const UINT *pLeafIndices)
+        {
+            UINT64 numBuckets = 1;
+            while (numBuckets < count)
             {
-                pLeaf->LeafFound = false;
+                numBuckets <<= 1;
             }
+            m_bucketMask = numBuckets - 1;
 
-            BVHOffsets offsets = *(BVHOffsets*)pOutputCpuData;
-            AABBNode *pNodeArray = (AABBNode*)((BYTE *)pOutputCpuData + offsets.offsetToBoxes);
-            Primitive *pPrimitiveArray = (Primitive*)((BYTE *)pOutputCpuData + offsets.offsetToVertices);
+            m_bucketStarts.assign((size_t)numBuckets + 1, 0);
+            for (UINT i = 0; i < count; i++)
+            {
+                m_bucketStarts[(pHashes[i] & m_bucketMask) + 1]++;
+            }
+            for (UINT64 bucket = 0; bucket < numBuckets; bucket++)
+            {
+                m_bucketStarts[bucket + 1] += m_bucketStarts[bucket];
+            }
 
-            std::deque<AABBNode*> nodeQueue;
+            std::vector<UINT> bucketEnds(m_bucketStarts.begin(), m_bucketStarts.end() - 1);
+            m_leaves.resize(count);
+            for (UINT i = 0; i < count; i++)
+            {
+                m_leaves[bucketEnds[pHashes[i] & m_bucketMask]++] = pLeafIndices ? pLeafIndices[i] : i;
+            }
+        }
 
-            nodeQueue.push_back(&pNodeArray[0]);
-            UINT nodesInLevel = 1;
-            while (nodeQueue.size())
+        // Leaves of other hashes that share the bucket are visited as well
+        template <typename Visitor>
+        void ForEachLeaf(UINT64 hash, const Visitor &visit) const
+        {
+            const UINT64 bucket = hash & m_bucketMask;
+            for (UINT i = m_bucketStarts[bucket]; i < m_bucketStarts[bucket + 1]; i++)
             {
-                AABBNode *pCompressedNode = nodeQueue.front();
-                nodeQueue.pop_front();
-                nodesInLevel--;
-                bool bProcessedLastNodeInCurrentLevel = nodesInLevel == 0;
+                visit(m_leaves[i]);
+            }
+        }
 
-                AABB parentAABB;
-                FallbackLayer::DecompressAABB(parentAABB, *pCompressedNode);
+    private:
+        UINT64 m_bucketMask;
+        std::vector<UINT> m_bucketStarts;
+        std::vector<UINT> m_leaves;
+    };
+
+    bool BvhValidator::VerifyBVHOutput(
+        const ExpectedLeaves &expectedLeaves,
+        const BYTE *pOutputCpuData,
+        std::wstring &errorMessage)
+    {
+        //
+        // Given the list of leaves used to construct the BVH, ensure that:
+        // 1. The child nodes are contained in the parent node
+        // 2. Every leaf must be able to fit within at least one of the AABBs
+        //    of every level above the shallowest output leaf equal to it
+        // 3. Every leaf is equal to an output leaf
+        //
+        // Output leaves are matched with the expected ones through a hash
+        // table for triangles, or by descending the tree for boxes. An
+        // expected leaf is normally contained by each ancestor of its match,
+        // only when one of them doesn't are the other nodes of its level
+        // searched. Everything past walking the tree runs on all cores.
+        //
+        const BVHOffsets &offsets = *(const BVHOffsets*)pOutputCpuData;
+        const AABBNode *pNodeArray = (const AABBNode*)(pOutputCpuData + offsets.offsetToBoxes);
+        const Primitive *pPrimitiveArray = (const Primitive*)(pOutputCpuData + offsets.offsetToVertices);
+        const UINT maxNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode);
+        const UINT numExpectedLeaves = expectedLeaves.GetCount();
+
+        auto GetNodeBox = [&](UINT nodeIndex)
+        {
+            AABB box;
+            FallbackLayer::DecompressAABB(box, pNodeArray[nodeIndex]);
+            return box;
+        };
 
-                const bool bIsLeaf = pCompressedNode->leaf;
+        //
+        // Walk the tree breadth-first, numbering the nodes level by level
+        //
+        std::vector<UINT> nodeOrder;
+        std::vector<UINT> levelStarts;
+        std::vector<UINT> parents(maxNodes, INVALID_NODE_INDEX);
+        std::vector<UINT> depths(maxNodes, INVALID_NODE_INDEX);
+
+        nodeOrder.push_back(0);
+        depths[0] = 0;
+        for (UINT levelStart = 0; levelStart < nodeOrder.size();)
+        {
+            const UINT levelEnd = (UINT)nodeOrder.size();
+            levelStarts.push_back(levelStart);
+            for (UINT i = levelStart; i < levelEnd; i++)
+            {
+                const UINT nodeIndex = nodeOrder[i];
+                const AABBNode &node = pNodeArray[nodeIndex];
+                if (node.leaf)
+                {
+                    continue;
+                }
 
-                for (auto &pLeaf : pExpectedLeafNodes)
+                const UINT childIndices[] = { node.internalNode.leftNodeIndex, node.rightNodeIndex };
+                for (UINT childIndex : childIndices)
                 {
-                    if (pLeaf->IsContainedByBox(parentAABB))
+                    if (!IsChildNodeIndexValid(childIndex))
+                    {
+                        errorMessage = L"Circular referance to root node";
+                        return false;
+                    }
+                    if (childIndex >= maxNodes || depths[childIndex] != INVALID_NODE_INDEX)
                     {
-                        pLeaf->LeafFound = true;
+                        errorMessage = L"Child node index is out of range or shared with another node";
+                        return false;
                     }
+
+                    parents[childIndex] = nodeIndex;
+                    depths[childIndex] = (UINT)levelStarts.size();
+                    nodeOrder.push_back(childIndex);
                 }
+            }
+            levelStart = levelEnd;
+        }
+        levelStarts.push_back((UINT)nodeOrder.size());
+        const UINT numNodes = (UINT)nodeOrder.size();
 
-                if (!bIsLeaf)
+        CpuTaskPool taskPool(CpuTaskPool::GetDefaultThreadCount());
+
+        std::atomic<bool> bChildOutsideParent(false);
+        taskPool.ParallelFor(numNodes - 1, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin + 1; i < end + 1 && !bChildOutsideParent; i++)
+            {
+                const UINT nodeIndex = nodeOrder[i];
+                if (!IsChildContainedByParent(GetNodeBox(parents[nodeIndex]), GetNodeBox(nodeIndex)))
                 {
+                    bChildOutsideParent = true;
+                }
+            }
+        });
+        if (bChildOutsideParent)
+        {
+            errorMessage = L"AABB not contained by parent";
+            return false;
+        }
+
+        //
+        // Match the output leaves with the expected leaves
+        //
+        std::vector<std::atomic<UINT64>> matches(numExpectedLeaves);
+        taskPool.ParallelFor(numExpectedLeaves, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; i++)
+            {
+                matches[i].store(NO_MATCH, std::memory_order_relaxed);
+            }
+        });
+
+        if (expectedLeaves.m_bTriangles)
+        {
+            // TODO: Hacky way to use the same code path for both bottom and top level
+            // BVHs. Only the first triangle of every leaf is compared.
+            const UINT numPrimitives = (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices) / sizeof(Primitive);
+            std::atomic<bool> bInvalidPrimitive(false);
+
+            auto ForEachLeafTriangle = [&](const std::function<void(UINT nodeIndex, const Triangle &triangle)> &body)
+            {
+                taskPool.ParallelFor(maxNodes, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+                {
+                    for (UINT nodeIndex = begin; nodeIndex < end; nodeIndex++)
                     {
-                        ThrowErrorIfFalse(IsChildNodeIndexValid(pCompressedNode->internalNode.leftNodeIndex), L"Circular referance to root node");
-                        AABBNode *pLeftNode = &pNodeArray[pCompressedNode->internalNode.leftNodeIndex];
-                        AABB leftAABB;
-                        FallbackLayer::DecompressAABB(leftAABB, *pLeftNode);
-                        ThrowErrorIfFalse(IsChildContainedByParent(parentAABB, leftAABB), L"AABB not contained by parent");
+                        const AABBNode &node = pNodeArray[nodeIndex];
+                        if (depths[nodeIndex] == INVALID_NODE_INDEX || !node.leaf)
+                        {
+                            continue;
+                        }
 
-                        nodeQueue.push_back(pLeftNode);
+                        const UINT firstTriangleId = node.leafNode.firstTriangleId;
+                        if (firstTriangleId >= numPrimitives)
+                        {
+                            bInvalidPrimitive = true;
+                            continue;
+                        }
+                        body(nodeIndex, pPrimitiveArray[firstTriangleId].triangle);
                     }
+                });
+            };
+
+            // Bit for bit matches first, that's all there is for most builds
+            std::vector<UINT64> hashes(numExpectedLeaves);
+            taskPool.ParallelFor(numExpectedLeaves, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+            {
+                for (UINT i = begin; i < end; i++)
+                {
+                    hashes[i] = HashTriangleBits(&expectedLeaves.m_triangleVertices[i * 3].x);
+                }
+            });
 
+            LeafHashTable hashTable;
+            hashTable.Build(numExpectedLeaves, hashes.data(), nullptr);
+            ForEachLeafTriangle([&](UINT nodeIndex, const Triangle &triangle)
+            {
+                const float vertices[9] =
+                {
+                    triangle.v0.x, triangle.v0.y, triangle.v0.z,
+                    triangle.v1.x, triangle.v1.y, triangle.v1.z,
+                    triangle.v2.x, triangle.v2.y, triangle.v2.z,
+                };
+                hashTable.ForEachLeaf(HashTriangleBits(vertices), [&](UINT leafIndex)
+                {
+                    if (IsTriangleEqual(&expectedLeaves.m_triangleVertices[leafIndex * 3], triangle))
                     {
-                        UINT rightNodeIndex = pCompressedNode->rightNodeIndex;
-      
-                        ThrowErrorIfFalse(IsChildNodeIndexValid(rightNodeIndex), L"Circular referance to root node");
-                        AABBNode *pRightNode = &pNodeArray[rightNodeIndex];
-                        AABB rightAABB;
-                        FallbackLayer::DecompressAABB(rightAABB, *pRightNode);
-                        ThrowErrorIfFalse(IsChildContainedByParent(parentAABB, rightAABB), L"AABB not contained by parent");
-
-                        nodeQueue.push_back(pRightNode);
+                        RecordMatch(matches[leafIndex], depths[nodeIndex], nodeIndex);
                     }
+                });
+            });
+
+            if (bInvalidPrimitive)
+            {
+                errorMessage = L"Leaf references primitives outside of the primitive array";
+                return false;
+            }
+
+            // Then the leaves left over by the cell of their first vertex,
+            // comparing them with TEST_EPSILON
+            std::vector<UINT> unmatchedLeaves;
+            for (UINT i = 0; i < numExpectedLeaves; i++)
+            {
+                if (matches[i].load(std::memory_order_relaxed) == NO_MATCH)
+                {
+                    unmatchedLeaves.push_back(i);
                 }
-                else
+            }
+
+            if (unmatchedLeaves.size())
+            {
+                hashes.resize(unmatchedLeaves.size());
+                for (UINT i = 0; i < unmatchedLeaves.size(); i++)
                 {
-                    // TODO: Hacky way to use the same code path for both bottom and top level
-                    // BVHs. Doing the triangle calculations for both paths, should 
-                    UINT firstTriangleId = pCompressedNode->leafNode.firstTriangleId;
-                    UINT numTriangles = 1; // pCompressedNode->numTriangles;
-                    ThrowErrorIfFalse(numTriangles > 0, L"Invalid value for numTriangles");
+                    const Vertex &v = expectedLeaves.m_triangleVertices[unmatchedLeaves[i] * 3];
+                    hashes[i] = HashMatchCell(GetMatchCell(v.x), GetMatchCell(v.y), GetMatchCell(v.z));
+                }
+                hashTable.Build((UINT)unmatchedLeaves.size(), hashes.data(), unmatchedLeaves.data());
 
-                    for (UINT triangleId = firstTriangleId; triangleId < firstTriangleId + numTriangles; triangleId++)
+                ForEachLeafTriangle([&](UINT nodeIndex, const Triangle &triangle)
+                {
+                    const float3 &v = triangle.v0;
+                    const INT64 minCell[3] = { GetMatchCell(v.x - 2 * TEST_EPSILON), GetMatchCell(v.y - 2 * TEST_EPSILON), GetMatchCell(v.z - 2 * TEST_EPSILON) };
+                    const INT64 maxCell[3] = { GetMatchCell(v.x + 2 * TEST_EPSILON), GetMatchCell(v.y + 2 * TEST_EPSILON), GetMatchCell(v.z + 2 * TEST_EPSILON) };
+                    for (INT64 x = minCell[0]; x <= maxCell[0]; x++)
                     {
-                        Primitive *pTriangle = &pPrimitiveArray[triangleId];
-                        for (int j = (int)pExpectedLeafNodes.size() - 1; j >= 0; j--)
+                        for (INT64 y = minCell[1]; y <= maxCell[1]; y++)
                         {
-                            if (pExpectedLeafNodes[j]->IsLeafEqual((void *)pTriangle, parentAABB))
+                            for (INT64 z = minCell[2]; z <= maxCell[2]; z++)
                             {
-                                pExpectedLeafNodes.erase(pExpectedLeafNodes.begin() + j);
+                                hashTable.ForEachLeaf(HashMatchCell(x, y, z), [&](UINT leafIndex)
+                                {
+                                    if (IsTriangleEqual(&expectedLeaves.m_triangleVertices[leafIndex * 3], triangle))
+                                    {
+                                        RecordMatch(matches[leafIndex], depths[nodeIndex], nodeIndex);
+                                    }
+                                });
                             }
                         }
                     }
+                });
+            }
+        }
+        else
+        {
+            // Boxes match every leaf they're contained by, which can only be
+            // under nodes that contain them too
+            taskPool.ParallelFor(numExpectedLeaves, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+            {
+                std::vector<UINT> nodeStack;
+                for (UINT i = begin; i < end; i++)
+                {
+                    nodeStack.push_back(0);
+                    while (nodeStack.size())
+                    {
+                        const UINT nodeIndex = nodeStack.back();
+                        nodeStack.pop_back();
+                        if (!expectedLeaves.IsContainedByBox(i, GetNodeBox(nodeIndex)))
+                        {
+                            continue;
+                        }
 
+                        const AABBNode &node = pNodeArray[nodeIndex];
+                        if (node.leaf)
+                        {
+                            RecordMatch(matches[i], depths[nodeIndex], nodeIndex);
+                        }
+                        else
+                        {
+                            nodeStack.push_back(node.internalNode.leftNodeIndex);
+                            nodeStack.push_back(node.rightNodeIndex);
+                        }
+                    }
                 }
+            });
+        }
 
-                // If a whole level has been traversed, verify
-                // that all triangles have been accounted for
-                if (bProcessedLastNodeInCurrentLevel)
+        //
+        // Check the levels above every match, leaving the leaves without
+        // one for last. Leaves are visited by the node they matched in the
+        // order the nodes are stored in, so neighbouring leaves share most
+        // of their ancestors.
+        //
+        std::vector<UINT> matchedLeafHeads(maxNodes, INVALID_NODE_INDEX);
+        std::vector<UINT> matchedLeafNext(numExpectedLeaves);
+        bool bLeafNotFound = false;
+        for (UINT i = 0; i < numExpectedLeaves; i++)
+        {
+            const UINT64 match = matches[i].load(std::memory_order_relaxed);
+            if (match == NO_MATCH)
+            {
+                bLeafNotFound = true;
+                continue;
+            }
+
+            matchedLeafNext[i] = matchedLeafHeads[(UINT)match];
+            matchedLeafHeads[(UINT)match] = i;
+        }
+
+        std::atomic<bool> bLeafOutsideLevel(false);
+        taskPool.ParallelFor(maxNodes, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT matchIndex = begin; matchIndex < end && !bLeafOutsideLevel; matchIndex++)
+            {
+                for (UINT i = matchedLeafHeads[matchIndex]; i != INVALID_NODE_INDEX && !bLeafOutsideLevel; i = matchedLeafNext[i])
                 {
-                    for (auto &pLeaf : pExpectedLeafNodes)
+                    for (UINT nodeIndex = parents[matchIndex]; nodeIndex != INVALID_NODE_INDEX; nodeIndex = parents[nodeIndex])
                     {
-                        if (!pLeaf->LeafFound)
+                        if (expectedLeaves.IsContainedByBox(i, GetNodeBox(nodeIndex)))
+                        {
+                            continue;
+                        }
+
+                        // Any other node of the same level will do
+                        const UINT depth = depths[nodeIndex];
+                        bool bContained = false;
+                        for (UINT j = levelStarts[depth]; j < levelStarts[depth + 1] && !bContained; j++)
                         {
-                            ThrowError(L"One of the BVH levels has AABBs that can't contain one of the leaf nodes");
+                            bContained = expectedLeaves.IsContainedByBox(i, GetNodeBox(nodeOrder[j]));
                         }
 
-                        // Reset the flags after verification
-                        pLeaf->LeafFound = false;
+                        if (!bContained)
+                        {
+                            bLeafOutsideLevel = true;
+                            break;
+                        }
                     }
-                    nodesInLevel = static_cast<UINT>(nodeQueue.size());
                 }
             }
-            ThrowErrorIfFalse(pExpectedLeafNodes.size() == 0, L"Didn't find a leaf node for one or more of the expected leaves");
+        });
+
+        //
+        // A leaf without a match has to be contained at every level. Levels
+        // are found containing it by descending through the nodes that do,
+        // as those are the only ones a correct BVH can contain it in.
+        //
+        if (bLeafNotFound && !bLeafOutsideLevel)
+        {
+            const UINT numLevels = (UINT)levelStarts.size() - 1;
+            taskPool.ParallelFor(numExpectedLeaves, VALIDATION_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+            {
+                std::vector<UINT> nodeStack;
+                std::vector<bool> levelsContaining;
+                for (UINT i = begin; i < end && !bLeafOutsideLevel; i++)
+                {
+                    if (matches[i].load(std::memory_order_relaxed) != NO_MATCH)
+                    {
+                        continue;
+                    }
+
+                    levelsContaining.assign(numLevels, false);
+                    nodeStack.push_back(0);
+                    while (nodeStack.size())
+                    {
+                        const UINT nodeIndex = nodeStack.back();
+                        nodeStack.pop_back();
+                        if (!expectedLeaves.IsContainedByBox(i, GetNodeBox(nodeIndex)))
+                        {
+                            continue;
+                        }
+
+                        levelsContaining[depths[nodeIndex]] = true;
+                        const AABBNode &node = pNodeArray[nodeIndex];
+                        if (!node.leaf)
+                        {
+                            nodeStack.push_back(node.internalNode.leftNodeIndex);
+                            nodeStack.push_back(node.rightNodeIndex);
+                        }
+                    }
+
+                    if (std::find(levelsContaining.begin(), levelsContaining.end(), false) != levelsContaining.end())
+                    {
+                        bLeafOutsideLevel = true;
+                    }
+                }
+            });
         }
-        catch (bool)
+
+        if (bLeafOutsideLevel)
         {
+            errorMessage = L"One of the BVH levels has AABBs that can't contain one of the leaf nodes";
+            return false;
+        }
+        if (bLeafNotFound)
+        {
+            errorMessage = L"Didn't find a leaf node for one or more of the expected leaves";
             return false;
         }
         return true;
     }
 
-    bool BvhValidator::AABBLeafNode::IsContainedByBox(const AABB &parentBox)
-    {
-        return IsChildContainedByParent(parentBox, box);
-    };
-
-    bool BvhValidator::AABBLeafNode::IsLeafEqual(void *pLeafData, const AABB &leafAABB)
-    {
-        UNREFERENCED_PARAMETER(pLeafData);
-        return IsChildContainedByParent(leafAABB, box);
-    }
-
     template<typename V>
     V Transform(V &v, _In_reads_(12) const float* transform)
     {
@@ -217,7 +591,7 @@ namespace FallbackLayer
         transformedBox.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
         for (UINT i = 0; i < ARRAYSIZE(vertices); i++)
         {
-            float3 v = Transform(vertices[0], transform);
+            float3 v = Transform(vertices[i], transform);
             transformedBox.min = min(v, transformedBox.min);
             transformedBox.max = max(v, transformedBox.max);
         }
@@ -232,7 +606,9 @@ namespace FallbackLayer
         const BYTE *pOutputCpuData,
         std::wstring &errorMessage)
     {
-        std::vector<LeafNodePtr> pLeafNodes;
+        ExpectedLeaves expectedLeaves;
+        expectedLeaves.m_bTriangles = false;
+        expectedLeaves.m_boxes.resize(numBoxes);
         for (UINT i = 0; i < numBoxes; i ++)
         {
             AABB aabb = pReferenceBoxes[i];
@@ -240,25 +616,10 @@ namespace FallbackLayer
             {
                 aabb = TransformAABB(aabb, ppInstanceTransforms[i]);
             }
-            pLeafNodes.push_back(std::unique_ptr<LeafNode>(new AABBLeafNode(aabb)));
+            expectedLeaves.m_boxes[i] = aabb;
         }
 
-        return VerifyBVHOutput(pLeafNodes, pOutputCpuData, errorMessage);
-    }
-
-    bool BvhValidator::TriangleLeafNode::IsContainedByBox(const AABB &box)
-    {
-        return IsVertexContainedByAABB(box, v0) &&
-            IsVertexContainedByAABB(box, v1) &&
-            IsVertexContainedByAABB(box, v2);
-    }
-
-    bool BvhValidator::TriangleLeafNode::IsLeafEqual(void *pLeafData, const AABB &leafAABB)
-    {
-        UNREFERENCED_PARAMETER(leafAABB);
-        Primitive *pPrimitive = (Primitive *)pLeafData;
-        Triangle *pTriangle = &pPrimitive->triangle;
-        return IsTriangleEqual(*this, pTriangle);
+        return VerifyBVHOutput(expectedLeaves, pOutputCpuData, errorMessage);
     }
 
     UINT CalculateBaseIndex(UINT triangleIndex)
@@ -293,7 +654,8 @@ namespace FallbackLayer
         UINT geometryCount,
         const BYTE *pBVHData, std::wstring &errorMessage)
     {
-        std::vector<std::unique_ptr<LeafNode>> pLeafNodes;
+        ExpectedLeaves expectedLeaves;
+        expectedLeaves.m_bTriangles = true;
 
         for (UINT geometryIndex = 0; geometryIndex < geometryCount; geometryIndex++)
         {
@@ -320,11 +682,127 @@ namespace FallbackLayer
                     v[vertexIndex] = Transform(v[vertexIndex], geometryDescriptor.transform.data());
                 }
 
-                pLeafNodes.push_back(std::unique_ptr<LeafNode>(new TriangleLeafNode(v[0], v[1], v[2])));
+                expectedLeaves.m_triangleVertices.insert(expectedLeaves.m_triangleVertices.end(), v, v + verticesPerTriangle);
             }
         }
 
-        return VerifyBVHOutput(pLeafNodes, pBVHData, errorMessage);
+        return VerifyBVHOutput(expectedLeaves, pBVHData, errorMessage);
+    }
+
+    bool CompressedBvhValidator::VerifyBottomLevelOutput(
+        CpuGeometryDescriptor *pCpuGeometryDescriptors,
+        UINT geometryCount,
+        const BYTE *pOutputCpuData, std::wstring &errorMessage)
+    {
+        std::vector<BYTE> decompressedData(GetDecompressedBVHSize(pOutputCpuData));
+        DecompressBVH(pOutputCpuData, decompressedData.data());
+
+        return BvhValidator::VerifyBottomLevelOutput(pCpuGeometryDescriptors, geometryCount, decompressedData.data(), errorMessage) &&
+            VerifyPrimitivesEnclosedByAncestors(pOutputCpuData, errorMessage);
+    }
+
+    bool CompressedBvhValidator::VerifyTopLevelOutput(
+        const AABB *pReferenceBoxes,
+        float **ppInstanceTransforms,
+        UINT numBoxes,
+        const BYTE *pOutputCpuData,
+        std::wstring &errorMessage)
+    {
+        UNREFERENCED_PARAMETER(pReferenceBoxes);
+        UNREFERENCED_PARAMETER(ppInstanceTransforms);
+        UNREFERENCED_PARAMETER(numBoxes);
+        UNREFERENCED_PARAMETER(pOutputCpuData);
+        errorMessage = L"Only bottom-level BVHs are compressed";
+        return false;
+    }
+
+    static bool IsPointInsideAABB(const AABB &box, const float3 &point)
+    {
+        return box.min.x <= point.x && point.x <= box.max.x &&
+            box.min.y <= point.y && point.y <= box.max.y &&
+            box.min.z <= point.z && point.z <= box.max.z;
+    }
+
+    bool CompressedBvhValidator::VerifyPrimitivesEnclosedByAncestors(
+        const BYTE *pOutputCpuData,
+        std::wstring &errorMessage)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets*)pOutputCpuData;
+        const CompressedAABBNode *pNodeArray = (const CompressedAABBNode*)(pOutputCpuData + offsets.offsetToBoxes);
+        const Primitive *pPrimitiveArray = (const Primitive*)(pOutputCpuData + offsets.offsetToVertices);
+        const UINT numNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(CompressedAABBNode);
+        const UINT numPrimitives = (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices) / sizeof(Primitive);
+
+        // Being inside every ancestor is the same as being inside the
+        // intersection of their boxes, so only that is carried down the tree
+        struct NodeToVisit
+        {
+            UINT nodeIndex;
+            AABB ancestorsBox;
+        };
+
+        std::vector<NodeToVisit> nodeStack;
+        NodeToVisit root;
+        root.nodeIndex = 0;
+        root.ancestorsBox.min = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        root.ancestorsBox.max = { FLT_MAX, FLT_MAX, FLT_MAX };
+        nodeStack.push_back(root);
+
+        while (nodeStack.size())
+        {
+            const NodeToVisit nodeToVisit = nodeStack.back();
+            nodeStack.pop_back();
+
+            const CompressedAABBNode &node = pNodeArray[nodeToVisit.nodeIndex];
+            AABB box;
+            DecompressAABB(box, node);
+
+            AABB ancestorsBox;
+            ancestorsBox.min = max(nodeToVisit.ancestorsBox.min, box.min);
+            ancestorsBox.max = min(nodeToVisit.ancestorsBox.max, box.max);
+
+            if (node.leaf)
+            {
+                const UINT firstPrimitive = node.leafNode.firstTriangleId;
+                const UINT numLeafPrimitives = node.leafNode.numTriangleIds;
+                if (firstPrimitive + numLeafPrimitives > numPrimitives)
+                {
+                    errorMessage = L"Leaf references primitives outside of the primitive array";
+                    return false;
+                }
+
+                for (UINT i = firstPrimitive; i < firstPrimitive + numLeafPrimitives; i++)
+                {
+                    const Primitive &primitive = pPrimitiveArray[i];
+                    const bool bEnclosed = primitive.PrimitiveType == TRIANGLE_TYPE ?
+                        IsPointInsideAABB(ancestorsBox, primitive.triangle.v0) &&
+                        IsPointInsideAABB(ancestorsBox, primitive.triangle.v1) &&
+                        IsPointInsideAABB(ancestorsBox, primitive.triangle.v2) :
+                        IsPointInsideAABB(ancestorsBox, primitive.aabb.min) &&
+                        IsPointInsideAABB(ancestorsBox, primitive.aabb.max);
+                    if (!bEnclosed)
+                    {
+                        errorMessage = L"Primitive isn't enclosed by all of its ancestors' compressed boxes";
+                        return false;
+                    }
+                }
+            }
+            else
+            {
+                // Children always follow their parent, which also rules out cycles
+                const UINT leftNodeIndex = node.internalNode.leftNodeIndex;
+                const UINT rightNodeIndex = nodeToVisit.nodeIndex + 1;
+                if (leftNodeIndex <= rightNodeIndex || leftNodeIndex >= numNodes)
+                {
+                    errorMessage = L"Invalid left child index in compressed node";
+                    return false;
+                }
+
+                nodeStack.push_back({ leftNodeIndex, ancestorsBox });
+                nodeStack.push_back({ rightNodeIndex, ancestorsBox });
+            }
+        }
+        return true;
     }
 
     void DecompressAABB(
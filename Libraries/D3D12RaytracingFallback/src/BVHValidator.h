@@ -27,66 +27,64 @@ namespace FallbackLayer
             std::wstring &errorMessage);
 
     private:
-
-        class LeafNode
-        {
-        public:
-            virtual bool IsContainedByBox(const AABB &box) = 0;
-            virtual bool IsLeafEqual(void *pLeafData, const AABB &leafAABB) = 0;
-            bool LeafFound = false;
-        };
-
         struct Vertex
         {
             float x, y, z;
         };
 
-        AABB TransformAABB(const AABB &box, _In_reads_(12) const float* transform);
-
-        class AABBLeafNode : public LeafNode
+        //
+        // The leaves the output has to contain, in flat arrays. Bottom levels
+        // expect triangles, 3 vertices each, and top levels the world space
+        // boxes of their instances.
+        //
+        struct ExpectedLeaves
         {
-        public:
-            AABBLeafNode(const AABB &nBox) : box(nBox) {}
-            virtual bool IsLeafEqual(void *pLeafData, const AABB &leafAABB);
-            virtual bool IsContainedByBox(const AABB &box);
-
-            AABB box;
-        };
+            bool m_bTriangles;
+            std::vector<Vertex> m_triangleVertices;
+            std::vector<AABB> m_boxes;
 
-        class TriangleLeafNode : public LeafNode
-        {
-        public:
-            TriangleLeafNode(Vertex nV0, Vertex nV1, Vertex nV2) : v0(nV0), v1(nV1), v2(nV2) {}
-            virtual bool IsContainedByBox(const AABB &box);
-            virtual bool IsLeafEqual(void *pLeafData, const AABB &leafAABB);
-            Vertex v0, v1, v2;
+            UINT GetCount() const { return m_bTriangles ? (UINT)m_triangleVertices.size() / 3 : (UINT)m_boxes.size(); }
+            bool IsContainedByBox(UINT leafIndex, const AABB &box) const;
         };
 
-        typedef std::unique_ptr<LeafNode> LeafNodePtr;
+        AABB TransformAABB(const AABB &box, _In_reads_(12) const float* transform);
 
         bool VerifyBVHOutput(
-            std::vector<LeafNodePtr> &pExpectedLeafNodes,
+            const ExpectedLeaves &expectedLeaves,
             const BYTE *pOutputCpuData,
             std::wstring &errorMessage);
 
         static bool IsVertexContainedByAABB(const AABB &aabb, const BvhValidator::Vertex &v);
         static bool IsVertexEqual(const Vertex &vertex1, const Vertex &vertex2);
+        static bool IsTriangleEqual(_In_reads_(3) const Vertex *pVertices, const Triangle &triangle);
+    };
 
-        template <typename TriangleNode>
-        static bool IsTriangleEqual(const TriangleNode triangle, const Triangle *pTriangle)
-        {
-            BvhValidator::Vertex v[3];
-            for (UINT vertexIndex = 0; vertexIndex < 3; vertexIndex++)
-            {
-                v[vertexIndex].x = pTriangle->v[vertexIndex].x;
-                v[vertexIndex].y = pTriangle->v[vertexIndex].y;
-                v[vertexIndex].z = pTriangle->v[vertexIndex].z;
-            }
+    //
+    // Validates bottom-level BVH2s made of CompressedAABBNodes. The nodes are
+    // expanded and checked by BvhValidator, which allows some slack on every
+    // box. Since rays are only tested against triangles whose ancestors they
+    // hit, this also checks without any slack that every primitive is inside
+    // all of its ancestors' decoded boxes.
+    //
+    class CompressedBvhValidator : public BvhValidator
+    {
+    public:
+        virtual bool VerifyBottomLevelOutput(
+            CpuGeometryDescriptor *pCpuGeometryDescriptors,
+            UINT geometryCount,
+            const BYTE *pOutputCpuData, std::wstring &errorMessage);
+
+        virtual bool VerifyTopLevelOutput(
+            const AABB *pReferenceBoxes,
+            float **ppInstanceTransforms,
+            UINT numBoxes,
+            const BYTE *pOutputCpuData,
+            std::wstring &errorMessage);
 
-            return IsVertexEqual(triangle.v0, v[0]) && 
-                   IsVertexEqual(triangle.v1, v[1]) &&
-                   IsVertexEqual(triangle.v2, v[2]);
-        }
+    private:
+        static bool VerifyPrimitivesEnclosedByAncestors(
+            const BYTE *pOutputCpuData,
+            std::wstring &errorMessage);
     };
 
     void DecompressAABB(
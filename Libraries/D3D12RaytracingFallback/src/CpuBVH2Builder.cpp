@@ -1,4 +1,4 @@
-//*********************************************************
+﻿//*********************************************************
 //
 // Copyright (c) Microsoft. All rights reserved.
 // This code is licensed under the MIT License (MIT).
@@ -12,12 +12,15 @@
 
 namespace FallbackLayer
 {
-    struct BVH
-    {
-        std::vector<AABBNode>   m_nodes;
-        std::vector<float> m_triangles;
-        std::vector<PrimitiveMetaData> m_metadata;
-    };
+    // Recursion depth after which the parallel build hands the remaining
+    // subtree to the serial builder, bounds stack usage on degenerate splits
+    static const UINT MAX_PARALLEL_BUILD_DEPTH = 32;
+
+    // Number of candidate planes per axis tried by spatial splits is one less
+    static const UINT NUM_SPATIAL_BINS = 32;
+
+    // Smallest number of triangles a thread reads from the geometry descs at once
+    static const UINT LOAD_TRIANGLES_MIN_CHUNK_SIZE = 4 * 1024;
 
     static
         void AddExtentToBox(
@@ -44,9 +47,10 @@ namespace FallbackLayer
         void ComputeBox(
             AABB& overallBox,
             const std::vector<AABB>& boxes,
-            const std::vector<PrimitiveMetaData>& metadata)
+            const PrimitiveMetaData* metadata,
+            UINT32 numTris)
     {
-        if (metadata.empty())
+        if (numTris == 0)
         {
             overallBox.max.x = overallBox.min.x = 0;
             overallBox.max.y = overallBox.min.y = 0;
@@ -56,7 +60,6 @@ namespace FallbackLayer
 
         overallBox = boxes[metadata[0].PrimitiveIndex];
 
-        const UINT32 numTris = (UINT32)metadata.size();
         for (UINT32 i = 1; i < numTris; ++i)
         {
             const UINT32 triId = metadata[i].PrimitiveIndex;
@@ -67,157 +70,83 @@ namespace FallbackLayer
         }
     }
 
-    //
-    // Convert a 16-bit float to 32-bit.
-    //
-
-    static
-        float Fp16ToFp32(USHORT v)
-    {
-        static const UINT kMultiple = 0x77800000;   // 2**112
-        const UINT BiasedFloat = (v & 0x8000) << 16 | (v & 0x7FFF) << 13;
-        return (float&)BiasedFloat * (float&)kMultiple;
-    }
-
-    //
-    // Round toward minus infinity.  Guarantees output <= input.
-    //
-
-    static
-        USHORT Fp32ToFp16(float v, float RoundDirection = 0.0f)
-    {
-        assert(!!_finite(v));
-        assert(v > -65504 && v < 65504);
-
-        // Multiplying by 2^-112 causes exponents below -14 to denormalize
-        static const UINT kMultiple = 0x07800000;   // 2**-112
-        const float BiasedFloat = v * (float&)kMultiple;
-        const UINT u = (UINT&)BiasedFloat;
-
-        const UINT sign = u & 0x80000000;
-        UINT body = u & 0x0fffffff;
-
-        // Increase the magnitude before truncation to ensure proper bounds
-        if (v * RoundDirection > 0.0f)
-        {
-            if (body == 0)
-                body = 0x800000;
-            else
-                body += 0x1fff;
-        }
-
-        return (USHORT)(sign >> 16 | body >> 13);
-    }
-
-    static
-        float QuantizeToFp16(
-            float v)
-    {
-        return v;
-    }
-
-    static
-        UINT32 BuildBVHAddNode(
-            BVH& bvh,
-            const AABB& box,
-            UINT32 maxDimension)
+    void SetNodeBox(
+        AABBNode& packedBox,
+        const AABB& box)
     {
-        UNREFERENCED_PARAMETER(maxDimension);
-        assert(maxDimension < 3);
-        const UINT32 nodeIndex = (UINT32)bvh.m_nodes.size();
-
         float cX = (box.max.x + box.min.x) * 0.5f;
         float cY = (box.max.y + box.min.y) * 0.5f;
         float cZ = (box.max.z + box.min.z) * 0.5f;
-        cX = QuantizeToFp16(cX);
-        cY = QuantizeToFp16(cY);
-        cZ = QuantizeToFp16(cZ);
 
         float dX = max(box.max.x - cX, cX - box.min.x);
         float dY = max(box.max.y - cY, cY - box.min.y);
         float dZ = max(box.max.z - cZ, cZ - box.min.z);
 
-        AABBNode packedBox;
         packedBox.center[0] = cX;
         packedBox.center[1] = cY;
         packedBox.center[2] = cZ;
         packedBox.halfDim[0] = dX;
         packedBox.halfDim[1] = dY;
         packedBox.halfDim[2] = dZ;
-        packedBox.nodeAllBits = 0;
-
-        bvh.m_nodes.push_back(packedBox);
-
-        assert(bvh.m_nodes.size() - 1 == nodeIndex);
-
-        bvh.m_nodes[nodeIndex].internalNode.separatingAxis = 0;
-
-        return nodeIndex;
     }
 
     static
-        UINT32 BuildBVHAddLeaf(
-            BVH& bvh,
+        UINT32 BuildBVHAddNode(
+            std::vector<AABBNode>& nodes,
             const AABB& box,
-            const std::vector<PrimitiveMetaData>& metadata)
+            UINT32 maxDimension)
     {
-        const UINT32 nodeIndex = BuildBVHAddNode(bvh, box, 0);
-
-        bvh.m_nodes[nodeIndex].nodeAllBits = 0;
-        bvh.m_nodes[nodeIndex].leaf = true;
+        UNREFERENCED_PARAMETER(maxDimension);
+        assert(maxDimension < 3);
+        const UINT32 nodeIndex = (UINT32)nodes.size();
 
-        const UINT32 idIndex = (UINT32)bvh.m_metadata.size();
+        AABBNode packedBox;
+        SetNodeBox(packedBox, box);
+        packedBox.nodeAllBits = 0;
+        packedBox.rightNodeIndex = 0;
 
-        std::copy(metadata.begin(), metadata.end(), std::back_inserter(bvh.m_metadata));
+        nodes.push_back(packedBox);
 
-        assert(metadata.size() < 128);
-        assert(idIndex < (1 << 24));
+        assert(nodes.size() - 1 == nodeIndex);
 
-        bvh.m_nodes[nodeIndex].leafNode.firstTriangleId = idIndex;
-        bvh.m_nodes[nodeIndex].leafNode.numTriangleIds = (UINT32)metadata.size();
+        nodes[nodeIndex].internalNode.separatingAxis = 0;
 
         return nodeIndex;
     }
 
     //
-    // Sort min to max by centroid
+    // Leaves reference their primitives in place. The primitive reference
+    // array is partitioned so that it already ends up in leaf order.
     //
 
     static
-        void SortByCentroid(
-            std::vector<PrimitiveMetaData>& metadata,
-            const std::vector<AABB>& boxes,
-            UINT32 maxDimension)
+        UINT32 BuildBVHAddLeaf(
+            std::vector<AABBNode>& nodes,
+            const AABB& box,
+            UINT32 firstPrimitive,
+            UINT32 numPrimitives)
     {
-        struct TriPosition
-        {
-            float   pos;
-            UINT32  id;
-        };
-
-        std::vector<TriPosition> sortTris(metadata.size());
-
-        for (UINT32 i = 0; i < metadata.size(); ++i)
-        {
-            const UINT32 triId = metadata[i].PrimitiveIndex;
-            const AABB& box = boxes[triId];
+        const UINT32 nodeIndex = BuildBVHAddNode(nodes, box, 0);
 
-            const float boxCenter = (box.maxArr[maxDimension] + box.minArr[maxDimension]) / 2;
+        nodes[nodeIndex].nodeAllBits = 0;
+        nodes[nodeIndex].leaf = true;
 
-            sortTris[i].pos = boxCenter;
-            sortTris[i].id = metadata[i].PrimitiveIndex;
-        }
+        assert(numPrimitives < 128);
+        assert(firstPrimitive < (1 << 24));
 
-        // Split the list into left and right sublists
-        std::sort(sortTris.begin(), sortTris.end(), [](auto&& a, auto&& b) -> bool { return a.pos < b.pos; });
+        nodes[nodeIndex].leafNode.firstTriangleId = firstPrimitive;
+        nodes[nodeIndex].leafNode.numTriangleIds = numPrimitives;
 
-        // Update the output
-        for (UINT32 i = 0; i < metadata.size(); ++i)
-        {
-            metadata[i].PrimitiveIndex = sortTris[i].id;
-        }
+        return nodeIndex;
     }
 
+    static
+        float GetCentroid(
+            const AABB& box,
+            UINT32 dimension)
+    {
+        return (box.maxArr[dimension] + box.minArr[dimension]) * 0.5f;
+    }
 
     static
         float ComputeBoxSurfaceArea(
@@ -233,13 +162,8 @@ namespace FallbackLayer
         return 2 * (dims[0] * dims[1] + dims[0] * dims[2] + dims[1] * dims[2]);
     }
 
-    static
-        void InitBoxToInverseMax(
-            AABB& box)
-    {
-        box.max.x = box.max.y = box.max.z = -10e10f;//FLT_MAX;
-        box.min.x = box.min.y = box.min.z = 10e10f;//FLT_MAX;
-    }
+    // Picked once based on the CPU, every path makes the same split decisions
+    static const SahBinningKernel s_sahBinningKernel = GetSahBinningKernel();
 
     //
     // A feeble attempt at a SAH builder
@@ -247,109 +171,63 @@ namespace FallbackLayer
 
     static
         void SahSplit(
-            std::vector<PrimitiveMetaData>& metadata,
+            const SahPrimitiveBounds& bounds,
+            UINT32 numTris,
             UINT32& maxDimension,
             UINT32& numTrisInLeftNode,
-            const AABB& nodeBox,
-            const std::vector<AABB>& boxes)
+            SahBinning& binning,
+            UINT& splitBin,
+            const AABB& nodeBox)
     {
-        static const UINT NUM_SAH_BINS = 64;
-
-        struct SahBin
-        {
-            AABB    box;
-            UINT    numTriangles;
-        };
-
-        // NOTE: use vector if this blows out the stack?
-        SahBin  sahBins[3][NUM_SAH_BINS];
-
         // For the score to be meaningful it seems we need to normalize it to something
         const float normalizeToParent = 1.f / ComputeBoxSurfaceArea(nodeBox);
 
-        const UINT numTris = (UINT)metadata.size();
-
         float bestSah = FLT_MAX;
         maxDimension = 0;
         //numTrisInLeftNode = triangleIds.size() / 2;
 
-        // Compute SAH score per axis
         for (UINT i = 0; i < 3; ++i)
         {
             const float extents = nodeBox.maxArr[i] - nodeBox.minArr[i];
-            if (extents == 0)
-                continue;
-
-            const float rangeMin = nodeBox.minArr[i];
-
-            const float inverseExtents = 1.f / extents;
-
-            // Init boxes
-            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
-            {
-                sahBins[i][j].numTriangles = 0;
-                InitBoxToInverseMax(sahBins[i][j].box);
-            }
-
-            // Place triangles into the buckets
-            for (UINT j = 0; j < metadata.size(); ++j)
-            {
-                const UINT triId = metadata[j].PrimitiveIndex;
-
-                const AABB& triBox = boxes[triId];
-
-                const float centroid = (triBox.maxArr[i] + triBox.minArr[i]) * 0.5f;
+            binning.rangeMin[i] = nodeBox.minArr[i];
+            binning.inverseExtents[i] = extents == 0 ? 0.0f : 1.f / extents;
+        }
 
-                const UINT binIndex = std::min(NUM_SAH_BINS - 1,
-                    UINT(NUM_SAH_BINS * ((centroid - rangeMin) * inverseExtents)));
+        // Place triangles into the buckets of all three axes and precompute
+        // left and right boxes to be able to test plane positionings
+        SahBins bins;
+        s_sahBinningKernel(bounds, numTris, binning, bins);
 
-                sahBins[i][binIndex].numTriangles++;
-                AddExtentToBox(sahBins[i][binIndex].box, triBox);
-            }
+        // Compute SAH score per axis
+        for (UINT i = 0; i < 3; ++i)
+        {
+            if (binning.inverseExtents[i] == 0)
+                continue;
 
             // Make sure we caught all of them once
             UINT testTris = 0;
             for (UINT j = 0; j < NUM_SAH_BINS; ++j)
             {
-                testTris += sahBins[i][j].numTriangles;
+                testTris += bins.numTriangles[i][j];
             }
             assert(testTris == numTris);
 
-            // Precompute left and right boxes with counts to be able to test plane positionings
-
-            AABB leftBoxes[NUM_SAH_BINS];
-            AABB rightBoxes[NUM_SAH_BINS];
-
-            for (UINT j = 0; j < NUM_SAH_BINS; ++j)
-            {
-                const UINT rightIdx = NUM_SAH_BINS - j - 1;
-
-                rightBoxes[rightIdx] = sahBins[i][rightIdx].box;
-                leftBoxes[j] = sahBins[i][j].box;
-
-                if (j > 0)
-                {
-                    AddExtentToBox(leftBoxes[j], leftBoxes[j - 1]);
-                    AddExtentToBox(rightBoxes[rightIdx], rightBoxes[rightIdx + 1]);
-                }
-            }
-
             UINT numTrianglesOnLeft = 0;
             UINT numTrianglesOnRight = numTris;
 
             // Find the plane with the best score
             for (UINT j = 0; j < NUM_SAH_BINS - 1; ++j)
             {
-                if (!sahBins[i][j].numTriangles)
+                if (!bins.numTriangles[i][j])
                 {
                     continue;
                 }
 
-                numTrianglesOnLeft += sahBins[i][j].numTriangles;
-                numTrianglesOnRight -= sahBins[i][j].numTriangles;
+                numTrianglesOnLeft += bins.numTriangles[i][j];
+                numTrianglesOnRight -= bins.numTriangles[i][j];
 
-                const float sah = (numTrianglesOnLeft * ComputeBoxSurfaceArea(leftBoxes[j]) +
-                    numTrianglesOnRight * ComputeBoxSurfaceArea(rightBoxes[j + 1])) *
+                const float sah = (numTrianglesOnLeft * ComputeBoxSurfaceArea(GetSahBinBox(bins.leftBoxes[i][j])) +
+                    numTrianglesOnRight * ComputeBoxSurfaceArea(GetSahBinBox(bins.rightBoxes[i][j + 1]))) *
                     normalizeToParent;
 
                 assert(!_isnan(sah));
@@ -359,15 +237,150 @@ namespace FallbackLayer
                     bestSah = sah;
                     maxDimension = i;
                     numTrisInLeftNode = numTrianglesOnLeft;
+                    splitBin = j;
                 }
             }
         }
+    }
+
+    //
+    // std::partition of a range of references that moves their SAH bounds
+    // along, pred is called with reference indices. Returns the number of
+    // references pred holds for, which end up at the front of the range.
+    //
+    template <typename Predicate>
+    static
+        UINT32 PartitionReferences(
+            PrimitiveMetaData* metadata,
+            SahReferenceBounds& bounds,
+            UINT32 firstPrimitive,
+            UINT32 numTris,
+            Predicate pred)
+    {
+        UINT32 begin = firstPrimitive;
+        UINT32 end = firstPrimitive + numTris;
+        while (true)
+        {
+            while (begin != end && pred(begin))
+            {
+                ++begin;
+            }
+            if (begin == end)
+            {
+                break;
+            }
+
+            --end;
+            while (begin != end && !pred(end))
+            {
+                --end;
+            }
+            if (begin == end)
+            {
+                break;
+            }
+
+            std::swap(metadata[begin], metadata[end]);
+            bounds.Swap(begin, end);
+            ++begin;
+        }
+        return begin - firstPrimitive;
+    }
+
+    static
+        void LoadSahBounds(
+            SahReferenceBounds& bounds,
+            const std::vector<AABB>& boxes,
+            const PrimitiveMetaData* metadata,
+            UINT32 firstPrimitive,
+            UINT32 numPrimitives)
+    {
+        for (UINT32 i = firstPrimitive; i < firstPrimitive + numPrimitives; ++i)
+        {
+            bounds.SetBox(i, boxes[metadata[i].PrimitiveIndex]);
+        }
+    }
+
+    // Fills the SAH bounds of a whole reference array before a build
+    static
+        void InitSahBounds(
+            CpuTaskPool& taskPool,
+            SahReferenceBounds& bounds,
+            const std::vector<AABB>& boxes,
+            const PrimitiveMetaData* metadata,
+            UINT32 numPrimitives)
+    {
+        bounds.Resize(numPrimitives);
+        taskPool.ParallelFor(numPrimitives, LOAD_TRIANGLES_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            LoadSahBounds(bounds, boxes, metadata, begin, end - begin);
+        });
+    }
+
+    //
+    // Splits the range [firstPrimitive, firstPrimitive + numTris) in place.
+    // The right child's primitives are moved to the front of the range and
+    // the left child's to the back, which is the order BuildBVH emits their
+    // leaves in.
+    //
 
+    static
+        void SplitNode(
+            PrimitiveMetaData* metadata,
+            SahReferenceBounds& bounds,
+            UINT32 firstPrimitive,
+            UINT32 numTris,
+            UINT32& splitDimension,
+            UINT32& leftChildNumNodes,
+            const AABB& nodeBox,
+            const std::vector<AABB>& boxes)
+    {
         //
-        // Split the set to try to get a balanced tree
+        // Find separating plane. Use Median for speed.
+        // SAH is better but also more expensive to build.
         //
 
-        SortByCentroid(metadata, boxes, maxDimension);
+        SahBinning binning;
+        UINT splitBin = 0;
+
+        leftChildNumNodes = 0;
+        SahSplit(bounds.GetRange(firstPrimitive),
+            numTris,
+            splitDimension,
+            leftChildNumNodes,
+            binning,
+            splitBin,
+            nodeBox);
+
+        assert(leftChildNumNodes <= numTris);
+
+        if (leftChildNumNodes != 0 && leftChildNumNodes != numTris)
+        {
+            const UINT32 numRightTris = PartitionReferences(metadata, bounds, firstPrimitive, numTris,
+                [&](UINT32 reference)
+            {
+                return GetSahBinIndex(bounds.GetCentroid(reference, splitDimension), splitDimension, binning) > splitBin;
+            });
+
+            UNREFERENCED_PARAMETER(numRightTris);
+            assert(numRightTris == numTris - leftChildNumNodes);
+        }
+        else if (numTris > MAX_TRIS_IN_LEAF)
+        {
+            // Try to balance by using the median if SAH failed
+            leftChildNumNodes = numTris / 2;
+
+            PrimitiveMetaData* rangeMetaData = metadata + firstPrimitive;
+            std::nth_element(rangeMetaData, rangeMetaData + numTris - leftChildNumNodes, rangeMetaData + numTris,
+                [&](const PrimitiveMetaData& a, const PrimitiveMetaData& b)
+            {
+                return GetCentroid(boxes[a.PrimitiveIndex], splitDimension) >
+                    GetCentroid(boxes[b.PrimitiveIndex], splitDimension);
+            });
+
+            // Rare enough to simply reload the bounds afterwards
+            LoadSahBounds(bounds, boxes, metadata, firstPrimitive, numTris);
+        }
     }
 
     //
@@ -379,321 +392,1444 @@ namespace FallbackLayer
     // -- left child's index is +1 of the parent index, right child's index is stored
     //    in the packed AABB structure.
     // -- there could be a varaible number of triangles in leaves
+    // -- primitives are referenced in place; a node's primitives are always
+    //    the contiguous range [begin, begin + count) of the reference array.
     //
     static
         void BuildBVH(
-            BVH& bvh,
+            std::vector<AABBNode>& nodes,
+            std::vector<CpuBvh2BuildScratch::BuildRange>& stack,
             const std::vector<AABB>& boxes,
-            const std::vector<PrimitiveMetaData>& primitiveMetaData,
+            SahReferenceBounds& bounds,
+            PrimitiveMetaData* primitiveMetaData,
+            UINT32 firstPrimitive,
+            UINT32 numPrimitives,
             UINT32 maxTrisInLeaf)
     {
-        //
-        // These are huge so use pointers
-        //
-        struct StackItem
-        {
-            std::vector<PrimitiveMetaData> primitiveMetaData;
-            UINT32              parentIndex;
-            UINT                right : 1;
-            UINT                axis : 2;
-        };
-
-        std::deque<StackItem*>   fifoLefts;
-        std::deque<StackItem*>   fifoRights;
+        typedef CpuBvh2BuildScratch::BuildRange StackItem;
 
-        StackItem* temp = new StackItem;
-        temp->parentIndex = (UINT)-1;
-        temp->primitiveMetaData = primitiveMetaData;
-        temp->right = false;
-        temp->axis = 0;
-        fifoRights.push_back(temp);
+        stack.clear();
+        stack.push_back(StackItem{ firstPrimitive, numPrimitives, (UINT32)-1, false });
 
-        while (!fifoLefts.empty() || !fifoRights.empty())
+        while (!stack.empty())
         {
-            // Uniform BVH pops the first left node
-            StackItem* item = nullptr;
-
-            if (!fifoRights.empty())
-            {
-                item = fifoRights.back();
-                fifoRights.pop_back();
-            }
+            // Uniform BVH pops the right node first
+            const StackItem item = stack.back();
+            stack.pop_back();
 
-            if (!item)
-            {
-                item = fifoLefts.back();
-                fifoLefts.pop_back();
-            }
+            PrimitiveMetaData* itemMetaData = primitiveMetaData + item.m_begin;
 
             //
             // Compute overall bounding box
             //
             AABB nodeBox;
-            ComputeBox(nodeBox, boxes, item->primitiveMetaData);
+            ComputeBox(nodeBox, boxes, itemMetaData, item.m_count);
 
-            const UINT32 numTrianglesInNode = (UINT32)item->primitiveMetaData.size();
-            const UINT32 parentIndex = item->parentIndex;
+            const UINT32 numTrianglesInNode = item.m_count;
+            const UINT32 parentIndex = item.m_parentIndex;
 
             UINT32 thisNodeIndex;
 
             // Leaf or internal node?
             if (numTrianglesInNode <= maxTrisInLeaf)
             {
-                thisNodeIndex = BuildBVHAddLeaf(bvh, nodeBox, item->primitiveMetaData);
+                thisNodeIndex = BuildBVHAddLeaf(nodes, nodeBox, item.m_begin, numTrianglesInNode);
             }
             else
             {
-                //
-                // Find separating plane. Use Median for speed.
-                // SAH is better but also more expensive to build.
-                //
-
                 UINT splitDimension;
                 UINT leftChildNumNodes;
 
-                SahSplit(item->primitiveMetaData,
+                SplitNode(primitiveMetaData,
+                    bounds,
+                    item.m_begin,
+                    numTrianglesInNode,
                     splitDimension,
                     leftChildNumNodes,
                     nodeBox,
                     boxes);
 
-                assert(leftChildNumNodes <= item->primitiveMetaData.size());
-
-                // Try to balance by using the median if SAH failed
-                if ((leftChildNumNodes == 0 ||
-                    leftChildNumNodes == item->primitiveMetaData.size()) &&
-                    item->primitiveMetaData.size() > MAX_TRIS_IN_LEAF)
-                {
-                    leftChildNumNodes = (UINT)item->primitiveMetaData.size() / 2;
-                }
-
-                const UINT32 rightChildNumNodes = (UINT32)item->primitiveMetaData.size() - leftChildNumNodes;
-
+                const UINT32 rightChildNumNodes = numTrianglesInNode - leftChildNumNodes;
 
                 //
                 // "Recurse"
                 //
 
-                thisNodeIndex = BuildBVHAddNode(bvh, nodeBox, splitDimension);
-
-                StackItem* leftItem = new StackItem;
-                leftItem->parentIndex = thisNodeIndex;
-                leftItem->primitiveMetaData.resize(leftChildNumNodes);
-                leftItem->right = false;
-                leftItem->axis = splitDimension;
-                for (UINT32 i = 0; i < leftChildNumNodes; ++i)
-                {
-                    leftItem->primitiveMetaData[i] = item->primitiveMetaData[i];
-                }
-
-                StackItem* rightItem = new StackItem;
-                rightItem->parentIndex = thisNodeIndex;
-                rightItem->primitiveMetaData.resize(rightChildNumNodes);
-                rightItem->right = true;
-                rightItem->axis = splitDimension;
-                for (UINT32 i = 0; i < rightChildNumNodes; ++i)
-                {
-                    rightItem->primitiveMetaData[i] = item->primitiveMetaData[i + leftChildNumNodes];
-                }
+                thisNodeIndex = BuildBVHAddNode(nodes, nodeBox, splitDimension);
 
-                fifoLefts.push_back(leftItem);
-                fifoRights.push_back(rightItem);
+                stack.push_back(StackItem{ item.m_begin + rightChildNumNodes, leftChildNumNodes, thisNodeIndex, false });
+                stack.push_back(StackItem{ item.m_begin, rightChildNumNodes, thisNodeIndex, true });
             }
 
             // Update child link of the parent
             if (parentIndex != -1)
             {
-                if (!item->right)
+                if (!item.m_isRightChild)
                 {
-                    bvh.m_nodes[parentIndex].internalNode.leftNodeIndex = thisNodeIndex;
-                    bvh.m_nodes[parentIndex].rightNodeIndex = parentIndex + 1;
+                    nodes[parentIndex].internalNode.leftNodeIndex = thisNodeIndex;
+                    nodes[parentIndex].rightNodeIndex = parentIndex + 1;
                 }
             }
-
-            // Free the item after use
-            delete item;
         }
     }
 
-    void BuildUniformBVH(
-        _In_  UINT NumElements,
-        _In_reads_opt_(NumElements)  const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometries,
-        BVH &bvh)
+    //
+    // Every leaf holds at least one primitive, so a binary tree over
+    // numPrimitives can't have more nodes than this
+    //
+    static
+        UINT32 GetMaxNodeCount(
+            UINT32 numPrimitives)
     {
-        using namespace DirectX;
-        //
-        // Compute number of triangles
-        //
+        return numPrimitives ? numPrimitives * 2 - 1 : 1;
+    }
+
+    //
+    // Appends nodes of a subtree that was built into its own array, rebasing
+    // its node indices. Returns the index of the subtree's root.
+    //
+    static
+        UINT32 AppendSubtree(
+            std::vector<AABBNode>& nodes,
+            const std::vector<AABBNode>& subtree)
+    {
+        const UINT32 nodeOffset = (UINT32)nodes.size();
 
-        UINT    totalNumberOfTriangles = 0;
+        nodes.insert(nodes.end(), subtree.begin(), subtree.end());
 
-        for (UINT i = 0; i < NumElements; ++i)
+        for (UINT32 i = nodeOffset; i < nodes.size(); ++i)
         {
-            auto &geometry = pGeometries[i];
-            if (geometry.Type == D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
-            {
-                totalNumberOfTriangles += GetPrimitiveCountFromGeometryDesc(geometry);
-            }
-            else
+            AABBNode& node = nodes[i];
+            if (!node.leaf)
             {
-                throw - 1; // Intersection shaders not supported yet
+                node.internalNode.leftNodeIndex += nodeOffset;
+                node.rightNodeIndex += nodeOffset;
             }
-
         }
 
-        //
-        // Create AABBs
-        //
-
-        std::vector<AABB> boxes;
-        boxes.resize(totalNumberOfTriangles);
-
-        std::vector<PrimitiveMetaData> primitiveMetaData;
-        primitiveMetaData.resize(totalNumberOfTriangles);
-
-        std::vector<float>  triangleVertices;
-        triangleVertices.resize(totalNumberOfTriangles * 9);
+        return nodeOffset;
+    }
 
-        UINT triangleIndex = 0;
-        for (UINT i = 0; i < NumElements; ++i)
+    //
+    // Fork/join version of BuildBVH. The serial builder emits each node
+    // followed by its whole right subtree and then its whole left subtree, so
+    // every subtree is a contiguous range of nodes and primitives. The right
+    // subtree is built directly after its parent, while large left subtrees
+    // are built into a scratch array on the task pool and appended once the
+    // right side is done. This keeps the output identical to a
+    // single-threaded build.
+    //
+    static
+        void BuildBVHParallel(
+            std::vector<AABBNode>& nodes,
+            std::vector<CpuBvh2BuildScratch::BuildRange>& stack,
+            CpuBvh2BuildScratch& scratch,
+            const std::vector<AABB>& boxes,
+            SahReferenceBounds& bounds,
+            PrimitiveMetaData* primitiveMetaData,
+            UINT32 firstPrimitive,
+            UINT32 numPrimitives,
+            UINT32 maxTrisInLeaf,
+            UINT32 parallelBuildThreshold,
+            UINT32 depth,
+            CpuTaskPool& taskPool)
+    {
+        if (numPrimitives <= maxTrisInLeaf ||
+            numPrimitives < parallelBuildThreshold ||
+            depth >= MAX_PARALLEL_BUILD_DEPTH)
         {
-            auto &geometry = pGeometries[i];
-            if (geometry.Type != D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
-            {
-                throw - 1; // Intersection shaders not supported yet
-            }
-
-            auto &triangles = geometry.Triangles;
-            if (GetPrimitiveCountFromGeometryDesc(geometry) == 0)
-
-            {
-                continue;
-            }
+            BuildBVH(nodes, stack, boxes, bounds, primitiveMetaData, firstPrimitive, numPrimitives, maxTrisInLeaf);
+            return;
+        }
 
-            // 
-            const UINT64 vertexStrideDwords = triangles.VertexBuffer.StrideInBytes / 4;
-            const UINT numTris = GetPrimitiveCountFromGeometryDesc(geometry);
+        PrimitiveMetaData* nodeMetaData = primitiveMetaData + firstPrimitive;
 
-            float *pVertexData = (float *)geometry.Triangles.VertexBuffer.StartAddress;
-            float *pIndexData = (float *)geometry.Triangles.IndexBuffer;
+        AABB nodeBox;
+        ComputeBox(nodeBox, boxes, nodeMetaData, numPrimitives);
 
-            const float* pVertices = (float*)(pVertexData);
-            const UINT16* pIndices = (UINT16*)(pIndexData);
+        UINT splitDimension;
+        UINT leftChildNumNodes;
 
-            for (UINT j = 0; j < numTris; ++j)
-            {
-                const UINT16 i0 = pIndices[j * 3 + 0];
-                const UINT16 i1 = pIndices[j * 3 + 1];
-                const UINT16 i2 = pIndices[j * 3 + 2];
+        SplitNode(primitiveMetaData,
+            bounds,
+            firstPrimitive,
+            numPrimitives,
+            splitDimension,
+            leftChildNumNodes,
+            nodeBox,
+            boxes);
 
-                const float* v0 = &pVertices[i0 * vertexStrideDwords];
-                const float* v1 = &pVertices[i1 * vertexStrideDwords];
-                const float* v2 = &pVertices[i2 * vertexStrideDwords];
+        const UINT32 rightChildNumNodes = numPrimitives - leftChildNumNodes;
+        const UINT32 thisNodeIndex = BuildBVHAddNode(nodes, nodeBox, splitDimension);
 
-                float* pTriVerts = &triangleVertices[triangleIndex * 9];
+        CpuBvh2BuildScratch::Subtree& leftSubtree = scratch.AcquireSubtree(GetMaxNodeCount(leftChildNumNodes));
 
-                pTriVerts[0] = v0[0];
-                pTriVerts[1] = v0[1];
-                pTriVerts[2] = v0[2];
+        CpuTaskPool::TaskGroup group;
+        taskPool.Run(group, [&]()
+        {
+            BuildBVHParallel(leftSubtree.m_nodes, leftSubtree.m_stack, scratch, boxes, bounds, primitiveMetaData, firstPrimitive + rightChildNumNodes, leftChildNumNodes,
+                maxTrisInLeaf, parallelBuildThreshold, depth + 1, taskPool);
+        });
+        BuildBVHParallel(nodes, stack, scratch, boxes, bounds, primitiveMetaData, firstPrimitive, rightChildNumNodes,
+            maxTrisInLeaf, parallelBuildThreshold, depth + 1, taskPool);
+        taskPool.Wait(group);
 
-                pTriVerts[3] = v1[0];
-                pTriVerts[4] = v1[1];
-                pTriVerts[5] = v1[2];
+        const UINT32 leftNodeIndex = AppendSubtree(nodes, leftSubtree.m_nodes);
 
-                pTriVerts[6] = v2[0];
-                pTriVerts[7] = v2[1];
-                pTriVerts[8] = v2[2];
+        nodes[thisNodeIndex].internalNode.leftNodeIndex = leftNodeIndex;
+        nodes[thisNodeIndex].rightNodeIndex = thisNodeIndex + 1;
+    }
 
-                AABB& box = boxes[triangleIndex];
-                for (UINT k = 0; k < 3; ++k)
-                {
-#define AABB_Min_Padding 0.001f
-                    box.minArr[k] = std::min(v2[k], std::min(v0[k], v1[k]));
-                    box.maxArr[k] = std::max(v2[k], std::max(v0[k], v1[k])) + AABB_Min_Padding;
+    //
+    // Spatial splits, after "Spatial Splits in Bounding Volume Hierarchies"
+    // (Stich et al. 2009). A node's references can also be split by a plane,
+    // with every triangle that straddles it clipped into a reference on
+    // either side. References store the part of their triangle that they
+    // cover as their box.
+    //
 
-                    if (_isnan(box.minArr[k]) ||
-                        _isnan(box.maxArr[k]))
-                    {
-                        box.minArr[k] = 0;
-                        box.maxArr[k] = 0;
-                    }
-                }
+    static
+        void InitEmptyBox(
+            AABB& box)
+    {
+        box.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+        box.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    }
 
-                // Create out internal triangle indices.
-                PrimitiveMetaData metadata;
-                metadata.GeometryContributionToHitGroupIndex = i;
-                metadata.PrimitiveIndex = triangleIndex;
-                metadata.GeometryFlags = geometry.Flags;
-                primitiveMetaData[triangleIndex] = metadata;
+    static
+        bool IsEmptyBox(
+            const AABB& box)
+    {
+        return box.min.x > box.max.x || box.min.y > box.max.y || box.min.z > box.max.z;
+    }
 
-                // Next triangle
-                triangleIndex++;
-            }
+    static
+        void AddPointToBox(
+            AABB& box,
+            const float* pPoint)
+    {
+        for (UINT k = 0; k < 3; ++k)
+        {
+            box.minArr[k] = std::min(box.minArr[k], pPoint[k]);
+            box.maxArr[k] = std::max(box.maxArr[k], pPoint[k]);
         }
+    }
 
-        //
-        // Create a BVH
+    static
+        void IntersectBoxes(
+            AABB& box,
+            const AABB& other)
+    {
+        for (UINT k = 0; k < 3; ++k)
+        {
+            box.minArr[k] = std::max(box.minArr[k], other.minArr[k]);
+            box.maxArr[k] = std::min(box.maxArr[k], other.maxArr[k]);
+        }
+    }
+
+    //
+    // Clips the part of a triangle covered by referenceBox against the plane
+    // at position along dimension. A side the triangle doesn't reach gets an
+    // empty box. Boxes are padded like the triangles' own boxes, which also
+    // makes both sides overlap slightly so no ray slips between them.
+    //
+    static
+        void SplitReference(
+            const float* pTriangle,
+            const AABB& referenceBox,
+            UINT32 dimension,
+            float position,
+            AABB& leftBox,
+            AABB& rightBox)
+    {
+        InitEmptyBox(leftBox);
+        InitEmptyBox(rightBox);
+
+        for (UINT v = 0; v < 3; ++v)
+        {
+            const float* v0 = &pTriangle[v * 3];
+            const float* v1 = &pTriangle[((v + 1) % 3) * 3];
+
+            if (v0[dimension] <= position)
+            {
+                AddPointToBox(leftBox, v0);
+            }
+            if (v0[dimension] >= position)
+            {
+                AddPointToBox(rightBox, v0);
+            }
+
+            // The edge crosses the plane
+            if ((v0[dimension] < position && v1[dimension] > position) ||
+                (v0[dimension] > position && v1[dimension] < position))
+            {
+                const float t = (position - v0[dimension]) / (v1[dimension] - v0[dimension]);
+
+                float point[3];
+                for (UINT k = 0; k < 3; ++k)
+                {
+                    point[k] = v0[k] + (v1[k] - v0[k]) * t;
+                }
+                point[dimension] = position;
+
+                AddPointToBox(leftBox, point);
+                AddPointToBox(rightBox, point);
+            }
+        }
+
+        for (UINT k = 0; k < 3; ++k)
+        {
+            leftBox.maxArr[k] += AABB_Min_Padding;
+            rightBox.maxArr[k] += AABB_Min_Padding;
+        }
+
+        IntersectBoxes(leftBox, referenceBox);
+        IntersectBoxes(rightBox, referenceBox);
+    }
+
+    struct SpatialSplit
+    {
+        float sah;
+        UINT32 dimension;
+        float position;
+
+        // Children as estimated by the binning, before unsplitting
+        AABB leftBox;
+        AABB rightBox;
+        UINT32 numLeft;
+        UINT32 numRight;
+    };
+
+    static
+        UINT32 GetSpatialBin(
+            float value,
+            float origin,
+            float inverseBinSize)
+    {
+        const float bin = (value - origin) * inverseBinSize;
+        return (UINT32)std::min(std::max(bin, 0.0f), (float)(NUM_SPATIAL_BINS - 1));
+    }
+
+    //
+    // Chops every reference into the spatial bins it overlaps, counting it
+    // as entering its first bin and exiting its last one, and scores the
+    // planes between bins the same way SahSplit scores centroid splits.
+    //
+    static
+        bool FindSpatialSplit(
+            const PrimitiveMetaData* references,
+            UINT32 numReferences,
+            const AABB& nodeBox,
+            const std::vector<AABB>& referenceBoxes,
+            const std::vector<UINT32>& referenceTriangles,
+            const CpuTriangleLoader& triangleLoader,
+            SpatialSplit& split)
+    {
+        const float normalizeToParent = 1.f / ComputeBoxSurfaceArea(nodeBox);
+        split.sah = FLT_MAX;
+
+        for (UINT32 dimension = 0; dimension < 3; ++dimension)
+        {
+            const float origin = nodeBox.minArr[dimension];
+            const float binSize = (nodeBox.maxArr[dimension] - origin) / NUM_SPATIAL_BINS;
+            if (binSize <= 0)
+            {
+                continue;
+            }
+            const float inverseBinSize = 1.f / binSize;
+
+            AABB binBoxes[NUM_SPATIAL_BINS];
+            UINT32 entries[NUM_SPATIAL_BINS] = {};
+            UINT32 exits[NUM_SPATIAL_BINS] = {};
+            for (AABB& binBox : binBoxes)
+            {
+                InitEmptyBox(binBox);
+            }
+
+            for (UINT32 i = 0; i < numReferences; ++i)
+            {
+                const UINT32 referenceIndex = references[i].PrimitiveIndex;
+                const AABB& referenceBox = referenceBoxes[referenceIndex];
+                const UINT geometryIndex = references[i].GeometryContributionToHitGroupIndex;
+                float triangle[9];
+                triangleLoader.LoadTriangle(geometryIndex, referenceTriangles[referenceIndex] - triangleLoader.GetFirstTriangle(geometryIndex), triangle);
+
+                const UINT32 firstBin = GetSpatialBin(referenceBox.minArr[dimension], origin, inverseBinSize);
+                const UINT32 lastBin = GetSpatialBin(referenceBox.maxArr[dimension], origin, inverseBinSize);
+
+                AABB remainder = referenceBox;
+                for (UINT32 bin = firstBin; bin < lastBin; ++bin)
+                {
+                    const AABB binRemainder = remainder;
+                    AABB binPart;
+                    SplitReference(triangle, binRemainder, dimension, origin + binSize * (bin + 1), binPart, remainder);
+                    if (!IsEmptyBox(binPart))
+                    {
+                        AddExtentToBox(binBoxes[bin], binPart);
+                    }
+                }
+                if (!IsEmptyBox(remainder))
+                {
+                    AddExtentToBox(binBoxes[lastBin], remainder);
+                }
+
+                entries[firstBin]++;
+                exits[lastBin]++;
+            }
+
+            // Boxes of every possible right child
+            AABB rightBoxes[NUM_SPATIAL_BINS];
+            rightBoxes[NUM_SPATIAL_BINS - 1] = binBoxes[NUM_SPATIAL_BINS - 1];
+            for (UINT32 bin = NUM_SPATIAL_BINS - 1; bin-- > 0;)
+            {
+                rightBoxes[bin] = rightBoxes[bin + 1];
+                AddExtentToBox(rightBoxes[bin], binBoxes[bin]);
+            }
+
+            AABB leftBox;
+            InitEmptyBox(leftBox);
+            UINT32 numLeft = 0;
+            UINT32 numRight = numReferences;
+            for (UINT32 bin = 0; bin < NUM_SPATIAL_BINS - 1; ++bin)
+            {
+                AddExtentToBox(leftBox, binBoxes[bin]);
+                numLeft += entries[bin];
+                numRight -= exits[bin];
+
+                const AABB& rightBox = rightBoxes[bin + 1];
+                if (!numLeft || !numRight || IsEmptyBox(leftBox) || IsEmptyBox(rightBox))
+                {
+                    continue;
+                }
+
+                const float sah = (numLeft * ComputeBoxSurfaceArea(leftBox) +
+                    numRight * ComputeBoxSurfaceArea(rightBox)) *
+                    normalizeToParent;
+
+                if (sah < split.sah)
+                {
+                    split.sah = sah;
+                    split.dimension = dimension;
+                    split.position = origin + binSize * (bin + 1);
+                    split.leftBox = leftBox;
+                    split.rightBox = rightBox;
+                    split.numLeft = numLeft;
+                    split.numRight = numRight;
+                }
+            }
+        }
+
+        return split.sah != FLT_MAX;
+    }
+
+    //
+    // Sorts references into the children of a spatial split. A reference
+    // that straddles the plane is only duplicated while the budget lasts and
+    // when that's cheaper than moving it whole into either child
+    // ("reference unsplitting"). Both halves of a duplicated reference get
+    // new indices, past the end of referenceBoxes, whose boxes and triangles
+    // go to splitBoxes and splitTriangles. Nothing else is modified, so the
+    // caller can still throw the split away. Returns the split's SAH score,
+    // or FLT_MAX if either child ends up empty.
+    //
+    static
+        float PartitionSpatialSplit(
+            const PrimitiveMetaData* references,
+            UINT32 numReferences,
+            const SpatialSplit& split,
+            const AABB& nodeBox,
+            const std::vector<AABB>& referenceBoxes,
+            const std::vector<UINT32>& referenceTriangles,
+            const CpuTriangleLoader& triangleLoader,
+            UINT32 duplicateBudget,
+            std::vector<PrimitiveMetaData>& leftReferences,
+            std::vector<PrimitiveMetaData>& rightReferences,
+            std::vector<AABB>& splitBoxes,
+            std::vector<UINT32>& splitTriangles)
+    {
+        leftReferences.clear();
+        rightReferences.clear();
+        splitBoxes.clear();
+        splitTriangles.clear();
+
+        // The binned estimate of both children, updated as references are
+        // unsplit, and the children's actual boxes
+        AABB leftBox = split.leftBox;
+        AABB rightBox = split.rightBox;
+        AABB actualLeftBox;
+        AABB actualRightBox;
+        InitEmptyBox(actualLeftBox);
+        InitEmptyBox(actualRightBox);
+
+        // Can reach zero while unsplitting, so kept as floats
+        float numLeft = (float)split.numLeft;
+        float numRight = (float)split.numRight;
+
+        for (UINT32 i = 0; i < numReferences; ++i)
+        {
+            const PrimitiveMetaData& reference = references[i];
+            const AABB& referenceBox = referenceBoxes[reference.PrimitiveIndex];
+
+            if (referenceBox.maxArr[split.dimension] <= split.position)
+            {
+                leftReferences.push_back(reference);
+                AddExtentToBox(actualLeftBox, referenceBox);
+                continue;
+            }
+            if (referenceBox.minArr[split.dimension] >= split.position)
+            {
+                rightReferences.push_back(reference);
+                AddExtentToBox(actualRightBox, referenceBox);
+                continue;
+            }
+
+            const UINT geometryIndex = reference.GeometryContributionToHitGroupIndex;
+            const UINT32 triangle = referenceTriangles[reference.PrimitiveIndex];
+            float triangleVertices[9];
+            triangleLoader.LoadTriangle(geometryIndex, triangle - triangleLoader.GetFirstTriangle(geometryIndex), triangleVertices);
+            AABB leftPart;
+            AABB rightPart;
+            SplitReference(triangleVertices, referenceBox, split.dimension, split.position, leftPart, rightPart);
+
+            AABB leftUnion = leftBox;
+            AddExtentToBox(leftUnion, referenceBox);
+            AABB rightUnion = rightBox;
+            AddExtentToBox(rightUnion, referenceBox);
+
+            const float leftArea = ComputeBoxSurfaceArea(leftBox);
+            const float rightArea = ComputeBoxSurfaceArea(rightBox);
+            const float splitCost = leftArea * numLeft + rightArea * numRight;
+            const float leftCost = ComputeBoxSurfaceArea(leftUnion) * numLeft + rightArea * (numRight - 1);
+            const float rightCost = leftArea * (numLeft - 1) + ComputeBoxSurfaceArea(rightUnion) * numRight;
+
+            const bool bCanSplit = !IsEmptyBox(leftPart) && !IsEmptyBox(rightPart);
+            if (bCanSplit && splitBoxes.size() < duplicateBudget * 2 && splitCost < std::min(leftCost, rightCost))
+            {
+                PrimitiveMetaData half = reference;
+                half.PrimitiveIndex = (UINT32)(referenceBoxes.size() + splitBoxes.size());
+                leftReferences.push_back(half);
+                splitBoxes.push_back(leftPart);
+                splitTriangles.push_back(triangle);
+                AddExtentToBox(actualLeftBox, leftPart);
+
+                half.PrimitiveIndex++;
+                rightReferences.push_back(half);
+                splitBoxes.push_back(rightPart);
+                splitTriangles.push_back(triangle);
+                AddExtentToBox(actualRightBox, rightPart);
+            }
+            else if (IsEmptyBox(leftPart) || (!IsEmptyBox(rightPart) && rightCost < leftCost))
+            {
+                rightReferences.push_back(reference);
+                AddExtentToBox(actualRightBox, referenceBox);
+                if (bCanSplit)
+                {
+                    rightBox = rightUnion;
+                    numLeft--;
+                }
+            }
+            else
+            {
+                leftReferences.push_back(reference);
+                AddExtentToBox(actualLeftBox, referenceBox);
+                if (bCanSplit)
+                {
+                    leftBox = leftUnion;
+                    numRight--;
+                }
+            }
+        }
+
+        if (leftReferences.empty() || rightReferences.empty())
+        {
+            return FLT_MAX;
+        }
+
+        return (leftReferences.size() * ComputeBoxSurfaceArea(actualLeftBox) +
+            rightReferences.size() * ComputeBoxSurfaceArea(actualRightBox)) /
+            ComputeBoxSurfaceArea(nodeBox);
+    }
+
+    //
+    // Refitting. Children come after their parent and every subtree is the
+    // contiguous range of nodes from its root up to the end of its left
+    // subtree, so walking a subtree's range backwards visits children first.
+    //
+
+    static
+        UINT32 GetSubtreeEnd(
+            const AABBNode* nodes,
+            UINT32 nodeIndex)
+    {
+        // The left subtree is emitted last
+        while (!nodes[nodeIndex].leaf)
+        {
+            nodeIndex = nodes[nodeIndex].internalNode.leftNodeIndex;
+        }
+        return nodeIndex + 1;
+    }
+
+    //
+    // Reloads a leaf's primitives or unions an internal node's children.
+    // boxes holds the exact box of every node, like the build keeps them
+    // before packing, so refitting unchanged geometry writes the same nodes.
+    //
+    static
+        void RefitNode(
+            AABBNode* nodes,
+            UINT32 nodeIndex,
+            Primitive* primitives,
+            const PrimitiveMetaData* metadata,
+            const CpuTriangleLoader& triangleLoader,
+            std::vector<AABB>& boxes)
+    {
+        AABBNode& node = nodes[nodeIndex];
+        AABB box;
+        if (node.leaf)
+        {
+            const UINT32 firstPrimitive = node.leafNode.firstTriangleId;
+            const UINT32 numPrimitives = node.leafNode.numTriangleIds;
+
+            box.min = box.max = { 0.0f, 0.0f, 0.0f };
+            for (UINT32 i = firstPrimitive; i < firstPrimitive + numPrimitives; ++i)
+            {
+                const UINT32 geometryIndex = metadata[i].GeometryContributionToHitGroupIndex;
+                const UINT32 triangleIndex = metadata[i].PrimitiveIndex - triangleLoader.GetFirstTriangle(geometryIndex);
+
+                AABB triangleBox;
+                triangleLoader.LoadTriangle(geometryIndex, triangleIndex, (float*)primitives[i].triangle.v, triangleBox);
+                if (i == firstPrimitive)
+                {
+                    box = triangleBox;
+                }
+                else
+                {
+                    AddExtentToBox(box, triangleBox);
+                }
+            }
+        }
+        else
+        {
+            box = boxes[nodeIndex + 1];
+            AddExtentToBox(box, boxes[node.internalNode.leftNodeIndex]);
+        }
+
+        boxes[nodeIndex] = box;
+        SetNodeBox(node, box);
+    }
+
+    CpuBvh2BuildScratch::Subtree &CpuBvh2BuildScratch::AcquireSubtree(UINT32 maxNodes)
+    {
+        std::lock_guard<std::mutex> lock(m_subtreeLock);
+
+        // Tasks don't finish in the same order every build, so pick by size
+        // rather than by position. Otherwise every subtree slowly grows to
+        // fit the largest subtree that was ever built in it.
+        Subtree *pBestFit = nullptr;
+        for (Subtree &subtree : m_subtrees)
+        {
+            if (subtree.m_inUse)
+            {
+                continue;
+            }
+
+            // Prefer the smallest array that fits, otherwise the largest one
+            const size_t capacity = subtree.m_nodes.capacity();
+            const size_t bestCapacity = pBestFit ? pBestFit->m_nodes.capacity() : 0;
+            const bool bFits = capacity >= maxNodes;
+            const bool bBestFits = pBestFit && bestCapacity >= maxNodes;
+            if (!pBestFit ||
+                (bFits && (!bBestFits || capacity < bestCapacity)) ||
+                (!bFits && !bBestFits && capacity > bestCapacity))
+            {
+                pBestFit = &subtree;
+            }
+        }
+
+        if (!pBestFit)
+        {
+            m_subtrees.emplace_back();
+            pBestFit = &m_subtrees.back();
+        }
+
+        pBestFit->m_inUse = true;
+        pBestFit->m_nodes.clear();
+        pBestFit->m_nodes.reserve(maxNodes);
+        pBestFit->m_stack.clear();
+        return *pBestFit;
+    }
+
+    void CpuBvh2BuildScratch::ReleaseAllSubtrees()
+    {
+        std::lock_guard<std::mutex> lock(m_subtreeLock);
+        for (Subtree &subtree : m_subtrees)
+        {
+            subtree.m_inUse = false;
+        }
+    }
+
+    //
+    // Writes the LBVH subtree under hierarchy node hierarchyIndex, which
+    // covers the sorted primitives [first, last], starting at nodeIndex in
+    // the layout BuildBVH uses: a node, its whole right subtree, then its
+    // whole left subtree. Every subtree's size follows from its range, so
+    // both children can be written at once, and large left subtrees are
+    // handed to the task pool. Returns the subtree's box.
+    //
+    static
+        AABB BuildLinearBVHNode(
+            AABBNode* nodes,
+            UINT32 nodeIndex,
+            const HierarchyNode* hierarchy,
+            UINT32 hierarchyIndex,
+            UINT32 leafNodeOffset,
+            UINT32 first,
+            UINT32 last,
+            const std::vector<AABB>& boxes,
+            const PrimitiveMetaData* primitiveMetaData,
+            UINT32 parallelBuildThreshold,
+            UINT32 depth,
+            CpuTaskPool& taskPool)
+    {
+        AABBNode& node = nodes[nodeIndex];
+        node.nodeAllBits = 0;
+        node.rightNodeIndex = 0;
+
+        AABB nodeBox;
+        if (first == last)
+        {
+            nodeBox = boxes[primitiveMetaData[first].PrimitiveIndex];
+
+            node.leaf = true;
+            node.leafNode.firstTriangleId = first;
+            node.leafNode.numTriangleIds = 1;
+        }
+        else
+        {
+            // Child A covers [first, split] and child B [split + 1, last].
+            // An internal node's index is one end of its range, so an
+            // internal child A is node split.
+            const UINT32 childA = hierarchy[hierarchyIndex].LeftChildIndex;
+            const UINT32 childB = hierarchy[hierarchyIndex].RightChildIndex;
+            const UINT32 split = childA >= leafNodeOffset ? childA - leafNodeOffset : childA;
+
+            const UINT32 rightNodeIndex = nodeIndex + 1;
+            const UINT32 leftNodeIndex = rightNodeIndex + GetMaxNodeCount(last - split);
+
+            AABB leftBox;
+            AABB rightBox;
+            if (last - first + 1 >= parallelBuildThreshold && depth < MAX_PARALLEL_BUILD_DEPTH)
+            {
+                CpuTaskPool::TaskGroup group;
+                taskPool.Run(group, [&]()
+                {
+                    leftBox = BuildLinearBVHNode(nodes, leftNodeIndex, hierarchy, childA, leafNodeOffset, first, split,
+                        boxes, primitiveMetaData, parallelBuildThreshold, depth + 1, taskPool);
+                });
+                rightBox = BuildLinearBVHNode(nodes, rightNodeIndex, hierarchy, childB, leafNodeOffset, split + 1, last,
+                    boxes, primitiveMetaData, parallelBuildThreshold, depth + 1, taskPool);
+                taskPool.Wait(group);
+            }
+            else
+            {
+                rightBox = BuildLinearBVHNode(nodes, rightNodeIndex, hierarchy, childB, leafNodeOffset, split + 1, last,
+                    boxes, primitiveMetaData, parallelBuildThreshold, depth + 1, taskPool);
+                leftBox = BuildLinearBVHNode(nodes, leftNodeIndex, hierarchy, childA, leafNodeOffset, first, split,
+                    boxes, primitiveMetaData, parallelBuildThreshold, depth + 1, taskPool);
+            }
+
+            nodeBox = leftBox;
+            AddExtentToBox(nodeBox, rightBox);
+
+            node.internalNode.leftNodeIndex = leftNodeIndex;
+            node.rightNodeIndex = rightNodeIndex;
+        }
+
+        SetNodeBox(node, nodeBox);
+        return nodeBox;
+    }
+
+    // Smallest batch of triangles a task of the LBVH build works on
+    static const UINT LBVH_MIN_CHUNK_SIZE = 4 * 1024;
+    static const UINT LBVH_MAX_CENTROID_CHUNKS = 64;
+
+    //
+    // Triangle centroids, and the box of every vertex, computed the way the
+    // GPU builder's scene AABB and Morton code passes do. fminf and fmaxf
+    // skip NaNs like HLSL's min and max.
+    //
+    static
+        void ComputeCentroids(
+            CpuTaskPool& taskPool,
+            const CpuTriangleLoader& triangleLoader,
+            UINT32 numTris,
+            std::vector<float3>& centroids,
+            AABB& sceneBox)
+    {
+        centroids.resize(numTris);
+
+        const UINT32 chunkSize = std::max(LBVH_MIN_CHUNK_SIZE, DivideAndRoundUp(numTris, LBVH_MAX_CENTROID_CHUNKS));
+        const UINT32 numChunks = DivideAndRoundUp(numTris, chunkSize);
+        AABB chunkBoxes[LBVH_MAX_CENTROID_CHUNKS];
+
+        taskPool.ParallelFor(numChunks, 1, [&](UINT beginChunk, UINT endChunk)
+        {
+            for (UINT chunk = beginChunk; chunk < endChunk; chunk++)
+            {
+                AABB& box = chunkBoxes[chunk];
+                box.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+                box.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+                const UINT32 begin = chunk * chunkSize;
+                const UINT32 end = std::min(numTris, (chunk + 1) * chunkSize);
+                UINT geometryIndex = triangleLoader.FindGeometry(begin);
+                for (UINT32 i = begin; i < end; i++)
+                {
+                    while (i >= triangleLoader.GetFirstTriangle(geometryIndex + 1))
+                    {
+                        geometryIndex++;
+                    }
+
+                    float v[9];
+                    triangleLoader.LoadTriangle(geometryIndex, i - triangleLoader.GetFirstTriangle(geometryIndex), v);
+                    float centroid[3];
+                    for (UINT k = 0; k < 3; ++k)
+                    {
+                        box.minArr[k] = fminf(fminf(fminf(v[k], box.minArr[k]), v[3 + k]), v[6 + k]);
+                        box.maxArr[k] = fmaxf(fmaxf(fmaxf(v[k], box.maxArr[k]), v[3 + k]), v[6 + k]);
+                        centroid[k] = (v[k] + v[3 + k] + v[6 + k]) / 3.0f;
+                    }
+                    centroids[i] = { centroid[0], centroid[1], centroid[2] };
+                }
+            }
+        });
+
+        sceneBox = chunkBoxes[0];
+        for (UINT chunk = 1; chunk < numChunks; chunk++)
+        {
+            AddExtentToBox(sceneBox, chunkBoxes[chunk]);
+        }
+    }
+
+    static void CalculateMortonCode(const float3& centroid, const AABB& sceneBox, UINT32& mortonCode)
+    {
+        mortonCode = CalculateMortonCode30(centroid, sceneBox);
+    }
+
+    static void CalculateMortonCode(const float3& centroid, const AABB& sceneBox, UINT64& mortonCode)
+    {
+        mortonCode = CalculateMortonCode63(centroid, sceneBox);
+    }
+
+    //
+    // Morton codes, radix sort and hierarchy, the CPU side of
+    // MortonCodesCalculator, BitonicSort and ConstructHierarchyPass
+    //
+    template<typename MortonCode>
+    static
+        void BuildLinearBVHHierarchy(
+            CpuTaskPool& taskPool,
+            const std::vector<float3>& centroids,
+            const AABB& sceneBox,
+            std::vector<MortonCode>& mortonCodes,
+            std::vector<MortonCode>& scratchMortonCodes,
+            std::vector<UINT32>& sortedIndices,
+            std::vector<UINT32>& scratchIndices,
+            std::vector<HierarchyNode>& hierarchy)
+    {
+        const UINT32 numPrimitives = (UINT32)centroids.size();
+        mortonCodes.resize(numPrimitives);
+        scratchMortonCodes.resize(numPrimitives);
+        sortedIndices.resize(numPrimitives);
+        scratchIndices.resize(numPrimitives);
+        hierarchy.resize(GetMaxNodeCount(numPrimitives));
+
+        taskPool.ParallelFor(numPrimitives, LBVH_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; i++)
+            {
+                CalculateMortonCode(centroids[i], sceneBox, mortonCodes[i]);
+                sortedIndices[i] = i;
+            }
+        });
+
+        SortMortonCodes(taskPool, numPrimitives, mortonCodes.data(), sortedIndices.data(), scratchMortonCodes.data(), scratchIndices.data());
+        ConstructLbvhHierarchy(taskPool, numPrimitives, mortonCodes.data(), hierarchy.data());
+    }
+
+    CpuBvh2Builder::CpuBvh2Builder(UINT threadCount) :
+        m_taskPool(threadCount ? threadCount : CpuTaskPool::GetDefaultThreadCount())
+    {
+    }
+
+    //
+    // Serial builder with spatial splits. Unlike BuildBVH, a node's reference
+    // count isn't known before it's split, so references can't be
+    // partitioned in place. The references of the range on top of the stack
+    // are always at the end of m_references instead, where splitting them
+    // can grow the array. Leaves copy their references out in the order
+    // BuildBVH would have left them in.
+    //
+    void CpuBvh2Builder::BuildSpatialSplitBVH(
+        BVH &bvh,
+        UINT32 numTris)
+    {
+        typedef CpuBvh2BuildScratch::BuildRange StackItem;
+
+        std::vector<PrimitiveMetaData>& references = m_scratch.m_references;
+        std::vector<AABB>& referenceBoxes = m_scratch.m_referenceBoxes;
+        std::vector<UINT32>& referenceTriangles = m_scratch.m_referenceTriangles;
+        std::vector<PrimitiveMetaData>& leftReferences = m_scratch.m_leftReferences;
+        std::vector<PrimitiveMetaData>& rightReferences = m_scratch.m_rightReferences;
+        std::vector<AABB>& splitBoxes = m_scratch.m_splitBoxes;
+        std::vector<UINT32>& splitTriangles = m_scratch.m_splitTriangles;
+        SahReferenceBounds& sahBounds = m_scratch.m_sahBounds;
+        const CpuTriangleLoader& triangleLoader = m_scratch.m_triangleLoader;
+        std::vector<StackItem>& stack = m_scratch.m_stack;
+
+        // Every reference starts out as a whole triangle, whose
+        // PrimitiveIndex is already its own index
+        references.swap(bvh.m_metadata);
+        referenceBoxes.assign(m_scratch.m_boxes.begin(), m_scratch.m_boxes.end());
+        referenceTriangles.resize(numTris);
+        for (UINT32 i = 0; i < numTris; ++i)
+        {
+            referenceTriangles[i] = i;
+        }
+
+        UINT32 duplicateBudget = (UINT32)(numTris * std::max(m_settings.SpatialSplitBudget, 0.0f));
+        bvh.m_metadata.clear();
+        bvh.m_metadata.reserve(numTris + duplicateBudget);
+        bvh.m_nodes.reserve(GetMaxNodeCount(numTris + duplicateBudget));
+
+        AABB rootBox;
+        ComputeBox(rootBox, referenceBoxes, references.data(), numTris);
+        const float minOverlapArea = ComputeBoxSurfaceArea(rootBox) * m_settings.SpatialSplitOverlapThreshold;
+
+        stack.clear();
+        stack.push_back(StackItem{ 0, numTris, (UINT32)-1, false });
+
+        while (!stack.empty())
+        {
+            const StackItem item = stack.back();
+            stack.pop_back();
+            assert(item.m_begin + item.m_count == references.size());
+
+            PrimitiveMetaData* itemReferences = references.data() + item.m_begin;
+
+            AABB nodeBox;
+            ComputeBox(nodeBox, referenceBoxes, itemReferences, item.m_count);
+
+            const UINT32 parentIndex = item.m_parentIndex;
+            UINT32 thisNodeIndex;
+
+            if (item.m_count <= MAX_TRIS_IN_LEAF)
+            {
+                thisNodeIndex = BuildBVHAddLeaf(bvh.m_nodes, nodeBox, (UINT32)bvh.m_metadata.size(), item.m_count);
+
+                for (UINT32 i = 0; i < item.m_count; ++i)
+                {
+                    PrimitiveMetaData metadata = itemReferences[i];
+                    metadata.PrimitiveIndex = referenceTriangles[metadata.PrimitiveIndex];
+                    bvh.m_metadata.push_back(metadata);
+                }
+                references.resize(item.m_begin);
+            }
+            else
+            {
+                UINT splitDimension;
+                UINT leftChildNumNodes;
+
+                // References move around too much to keep their bounds in
+                // step, so they're loaded for every node
+                sahBounds.Resize((UINT32)references.size());
+                LoadSahBounds(sahBounds, referenceBoxes, references.data(), item.m_begin, item.m_count);
+
+                SplitNode(references.data(),
+                    sahBounds,
+                    item.m_begin,
+                    item.m_count,
+                    splitDimension,
+                    leftChildNumNodes,
+                    nodeBox,
+                    referenceBoxes);
+
+                UINT32 rightChildNumNodes = item.m_count - leftChildNumNodes;
+
+                // SplitNode puts the right child first, but it's popped first
+                // so it has to be at the end
+                std::rotate(itemReferences, itemReferences + rightChildNumNodes, itemReferences + item.m_count);
+
+                AABB leftBox;
+                AABB rightBox;
+                ComputeBox(leftBox, referenceBoxes, itemReferences, leftChildNumNodes);
+                ComputeBox(rightBox, referenceBoxes, itemReferences + leftChildNumNodes, rightChildNumNodes);
+
+                const float objectSah = (leftChildNumNodes * ComputeBoxSurfaceArea(leftBox) +
+                    rightChildNumNodes * ComputeBoxSurfaceArea(rightBox)) /
+                    ComputeBoxSurfaceArea(nodeBox);
+
+                // Only worth trying when the centroid split's children overlap
+                AABB overlap = leftBox;
+                IntersectBoxes(overlap, rightBox);
+
+                SpatialSplit spatialSplit;
+                if (duplicateBudget &&
+                    !IsEmptyBox(overlap) &&
+                    ComputeBoxSurfaceArea(overlap) > minOverlapArea &&
+                    FindSpatialSplit(itemReferences, item.m_count, nodeBox, referenceBoxes, referenceTriangles, triangleLoader, spatialSplit) &&
+                    spatialSplit.sah < objectSah &&
+                    PartitionSpatialSplit(itemReferences, item.m_count, spatialSplit, nodeBox, referenceBoxes, referenceTriangles, triangleLoader,
+                        duplicateBudget, leftReferences, rightReferences, splitBoxes, splitTriangles) < objectSah)
+                {
+                    splitDimension = spatialSplit.dimension;
+                    leftChildNumNodes = (UINT32)leftReferences.size();
+                    rightChildNumNodes = (UINT32)rightReferences.size();
+                    duplicateBudget -= (UINT32)splitBoxes.size() / 2;
+
+                    referenceBoxes.insert(referenceBoxes.end(), splitBoxes.begin(), splitBoxes.end());
+                    referenceTriangles.insert(referenceTriangles.end(), splitTriangles.begin(), splitTriangles.end());
+
+                    references.resize(item.m_begin);
+                    references.insert(references.end(), leftReferences.begin(), leftReferences.end());
+                    references.insert(references.end(), rightReferences.begin(), rightReferences.end());
+                }
+
+                thisNodeIndex = BuildBVHAddNode(bvh.m_nodes, nodeBox, splitDimension);
+
+                stack.push_back(StackItem{ item.m_begin, leftChildNumNodes, thisNodeIndex, false });
+                stack.push_back(StackItem{ item.m_begin + leftChildNumNodes, rightChildNumNodes, thisNodeIndex, true });
+            }
+
+            // Update child link of the parent
+            if (parentIndex != -1)
+            {
+                if (!item.m_isRightChild)
+                {
+                    bvh.m_nodes[parentIndex].internalNode.leftNodeIndex = thisNodeIndex;
+                    bvh.m_nodes[parentIndex].rightNodeIndex = parentIndex + 1;
+                }
+            }
+        }
+    }
+
+    void CpuBvh2Builder::BuildLinearBVH(
+        BVH &bvh,
+        UINT32 numTris)
+    {
+        if (m_settings.LbvhMortonCodeBits != 30 && m_settings.LbvhMortonCodeBits != 63)
+        {
+            ThrowFailure(E_INVALIDARG, L"LbvhMortonCodeBits must be 30 or 63");
+        }
+
+        // Nothing to sort, this is the same single leaf a SAH build makes
+        if (numTris < 2)
+        {
+            BuildBVH(bvh.m_nodes, m_scratch.m_stack, m_scratch.m_boxes, m_scratch.m_sahBounds, bvh.m_metadata.data(), 0, numTris, MAX_TRIS_IN_LEAF);
+            return;
+        }
+
+        AABB sceneBox;
+        ComputeCentroids(m_taskPool, m_scratch.m_triangleLoader, numTris, m_scratch.m_centroids, sceneBox);
+
+        if (m_settings.LbvhMortonCodeBits == 30)
+        {
+            BuildLinearBVHHierarchy(m_taskPool, m_scratch.m_centroids, sceneBox, m_scratch.m_mortonCodes, m_scratch.m_scratchMortonCodes,
+                m_scratch.m_sortedIndices, m_scratch.m_scratchIndices, m_scratch.m_hierarchy);
+        }
+        else
+        {
+            BuildLinearBVHHierarchy(m_taskPool, m_scratch.m_centroids, sceneBox, m_scratch.m_mortonCodes64, m_scratch.m_scratchMortonCodes64,
+                m_scratch.m_sortedIndices, m_scratch.m_scratchIndices, m_scratch.m_hierarchy);
+        }
+
+        // Leaves reference the triangles in sorted order. The sorted copy
+        // trades places with the BVH's metadata rather than being copied back.
+        std::vector<PrimitiveMetaData>& sortedMetadata = m_scratch.m_sortedMetadata;
+        sortedMetadata.resize(numTris);
+        const UINT32* sortedIndices = m_scratch.m_sortedIndices.data();
+        m_taskPool.ParallelFor(numTris, LBVH_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; i++)
+            {
+                sortedMetadata[i] = bvh.m_metadata[sortedIndices[i]];
+            }
+        });
+        bvh.m_metadata.swap(sortedMetadata);
+
+        bvh.m_nodes.resize(GetMaxNodeCount(numTris));
+        BuildLinearBVHNode(bvh.m_nodes.data(), 0, m_scratch.m_hierarchy.data(), 0, numTris - 1, 0, numTris - 1,
+            m_scratch.m_boxes, bvh.m_metadata.data(), m_settings.ParallelBuildThreshold, 0, m_taskPool);
+    }
+
+    void CpuBvh2Builder::ReorderBVHTreelets(
+        _Inout_updates_(numNodes) AABBNode *pNodes,
+        UINT32 numNodes,
+        _Inout_updates_(numReferences) PrimitiveMetaData *pMetadata,
+        _Inout_updates_opt_(numReferences) Primitive *pPrimitives,
+        UINT32 numReferences)
+    {
+        const UINT iterations = m_settings.TreeletReorderIterations;
+        std::vector<float> &sahCosts = m_stats.TreeletReorderSahCosts;
+        sahCosts.resize(iterations + 1);
+        sahCosts[0] = ComputeBVHSahCost(pNodes, numNodes);
+
+        std::vector<UINT32> &referenceOrder = m_scratch.m_referenceOrder;
+        referenceOrder.resize(numReferences);
+        ReorderTreelets(m_taskPool, pNodes, numNodes, m_settings.TreeletSize, iterations, m_settings.ParallelBuildThreshold,
+            m_scratch.m_treeletReorder, referenceOrder.data(), sahCosts.data() + 1);
+
+        std::vector<PrimitiveMetaData> &reorderedMetadata = m_scratch.m_sortedMetadata;
+        std::vector<Primitive> &reorderedPrimitives = m_scratch.m_reorderedPrimitives;
+        reorderedMetadata.resize(numReferences);
+        reorderedPrimitives.resize(pPrimitives ? numReferences : 0);
+        m_taskPool.ParallelFor(numReferences, LBVH_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; i++)
+            {
+                reorderedMetadata[i] = pMetadata[referenceOrder[i]];
+                if (pPrimitives)
+                {
+                    reorderedPrimitives[i] = pPrimitives[referenceOrder[i]];
+                }
+            }
+        });
+        memcpy(pMetadata, reorderedMetadata.data(), numReferences * sizeof(PrimitiveMetaData));
+        if (pPrimitives)
+        {
+            memcpy(pPrimitives, reorderedPrimitives.data(), numReferences * sizeof(Primitive));
+        }
+    }
+
+    void CpuBvh2Builder::BuildUniformBVH(
+        _In_  UINT NumElements,
+        _In_reads_opt_(NumElements)  const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometries,
+        BVH &bvh)
+    {
+        //
+        // Compute number of triangles
         //
 
-        BuildBVH(bvh, boxes, primitiveMetaData, MAX_TRIS_IN_LEAF);
+        CpuTriangleLoader& triangleLoader = m_scratch.m_triangleLoader;
+        triangleLoader.Reset(NumElements, pGeometries);
+        const UINT totalNumberOfTriangles = triangleLoader.GetNumTriangles();
+
+        //
+        // Create AABBs
+        //
+
+        std::vector<AABB>& boxes = m_scratch.m_boxes;
+        boxes.resize(totalNumberOfTriangles);
+
+        // The reference array is partitioned in place into leaf order and
+        // becomes the BVH's metadata
+        std::vector<PrimitiveMetaData>& primitiveMetaData = bvh.m_metadata;
+        primitiveMetaData.resize(totalNumberOfTriangles);
+
+        // Triangles are read straight from the geometry descs, a chunk can
+        // span several geometries
+        m_taskPool.ParallelFor(totalNumberOfTriangles, LOAD_TRIANGLES_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            UINT32 triangleIndex = begin;
+            for (UINT i = triangleLoader.FindGeometry(begin); triangleIndex < end; ++i)
+            {
+                const UINT32 firstTriangle = triangleLoader.GetFirstTriangle(i);
+                const UINT32 geometryEnd = std::min((UINT32)end, triangleLoader.GetFirstTriangle(i + 1));
+                triangleLoader.LoadBoxes(i, triangleIndex - firstTriangle, geometryEnd - firstTriangle, boxes.data() + triangleIndex);
+
+                for (; triangleIndex < geometryEnd; ++triangleIndex)
+                {
+                    // Create out internal triangle indices.
+                    PrimitiveMetaData metadata;
+                    metadata.GeometryContributionToHitGroupIndex = i;
+                    metadata.PrimitiveIndex = triangleIndex;
+                    metadata.GeometryFlags = pGeometries[i].Flags;
+                    primitiveMetaData[triangleIndex] = metadata;
+                }
+            }
+        });
+
+        //
+        // Create a BVH
+        //
+
+        const UINT numTris = totalNumberOfTriangles;
+        m_stats.TreeletReorderSahCosts.clear();
+        bvh.m_nodes.clear();
+        bvh.m_nodes.reserve(GetMaxNodeCount(numTris));
+
+        if (m_settings.Algorithm == CpuBvh2LbvhBuild)
+        {
+            BuildLinearBVH(bvh, numTris);
+        }
+        else if (m_settings.SpatialSplits)
+        {
+            BuildSpatialSplitBVH(bvh, numTris);
+        }
+        else
+        {
+            InitSahBounds(m_taskPool, m_scratch.m_sahBounds, boxes, primitiveMetaData.data(), numTris);
+            if (m_taskPool.GetThreadCount() > 1)
+            {
+                BuildBVHParallel(bvh.m_nodes, m_scratch.m_stack, m_scratch, boxes, m_scratch.m_sahBounds, primitiveMetaData.data(), 0, numTris,
+                    MAX_TRIS_IN_LEAF, m_settings.ParallelBuildThreshold, 0, m_taskPool);
+                m_scratch.ReleaseAllSubtrees();
+            }
+            else
+            {
+                BuildBVH(bvh.m_nodes, m_scratch.m_stack, boxes, m_scratch.m_sahBounds, primitiveMetaData.data(), 0, numTris, MAX_TRIS_IN_LEAF);
+            }
+        }
+
+        if (m_settings.TreeletReorderIterations)
+        {
+            ReorderBVHTreelets(bvh.m_nodes.data(), (UINT32)bvh.m_nodes.size(), bvh.m_metadata.data(), nullptr, (UINT32)bvh.m_metadata.size());
+        }
 
         //
         // Now copy and compress geometry
         //
 
-        // Copy verts
-        const UINT numTris = triangleIndex;
-        bvh.m_triangles.resize(numTris * 3 * 3);
-        assert(bvh.m_triangles.size() == triangleVertices.size());
-        assert(sizeof(bvh.m_triangles[0]) == sizeof(triangleVertices[0]));
+        // Copy verts, once per reference when spatial splits duplicated some
+        const UINT numReferences = (UINT)bvh.m_metadata.size();
+        bvh.m_triangles.resize(numReferences * 3 * 3);
+
+        m_taskPool.ParallelFor(numReferences, LOAD_TRIANGLES_MIN_CHUNK_SIZE, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; ++i)
+            {
+                const PrimitiveMetaData &metadata = bvh.m_metadata[i];
+                const UINT geometryIndex = metadata.GeometryContributionToHitGroupIndex;
+                triangleLoader.LoadTriangle(geometryIndex, metadata.PrimitiveIndex - triangleLoader.GetFirstTriangle(geometryIndex), &bvh.m_triangles[i * 9]);
+            }
+        });
+
+        m_stats.NumNodes = (UINT)bvh.m_nodes.size();
+        m_stats.NumReferences = numReferences;
+        m_stats.NumDuplicatedReferences = numReferences - numTris;
+        m_stats.SahCost = ComputeBVHSahCost(bvh.m_nodes.data(), (UINT)bvh.m_nodes.size());
+        m_stats.bRefit = false;
+        m_stats.SahGrowth = 1.0f;
+    }
+
+    void CpuBvh2Builder::BuildBoxBVH(
+        _In_reads_(numBoxes) const AABB *pBoxes,
+        UINT numBoxes,
+        BVH &bvh)
+    {
+        std::vector<AABB>& boxes = m_scratch.m_boxes;
+        boxes.assign(pBoxes, pBoxes + numBoxes);
 
-        for (UINT i = 0; i < numTris; ++i)
+        std::vector<PrimitiveMetaData>& primitiveMetaData = bvh.m_metadata;
+        primitiveMetaData.resize(numBoxes);
+        for (UINT i = 0; i < numBoxes; ++i)
         {
-            UINT inputIndex = bvh.m_metadata[i].PrimitiveIndex;
-            float *pInputTriangle = &triangleVertices.data()[inputIndex * 9];
-            float* pOutputTriangle = &bvh.m_triangles[i * 9];
+            PrimitiveMetaData metadata = {};
+            metadata.PrimitiveIndex = i;
+            primitiveMetaData[i] = metadata;
+        }
 
-            // Construct three planes and write to pPlanes
-            XMVECTOR V0 = XMVectorSet(pInputTriangle[0], pInputTriangle[1], pInputTriangle[2], 0.0f);
-            XMVECTOR V1 = XMVectorSet(pInputTriangle[3], pInputTriangle[4], pInputTriangle[5], 0.0f);
-            XMVECTOR V2 = XMVectorSet(pInputTriangle[6], pInputTriangle[7], pInputTriangle[8], 0.0f);
+        bvh.m_triangles.clear();
+        bvh.m_nodes.clear();
+        bvh.m_nodes.reserve(GetMaxNodeCount(numBoxes));
 
-            XMStoreFloat3((XMFLOAT3*)pOutputTriangle + 0, V0);
-            XMStoreFloat3((XMFLOAT3*)pOutputTriangle + 1, V1);
-            XMStoreFloat3((XMFLOAT3*)pOutputTriangle + 2, V2);
+        InitSahBounds(m_taskPool, m_scratch.m_sahBounds, boxes, primitiveMetaData.data(), numBoxes);
+        if (m_taskPool.GetThreadCount() > 1)
+        {
+            BuildBVHParallel(bvh.m_nodes, m_scratch.m_stack, m_scratch, boxes, m_scratch.m_sahBounds, primitiveMetaData.data(), 0, numBoxes,
+                1, m_settings.ParallelBuildThreshold, 0, m_taskPool);
+            m_scratch.ReleaseAllSubtrees();
+        }
+        else
+        {
+            BuildBVH(bvh.m_nodes, m_scratch.m_stack, boxes, m_scratch.m_sahBounds, primitiveMetaData.data(), 0, numBoxes, 1);
         }
     }
-}
 
-void BuildRaytracingAccelerationStructureOnCpu(
-    _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
-    _Out_ void *pData)
-{
-    FallbackLayer::BVH bvh;
-    FallbackLayer::BuildUniformBVH(pDesc->NumDescs, pDesc->pGeometryDescs, bvh);
+    void CpuBvh2Builder::RefitBVH(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Inout_ BYTE *pData)
+    {
+        const BYTE *pSource = (const BYTE *)pDesc->SourceAccelerationStructureData;
+        if (pSource && pSource != pData)
+        {
+            memcpy(pData, pSource, ((const BVHOffsets *)pSource)->totalSize);
+        }
 
-    BYTE* outputData = (BYTE*)pData;
-    BVHOffsets offsets;
-    offsets.offsetToBoxes = sizeof(BVHOffsets);
-    const UINT sizeofBoxes = (UINT)(bvh.m_nodes.size() * sizeof(*bvh.m_nodes.data()));
-    offsets.offsetToVertices = offsets.offsetToBoxes + sizeofBoxes;
-    
-    UINT numTriangles = (UINT)bvh.m_triangles.size() / 9;
-    const UINT sizeofVertices = numTriangles * sizeof(Primitive);
-    offsets.offsetToPrimitiveMetaData = offsets.offsetToVertices + sizeofVertices;
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+        AABBNode *nodes = (AABBNode *)(pData + offsets.offsetToBoxes);
+        Primitive *primitives = (Primitive *)(pData + offsets.offsetToVertices);
+        PrimitiveMetaData *metadata = (PrimitiveMetaData *)(pData + offsets.offsetToPrimitiveMetaData);
+        const UINT32 numNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode);
+        const UINT32 numReferences = (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices) / sizeof(Primitive);
 
-    const UINT sizeofMetadata = (UINT)(bvh.m_metadata.size() * sizeof(*bvh.m_metadata.data()));
-    offsets.totalSize = offsets.offsetToPrimitiveMetaData + sizeofMetadata;
+        const UINT32 offsetToUpdateInfo = offsets.offsetToPrimitiveMetaData + numReferences * sizeof(PrimitiveMetaData);
+        if (offsets.totalSize < offsetToUpdateInfo + sizeof(CpuBvh2UpdateInfo))
+        {
+            ThrowFailure(E_INVALIDARG, L"Only acceleration structures built with D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE can be updated");
+        }
+        const CpuBvh2UpdateInfo &updateInfo = *(const CpuBvh2UpdateInfo *)(pData + offsetToUpdateInfo);
 
-    memcpy(outputData,  &offsets, sizeof(offsets));
-    memcpy(outputData + offsets.offsetToBoxes, bvh.m_nodes.data(), sizeofBoxes);
+        // Metadata holds triangle indices across all geometries
+        CpuTriangleLoader &triangleLoader = m_scratch.m_triangleLoader;
+        triangleLoader.Reset(pDesc->NumDescs, pDesc->pGeometryDescs);
+        const UINT32 numTriangles = triangleLoader.GetNumTriangles();
 
-    Primitive *pPrimitives = (Primitive *)(outputData + offsets.offsetToVertices);
-    for (UINT i = 0; i < numTriangles; i++)
+        if (numTriangles != updateInfo.NumTriangles)
+        {
+            ThrowFailure(E_INVALIDARG, L"Updates can't change the number of triangles in an acceleration structure");
+        }
+
+        std::vector<AABB> &boxes = m_scratch.m_boxes;
+        boxes.resize(numNodes);
+
+        // Split the tree into subtrees small enough to refit serially and
+        // the nodes above them
+        std::vector<UINT32> &subtrees = m_scratch.m_refitSubtrees;
+        std::vector<UINT32> &topNodes = m_scratch.m_refitTopNodes;
+        std::vector<CpuBvh2BuildScratch::BuildRange> &stack = m_scratch.m_stack;
+        subtrees.clear();
+        topNodes.clear();
+        stack.clear();
+
+        const UINT32 maxSerialNodes = m_taskPool.GetThreadCount() > 1 ?
+            GetMaxNodeCount(m_settings.ParallelBuildThreshold) : numNodes;
+        stack.push_back(CpuBvh2BuildScratch::BuildRange{ 0, 0, (UINT32)-1, false });
+        while (!stack.empty())
+        {
+            const UINT32 nodeIndex = stack.back().m_begin;
+            stack.pop_back();
+
+            if (GetSubtreeEnd(nodes, nodeIndex) - nodeIndex <= maxSerialNodes)
+            {
+                subtrees.push_back(nodeIndex);
+            }
+            else
+            {
+                topNodes.push_back(nodeIndex);
+                stack.push_back(CpuBvh2BuildScratch::BuildRange{ nodes[nodeIndex].internalNode.leftNodeIndex, 0, nodeIndex, false });
+                stack.push_back(CpuBvh2BuildScratch::BuildRange{ nodeIndex + 1, 0, nodeIndex, true });
+            }
+        }
+
+        m_taskPool.ParallelFor((UINT)subtrees.size(), 1, [&](UINT begin, UINT end)
+        {
+            for (UINT i = begin; i < end; ++i)
+            {
+                const UINT32 root = subtrees[i];
+                for (UINT32 nodeIndex = GetSubtreeEnd(nodes, root); nodeIndex-- > root;)
+                {
+                    RefitNode(nodes, nodeIndex, primitives, metadata, triangleLoader, boxes);
+                }
+            }
+        });
+
+        // Both children of a top node are either subtrees or top nodes found
+        // after it
+        for (size_t i = topNodes.size(); i-- > 0;)
+        {
+            RefitNode(nodes, topNodes[i], primitives, metadata, triangleLoader, boxes);
+        }
+
+        m_stats.TreeletReorderSahCosts.clear();
+        if (m_settings.TreeletReorderIterations)
+        {
+            ReorderBVHTreelets(nodes, numNodes, metadata, primitives, numReferences);
+        }
+
+        m_stats.NumNodes = numNodes;
+        m_stats.NumReferences = numReferences;
+        m_stats.NumDuplicatedReferences = numReferences - numTriangles;
+        m_stats.SahCost = ComputeBVHSahCost(nodes, numNodes);
+        m_stats.bRefit = true;
+        m_stats.SahGrowth = updateInfo.BuildSahCost > 0.0f ? m_stats.SahCost / updateInfo.BuildSahCost : 1.0f;
+    }
+
+    void CpuBvh2Builder::BuildRaytracingAccelerationStructure(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Inout_ void *pData)
     {
-        Triangle *pTriangle = (Triangle *)((BYTE *)bvh.m_triangles.data() + sizeof(Triangle) * i);
-        pPrimitives[i].PrimitiveType = TRIANGLE_TYPE;
-        pPrimitives[i].triangle = *pTriangle;
+        if (pDesc->Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE)
+        {
+            RefitBVH(pDesc, (BYTE *)pData);
+            return;
+        }
+
+        BVH &bvh = m_scratch.m_bvh;
+        BuildUniformBVH(pDesc->NumDescs, pDesc->pGeometryDescs, bvh);
+        WriteBVHToOutput(bvh, pData);
+
+        if (pDesc->Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE)
+        {
+            BVHOffsets &offsets = *(BVHOffsets *)pData;
+            CpuBvh2UpdateInfo updateInfo;
+            updateInfo.NumTriangles = m_stats.NumReferences - m_stats.NumDuplicatedReferences;
+            updateInfo.BuildSahCost = m_stats.SahCost;
+            memcpy((BYTE *)pData + offsets.totalSize, &updateInfo, sizeof(updateInfo));
+            offsets.totalSize += sizeof(updateInfo);
+        }
     }
-    memcpy(outputData + offsets.offsetToPrimitiveMetaData, bvh.m_metadata.data(), sizeofMetadata);
+
+    void WriteBVHToOutput(const BVH &bvh, _Out_ void *pData)
+    {
+        BYTE* outputData = (BYTE*)pData;
+        BVHOffsets offsets;
+        offsets.offsetToBoxes = sizeof(BVHOffsets);
+        const UINT sizeofBoxes = (UINT)(bvh.m_nodes.size() * sizeof(*bvh.m_nodes.data()));
+        offsets.offsetToVertices = offsets.offsetToBoxes + sizeofBoxes;
+
+        UINT numTriangles = (UINT)bvh.m_triangles.size() / 9;
+        const UINT sizeofVertices = numTriangles * sizeof(Primitive);
+        offsets.offsetToPrimitiveMetaData = offsets.offsetToVertices + sizeofVertices;
+
+        const UINT sizeofMetadata = (UINT)(bvh.m_metadata.size() * sizeof(*bvh.m_metadata.data()));
+        offsets.totalSize = offsets.offsetToPrimitiveMetaData + sizeofMetadata;
+
+        memcpy(outputData, &offsets, sizeof(offsets));
+        memcpy(outputData + offsets.offsetToBoxes, bvh.m_nodes.data(), sizeofBoxes);
+
+        Primitive *pPrimitives = (Primitive *)(outputData + offsets.offsetToVertices);
+        for (UINT i = 0; i < numTriangles; i++)
+        {
+            Triangle *pTriangle = (Triangle *)((BYTE *)bvh.m_triangles.data() + sizeof(Triangle) * i);
+            pPrimitives[i].PrimitiveType = TRIANGLE_TYPE;
+            pPrimitives[i].triangle = *pTriangle;
+        }
+        memcpy(outputData + offsets.offsetToPrimitiveMetaData, bvh.m_metadata.data(), sizeofMetadata);
+    }
+
+    float ComputeBVHSahCost(const AABBNode *pNodes, UINT numNodes)
+    {
+        if (numNodes == 0)
+        {
+            return 0.0f;
+        }
+
+        AABB box;
+        DecompressAABB(box, pNodes[0]);
+        const float rootArea = ComputeBoxSurfaceArea(box);
+        if (rootArea <= 0.0f)
+        {
+            return 0.0f;
+        }
+
+        // Summed in double, there can be millions of terms
+        double cost = 0.0;
+        for (UINT i = 0; i < numNodes; ++i)
+        {
+            const AABBNode &node = pNodes[i];
+            DecompressAABB(box, node);
+            const double area = ComputeBoxSurfaceArea(box);
+            cost += node.leaf ? area * node.leafNode.numTriangleIds : area;
+        }
+        return (float)(cost / rootArea);
+    }
+}
+
+void BuildRaytracingAccelerationStructureOnCpu(
+    _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+    _Out_ void *pData)
+{
+    FallbackLayer::CpuBvh2Builder builder(1);
+    builder.BuildRaytracingAccelerationStructure(pDesc, pData);
 }
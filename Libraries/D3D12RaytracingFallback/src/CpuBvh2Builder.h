@@ -0,0 +1,264 @@
+﻿//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    struct BVH
+    {
+        std::vector<AABBNode>   m_nodes;
+        std::vector<float> m_triangles;
+        std::vector<PrimitiveMetaData> m_metadata;
+    };
+
+    enum CpuBvh2BuildAlgorithm
+    {
+        // Top-down build that picks every split with binned SAH
+        CpuBvh2SahBuild,
+
+        // Linear BVH: triangles sorted by the Morton code of their centroid,
+        // with the hierarchy read off the sorted codes the same way the GPU
+        // builder does, see CpuLbvh.h. Much faster to build, slower to trace.
+        CpuBvh2LbvhBuild,
+    };
+
+    struct CpuBvh2BuildSettings
+    {
+        CpuBvh2BuildAlgorithm Algorithm = CpuBvh2SahBuild;
+
+        // Bits in the Morton codes of LBVH builds, 30 or 63. 30 bits match
+        // the GPU builder, 63 bits tell more triangles apart in large scenes.
+        UINT LbvhMortonCodeBits = 30;
+
+        // Subtrees with fewer primitives than this are built, refit or
+        // treelet reordered serially by whichever thread picks them up
+        UINT ParallelBuildThreshold = 16 * 1024;
+
+        // Treelet reordering passes run over the tree after it's built or
+        // refit, see CpuTreeletReorder.h. They win back much of the SAH
+        // cost an LBVH build gives up, for a fraction of the time a SAH
+        // build takes. 0 turns reordering off.
+        UINT TreeletReorderIterations = 0;
+
+        // Leaves in a treelet, from MIN_TREELET_SIZE to MAX_TREELET_SIZE.
+        // Reordering a treelet takes about 3^TreeletSize steps.
+        UINT TreeletSize = 7;
+
+        // Spatial split BVH (SBVH) mode. Besides splitting the primitive
+        // references of a node by their centroids, the builder also considers
+        // splitting them with a plane, clipping triangles that straddle it
+        // into a reference on either side. Duplicated references end up in
+        // the leaves' PrimitiveMetaData ranges like any other reference.
+        // Spatial splits are always built on a single thread and only apply
+        // to SAH builds.
+        bool SpatialSplits = false;
+
+        // Extra references spatial splits may create, as a fraction of the
+        // number of triangles
+        float SpatialSplitBudget = 0.3f;
+
+        // Spatial splits are only tried when the children of the best
+        // centroid split overlap by more than this fraction of the root's
+        // surface area
+        float SpatialSplitOverlapThreshold = 1e-5f;
+    };
+
+    struct CpuBvh2BuildStats
+    {
+        UINT NumNodes = 0;
+
+        // Primitive references in the leaves, including those duplicated by
+        // spatial splits
+        UINT NumReferences = 0;
+        UINT NumDuplicatedReferences = 0;
+
+        // See ComputeBVHSahCost
+        float SahCost = 0.0f;
+
+        // Set by refits. SahCost relative to that of the full build the tree
+        // came from, which grows as the geometry deforms away from the shape
+        // it was built for. Rebuilding brings it back to 1.
+        bool bRefit = false;
+        float SahGrowth = 1.0f;
+
+        // With treelet reordering, the SahCost the build or refit came out
+        // with followed by the SahCost after every reordering iteration
+        std::vector<float> TreeletReorderSahCosts;
+    };
+
+    //
+    // Builds with D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE
+    // append this after the primitive metadata, and count it in the header's
+    // totalSize. Refits need it to check the new geometry matches and to
+    // measure how far the tree has degraded.
+    //
+    struct CpuBvh2UpdateInfo
+    {
+        UINT NumTriangles;
+        float BuildSahCost;
+    };
+
+    //
+    // Memory the builder keeps around between builds. Every vector is cleared
+    // rather than freed, so rebuilding geometry of a similar size doesn't
+    // touch the heap once the first build has grown them.
+    //
+    struct CpuBvh2BuildScratch
+    {
+        // A contiguous range of the primitive reference array that still
+        // needs a node
+        struct BuildRange
+        {
+            UINT32 m_begin;
+            UINT32 m_count;
+            UINT32 m_parentIndex;
+            UINT32 m_isRightChild;
+        };
+
+        // Nodes and traversal stack for a subtree built on a worker thread
+        struct Subtree
+        {
+            std::vector<AABBNode> m_nodes;
+            std::vector<BuildRange> m_stack;
+            bool m_inUse = false;
+        };
+
+        // Hands out the free subtree whose node array best fits maxNodes
+        Subtree &AcquireSubtree(UINT32 maxNodes);
+        void ReleaseAllSubtrees();
+
+        std::vector<AABB> m_boxes;
+        CpuTriangleLoader m_triangleLoader;
+
+        // The references' boxes as SAH binning reads them, partitioned
+        // along with the references
+        SahReferenceBounds m_sahBounds;
+        std::vector<BuildRange> m_stack;
+        BVH m_bvh;
+
+        // Spatial split builds. Every reference has its own, possibly
+        // clipped, box in m_referenceBoxes, which is what the PrimitiveIndex
+        // of an entry in m_references points at. A spatial split's clipped
+        // references are kept aside until the split is picked.
+        std::vector<PrimitiveMetaData> m_references;
+        std::vector<AABB> m_referenceBoxes;
+        std::vector<UINT32> m_referenceTriangles;
+        std::vector<PrimitiveMetaData> m_leftReferences;
+        std::vector<PrimitiveMetaData> m_rightReferences;
+        std::vector<AABB> m_splitBoxes;
+        std::vector<UINT32> m_splitTriangles;
+
+        // Refits. m_boxes holds every node's exact box, m_refitSubtrees the
+        // subtrees refit in parallel and m_refitTopNodes the nodes above them.
+        std::vector<UINT32> m_refitSubtrees;
+        std::vector<UINT32> m_refitTopNodes;
+
+        // LBVH builds. Only the Morton code arrays of the configured width
+        // are used.
+        std::vector<float3> m_centroids;
+        std::vector<UINT32> m_mortonCodes;
+        std::vector<UINT32> m_scratchMortonCodes;
+        std::vector<UINT64> m_mortonCodes64;
+        std::vector<UINT64> m_scratchMortonCodes64;
+        std::vector<UINT32> m_sortedIndices;
+        std::vector<UINT32> m_scratchIndices;
+        std::vector<HierarchyNode> m_hierarchy;
+        std::vector<PrimitiveMetaData> m_sortedMetadata;
+
+        // Treelet reordering. Primitives and their metadata are copied to
+        // their new order through m_reorderedPrimitives and m_sortedMetadata.
+        CpuTreeletReorderScratch m_treeletReorder;
+        std::vector<UINT32> m_referenceOrder;
+        std::vector<Primitive> m_reorderedPrimitives;
+
+    private:
+        // A deque so handing out a new subtree never moves the ones in use
+        std::deque<Subtree> m_subtrees;
+        std::mutex m_subtreeLock;
+    };
+
+    // Builds bottom-level BVH2s on the CPU. The output is byte-identical
+    // regardless of the number of threads used. Builds reuse the builder's
+    // scratch memory, so a builder must not be used by two threads at once.
+    class CpuBvh2Builder
+    {
+    public:
+        // A threadCount of 0 uses one thread per hardware thread
+        CpuBvh2Builder(UINT threadCount = 0);
+
+        //
+        // With PERFORM_UPDATE the tree in SourceAccelerationStructureData, or
+        // already in pData if that's 0, is refit to the new vertex positions
+        // instead of rebuilt: primitives are reloaded and node boxes are
+        // recomputed bottom-up, keeping the topology. The source must have
+        // been built with ALLOW_UPDATE from geometry with the same triangles.
+        //
+        void BuildRaytracingAccelerationStructure(
+            _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+            _Inout_ void *pData);
+
+        void BuildUniformBVH(
+            _In_  UINT NumElements,
+            _In_reads_opt_(NumElements)  const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometries,
+            BVH &bvh);
+
+        //
+        // Binned SAH build over boxes rather than triangles, one box per leaf.
+        // A leaf's firstTriangleId indexes bvh.m_metadata, whose
+        // PrimitiveIndex is the index of the box. Top levels are built this
+        // way, see CpuTopLevelBvh2Builder.
+        //
+        void BuildBoxBVH(
+            _In_reads_(numBoxes) const AABB *pBoxes,
+            UINT numBoxes,
+            BVH &bvh);
+
+        UINT GetThreadCount() const { return m_taskPool.GetThreadCount(); }
+
+        CpuBvh2BuildSettings &GetSettings() { return m_settings; }
+
+        const CpuBvh2BuildStats &GetLastBuildStats() const { return m_stats; }
+
+    private:
+        void BuildSpatialSplitBVH(BVH &bvh, UINT32 numTris);
+        void BuildLinearBVH(BVH &bvh, UINT32 numTris);
+
+        // Moves the primitives along with their metadata if pPrimitives isn't null
+        void ReorderBVHTreelets(
+            _Inout_updates_(numNodes) AABBNode *pNodes,
+            UINT32 numNodes,
+            _Inout_updates_(numReferences) PrimitiveMetaData *pMetadata,
+            _Inout_updates_opt_(numReferences) Primitive *pPrimitives,
+            UINT32 numReferences);
+
+        void RefitBVH(
+            _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+            _Inout_ BYTE *pData);
+
+        CpuTaskPool m_taskPool;
+        CpuBvh2BuildSettings m_settings;
+        CpuBvh2BuildStats m_stats;
+        CpuBvh2BuildScratch m_scratch;
+    };
+
+    void WriteBVHToOutput(const BVH &bvh, _Out_ void *pData);
+
+    // Packs a box into a node's center and half extents
+    void SetNodeBox(AABBNode &node, const AABB &box);
+
+    //
+    // SAH cost of a BVH2 relative to its root:
+    //   (sum of internal node areas + sum of leaf areas * primitives in leaf)
+    //   / root area
+    // with unit traversal and intersection costs.
+    //
+    float ComputeBVHSahCost(const AABBNode *pNodes, UINT numNodes);
+}
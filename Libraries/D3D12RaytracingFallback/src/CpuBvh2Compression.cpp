@@ -0,0 +1,247 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    // Largest finite fp16 value
+    static const float FP16_MAX = 65504.0f;
+    static const UINT16 FP16_INFINITY = 0x7C00;
+
+    //
+    // Truncates toward zero. When v * RoundDirection > 0 the magnitude is
+    // rounded up instead, so the output is never closer to zero than v.
+    //
+
+    UINT16 Fp32ToFp16(float v, float RoundDirection)
+    {
+        assert(!!_finite(v));
+        assert(v > -FP16_MAX && v < FP16_MAX);
+
+        // Multiplying by 2^-112 causes exponents below -14 to denormalize
+        static const UINT kMultiple = 0x07800000;   // 2**-112
+        const float BiasedFloat = v * (float&)kMultiple;
+        const UINT u = (UINT&)BiasedFloat;
+
+        const UINT sign = u & 0x80000000;
+        UINT body = u & 0x0fffffff;
+
+        // Increase the magnitude before truncation to ensure proper bounds
+        if (v * RoundDirection > 0.0f)
+        {
+            if (body == 0)
+                body = 0x800000;
+            else
+                body += 0x1fff;
+        }
+
+        return (UINT16)(sign >> 16 | body >> 13);
+    }
+
+    float QuantizeToFp16(float v)
+    {
+        return Fp16ToFp32(Fp32ToFp16(v));
+    }
+
+    static bool IsFp16Representable(float v)
+    {
+        // Also rejects NaNs
+        return v > -FP16_MAX && v < FP16_MAX;
+    }
+
+    static UINT GetNodeCount(const BVHOffsets &offsets, UINT nodeSize)
+    {
+        return (offsets.offsetToVertices - offsets.offsetToBoxes) / nodeSize;
+    }
+
+    static void WriteOffsets(const BVHOffsets &offsets, UINT numNodes, UINT nodeSize, _Out_ BVHOffsets &newOffsets)
+    {
+        newOffsets.offsetToBoxes = sizeof(BVHOffsets);
+        newOffsets.offsetToVertices = newOffsets.offsetToBoxes + numNodes * nodeSize;
+        newOffsets.offsetToPrimitiveMetaData = newOffsets.offsetToVertices + (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices);
+        newOffsets.totalSize = newOffsets.offsetToPrimitiveMetaData + (offsets.totalSize - offsets.offsetToPrimitiveMetaData);
+    }
+
+    // Primitives and their metadata don't depend on the node format
+    static void CopyPrimitives(const BYTE *pSource, const BVHOffsets &sourceOffsets, BYTE *pDest, const BVHOffsets &destOffsets)
+    {
+        memcpy(pDest + destOffsets.offsetToVertices,
+            pSource + sourceOffsets.offsetToVertices,
+            sourceOffsets.totalSize - sourceOffsets.offsetToVertices);
+    }
+
+    //
+    // The center is truncated to fp16 and the half extents are rounded up.
+    // Decoding computes center -/+ halfDim in fp32, which can round inward, so
+    // the half extents are grown one ulp at a time until the decoded box
+    // encloses the input box.
+    //
+
+    static bool CompressAABB(const AABB &box, CompressedAABBNode &packedBox)
+    {
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            const float minValue = box.minArr[axis];
+            const float maxValue = box.maxArr[axis];
+            if (!IsFp16Representable(minValue) || !IsFp16Representable(maxValue))
+            {
+                return false;
+            }
+
+            const float center = QuantizeToFp16((maxValue + minValue) * 0.5f);
+            const float halfDim = max(maxValue - center, center - minValue);
+            if (!IsFp16Representable(halfDim))
+            {
+                return false;
+            }
+
+            UINT16 packedHalfDim = Fp32ToFp16(halfDim, 1.0f);
+            while (center - Fp16ToFp32(packedHalfDim) > minValue ||
+                   center + Fp16ToFp32(packedHalfDim) < maxValue)
+            {
+                if (++packedHalfDim >= FP16_INFINITY)
+                {
+                    return false;
+                }
+            }
+
+            packedBox.center[axis] = Fp32ToFp16(center);
+            packedBox.halfDim[axis] = packedHalfDim;
+        }
+        return true;
+    }
+
+    static void AddPointToBox(AABB &box, const float3 &point)
+    {
+        box.min = min(box.min, point);
+        box.max = max(box.max, point);
+    }
+
+    UINT GetCompressedBVHSize(const BYTE *pBvhData)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pBvhData;
+        BVHOffsets compressedOffsets;
+        WriteOffsets(offsets, GetNodeCount(offsets, sizeof(AABBNode)), sizeof(CompressedAABBNode), compressedOffsets);
+        return compressedOffsets.totalSize;
+    }
+
+    bool CompressBVH(const BYTE *pBvhData, _Out_ BYTE *pCompressedData)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pBvhData;
+        const AABBNode *pNodes = (const AABBNode *)(pBvhData + offsets.offsetToBoxes);
+        const Primitive *pPrimitives = (const Primitive *)(pBvhData + offsets.offsetToVertices);
+        const UINT numNodes = GetNodeCount(offsets, sizeof(AABBNode));
+
+        BVHOffsets compressedOffsets;
+        WriteOffsets(offsets, numNodes, sizeof(CompressedAABBNode), compressedOffsets);
+        CompressedAABBNode *pCompressedNodes = (CompressedAABBNode *)(pCompressedData + compressedOffsets.offsetToBoxes);
+
+        // Children always come after their parent, so walking the nodes
+        // backwards visits both children before the parent. decodedBoxes
+        // holds what each compressed node decodes to.
+        std::vector<AABB> decodedBoxes(numNodes);
+        for (UINT nodeIndex = numNodes; nodeIndex-- > 0;)
+        {
+            const AABBNode &node = pNodes[nodeIndex];
+
+            AABB box;
+            box.min = { FLT_MAX, FLT_MAX, FLT_MAX };
+            box.max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            if (node.leaf)
+            {
+                const UINT firstPrimitive = node.leafNode.firstTriangleId;
+                for (UINT i = firstPrimitive; i < firstPrimitive + node.leafNode.numTriangleIds; i++)
+                {
+                    const Primitive &primitive = pPrimitives[i];
+                    if (primitive.PrimitiveType == TRIANGLE_TYPE)
+                    {
+                        for (UINT v = 0; v < 3; v++)
+                        {
+                            AddPointToBox(box, primitive.triangle.v[v]);
+                        }
+                    }
+                    else
+                    {
+                        AddPointToBox(box, primitive.aabb.min);
+                        AddPointToBox(box, primitive.aabb.max);
+                    }
+                }
+
+                // An empty BVH is a single leaf with no primitives
+                if (node.leafNode.numTriangleIds == 0)
+                {
+                    box.min = box.max = { 0.0f, 0.0f, 0.0f };
+                }
+            }
+            else
+            {
+                const UINT leftNodeIndex = node.internalNode.leftNodeIndex;
+                const UINT rightNodeIndex = nodeIndex + 1;
+                if (node.rightNodeIndex != rightNodeIndex || leftNodeIndex <= rightNodeIndex || leftNodeIndex >= numNodes)
+                {
+                    return false;
+                }
+
+                AddPointToBox(box, decodedBoxes[leftNodeIndex].min);
+                AddPointToBox(box, decodedBoxes[leftNodeIndex].max);
+                AddPointToBox(box, decodedBoxes[rightNodeIndex].min);
+                AddPointToBox(box, decodedBoxes[rightNodeIndex].max);
+            }
+
+            CompressedAABBNode &packedBox = pCompressedNodes[nodeIndex];
+            packedBox.nodeAllBits = node.nodeAllBits;
+            if (!CompressAABB(box, packedBox))
+            {
+                return false;
+            }
+            DecompressAABB(decodedBoxes[nodeIndex], packedBox);
+        }
+
+        memcpy(pCompressedData, &compressedOffsets, sizeof(compressedOffsets));
+        CopyPrimitives(pBvhData, offsets, pCompressedData, compressedOffsets);
+        return true;
+    }
+
+    UINT GetDecompressedBVHSize(const BYTE *pCompressedData)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pCompressedData;
+        BVHOffsets decompressedOffsets;
+        WriteOffsets(offsets, GetNodeCount(offsets, sizeof(CompressedAABBNode)), sizeof(AABBNode), decompressedOffsets);
+        return decompressedOffsets.totalSize;
+    }
+
+    void DecompressBVH(const BYTE *pCompressedData, _Out_ BYTE *pBvhData)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pCompressedData;
+        const CompressedAABBNode *pCompressedNodes = (const CompressedAABBNode *)(pCompressedData + offsets.offsetToBoxes);
+        const UINT numNodes = GetNodeCount(offsets, sizeof(CompressedAABBNode));
+
+        BVHOffsets decompressedOffsets;
+        WriteOffsets(offsets, numNodes, sizeof(AABBNode), decompressedOffsets);
+        AABBNode *pNodes = (AABBNode *)(pBvhData + decompressedOffsets.offsetToBoxes);
+
+        for (UINT nodeIndex = 0; nodeIndex < numNodes; nodeIndex++)
+        {
+            const CompressedAABBNode &packedBox = pCompressedNodes[nodeIndex];
+            AABBNode &node = pNodes[nodeIndex];
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                node.center[axis] = Fp16ToFp32(packedBox.center[axis]);
+                node.halfDim[axis] = Fp16ToFp32(packedBox.halfDim[axis]);
+            }
+            node.nodeAllBits = packedBox.nodeAllBits;
+            node.rightNodeIndex = packedBox.leaf ? 0 : nodeIndex + 1;
+        }
+
+        memcpy(pBvhData, &decompressedOffsets, sizeof(decompressedOffsets));
+        CopyPrimitives(pCompressedData, offsets, pBvhData, decompressedOffsets);
+    }
+}
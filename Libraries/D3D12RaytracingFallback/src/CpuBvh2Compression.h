@@ -0,0 +1,60 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    // Inline since traversal decodes six of these per box
+    inline float Fp16ToFp32(UINT16 v)
+    {
+        static const UINT kMultiple = 0x77800000;   // 2**112
+        const UINT BiasedFloat = (v & 0x8000) << 16 | (v & 0x7FFF) << 13;
+        return (float&)BiasedFloat * (float&)kMultiple;
+    }
+
+    // Truncates toward zero, or away from zero when v * RoundDirection > 0
+    UINT16 Fp32ToFp16(float v, float RoundDirection = 0.0f);
+
+    // Rounds to an fp16 value and returns it as fp32
+    float QuantizeToFp16(float v);
+
+    // Size of the blob CompressBVH writes for the BVH2 in pBvhData
+    UINT GetCompressedBVHSize(const BYTE *pBvhData);
+
+    //
+    // Converts a bottom-level BVH2 written by WriteBVHToOutput to one made of
+    // CompressedAABBNodes. Boxes are recomputed bottom-up from the primitives
+    // and rounded outward, so every decoded box encloses its children's decoded
+    // boxes exactly. Primitives and their metadata are copied as-is.
+    //
+    // Fails if a box doesn't fit in fp16 or a right child doesn't directly
+    // follow its parent.
+    //
+    bool CompressBVH(const BYTE *pBvhData, _Out_ BYTE *pCompressedData);
+
+    // Expands a compressed BVH2 back to AABBNodes. fp16 values are exact in
+    // fp32, so the expanded nodes decode to the same boxes.
+    UINT GetDecompressedBVHSize(const BYTE *pCompressedData);
+    void DecompressBVH(const BYTE *pCompressedData, _Out_ BYTE *pBvhData);
+
+    inline void DecompressAABB(
+        AABB& box,
+        const CompressedAABBNode& packedBox)
+    {
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            const float center = Fp16ToFp32(packedBox.center[axis]);
+            const float halfDim = Fp16ToFp32(packedBox.halfDim[axis]);
+            box.minArr[axis] = center - halfDim;
+            box.maxArr[axis] = center + halfDim;
+        }
+    }
+}
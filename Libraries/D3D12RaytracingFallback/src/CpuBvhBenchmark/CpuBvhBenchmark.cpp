@@ -0,0 +1,637 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "stdafx.h"
+#include "SceneBenchmark.h"
+
+using namespace FallbackLayer;
+
+// Headless benchmark for the CPU BVH2 builder. Generates a random triangle
+// soup and reports build throughput at 1..N threads, along with the heap
+// allocations made by a rebuild and the process' peak working set. It also
+// times every SAH binning path the CPU supports on the soup's root node, and
+// compares CPU traversal of the binary, compressed and wide BVH layouts.
+//
+// usage: CpuBvhBenchmark [triangleCount] [maxThreads] [iterations]
+//        CpuBvhBenchmark -scene <file> [options], see SceneBenchmark.h
+
+static std::atomic<UINT64> g_numAllocations(0);
+
+void *operator new(size_t size)
+{
+    g_numAllocations++;
+    void *pMemory = malloc(size ? size : 1);
+    if (!pMemory)
+    {
+        throw std::bad_alloc();
+    }
+    return pMemory;
+}
+
+void operator delete(void *pMemory) noexcept
+{
+    free(pMemory);
+}
+
+namespace
+{
+    // The CPU builder reads 16-bit indices, so split the soup into
+    // geometries that each stay under the R16 vertex limit
+    const UINT MaxTrianglesPerGeometry = 65535 / 3;
+
+    struct TriangleSoup
+    {
+        std::vector<std::vector<float>> m_vertices;
+        std::vector<std::vector<UINT16>> m_indices;
+        std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> m_geometryDescs;
+        UINT m_numTriangles;
+    };
+
+    void GenerateTriangleSoup(UINT numTriangles, TriangleSoup &soup)
+    {
+        std::mt19937 generator(1234);
+        std::uniform_real_distribution<float> position(0.0f, 1000.0f);
+        std::uniform_real_distribution<float> offset(-2.0f, 2.0f);
+
+        soup.m_numTriangles = numTriangles;
+        for (UINT firstTriangle = 0; firstTriangle < numTriangles; firstTriangle += MaxTrianglesPerGeometry)
+        {
+            const UINT trianglesInGeometry = std::min(MaxTrianglesPerGeometry, numTriangles - firstTriangle);
+
+            soup.m_vertices.push_back(std::vector<float>());
+            soup.m_indices.push_back(std::vector<UINT16>());
+            std::vector<float> &vertices = soup.m_vertices.back();
+            std::vector<UINT16> &indices = soup.m_indices.back();
+
+            for (UINT i = 0; i < trianglesInGeometry; i++)
+            {
+                const float center[3] = { position(generator), position(generator), position(generator) };
+                for (UINT v = 0; v < 3; v++)
+                {
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        vertices.push_back(center[axis] + offset(generator));
+                    }
+                    indices.push_back((UINT16)(i * 3 + v));
+                }
+            }
+        }
+
+        for (size_t i = 0; i < soup.m_vertices.size(); i++)
+        {
+            D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
+            geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            auto &triangles = geometryDesc.Triangles;
+            triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+            triangles.IndexCount = (UINT)soup.m_indices[i].size();
+            triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)soup.m_indices[i].data();
+            triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+            triangles.VertexCount = (UINT)soup.m_vertices[i].size() / 3;
+            triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)soup.m_vertices[i].data();
+            triangles.VertexBuffer.StrideInBytes = sizeof(float) * 3;
+            soup.m_geometryDescs.push_back(geometryDesc);
+        }
+    }
+
+    double GetPeakWorkingSetMB()
+    {
+#ifdef FALLBACK_CPU_BUILDERS_ONLY
+        // ru_maxrss is in kilobytes on Linux
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024.0;
+#else
+        PROCESS_MEMORY_COUNTERS counters = {};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#endif
+    }
+
+    void BenchmarkSahBinning(const TriangleSoup &soup, UINT numIterations)
+    {
+        std::vector<AABB> boxes;
+        AABB rootBox;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            rootBox.minArr[axis] = FLT_MAX;
+            rootBox.maxArr[axis] = -FLT_MAX;
+        }
+
+        for (auto &vertices : soup.m_vertices)
+        {
+            for (size_t v = 0; v < vertices.size(); v += 9)
+            {
+                AABB box;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    box.minArr[axis] = std::min(vertices[v + axis], std::min(vertices[v + 3 + axis], vertices[v + 6 + axis]));
+                    box.maxArr[axis] = std::max(vertices[v + axis], std::max(vertices[v + 3 + axis], vertices[v + 6 + axis]));
+                    rootBox.minArr[axis] = std::min(rootBox.minArr[axis], box.minArr[axis]);
+                    rootBox.maxArr[axis] = std::max(rootBox.maxArr[axis], box.maxArr[axis]);
+                }
+                boxes.push_back(box);
+            }
+        }
+
+        SahReferenceBounds bounds;
+        bounds.Resize((UINT)boxes.size());
+        for (UINT i = 0; i < boxes.size(); i++)
+        {
+            bounds.SetBox(i, boxes[i]);
+        }
+
+        SahBinning binning;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            binning.rangeMin[axis] = rootBox.minArr[axis];
+            binning.inverseExtents[axis] = 1.0f / (rootBox.maxArr[axis] - rootBox.minArr[axis]);
+        }
+
+        // Not heap allocated, new doesn't honor the bins' alignment before C++17
+        SahBins referenceBins;
+        SahBins simdBins;
+        const char *pathNames[NumSahBinningPaths] = { "scalar", "sse4.1", "avx" };
+
+        double scalarMs = 0.0;
+        printf("sah binning path, best ms, speedup, matches scalar\n");
+        for (UINT path = 0; path < NumSahBinningPaths; path++)
+        {
+            if (!IsSahBinningPathSupported((SahBinningPath)path))
+            {
+                printf("%s, unsupported\n", pathNames[path]);
+                continue;
+            }
+
+            SahBinningKernel kernel = GetSahBinningKernel((SahBinningPath)path);
+            SahBins &bins = path == SahBinningScalar ? referenceBins : simdBins;
+
+            double bestMs = DBL_MAX;
+            for (UINT iteration = 0; iteration < numIterations; iteration++)
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                kernel(bounds.GetRange(0), (UINT)boxes.size(), binning, bins);
+                auto end = std::chrono::high_resolution_clock::now();
+                bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+            }
+
+            if (path == SahBinningScalar)
+            {
+                scalarMs = bestMs;
+            }
+
+            bool bMatchesScalar = memcmp(referenceBins.numTriangles, bins.numTriangles, sizeof(bins.numTriangles)) == 0;
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                for (UINT j = 0; j < NUM_SAH_BINS; j++)
+                {
+                    const AABB left[2] = { GetSahBinBox(referenceBins.leftBoxes[axis][j]), GetSahBinBox(bins.leftBoxes[axis][j]) };
+                    const AABB right[2] = { GetSahBinBox(referenceBins.rightBoxes[axis][j]), GetSahBinBox(bins.rightBoxes[axis][j]) };
+                    for (UINT k = 0; k < 3; k++)
+                    {
+                        bMatchesScalar &= left[0].minArr[k] == left[1].minArr[k] && left[0].maxArr[k] == left[1].maxArr[k];
+                        bMatchesScalar &= right[0].minArr[k] == right[1].minArr[k] && right[0].maxArr[k] == right[1].maxArr[k];
+                    }
+                }
+            }
+
+            printf("%s, %.2f, %.2fx, %s\n", pathNames[path], bestMs, scalarMs / bestMs, bMatchesScalar ? "yes" : "NO");
+        }
+    }
+
+    // Rays from random points toward random triangles, so most of them hit
+    void GenerateRays(const TriangleSoup &soup, UINT numRays, std::vector<CpuRay> &rays)
+    {
+        std::mt19937 generator(5678);
+        std::uniform_real_distribution<float> position(0.0f, 1000.0f);
+        std::uniform_int_distribution<UINT> triangle(0, soup.m_numTriangles - 1);
+
+        rays.resize(numRays);
+        for (CpuRay &ray : rays)
+        {
+            const UINT triangleIndex = triangle(generator);
+            const float *pVertices = &soup.m_vertices[triangleIndex / MaxTrianglesPerGeometry][(triangleIndex % MaxTrianglesPerGeometry) * 9];
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                const float centroid = (pVertices[axis] + pVertices[3 + axis] + pVertices[6 + axis]) / 3.0f;
+                ray.origin[axis] = position(generator);
+                ray.direction[axis] = centroid - ray.origin[axis];
+            }
+            ray.tMin = 0.0f;
+            ray.tMax = FLT_MAX;
+        }
+    }
+
+    template<typename TraceRayFunction>
+    double BenchmarkTraversal(TraceRayFunction traceRay, const BYTE *pData, const std::vector<CpuRay> &rays, std::vector<CpuRayHit> &hits, UINT &numHits)
+    {
+        hits.resize(rays.size());
+        numHits = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            if (traceRay(pData, rays[i], hits[i]))
+            {
+                numHits++;
+            }
+            else
+            {
+                hits[i].primitiveId = UINT_MAX;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return rays.size() / std::chrono::duration<double>(end - start).count();
+    }
+
+    struct TraversalLayout
+    {
+        const char *m_name;
+        std::vector<BYTE> m_data;
+        UINT m_nodeSize;
+        double m_conversionMs;
+        bool (*m_traceRay)(const BYTE *, const CpuRay &, CpuRayHit &);
+    };
+
+    // Traces the same rays through the BVH2 and every layout derived from it
+    void BenchmarkTraversalLayouts(const TriangleSoup &soup, const std::vector<BYTE> &bvhData)
+    {
+        std::vector<TraversalLayout> layouts(4);
+        layouts[0] = { "bvh2 fp32", bvhData, sizeof(AABBNode), 0.0, TraceRayBVH2 };
+        layouts[1] = { "bvh2 fp16", std::vector<BYTE>(GetCompressedBVHSize(bvhData.data())), sizeof(CompressedAABBNode), 0.0, TraceRayCompressedBVH2 };
+        layouts[2] = { "bvh4", std::vector<BYTE>(GetMaxWideBVHSize(bvhData.data(), 4)), sizeof(Bvh4Node), 0.0, TraceRayBVH4 };
+        layouts[3] = { "bvh8", std::vector<BYTE>(GetMaxWideBVHSize(bvhData.data(), 8)), sizeof(Bvh8Node), 0.0, TraceRayBVH8 };
+
+        const WideBvhCollapseSettings collapseSettings;
+        for (size_t i = 1; i < layouts.size(); i++)
+        {
+            BYTE *pData = layouts[i].m_data.data();
+            auto start = std::chrono::high_resolution_clock::now();
+            switch (i)
+            {
+            case 1:
+                if (!CompressBVH(bvhData.data(), pData))
+                {
+                    printf("node compression failed, the soup doesn't fit in fp16\n");
+                    return;
+                }
+                break;
+            case 2:
+                CollapseBVH4(bvhData.data(), collapseSettings, pData);
+                break;
+            case 3:
+                CollapseBVH8(bvhData.data(), collapseSettings, pData);
+                break;
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            layouts[i].m_conversionMs = std::chrono::duration<double, std::milli>(end - start).count();
+        }
+
+        std::vector<CpuRay> rays;
+        GenerateRays(soup, 1000000, rays);
+
+        std::vector<CpuRayHit> referenceHits;
+        std::vector<CpuRayHit> hits;
+        double referenceRaysPerSecond = 0.0;
+        printf("layout, conversion ms, nodes, node MB, total MB, rays/sec, speedup, hit rate, rays with a different closest hit\n");
+        for (size_t i = 0; i < layouts.size(); i++)
+        {
+            const TraversalLayout &layout = layouts[i];
+            const BVHOffsets &offsets = *(const BVHOffsets *)layout.m_data.data();
+            std::vector<CpuRayHit> &layoutHits = i == 0 ? referenceHits : hits;
+
+            UINT numHits;
+            const double raysPerSecond = BenchmarkTraversal(layout.m_traceRay, layout.m_data.data(), rays, layoutHits, numHits);
+            if (i == 0)
+            {
+                referenceRaysPerSecond = raysPerSecond;
+            }
+
+            UINT numDifferentHits = 0;
+            for (size_t ray = 0; ray < rays.size(); ray++)
+            {
+                if (referenceHits[ray].primitiveId != layoutHits[ray].primitiveId)
+                {
+                    numDifferentHits++;
+                }
+            }
+
+            printf("%s, %.2f, %u, %.1f, %.1f, %.0f, %.2fx, %.3f, %u\n",
+                layout.m_name,
+                layout.m_conversionMs,
+                (offsets.offsetToVertices - offsets.offsetToBoxes) / layout.m_nodeSize,
+                (offsets.offsetToVertices - offsets.offsetToBoxes) / (1024.0 * 1024.0),
+                offsets.totalSize / (1024.0 * 1024.0),
+                raysPerSecond,
+                raysPerSecond / referenceRaysPerSecond,
+                (double)numHits / rays.size(),
+                numDifferentHits);
+        }
+    }
+
+    size_t GetMaxOutputSize(UINT numTriangles)
+    {
+        return sizeof(BVHOffsets) +
+            (size_t)numTriangles * 2 * sizeof(AABBNode) +
+            (size_t)numTriangles * (sizeof(Primitive) + sizeof(PrimitiveMetaData));
+    }
+
+    // Object splits only versus spatial splits on the same soup. Closest
+    // hits are compared by triangle, since references are laid out differently.
+    void BenchmarkSpatialSplits(const TriangleSoup &soup, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC &buildDesc)
+    {
+        std::vector<CpuRay> rays;
+        GenerateRays(soup, 1000000, rays);
+
+        std::vector<CpuRayHit> referenceHits;
+        std::vector<CpuRayHit> hits;
+        std::vector<PrimitiveMetaData> referenceMetadata;
+        printf("split mode, build ms, nodes, references, duplicated references, sah cost, rays/sec, rays with a different closest triangle\n");
+        for (UINT mode = 0; mode < 2; mode++)
+        {
+            CpuBvh2Builder builder(1);
+            builder.GetSettings().SpatialSplits = mode == 1;
+
+            const float budget = mode == 1 ? builder.GetSettings().SpatialSplitBudget : 0.0f;
+            std::vector<BYTE> output(GetMaxOutputSize(soup.m_numTriangles + (UINT)(soup.m_numTriangles * budget)));
+
+            auto start = std::chrono::high_resolution_clock::now();
+            builder.BuildRaytracingAccelerationStructure(&buildDesc, output.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            const double buildMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+            std::vector<CpuRayHit> &modeHits = mode == 0 ? referenceHits : hits;
+            UINT numHits;
+            const double raysPerSecond = BenchmarkTraversal(TraceRayBVH2, output.data(), rays, modeHits, numHits);
+
+            const BVHOffsets &offsets = *(const BVHOffsets *)output.data();
+            const PrimitiveMetaData *pMetadata = (const PrimitiveMetaData *)(output.data() + offsets.offsetToPrimitiveMetaData);
+            const CpuBvh2BuildStats &stats = builder.GetLastBuildStats();
+            if (mode == 0)
+            {
+                referenceMetadata.assign(pMetadata, pMetadata + stats.NumReferences);
+            }
+
+            UINT numDifferentHits = 0;
+            for (size_t ray = 0; ray < rays.size(); ray++)
+            {
+                const UINT referenceId = referenceHits[ray].primitiveId;
+                const UINT id = modeHits[ray].primitiveId;
+                if ((referenceId == UINT_MAX) != (id == UINT_MAX) ||
+                    (id != UINT_MAX && referenceMetadata[referenceId].PrimitiveIndex != pMetadata[id].PrimitiveIndex))
+                {
+                    numDifferentHits++;
+                }
+            }
+
+            printf("%s, %.2f, %u, %u, %u, %.2f, %.0f, %u\n",
+                mode == 0 ? "object" : "spatial",
+                buildMs,
+                stats.NumNodes,
+                stats.NumReferences,
+                stats.NumDuplicatedReferences,
+                stats.SahCost,
+                raysPerSecond,
+                numDifferentHits);
+        }
+    }
+
+    // SAH builds versus LBVH builds with either Morton code width
+    void BenchmarkLinearBuilds(const TriangleSoup &soup, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC &buildDesc, UINT maxThreads)
+    {
+        std::vector<CpuRay> rays;
+        GenerateRays(soup, 1000000, rays);
+        std::vector<CpuRayHit> hits;
+        std::vector<BYTE> output(GetMaxOutputSize(soup.m_numTriangles));
+
+        struct BuildMode
+        {
+            const char *m_name;
+            CpuBvh2BuildAlgorithm m_algorithm;
+            UINT m_mortonCodeBits;
+        };
+        const BuildMode buildModes[] =
+        {
+            { "sah", CpuBvh2SahBuild, 0 },
+            { "lbvh 30-bit", CpuBvh2LbvhBuild, 30 },
+            { "lbvh 63-bit", CpuBvh2LbvhBuild, 63 },
+        };
+
+        printf("algorithm, 1 thread build ms, %u thread build ms, sah cost, rays/sec, hits\n", maxThreads);
+        for (const BuildMode &mode : buildModes)
+        {
+            double buildMs[2];
+            const UINT threadCounts[2] = { 1, maxThreads };
+            float sahCost = 0.0f;
+            for (UINT i = 0; i < 2; i++)
+            {
+                CpuBvh2Builder builder(threadCounts[i]);
+                builder.GetSettings().Algorithm = mode.m_algorithm;
+                if (mode.m_algorithm == CpuBvh2LbvhBuild)
+                {
+                    builder.GetSettings().LbvhMortonCodeBits = mode.m_mortonCodeBits;
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+                builder.BuildRaytracingAccelerationStructure(&buildDesc, output.data());
+                auto end = std::chrono::high_resolution_clock::now();
+                buildMs[i] = std::chrono::duration<double, std::milli>(end - start).count();
+                sahCost = builder.GetLastBuildStats().SahCost;
+            }
+
+            UINT numHits;
+            const double raysPerSecond = BenchmarkTraversal(TraceRayBVH2, output.data(), rays, hits, numHits);
+            printf("%s, %.2f, %.2f, %.2f, %.0f, %u\n", mode.m_name, buildMs[0], buildMs[1], sahCost, raysPerSecond, numHits);
+        }
+    }
+
+    //
+    // SAH and LBVH builds followed by a growing number of treelet reordering
+    // iterations. The SAH cost reduction is that of the last iteration.
+    //
+    void BenchmarkTreeletReordering(const TriangleSoup &soup, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC &buildDesc, UINT maxThreads)
+    {
+        std::vector<CpuRay> rays;
+        GenerateRays(soup, 1000000, rays);
+        std::vector<CpuRayHit> hits;
+        std::vector<BYTE> output(GetMaxOutputSize(soup.m_numTriangles));
+
+        printf("algorithm, reorder iterations, %u thread build ms, sah cost, sah cost reduction, rays/sec\n", maxThreads);
+        for (CpuBvh2BuildAlgorithm algorithm : { CpuBvh2SahBuild, CpuBvh2LbvhBuild })
+        {
+            for (UINT iterations = 0; iterations <= 3; iterations++)
+            {
+                CpuBvh2Builder builder(maxThreads);
+                builder.GetSettings().Algorithm = algorithm;
+                builder.GetSettings().TreeletReorderIterations = iterations;
+
+                auto start = std::chrono::high_resolution_clock::now();
+                builder.BuildRaytracingAccelerationStructure(&buildDesc, output.data());
+                auto end = std::chrono::high_resolution_clock::now();
+                const double buildMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+                const std::vector<float> &sahCosts = builder.GetLastBuildStats().TreeletReorderSahCosts;
+                const float sahCostReduction = iterations ? sahCosts[iterations - 1] - sahCosts[iterations] : 0.0f;
+
+                UINT numHits;
+                const double raysPerSecond = BenchmarkTraversal(TraceRayBVH2, output.data(), rays, hits, numHits);
+                printf("%s, %u, %.2f, %.2f, %.2f, %.0f\n", algorithm == CpuBvh2SahBuild ? "sah" : "lbvh",
+                    iterations, buildMs, builder.GetLastBuildStats().SahCost, sahCostReduction, raysPerSecond);
+            }
+        }
+    }
+
+    //
+    // Refitting a BVH built with ALLOW_UPDATE after moving every triangle
+    // versus rebuilding it. Deforms the soup in place, so it runs last.
+    //
+    void BenchmarkRefit(TriangleSoup &soup, const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC &buildDesc, UINT maxThreads)
+    {
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC updatableDesc = buildDesc;
+        updatableDesc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+
+        const size_t outputSize = GetMaxOutputSize(soup.m_numTriangles) + sizeof(CpuBvh2UpdateInfo);
+        std::vector<BYTE> builtOutput(outputSize);
+        std::vector<BYTE> refitOutput(outputSize);
+        std::vector<BYTE> rebuiltOutput(outputSize);
+        CpuBvh2Builder(1).BuildRaytracingAccelerationStructure(&updatableDesc, builtOutput.data());
+
+        for (std::vector<float> &vertices : soup.m_vertices)
+        {
+            for (size_t i = 0; i < vertices.size(); i += 3)
+            {
+                const float x = vertices[i];
+                vertices[i] += 20.0f * sinf(vertices[i + 1] * 0.01f);
+                vertices[i + 1] += 20.0f * cosf(x * 0.01f);
+            }
+        }
+
+        std::vector<CpuRay> rays;
+        GenerateRays(soup, 1000000, rays);
+        std::vector<CpuRayHit> hits;
+        UINT numHits;
+
+        printf("threads, refit ms, rebuild ms, refit sah growth, refit rays/sec, rebuild rays/sec\n");
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC refitDesc = updatableDesc;
+        refitDesc.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+        refitDesc.SourceAccelerationStructureData = (D3D12_GPU_VIRTUAL_ADDRESS)builtOutput.data();
+        for (UINT threadCount = 1; threadCount <= maxThreads; threadCount++)
+        {
+            CpuBvh2Builder builder(threadCount);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            builder.BuildRaytracingAccelerationStructure(&refitDesc, refitOutput.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            const double refitMs = std::chrono::duration<double, std::milli>(end - start).count();
+            const float sahGrowth = builder.GetLastBuildStats().SahGrowth;
+
+            start = std::chrono::high_resolution_clock::now();
+            builder.BuildRaytracingAccelerationStructure(&buildDesc, rebuiltOutput.data());
+            end = std::chrono::high_resolution_clock::now();
+            const double rebuildMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+            // Traversal speed doesn't depend on how many threads built the BVH
+            if (threadCount == 1)
+            {
+                const double refitRaysPerSecond = BenchmarkTraversal(TraceRayBVH2, refitOutput.data(), rays, hits, numHits);
+                const double rebuiltRaysPerSecond = BenchmarkTraversal(TraceRayBVH2, rebuiltOutput.data(), rays, hits, numHits);
+                printf("%u, %.2f, %.2f, %.3f, %.0f, %.0f\n", threadCount, refitMs, rebuildMs, sahGrowth, refitRaysPerSecond, rebuiltRaysPerSecond);
+            }
+            else
+            {
+                printf("%u, %.2f, %.2f, %.3f, -, -\n", threadCount, refitMs, rebuildMs, sahGrowth);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-scene") == 0)
+    {
+        return RunSceneBenchmark(argc - 2, argv + 2);
+    }
+
+    const UINT numTriangles = argc > 1 ? (UINT)atoi(argv[1]) : 1000000;
+    const UINT maxThreads = argc > 2 ? (UINT)atoi(argv[2]) : CpuTaskPool::GetDefaultThreadCount();
+    const UINT numIterations = argc > 3 ? std::max(1, atoi(argv[3])) : 3;
+
+    printf("Generating %u triangles...\n", numTriangles);
+    TriangleSoup soup;
+    GenerateTriangleSoup(numTriangles, soup);
+    BenchmarkSahBinning(soup, numIterations);
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+    buildDesc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+    buildDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    buildDesc.NumDescs = (UINT)soup.m_geometryDescs.size();
+    buildDesc.pGeometryDescs = soup.m_geometryDescs.data();
+
+    const size_t outputSize = GetMaxOutputSize(numTriangles);
+    std::vector<BYTE> referenceOutput(outputSize);
+    std::vector<BYTE> output(outputSize);
+
+    double singleThreadedMs = 0.0;
+    printf("threads, best build ms, triangles/sec, speedup, first build allocations, rebuild allocations, peak working set MB, matches serial build\n");
+    for (UINT threadCount = 1; threadCount <= maxThreads; threadCount++)
+    {
+        CpuBvh2Builder builder(threadCount);
+        std::vector<BYTE> &buildOutput = threadCount == 1 ? referenceOutput : output;
+
+        // The first build grows the builder's scratch memory, later builds
+        // should reuse it
+        UINT64 firstBuildAllocations = 0;
+        UINT64 rebuildAllocations = 0;
+
+        double bestMs = DBL_MAX;
+        for (UINT iteration = 0; iteration < numIterations; iteration++)
+        {
+            const UINT64 allocationsBeforeBuild = g_numAllocations;
+            auto start = std::chrono::high_resolution_clock::now();
+            builder.BuildRaytracingAccelerationStructure(&buildDesc, buildOutput.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+
+            const UINT64 numAllocations = g_numAllocations - allocationsBeforeBuild;
+            if (iteration == 0)
+            {
+                firstBuildAllocations = numAllocations;
+            }
+            else
+            {
+                rebuildAllocations = std::max(rebuildAllocations, numAllocations);
+            }
+        }
+
+        if (threadCount == 1)
+        {
+            singleThreadedMs = bestMs;
+        }
+
+        const UINT totalSize = ((BVHOffsets *)buildOutput.data())->totalSize;
+        const bool bMatchesSerialBuild = memcmp(referenceOutput.data(), buildOutput.data(), totalSize) == 0;
+
+        printf("%u, %.2f, %.0f, %.2fx, %llu, %llu, %.1f, %s\n",
+            threadCount,
+            bestMs,
+            numTriangles / (bestMs / 1000.0),
+            singleThreadedMs / bestMs,
+            firstBuildAllocations,
+            rebuildAllocations,
+            GetPeakWorkingSetMB(),
+            bMatchesSerialBuild ? "yes" : "NO");
+    }
+
+    BenchmarkTraversalLayouts(soup, referenceOutput);
+    BenchmarkSpatialSplits(soup, buildDesc);
+    BenchmarkLinearBuilds(soup, buildDesc, maxThreads);
+    BenchmarkTreeletReordering(soup, buildDesc, maxThreads);
+    BenchmarkRefit(soup, buildDesc, maxThreads);
+
+    return 0;
+}
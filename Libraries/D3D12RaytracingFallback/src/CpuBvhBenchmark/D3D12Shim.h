@@ -0,0 +1,286 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+//
+// Just enough of the Windows SDK and D3D12 headers for the CPU builders to
+// compile without them, see CMakeLists.txt. The D3D12 types match the
+// layout of d3d12_1.h, which the builders' output depends on.
+//
+
+#include <immintrin.h>
+#include <cpuid.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <exception>
+
+typedef int16_t INT16;
+typedef int32_t INT;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef uint8_t BYTE;
+typedef uint16_t UINT16;
+typedef uint32_t UINT;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef float FLOAT;
+typedef int32_t HRESULT;
+typedef const wchar_t *LPCWSTR;
+
+#define S_OK ((HRESULT)0)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+#define UNREFERENCED_PARAMETER(parameter) (void)(parameter)
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+#define ARRAYSIZE _countof
+#define __forceinline inline __attribute__((always_inline))
+#define _isnan isnan
+#define _finite isfinite
+
+// SAL annotations
+#define _In_
+#define _In_opt_
+#define _In_reads_(size)
+#define _In_reads_opt_(size)
+#define _Out_
+#define _Out_writes_(size)
+#define _Out_writes_opt_(size)
+#define _Inout_
+#define _Inout_updates_(size)
+#define _Inout_updates_opt_(size)
+
+class _com_error : public std::exception
+{
+public:
+    explicit _com_error(HRESULT hr) : m_hr(hr) {}
+    HRESULT Error() const { return m_hr; }
+    const char *what() const noexcept override { return "D3D12 Raytracing Fallback Error"; }
+
+private:
+    HRESULT m_hr;
+};
+
+inline void OutputDebugString(LPCWSTR string)
+{
+    fputws(string, stderr);
+}
+
+inline unsigned char _BitScanForward(unsigned long *pIndex, UINT32 mask)
+{
+    if (mask == 0)
+    {
+        return 0;
+    }
+    *pIndex = (unsigned long)__builtin_ctz(mask);
+    return 1;
+}
+
+inline unsigned char _BitScanReverse(unsigned long *pIndex, UINT32 mask)
+{
+    if (mask == 0)
+    {
+        return 0;
+    }
+    *pIndex = 31 - (unsigned long)__builtin_clz(mask);
+    return 1;
+}
+
+inline unsigned char _BitScanReverse64(unsigned long *pIndex, UINT64 mask)
+{
+    if (mask == 0)
+    {
+        return 0;
+    }
+    *pIndex = 63 - (unsigned long)__builtin_clzll(mask);
+    return 1;
+}
+
+#define BitScanForward _BitScanForward
+#define BitScanReverse _BitScanReverse
+
+// cpuid.h's __cpuid is a macro with a different signature than MSVC's
+#undef __cpuid
+inline void __cpuid(int cpuInfo[4], int function)
+{
+    __cpuid_count(function, 0, cpuInfo[0], cpuInfo[1], cpuInfo[2], cpuInfo[3]);
+}
+
+// GCC's _xgetbv needs the whole file built with -mxsave
+inline UINT64 ReadExtendedControlRegister(UINT32 index)
+{
+    UINT32 eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((UINT64)edx << 32) | eax;
+}
+#define _xgetbv ReadExtendedControlRegister
+
+#define DEFINE_ENUM_FLAG_OPERATORS(ENUMTYPE) \
+    inline ENUMTYPE operator|(ENUMTYPE a, ENUMTYPE b) { return ENUMTYPE((int)a | (int)b); } \
+    inline ENUMTYPE &operator|=(ENUMTYPE &a, ENUMTYPE b) { return a = a | b; } \
+    inline ENUMTYPE operator&(ENUMTYPE a, ENUMTYPE b) { return ENUMTYPE((int)a & (int)b); } \
+    inline ENUMTYPE &operator&=(ENUMTYPE &a, ENUMTYPE b) { return a = a & b; } \
+    inline ENUMTYPE operator~(ENUMTYPE a) { return ENUMTYPE(~(int)a); }
+
+enum DXGI_FORMAT
+{
+    DXGI_FORMAT_UNKNOWN = 0,
+    DXGI_FORMAT_R32G32B32A32_FLOAT = 2,
+    DXGI_FORMAT_R32G32B32_FLOAT = 6,
+    DXGI_FORMAT_R16G16B16A16_FLOAT = 10,
+    DXGI_FORMAT_R16G16B16A16_SNORM = 13,
+    DXGI_FORMAT_R32G32_FLOAT = 16,
+    DXGI_FORMAT_R16G16_FLOAT = 34,
+    DXGI_FORMAT_R16G16_SNORM = 37,
+    DXGI_FORMAT_R32_UINT = 42,
+    DXGI_FORMAT_R16_UINT = 57,
+};
+
+typedef UINT64 D3D12_GPU_VIRTUAL_ADDRESS;
+
+enum D3D12_RAYTRACING_GEOMETRY_FLAGS
+{
+    D3D12_RAYTRACING_GEOMETRY_FLAG_NONE = 0,
+    D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE = 0x1,
+    D3D12_RAYTRACING_GEOMETRY_FLAG_NO_DUPLICATE_ANYHIT_INVOCATION = 0x2
+};
+DEFINE_ENUM_FLAG_OPERATORS(D3D12_RAYTRACING_GEOMETRY_FLAGS);
+
+enum D3D12_RAYTRACING_GEOMETRY_TYPE
+{
+    D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES = 0,
+    D3D12_RAYTRACING_GEOMETRY_TYPE_PROCEDURAL_PRIMITIVE_AABBS = 1
+};
+
+enum D3D12_RAYTRACING_INSTANCE_FLAGS
+{
+    D3D12_RAYTRACING_INSTANCE_FLAG_NONE = 0,
+    D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_CULL_DISABLE = 0x1,
+    D3D12_RAYTRACING_INSTANCE_FLAG_TRIANGLE_FRONT_COUNTERCLOCKWISE = 0x2,
+    D3D12_RAYTRACING_INSTANCE_FLAG_FORCE_OPAQUE = 0x4,
+    D3D12_RAYTRACING_INSTANCE_FLAG_FORCE_NON_OPAQUE = 0x8
+};
+DEFINE_ENUM_FLAG_OPERATORS(D3D12_RAYTRACING_INSTANCE_FLAGS);
+
+struct D3D12_GPU_VIRTUAL_ADDRESS_AND_STRIDE
+{
+    D3D12_GPU_VIRTUAL_ADDRESS StartAddress;
+    UINT64 StrideInBytes;
+};
+
+struct D3D12_GPU_VIRTUAL_ADDRESS_RANGE
+{
+    D3D12_GPU_VIRTUAL_ADDRESS StartAddress;
+    UINT64 SizeInBytes;
+};
+
+struct D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC
+{
+    D3D12_GPU_VIRTUAL_ADDRESS Transform;
+    DXGI_FORMAT IndexFormat;
+    DXGI_FORMAT VertexFormat;
+    UINT IndexCount;
+    UINT VertexCount;
+    D3D12_GPU_VIRTUAL_ADDRESS IndexBuffer;
+    D3D12_GPU_VIRTUAL_ADDRESS_AND_STRIDE VertexBuffer;
+};
+
+struct D3D12_RAYTRACING_GEOMETRY_AABBS_DESC
+{
+    UINT64 AABBCount;
+    D3D12_GPU_VIRTUAL_ADDRESS_AND_STRIDE AABBs;
+};
+
+struct D3D12_RAYTRACING_GEOMETRY_DESC
+{
+    D3D12_RAYTRACING_GEOMETRY_TYPE Type;
+    D3D12_RAYTRACING_GEOMETRY_FLAGS Flags;
+    union
+    {
+        D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC Triangles;
+        D3D12_RAYTRACING_GEOMETRY_AABBS_DESC AABBs;
+    };
+};
+
+enum D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS
+{
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE = 0,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE = 0x1,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_COMPACTION = 0x2,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE = 0x4,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_BUILD = 0x8,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_MINIMIZE_MEMORY = 0x10,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE = 0x20
+};
+DEFINE_ENUM_FLAG_OPERATORS(D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS);
+
+enum D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE
+{
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL = 0,
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL = 0x1
+};
+
+enum D3D12_ELEMENTS_LAYOUT
+{
+    D3D12_ELEMENTS_LAYOUT_ARRAY = 0,
+    D3D12_ELEMENTS_LAYOUT_ARRAY_OF_POINTERS = 0x1
+};
+
+struct D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC
+{
+    D3D12_GPU_VIRTUAL_ADDRESS_RANGE DestAccelerationStructureData;
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE Type;
+    UINT NumDescs;
+    D3D12_ELEMENTS_LAYOUT DescsLayout;
+    union
+    {
+        D3D12_GPU_VIRTUAL_ADDRESS InstanceDescs;
+        const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometryDescs;
+        const D3D12_RAYTRACING_GEOMETRY_DESC *const *ppGeometryDescs;
+    };
+    D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS Flags;
+    D3D12_GPU_VIRTUAL_ADDRESS SourceAccelerationStructureData;
+    D3D12_GPU_VIRTUAL_ADDRESS_RANGE ScratchAccelerationStructureData;
+};
+
+// From D3D12RaytracingFallback.h
+struct EMULATED_GPU_POINTER
+{
+    UINT32 OffsetInBytes;
+    UINT32 DescriptorHeapIndex;
+};
+
+struct WRAPPED_GPU_POINTER
+{
+    union
+    {
+        EMULATED_GPU_POINTER EmulatedGpuPtr;
+        D3D12_GPU_VIRTUAL_ADDRESS GpuVA;
+    };
+};
+
+struct D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC
+{
+    FLOAT Transform[12];
+    UINT InstanceID : 24;
+    UINT InstanceMask : 8;
+    UINT InstanceContributionToHitGroupIndex : 24;
+    UINT Flags : 8;
+    WRAPPED_GPU_POINTER AccelerationStructure;
+};
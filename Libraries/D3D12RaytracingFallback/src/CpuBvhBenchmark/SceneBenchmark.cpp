@@ -0,0 +1,788 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "stdafx.h"
+#include "SceneBenchmark.h"
+
+using namespace FallbackLayer;
+
+namespace
+{
+    // Raw dumps are split into geometries that stay under the R16 vertex
+    // limit, like the generated soups
+    const UINT MaxTrianglesPerGeometry = 65535 / 3;
+
+    //
+    // The parts of MiniEngine's H3D layout (Model.h) the benchmark reads.
+    // Vector3 is a 16 byte aligned XMVECTOR there, hence the padding.
+    //
+    struct alignas(16) H3DVector3
+    {
+        float v[4];
+    };
+
+    struct H3DBoundingBox
+    {
+        H3DVector3 min;
+        H3DVector3 max;
+    };
+
+    struct H3DHeader
+    {
+        UINT32 meshCount;
+        UINT32 materialCount;
+        UINT32 vertexDataByteSize;
+        UINT32 indexDataByteSize;
+        UINT32 vertexDataByteSizeDepth;
+        H3DBoundingBox boundingBox;
+    };
+
+    struct H3DVertexAttrib
+    {
+        UINT16 offset;
+        UINT16 normalized;
+        UINT16 components;
+        UINT16 format;
+    };
+
+    struct H3DMesh
+    {
+        H3DBoundingBox boundingBox;
+        UINT32 materialIndex;
+        UINT32 attribsEnabled;
+        UINT32 attribsEnabledDepth;
+        UINT32 vertexStride;
+        UINT32 vertexStrideDepth;
+        H3DVertexAttrib attrib[16];
+        H3DVertexAttrib attribDepth[16];
+        UINT32 vertexDataByteOffset;
+        UINT32 vertexCount;
+        UINT32 indexDataByteOffset;
+        UINT32 indexCount;
+        UINT32 vertexDataByteOffsetDepth;
+        UINT32 vertexCountDepth;
+    };
+
+    struct H3DMaterial
+    {
+        H3DVector3 colors[5];
+        float opacity;
+        float shininess;
+        float specularStrength;
+        char texturePaths[6][128];
+        char name[128];
+    };
+
+    static_assert(sizeof(H3DHeader) == 64, "H3DHeader doesn't match Model::Header");
+    static_assert(sizeof(H3DMesh) == 336, "H3DMesh doesn't match Mesh");
+    static_assert(sizeof(H3DMaterial) == 992, "H3DMaterial doesn't match Material");
+
+    const UINT16 H3DAttribFormatFloat = 5;
+
+    struct Scene
+    {
+        // The file as it was read, H3D geometries point into it
+        std::vector<BYTE> m_fileData;
+        // Indices shared by every geometry of a raw dump
+        std::vector<UINT16> m_rawIndices;
+        std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> m_geometryDescs;
+
+        // Every triangle's vertices, 9 floats each, in build order
+        std::vector<float> m_triangles;
+        AABB m_bounds;
+        UINT m_numTriangles = 0;
+    };
+
+    bool ReadFile(const char *pPath, std::vector<BYTE> &data)
+    {
+        std::ifstream file(pPath, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            return false;
+        }
+        data.resize((size_t)file.tellg());
+        file.seekg(0);
+        return file.read((char *)data.data(), data.size()).good() || data.empty();
+    }
+
+    bool HasH3DExtension(const char *pPath)
+    {
+        const size_t length = strlen(pPath);
+        if (length < 4)
+        {
+            return false;
+        }
+        const char *pExtension = pPath + length - 4;
+        return pExtension[0] == '.' &&
+            tolower(pExtension[1]) == 'h' && pExtension[2] == '3' && tolower(pExtension[3]) == 'd';
+    }
+
+    bool LoadH3DScene(Scene &scene)
+    {
+        const std::vector<BYTE> &data = scene.m_fileData;
+        if (data.size() < sizeof(H3DHeader))
+        {
+            return false;
+        }
+
+        const H3DHeader &header = *(const H3DHeader *)data.data();
+        const size_t meshesOffset = sizeof(H3DHeader);
+        const size_t vertexDataOffset = meshesOffset + (size_t)header.meshCount * sizeof(H3DMesh) + (size_t)header.materialCount * sizeof(H3DMaterial);
+        const size_t indexDataOffset = vertexDataOffset + header.vertexDataByteSize;
+        if (indexDataOffset + header.indexDataByteSize > data.size())
+        {
+            return false;
+        }
+
+        const H3DMesh *pMeshes = (const H3DMesh *)(data.data() + meshesOffset);
+        const BYTE *pVertexData = data.data() + vertexDataOffset;
+        const BYTE *pIndexData = data.data() + indexDataOffset;
+        for (UINT meshIndex = 0; meshIndex < header.meshCount; meshIndex++)
+        {
+            const H3DMesh &mesh = pMeshes[meshIndex];
+            const H3DVertexAttrib &position = mesh.attrib[0];
+            if (position.components != 3 || position.format != H3DAttribFormatFloat ||
+                (size_t)mesh.vertexDataByteOffset + (size_t)mesh.vertexCount * mesh.vertexStride > header.vertexDataByteSize ||
+                (size_t)mesh.indexDataByteOffset + (size_t)mesh.indexCount * sizeof(UINT16) > header.indexDataByteSize)
+            {
+                return false;
+            }
+            if (mesh.indexCount < 3)
+            {
+                continue;
+            }
+
+            const BYTE *pPositions = pVertexData + mesh.vertexDataByteOffset + position.offset;
+            const UINT16 *pIndices = (const UINT16 *)(pIndexData + mesh.indexDataByteOffset);
+
+            D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
+            geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            auto &triangles = geometryDesc.Triangles;
+            triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+            triangles.IndexCount = mesh.indexCount - mesh.indexCount % 3;
+            triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)pIndices;
+            triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+            triangles.VertexCount = mesh.vertexCount;
+            triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)pPositions;
+            triangles.VertexBuffer.StrideInBytes = mesh.vertexStride;
+            scene.m_geometryDescs.push_back(geometryDesc);
+
+            for (UINT i = 0; i < triangles.IndexCount; i++)
+            {
+                if (pIndices[i] >= mesh.vertexCount)
+                {
+                    return false;
+                }
+                const float *pPosition = (const float *)(pPositions + (size_t)pIndices[i] * mesh.vertexStride);
+                scene.m_triangles.insert(scene.m_triangles.end(), pPosition, pPosition + 3);
+            }
+        }
+        return true;
+    }
+
+    bool LoadRawScene(Scene &scene)
+    {
+        std::vector<BYTE> &data = scene.m_fileData;
+        if (data.size() % (9 * sizeof(float)))
+        {
+            return false;
+        }
+        scene.m_triangles.resize(data.size() / sizeof(float));
+        memcpy(scene.m_triangles.data(), data.data(), data.size());
+        std::vector<BYTE>().swap(scene.m_fileData);
+
+        const UINT numTriangles = (UINT)(scene.m_triangles.size() / 9);
+        scene.m_rawIndices.resize(std::min(numTriangles, MaxTrianglesPerGeometry) * 3);
+        for (size_t i = 0; i < scene.m_rawIndices.size(); i++)
+        {
+            scene.m_rawIndices[i] = (UINT16)i;
+        }
+
+        for (UINT firstTriangle = 0; firstTriangle < numTriangles; firstTriangle += MaxTrianglesPerGeometry)
+        {
+            const UINT trianglesInGeometry = std::min(MaxTrianglesPerGeometry, numTriangles - firstTriangle);
+
+            D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = {};
+            geometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            auto &triangles = geometryDesc.Triangles;
+            triangles.IndexFormat = DXGI_FORMAT_R16_UINT;
+            triangles.IndexCount = trianglesInGeometry * 3;
+            triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)scene.m_rawIndices.data();
+            triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+            triangles.VertexCount = trianglesInGeometry * 3;
+            triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)(scene.m_triangles.data() + (size_t)firstTriangle * 9);
+            triangles.VertexBuffer.StrideInBytes = sizeof(float) * 3;
+            scene.m_geometryDescs.push_back(geometryDesc);
+        }
+        return true;
+    }
+
+    bool LoadScene(const char *pPath, Scene &scene)
+    {
+        if (!ReadFile(pPath, scene.m_fileData))
+        {
+            return false;
+        }
+
+        const bool bLoaded = HasH3DExtension(pPath) ? LoadH3DScene(scene) : LoadRawScene(scene);
+        scene.m_numTriangles = (UINT)(scene.m_triangles.size() / 9);
+        if (!bLoaded || scene.m_numTriangles == 0)
+        {
+            return false;
+        }
+
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            scene.m_bounds.minArr[axis] = FLT_MAX;
+            scene.m_bounds.maxArr[axis] = -FLT_MAX;
+        }
+        for (size_t i = 0; i < scene.m_triangles.size(); i += 3)
+        {
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                scene.m_bounds.minArr[axis] = std::min(scene.m_bounds.minArr[axis], scene.m_triangles[i + axis]);
+                scene.m_bounds.maxArr[axis] = std::max(scene.m_bounds.maxArr[axis], scene.m_triangles[i + axis]);
+            }
+        }
+        return true;
+    }
+
+    //
+    // A pinhole camera outside the scene's bounding sphere, looking at its
+    // center down the (-1, -1, -1) diagonal with a field of view that just
+    // fits the sphere. Rays are generated in scanline order, so neighbouring
+    // rays take similar paths through the tree like primary rays do on a GPU.
+    //
+    void GeneratePrimaryRays(const Scene &scene, UINT resolution, std::vector<CpuRay> &rays)
+    {
+        float center[3];
+        float radius = 0.0f;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            center[axis] = (scene.m_bounds.minArr[axis] + scene.m_bounds.maxArr[axis]) * 0.5f;
+            const float halfExtent = (scene.m_bounds.maxArr[axis] - scene.m_bounds.minArr[axis]) * 0.5f;
+            radius += halfExtent * halfExtent;
+        }
+        radius = std::max(sqrtf(radius), 1e-3f);
+
+        const float forward[3] = { -0.57735f, -0.57735f, -0.57735f };
+        const float right[3] = { 0.70711f, 0.0f, -0.70711f };
+        const float up[3] = { -0.40825f, 0.81650f, -0.40825f };
+
+        // At twice the radius a 60 degree field of view touches the sphere
+        const float tanHalfFov = 0.57735f;
+        rays.resize((size_t)resolution * resolution);
+        for (UINT y = 0; y < resolution; y++)
+        {
+            for (UINT x = 0; x < resolution; x++)
+            {
+                const float u = ((x + 0.5f) / resolution * 2.0f - 1.0f) * tanHalfFov;
+                const float v = (1.0f - (y + 0.5f) / resolution * 2.0f) * tanHalfFov;
+
+                CpuRay &ray = rays[(size_t)y * resolution + x];
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    ray.origin[axis] = center[axis] - forward[axis] * 2.0f * radius;
+                    ray.direction[axis] = forward[axis] + right[axis] * u + up[axis] * v;
+                }
+                ray.tMin = 0.0f;
+                ray.tMax = FLT_MAX;
+            }
+        }
+    }
+
+    // Rays from random points in the scene's bounds toward random triangles,
+    // so most of them hit but their paths through the tree are incoherent
+    void GenerateRandomRays(const Scene &scene, UINT numRays, std::vector<CpuRay> &rays)
+    {
+        std::mt19937 generator(5678);
+        std::uniform_real_distribution<float> position[3];
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            position[axis] = std::uniform_real_distribution<float>(scene.m_bounds.minArr[axis], scene.m_bounds.maxArr[axis]);
+        }
+        std::uniform_int_distribution<UINT> triangle(0, scene.m_numTriangles - 1);
+
+        rays.resize(numRays);
+        for (CpuRay &ray : rays)
+        {
+            const float *pVertices = &scene.m_triangles[(size_t)triangle(generator) * 9];
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                const float centroid = (pVertices[axis] + pVertices[3 + axis] + pVertices[6 + axis]) / 3.0f;
+                ray.origin[axis] = position[axis](generator);
+                ray.direction[axis] = centroid - ray.origin[axis];
+            }
+            ray.tMin = 0.0f;
+            ray.tMax = FLT_MAX;
+        }
+    }
+
+    struct TraversalResult
+    {
+        double m_raysPerSecond;
+        UINT m_numHits;
+    };
+
+    TraversalResult BenchmarkTraversal(const BYTE *pData, const std::vector<CpuRay> &rays)
+    {
+        TraversalResult result = {};
+        CpuRayHit hit;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const CpuRay &ray : rays)
+        {
+            if (TraceRayBVH2(pData, ray, hit))
+            {
+                result.m_numHits++;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        result.m_raysPerSecond = rays.empty() ? 0.0 : rays.size() / std::chrono::duration<double>(end - start).count();
+        return result;
+    }
+
+    float TriangleArea(const float *pVertices, UINT numVertices)
+    {
+        float normal[3] = {};
+        for (UINT i = 1; i + 1 < numVertices; i++)
+        {
+            float edge1[3];
+            float edge2[3];
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                edge1[axis] = pVertices[i * 3 + axis] - pVertices[axis];
+                edge2[axis] = pVertices[(i + 1) * 3 + axis] - pVertices[axis];
+            }
+            normal[0] += edge1[1] * edge2[2] - edge1[2] * edge2[1];
+            normal[1] += edge1[2] * edge2[0] - edge1[0] * edge2[2];
+            normal[2] += edge1[0] * edge2[1] - edge1[1] * edge2[0];
+        }
+        return 0.5f * sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    }
+
+    // Area of the part of a triangle inside a box. The triangle is clipped
+    // against one slab plane at a time, each of which adds at most a vertex.
+    float ClippedTriangleArea(const Triangle &triangle, const AABB &box)
+    {
+        const float *pTriangle = &triangle.v0.x;
+        bool bInside = true;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            const float triangleMin = std::min(pTriangle[axis], std::min(pTriangle[3 + axis], pTriangle[6 + axis]));
+            const float triangleMax = std::max(pTriangle[axis], std::max(pTriangle[3 + axis], pTriangle[6 + axis]));
+            if (triangleMin > box.maxArr[axis] || triangleMax < box.minArr[axis])
+            {
+                return 0.0f;
+            }
+            bInside &= triangleMin >= box.minArr[axis] && triangleMax <= box.maxArr[axis];
+        }
+        if (bInside)
+        {
+            return TriangleArea(pTriangle, 3);
+        }
+
+        float polygons[2][9 * 3];
+        memcpy(polygons[0], pTriangle, 9 * sizeof(float));
+        UINT numVertices = 3;
+        UINT current = 0;
+        for (UINT plane = 0; plane < 6; plane++)
+        {
+            const UINT axis = plane / 2;
+            const float sign = plane & 1 ? -1.0f : 1.0f;
+            const float offset = plane & 1 ? box.maxArr[axis] : box.minArr[axis];
+            const float *pIn = polygons[current];
+            float *pOut = polygons[1 - current];
+
+            UINT numOutVertices = 0;
+            for (UINT i = 0; i < numVertices; i++)
+            {
+                const float *pA = pIn + i * 3;
+                const float *pB = pIn + ((i + 1) % numVertices) * 3;
+                const float distanceA = sign * (pA[axis] - offset);
+                const float distanceB = sign * (pB[axis] - offset);
+                if (distanceA >= 0.0f)
+                {
+                    memcpy(pOut + numOutVertices++ * 3, pA, 3 * sizeof(float));
+                }
+                if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+                {
+                    const float t = distanceA / (distanceA - distanceB);
+                    for (UINT k = 0; k < 3; k++)
+                    {
+                        pOut[numOutVertices * 3 + k] = pA[k] + (pB[k] - pA[k]) * t;
+                    }
+                    numOutVertices++;
+                }
+            }
+
+            numVertices = numOutVertices;
+            current = 1 - current;
+            if (numVertices < 3)
+            {
+                return 0.0f;
+            }
+        }
+        return TriangleArea(polygons[current], numVertices);
+    }
+
+    bool BoxesOverlap(const AABB &a, const AABB &b)
+    {
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            if (a.minArr[axis] > b.maxArr[axis] || a.maxArr[axis] < b.minArr[axis])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AABB IntersectBoxes(const AABB &a, const AABB &b)
+    {
+        AABB box;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            box.minArr[axis] = std::max(a.minArr[axis], b.minArr[axis]);
+            box.maxArr[axis] = std::min(a.maxArr[axis], b.maxArr[axis]);
+        }
+        return box;
+    }
+
+    //
+    // Effective Primitive Overlap from "On Quality Metrics of Bounding Volume
+    // Hierarchies" (Aila, Karras and Laine 2013): for every node, the area of
+    // the geometry outside its subtree that lies inside its box, weighted by
+    // the node's cost (1 for internal nodes, the primitive count for leaves)
+    // and normalized by the total area of the scene. Unlike the SAH cost it
+    // predicts how many nodes a ray visits that it didn't need to.
+    //
+    // Spatial splits duplicate references, so with bClipToLeafBoxes each
+    // reference only counts the part of its triangle inside its own leaf.
+    //
+    double ComputeEpo(CpuTaskPool &taskPool, const BYTE *pData, bool bClipToLeafBoxes)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+        const AABBNode *pNodes = (const AABBNode *)(pData + offsets.offsetToBoxes);
+        const Primitive *pPrimitives = (const Primitive *)(pData + offsets.offsetToVertices);
+        const UINT numNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode);
+
+        std::vector<AABB> boxes(numNodes);
+        for (UINT i = 0; i < numNodes; i++)
+        {
+            DecompressAABB(boxes[i], pNodes[i]);
+        }
+
+        double totalArea = 0.0;
+        for (UINT i = 0; i < numNodes; i++)
+        {
+            if (pNodes[i].leaf)
+            {
+                const UINT firstPrimitive = pNodes[i].leafNode.firstTriangleId;
+                for (UINT p = firstPrimitive; p < firstPrimitive + pNodes[i].leafNode.numTriangleIds; p++)
+                {
+                    totalArea += bClipToLeafBoxes ?
+                        ClippedTriangleArea(pPrimitives[p].triangle, boxes[i]) :
+                        TriangleArea(&pPrimitives[p].triangle.v0.x, 3);
+                }
+            }
+        }
+
+        std::vector<double> nodeEpo(numNodes);
+        taskPool.ParallelFor(numNodes, 256, [&](UINT begin, UINT end)
+        {
+            std::vector<UINT> stack;
+            for (UINT nodeIndex = begin; nodeIndex < end; nodeIndex++)
+            {
+                const AABB &nodeBox = boxes[nodeIndex];
+                double overlap = 0.0;
+
+                // Walks every node that overlaps this one except those in its
+                // own subtree
+                stack.clear();
+                if (nodeIndex != 0)
+                {
+                    stack.push_back(0);
+                }
+                while (!stack.empty())
+                {
+                    const UINT otherIndex = stack.back();
+                    stack.pop_back();
+
+                    const AABBNode &other = pNodes[otherIndex];
+                    if (other.leaf)
+                    {
+                        const AABB clipBox = bClipToLeafBoxes ? IntersectBoxes(nodeBox, boxes[otherIndex]) : nodeBox;
+                        const UINT firstPrimitive = other.leafNode.firstTriangleId;
+                        for (UINT p = firstPrimitive; p < firstPrimitive + other.leafNode.numTriangleIds; p++)
+                        {
+                            overlap += ClippedTriangleArea(pPrimitives[p].triangle, clipBox);
+                        }
+                        continue;
+                    }
+
+                    const UINT childIndices[2] = { other.internalNode.leftNodeIndex, other.rightNodeIndex };
+                    for (UINT childIndex : childIndices)
+                    {
+                        if (childIndex != nodeIndex && BoxesOverlap(nodeBox, boxes[childIndex]))
+                        {
+                            stack.push_back(childIndex);
+                        }
+                    }
+                }
+
+                const UINT cost = pNodes[nodeIndex].leaf ? pNodes[nodeIndex].leafNode.numTriangleIds : 1;
+                nodeEpo[nodeIndex] = cost * overlap;
+            }
+        });
+
+        // Summed in node order so the result doesn't depend on the thread count
+        double epo = 0.0;
+        for (double value : nodeEpo)
+        {
+            epo += value;
+        }
+        return totalArea > 0.0 ? epo / totalArea : 0.0;
+    }
+
+    void AppendFormat(std::string &output, const char *pFormat, ...)
+    {
+        char buffer[512];
+        va_list args;
+        va_start(args, pFormat);
+        vsnprintf(buffer, sizeof(buffer), pFormat, args);
+        va_end(args);
+        output += buffer;
+    }
+
+    void AppendJsonString(std::string &output, const char *pString)
+    {
+        output += '"';
+        for (const char *pChar = pString; *pChar; pChar++)
+        {
+            if (*pChar == '"' || *pChar == '\\')
+            {
+                output += '\\';
+                output += *pChar;
+            }
+            else if ((unsigned char)*pChar < 0x20)
+            {
+                AppendFormat(output, "\\u%04x", (unsigned char)*pChar);
+            }
+            else
+            {
+                output += *pChar;
+            }
+        }
+        output += '"';
+    }
+
+    struct BuildConfiguration
+    {
+        const char *m_name;
+        CpuBvh2BuildAlgorithm m_algorithm;
+        UINT m_mortonCodeBits;
+        bool m_bSpatialSplits;
+        UINT m_treeletReorderIterations;
+    };
+
+    const BuildConfiguration BuildConfigurations[] =
+    {
+        { "sah", CpuBvh2SahBuild, 30, false, 0 },
+        { "sah spatial splits", CpuBvh2SahBuild, 30, true, 0 },
+        { "lbvh 30-bit", CpuBvh2LbvhBuild, 30, false, 0 },
+        { "lbvh 63-bit", CpuBvh2LbvhBuild, 63, false, 0 },
+        { "lbvh 30-bit treelet reordered", CpuBvh2LbvhBuild, 30, false, 3 },
+    };
+
+    struct SceneBenchmarkOptions
+    {
+        const char *m_pScenePath = nullptr;
+        const char *m_pJsonPath = nullptr;
+        UINT m_threadCount = 0;
+        UINT m_numIterations = 3;
+        UINT m_numRandomRays = 1000000;
+        UINT m_resolution = 1024;
+        bool m_bComputeEpo = true;
+    };
+
+    bool ParseOptions(int argc, char **argv, SceneBenchmarkOptions &options)
+    {
+        if (argc < 1)
+        {
+            return false;
+        }
+        options.m_pScenePath = argv[0];
+        for (int i = 1; i < argc; i++)
+        {
+            const bool bHasValue = i + 1 < argc;
+            if (strcmp(argv[i], "-noepo") == 0)
+            {
+                options.m_bComputeEpo = false;
+            }
+            else if (strcmp(argv[i], "-json") == 0 && bHasValue)
+            {
+                options.m_pJsonPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "-threads") == 0 && bHasValue)
+            {
+                options.m_threadCount = (UINT)atoi(argv[++i]);
+            }
+            else if (strcmp(argv[i], "-iterations") == 0 && bHasValue)
+            {
+                options.m_numIterations = (UINT)std::max(1, atoi(argv[++i]));
+            }
+            else if (strcmp(argv[i], "-rays") == 0 && bHasValue)
+            {
+                options.m_numRandomRays = (UINT)std::max(0, atoi(argv[++i]));
+            }
+            else if (strcmp(argv[i], "-resolution") == 0 && bHasValue)
+            {
+                options.m_resolution = (UINT)std::max(0, atoi(argv[++i]));
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int RunSceneBenchmark(int argc, char **argv)
+{
+    SceneBenchmarkOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: CpuBvhBenchmark -scene <model.h3d | triangles.bin> [-threads N] [-iterations N] [-rays N] [-resolution N] [-json output.json] [-noepo]\n");
+        return 1;
+    }
+
+    Scene scene;
+    if (!LoadScene(options.m_pScenePath, scene))
+    {
+        fprintf(stderr, "Couldn't load a triangle scene from %s\n", options.m_pScenePath);
+        return 1;
+    }
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC buildDesc = {};
+    buildDesc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+    buildDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+    buildDesc.NumDescs = (UINT)scene.m_geometryDescs.size();
+    buildDesc.pGeometryDescs = scene.m_geometryDescs.data();
+
+    std::vector<CpuRay> primaryRays;
+    std::vector<CpuRay> randomRays;
+    GeneratePrimaryRays(scene, options.m_resolution, primaryRays);
+    GenerateRandomRays(scene, options.m_numRandomRays, randomRays);
+
+    CpuTaskPool taskPool(options.m_threadCount ? options.m_threadCount : CpuTaskPool::GetDefaultThreadCount());
+
+    std::string json;
+    json += "{\n  \"scene\": ";
+    AppendJsonString(json, options.m_pScenePath);
+    AppendFormat(json, ",\n  \"triangles\": %u,\n  \"geometries\": %u,\n  \"threads\": %u,\n  \"iterations\": %u,\n",
+        scene.m_numTriangles, (UINT)scene.m_geometryDescs.size(), taskPool.GetThreadCount(), options.m_numIterations);
+    json += "  \"configurations\": [";
+
+    std::vector<BYTE> output;
+    const UINT numConfigurations = ARRAYSIZE(BuildConfigurations);
+    for (UINT configIndex = 0; configIndex < numConfigurations; configIndex++)
+    {
+        const BuildConfiguration &config = BuildConfigurations[configIndex];
+        fprintf(stderr, "Building %s...\n", config.m_name);
+
+        CpuBvh2Builder builder(taskPool.GetThreadCount());
+        CpuBvh2BuildSettings &settings = builder.GetSettings();
+        settings.Algorithm = config.m_algorithm;
+        settings.LbvhMortonCodeBits = config.m_mortonCodeBits;
+        settings.SpatialSplits = config.m_bSpatialSplits;
+        settings.TreeletReorderIterations = config.m_treeletReorderIterations;
+
+        const UINT maxReferences = scene.m_numTriangles + (config.m_bSpatialSplits ? (UINT)(scene.m_numTriangles * settings.SpatialSplitBudget) : 0);
+        output.resize(sizeof(BVHOffsets) +
+            (size_t)maxReferences * 2 * sizeof(AABBNode) +
+            (size_t)maxReferences * (sizeof(Primitive) + sizeof(PrimitiveMetaData)));
+
+        double bestMs = DBL_MAX;
+        for (UINT iteration = 0; iteration < options.m_numIterations; iteration++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            builder.BuildRaytracingAccelerationStructure(&buildDesc, output.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        const CpuBvh2BuildStats &stats = builder.GetLastBuildStats();
+
+        const BVHOffsets &offsets = *(const BVHOffsets *)output.data();
+        const AABBNode *pNodes = (const AABBNode *)(output.data() + offsets.offsetToBoxes);
+        std::vector<UINT> leafSizeHistogram;
+        for (UINT i = 0; i < stats.NumNodes; i++)
+        {
+            if (pNodes[i].leaf)
+            {
+                const UINT leafSize = pNodes[i].leafNode.numTriangleIds;
+                leafSizeHistogram.resize(std::max((UINT)leafSizeHistogram.size(), leafSize));
+                leafSizeHistogram[leafSize - 1]++;
+            }
+        }
+
+        const double epo = options.m_bComputeEpo ? ComputeEpo(taskPool, output.data(), stats.NumDuplicatedReferences != 0) : 0.0;
+        const TraversalResult primary = BenchmarkTraversal(output.data(), primaryRays);
+        const TraversalResult random = BenchmarkTraversal(output.data(), randomRays);
+
+        json += configIndex ? ",\n    {\n" : "\n    {\n";
+        json += "      \"name\": ";
+        AppendJsonString(json, config.m_name);
+        AppendFormat(json, ",\n      \"algorithm\": \"%s\",\n", config.m_algorithm == CpuBvh2SahBuild ? "sah" : "lbvh");
+        AppendFormat(json, "      \"lbvhMortonCodeBits\": %u,\n", config.m_mortonCodeBits);
+        AppendFormat(json, "      \"spatialSplits\": %s,\n", config.m_bSpatialSplits ? "true" : "false");
+        AppendFormat(json, "      \"treeletReorderIterations\": %u,\n", config.m_treeletReorderIterations);
+        AppendFormat(json, "      \"buildMs\": %.3f,\n", bestMs);
+        AppendFormat(json, "      \"nodes\": %u,\n", stats.NumNodes);
+        AppendFormat(json, "      \"references\": %u,\n", stats.NumReferences);
+        AppendFormat(json, "      \"duplicatedReferences\": %u,\n", stats.NumDuplicatedReferences);
+        json += "      \"leafSizeHistogram\": [";
+        for (size_t i = 0; i < leafSizeHistogram.size(); i++)
+        {
+            AppendFormat(json, i ? ", %u" : "%u", leafSizeHistogram[i]);
+        }
+        json += "],\n";
+        AppendFormat(json, "      \"sahCost\": %.4f,\n", stats.SahCost);
+        if (options.m_bComputeEpo)
+        {
+            AppendFormat(json, "      \"epo\": %.4f,\n", epo);
+        }
+        else
+        {
+            json += "      \"epo\": null,\n";
+        }
+        AppendFormat(json, "      \"primaryRays\": { \"rays\": %u, \"hits\": %u, \"raysPerSecond\": %.0f },\n",
+            (UINT)primaryRays.size(), primary.m_numHits, primary.m_raysPerSecond);
+        AppendFormat(json, "      \"randomRays\": { \"rays\": %u, \"hits\": %u, \"raysPerSecond\": %.0f }\n",
+            (UINT)randomRays.size(), random.m_numHits, random.m_raysPerSecond);
+        json += "    }";
+    }
+    json += "\n  ]\n}\n";
+
+    if (options.m_pJsonPath)
+    {
+        std::ofstream file(options.m_pJsonPath, std::ios::binary);
+        if (!file.write(json.data(), json.size()))
+        {
+            fprintf(stderr, "Couldn't write %s\n", options.m_pJsonPath);
+            return 1;
+        }
+    }
+    else
+    {
+        fputs(json.c_str(), stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+//
+// Builds the BVH2 of a scene loaded from disk with every CPU builder
+// configuration and writes build time, tree quality and traversal speed as
+// JSON, so runs on different commits can be diffed by a script.
+//
+// usage: CpuBvhBenchmark -scene <model.h3d | triangles.bin> [-threads N]
+//            [-iterations N] [-rays N] [-resolution N] [-json output.json] [-noepo]
+//
+// .h3d files are MiniEngine models, the BVH is built from each mesh's
+// positions and 16-bit indices. Any other file is read as a raw dump of
+// triangles, 9 little-endian floats each. The JSON goes to stdout unless
+// -json is given; progress goes to stderr. Returns non-zero if the scene
+// can't be loaded.
+//
+int RunSceneBenchmark(int argc, char **argv);
@@ -0,0 +1,23 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+#include "../pch.h"
+#ifdef FALLBACK_CPU_BUILDERS_ONLY
+#include <sys/resource.h>
+#else
+#include <psapi.h>
+#endif
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <stdarg.h>
+#include <stdio.h>
@@ -0,0 +1,465 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    static UINT64 RotateLeft(UINT64 value, UINT bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    static UINT64 FinalizationMix(UINT64 k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    //
+    // MurmurHash3_x64_128 over a stream of appended bytes. Appending the
+    // same bytes in different pieces gives the same hash.
+    //
+    class CacheKeyHasher
+    {
+    public:
+        CacheKeyHasher() : m_h1(0), m_h2(0), m_length(0), m_tailSize(0) {}
+
+        void Append(const void *pData, size_t size)
+        {
+            const BYTE *pBytes = (const BYTE *)pData;
+            m_length += size;
+
+            if (m_tailSize)
+            {
+                const size_t copySize = std::min(size, sizeof(m_tail) - m_tailSize);
+                memcpy(m_tail + m_tailSize, pBytes, copySize);
+                m_tailSize += (UINT)copySize;
+                pBytes += copySize;
+                size -= copySize;
+                if (m_tailSize < sizeof(m_tail))
+                {
+                    return;
+                }
+                MixBlock(m_tail);
+                m_tailSize = 0;
+            }
+
+            for (; size >= sizeof(m_tail); pBytes += sizeof(m_tail), size -= sizeof(m_tail))
+            {
+                MixBlock(pBytes);
+            }
+            memcpy(m_tail, pBytes, size);
+            m_tailSize = (UINT)size;
+        }
+
+        template<typename T>
+        void AppendValue(const T &value)
+        {
+            Append(&value, sizeof(value));
+        }
+
+        CpuBvhCacheKey Finish()
+        {
+            UINT64 k[2] = {};
+            for (UINT i = m_tailSize; i > 0; i--)
+            {
+                k[(i - 1) / 8] ^= (UINT64)m_tail[i - 1] << (((i - 1) % 8) * 8);
+            }
+            if (m_tailSize > 8)
+            {
+                m_h2 ^= RotateLeft(k[1] * C2, 33) * C1;
+            }
+            if (m_tailSize)
+            {
+                m_h1 ^= RotateLeft(k[0] * C1, 31) * C2;
+            }
+
+            m_h1 ^= m_length;
+            m_h2 ^= m_length;
+            m_h1 += m_h2;
+            m_h2 += m_h1;
+            m_h1 = FinalizationMix(m_h1);
+            m_h2 = FinalizationMix(m_h2);
+            m_h1 += m_h2;
+            m_h2 += m_h1;
+
+            CpuBvhCacheKey key;
+            key.Hash[0] = m_h1;
+            key.Hash[1] = m_h2;
+            return key;
+        }
+
+    private:
+        static const UINT64 C1 = 0x87c37b91114253d5ull;
+        static const UINT64 C2 = 0x4cf5ad432745937full;
+
+        void MixBlock(const BYTE *pBlock)
+        {
+            UINT64 k1;
+            UINT64 k2;
+            memcpy(&k1, pBlock, sizeof(k1));
+            memcpy(&k2, pBlock + sizeof(k1), sizeof(k2));
+
+            m_h1 ^= RotateLeft(k1 * C1, 31) * C2;
+            m_h1 = (RotateLeft(m_h1, 27) + m_h2) * 5 + 0x52dce729;
+            m_h2 ^= RotateLeft(k2 * C2, 33) * C1;
+            m_h2 = (RotateLeft(m_h2, 31) + m_h1) * 5 + 0x38495ab5;
+        }
+
+        UINT64 m_h1;
+        UINT64 m_h2;
+        UINT64 m_length;
+        BYTE m_tail[16];
+        UINT m_tailSize;
+    };
+
+    static UINT GetVertexSize(DXGI_FORMAT format)
+    {
+        switch (format)
+        {
+        case DXGI_FORMAT_UNKNOWN:
+        case DXGI_FORMAT_R32G32B32_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+            return 12;
+        case DXGI_FORMAT_R32G32_FLOAT:
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R16G16B16A16_SNORM:
+            return 8;
+        case DXGI_FORMAT_R16G16_FLOAT:
+        case DXGI_FORMAT_R16G16_SNORM:
+            return 4;
+        default:
+            ThrowFailure(E_INVALIDARG, L"Unsupported vertex format in a cached geometry");
+            return 0;
+        }
+    }
+
+    static UINT GetIndexSize(DXGI_FORMAT format)
+    {
+        switch (format)
+        {
+        case DXGI_FORMAT_UNKNOWN:
+            return 0;
+        case DXGI_FORMAT_R16_UINT:
+            return 2;
+        case DXGI_FORMAT_R32_UINT:
+            return 4;
+        default:
+            ThrowFailure(E_INVALIDARG, L"Unsupported index format in a cached geometry");
+            return 0;
+        }
+    }
+
+    CpuBvhCacheKey ComputeCpuBvhCacheKey(
+        _In_ const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        const CpuBvh2BuildSettings &settings)
+    {
+        if (pDesc->Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE)
+        {
+            ThrowFailure(E_INVALIDARG, L"Updates can't be cached");
+        }
+
+        CacheKeyHasher hasher;
+        hasher.AppendValue(CPU_BVH_CACHE_VERSION);
+        hasher.AppendValue((UINT32)pDesc->Type);
+        hasher.AppendValue((UINT32)pDesc->Flags);
+        hasher.AppendValue(pDesc->NumDescs);
+
+        hasher.AppendValue((UINT32)settings.Algorithm);
+        hasher.AppendValue(settings.LbvhMortonCodeBits);
+        hasher.AppendValue(settings.ParallelBuildThreshold);
+        hasher.AppendValue(settings.TreeletReorderIterations);
+        hasher.AppendValue(settings.TreeletSize);
+        hasher.AppendValue((UINT32)settings.SpatialSplits);
+        hasher.AppendValue(settings.SpatialSplitBudget);
+        hasher.AppendValue(settings.SpatialSplitOverlapThreshold);
+
+        for (UINT i = 0; i < pDesc->NumDescs; i++)
+        {
+            const D3D12_RAYTRACING_GEOMETRY_DESC &geometry = GetGeometryDesc(*pDesc, i);
+            hasher.AppendValue((UINT32)geometry.Type);
+            hasher.AppendValue((UINT32)geometry.Flags);
+            if (geometry.Type != D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
+            {
+                ThrowFailure(E_INVALIDARG, L"Only triangle geometry can be cached");
+            }
+
+            const auto &triangles = geometry.Triangles;
+            hasher.AppendValue((UINT32)triangles.IndexFormat);
+            hasher.AppendValue((UINT32)triangles.VertexFormat);
+            hasher.AppendValue(triangles.IndexCount);
+            hasher.AppendValue(triangles.VertexCount);
+
+            const UINT indexSize = GetIndexSize(triangles.IndexFormat);
+            if (indexSize && triangles.IndexCount)
+            {
+                hasher.Append((const void *)triangles.IndexBuffer, (size_t)triangles.IndexCount * indexSize);
+            }
+
+            // Only the position bytes of each vertex, other attributes
+            // interleaved with them don't change the BVH
+            const UINT vertexSize = GetVertexSize(triangles.VertexFormat);
+            const BYTE *pVertices = (const BYTE *)triangles.VertexBuffer.StartAddress;
+            const UINT64 stride = triangles.VertexBuffer.StrideInBytes;
+            if (stride == vertexSize)
+            {
+                hasher.Append(pVertices, (size_t)triangles.VertexCount * vertexSize);
+            }
+            else
+            {
+                for (UINT v = 0; v < triangles.VertexCount; v++)
+                {
+                    hasher.Append(pVertices + v * stride, vertexSize);
+                }
+            }
+        }
+        return hasher.Finish();
+    }
+
+    CpuBvhCache::CpuBvhCache() :
+        m_file(INVALID_HANDLE_VALUE),
+        m_mapping(nullptr),
+        m_pView(nullptr),
+        m_viewSize(0),
+        m_pEntries(nullptr),
+        m_numMappedEntries(0)
+    {
+    }
+
+    CpuBvhCache::~CpuBvhCache()
+    {
+        Close();
+    }
+
+    bool CpuBvhCache::Open(LPCWSTR pPath)
+    {
+        Close();
+        m_addedEntries.clear();
+
+        m_file = CreateFileW(pPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER fileSize = {};
+        if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(CpuBvhCacheHeader))
+        {
+            Close();
+            return false;
+        }
+
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        m_pView = m_mapping ? (const BYTE *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!m_pView)
+        {
+            Close();
+            return false;
+        }
+        m_viewSize = (UINT64)fileSize.QuadPart;
+
+        // Only the header and entry table are checked here, a BVH's own
+        // header is checked when it's looked up so opening stays O(entries)
+        const CpuBvhCacheHeader &header = *(const CpuBvhCacheHeader *)m_pView;
+        const UINT64 tableEnd = sizeof(CpuBvhCacheHeader) + (UINT64)header.NumEntries * sizeof(CpuBvhCacheEntry);
+        if (header.Magic != CPU_BVH_CACHE_MAGIC || header.Version != CPU_BVH_CACHE_VERSION || tableEnd > m_viewSize)
+        {
+            Close();
+            return false;
+        }
+
+        const CpuBvhCacheEntry *pEntries = (const CpuBvhCacheEntry *)(m_pView + sizeof(CpuBvhCacheHeader));
+        for (UINT i = 0; i < header.NumEntries; i++)
+        {
+            const CpuBvhCacheEntry &entry = pEntries[i];
+            if (entry.Offset < tableEnd || entry.Size < sizeof(BVHOffsets) || entry.Size > m_viewSize - entry.Offset ||
+                entry.Offset % CPU_BVH_CACHE_ALIGNMENT ||
+                (i > 0 && !(pEntries[i - 1].Key < entry.Key)))
+            {
+                Close();
+                return false;
+            }
+        }
+
+        m_pEntries = pEntries;
+        m_numMappedEntries = header.NumEntries;
+        return true;
+    }
+
+    void CpuBvhCache::Close()
+    {
+        if (m_pView)
+        {
+            UnmapViewOfFile(m_pView);
+        }
+        if (m_mapping)
+        {
+            CloseHandle(m_mapping);
+        }
+        if (m_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_file);
+        }
+
+        m_file = INVALID_HANDLE_VALUE;
+        m_mapping = nullptr;
+        m_pView = nullptr;
+        m_viewSize = 0;
+        m_pEntries = nullptr;
+        m_numMappedEntries = 0;
+    }
+
+    const BYTE *CpuBvhCache::Find(const CpuBvhCacheKey &key) const
+    {
+        auto addedEntry = m_addedEntries.find(key);
+        if (addedEntry != m_addedEntries.end())
+        {
+            return addedEntry->second.data();
+        }
+
+        const CpuBvhCacheEntry *pEnd = m_pEntries + m_numMappedEntries;
+        const CpuBvhCacheEntry *pEntry = std::lower_bound(m_pEntries, pEnd, key,
+            [](const CpuBvhCacheEntry &entry, const CpuBvhCacheKey &key) { return entry.Key < key; });
+        if (pEntry == pEnd || !(pEntry->Key == key))
+        {
+            return nullptr;
+        }
+
+        const BYTE *pBvhData = m_pView + pEntry->Offset;
+        if (((const BVHOffsets *)pBvhData)->totalSize != pEntry->Size)
+        {
+            return nullptr;
+        }
+        return pBvhData;
+    }
+
+    void CpuBvhCache::Add(const CpuBvhCacheKey &key, _In_ const BYTE *pBvhData)
+    {
+        const UINT totalSize = ((const BVHOffsets *)pBvhData)->totalSize;
+        m_addedEntries[key].assign(pBvhData, pBvhData + totalSize);
+    }
+
+    const BYTE *CpuBvhCache::FindOrBuild(
+        CpuBvh2Builder &builder,
+        _In_ const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Inout_ void *pData)
+    {
+        if (pDesc->Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE)
+        {
+            builder.BuildRaytracingAccelerationStructure(pDesc, pData);
+            return (const BYTE *)pData;
+        }
+
+        const CpuBvhCacheKey key = ComputeCpuBvhCacheKey(pDesc, builder.GetSettings());
+        const BYTE *pCachedData = Find(key);
+        if (pCachedData)
+        {
+            return pCachedData;
+        }
+
+        builder.BuildRaytracingAccelerationStructure(pDesc, pData);
+        Add(key, (const BYTE *)pData);
+        return (const BYTE *)pData;
+    }
+
+    static void WriteToFile(HANDLE file, const void *pData, UINT64 size)
+    {
+        const BYTE *pBytes = (const BYTE *)pData;
+        while (size)
+        {
+            const DWORD chunkSize = (DWORD)std::min<UINT64>(size, 1u << 30);
+            DWORD bytesWritten = 0;
+            if (!WriteFile(file, pBytes, chunkSize, &bytesWritten, nullptr) || bytesWritten != chunkSize)
+            {
+                ThrowFailure(HRESULT_FROM_WIN32(GetLastError()), L"Failed to write the BVH cache");
+            }
+            pBytes += chunkSize;
+            size -= chunkSize;
+        }
+    }
+
+    void CpuBvhCache::Save(LPCWSTR pPath)
+    {
+        // Added BVHs replace mapped ones with the same key
+        std::vector<std::pair<CpuBvhCacheKey, std::pair<const BYTE *, UINT64>>> blobs;
+        blobs.reserve(GetNumEntries());
+        for (auto &addedEntry : m_addedEntries)
+        {
+            blobs.push_back({ addedEntry.first, { addedEntry.second.data(), addedEntry.second.size() } });
+        }
+        for (UINT i = 0; i < m_numMappedEntries; i++)
+        {
+            if (m_addedEntries.find(m_pEntries[i].Key) == m_addedEntries.end())
+            {
+                blobs.push_back({ m_pEntries[i].Key, { m_pView + m_pEntries[i].Offset, m_pEntries[i].Size } });
+            }
+        }
+        std::sort(blobs.begin(), blobs.end(),
+            [](const std::pair<CpuBvhCacheKey, std::pair<const BYTE *, UINT64>> &a, const std::pair<CpuBvhCacheKey, std::pair<const BYTE *, UINT64>> &b)
+        {
+            return a.first < b.first;
+        });
+
+        CpuBvhCacheHeader header = {};
+        header.Magic = CPU_BVH_CACHE_MAGIC;
+        header.Version = CPU_BVH_CACHE_VERSION;
+        header.NumEntries = (UINT32)blobs.size();
+
+        std::vector<CpuBvhCacheEntry> entries(blobs.size());
+        UINT64 offset = sizeof(CpuBvhCacheHeader) + entries.size() * sizeof(CpuBvhCacheEntry);
+        for (size_t i = 0; i < blobs.size(); i++)
+        {
+            offset = (offset + CPU_BVH_CACHE_ALIGNMENT - 1) & ~(UINT64)(CPU_BVH_CACHE_ALIGNMENT - 1);
+            entries[i].Key = blobs[i].first;
+            entries[i].Offset = offset;
+            entries[i].Size = blobs[i].second.second;
+            offset += entries[i].Size;
+        }
+
+        const std::wstring temporaryPath = std::wstring(pPath) + L".tmp";
+        HANDLE file = CreateFileW(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            ThrowFailure(HRESULT_FROM_WIN32(GetLastError()), L"Failed to create the BVH cache");
+        }
+
+        try
+        {
+            const BYTE padding[CPU_BVH_CACHE_ALIGNMENT] = {};
+            WriteToFile(file, &header, sizeof(header));
+            WriteToFile(file, entries.data(), entries.size() * sizeof(CpuBvhCacheEntry));
+            UINT64 fileSize = sizeof(CpuBvhCacheHeader) + entries.size() * sizeof(CpuBvhCacheEntry);
+            for (size_t i = 0; i < blobs.size(); i++)
+            {
+                WriteToFile(file, padding, entries[i].Offset - fileSize);
+                WriteToFile(file, blobs[i].second.first, entries[i].Size);
+                fileSize = entries[i].Offset + entries[i].Size;
+            }
+        }
+        catch (...)
+        {
+            CloseHandle(file);
+            DeleteFileW(temporaryPath.c_str());
+            throw;
+        }
+        CloseHandle(file);
+
+        // The mapping has to go before the file it maps can be replaced
+        Close();
+        if (!MoveFileExW(temporaryPath.c_str(), pPath, MOVEFILE_REPLACE_EXISTING))
+        {
+            ThrowFailure(HRESULT_FROM_WIN32(GetLastError()), L"Failed to replace the BVH cache");
+        }
+        if (!Open(pPath))
+        {
+            ThrowFailure(E_FAIL, L"Failed to map the BVH cache that was just written");
+        }
+    }
+}
@@ -0,0 +1,118 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    // Bump whenever CpuBvh2Builder's output changes for the same input, so
+    // cache files written by older builds are ignored instead of loaded
+    static const UINT32 CPU_BVH_CACHE_VERSION = 1;
+    static const UINT32 CPU_BVH_CACHE_MAGIC = 0x43485642; // "BVHC"
+
+    // Cached BVHs start on a cache line in the file, and so in the mapping
+    static const UINT32 CPU_BVH_CACHE_ALIGNMENT = 64;
+
+    // 128-bit MurmurHash3 of everything a build's output depends on
+    struct CpuBvhCacheKey
+    {
+        UINT64 Hash[2];
+
+        bool operator==(const CpuBvhCacheKey &other) const { return Hash[0] == other.Hash[0] && Hash[1] == other.Hash[1]; }
+        bool operator<(const CpuBvhCacheKey &other) const { return Hash[0] != other.Hash[0] ? Hash[0] < other.Hash[0] : Hash[1] < other.Hash[1]; }
+    };
+
+    //
+    // Cache file layout: a CpuBvhCacheHeader, NumEntries CpuBvhCacheEntries
+    // sorted by key, then every entry's BVH blob exactly as the builder
+    // wrote it (BVHOffsets, nodes, primitives, metadata and, for ALLOW_UPDATE
+    // builds, the CpuBvh2UpdateInfo).
+    //
+    struct CpuBvhCacheHeader
+    {
+        UINT32 Magic;
+        UINT32 Version;
+        UINT32 NumEntries;
+        UINT32 Reserved;
+    };
+
+    struct CpuBvhCacheEntry
+    {
+        CpuBvhCacheKey Key;
+        // From the start of the file
+        UINT64 Offset;
+        UINT64 Size;
+    };
+
+    //
+    // Hashes the positions and indices a build reads, rather than whole
+    // vertex buffers, along with the geometry descs, the build flags and
+    // every setting that affects the output. Updates can't be cached.
+    //
+    CpuBvhCacheKey ComputeCpuBvhCacheKey(
+        _In_ const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        const CpuBvh2BuildSettings &settings);
+
+    //
+    // Persistent cache of bottom-level BVH2s built by CpuBvh2Builder. A cache
+    // file is memory-mapped read-only and its BVHs are handed out in place,
+    // so loading a scene whose geometry hasn't changed costs the map and a
+    // hash of the geometry rather than a build. BVHs built on a miss are
+    // kept in memory until Save writes them out with the mapped ones.
+    //
+    class CpuBvhCache
+    {
+    public:
+        CpuBvhCache();
+        ~CpuBvhCache();
+
+        // Maps a file written by Save, dropping BVHs added since the last
+        // Save. A missing or unreadable file, or one from another version,
+        // leaves the cache empty and returns false.
+        bool Open(LPCWSTR pPath);
+        void Close();
+
+        // The cached BVH for key, or null. Valid until Close or Save.
+        const BYTE *Find(const CpuBvhCacheKey &key) const;
+
+        // Copies a BVH written by CpuBvh2Builder, totalSize bytes long
+        void Add(const CpuBvhCacheKey &key, _In_ const BYTE *pBvhData);
+
+        //
+        // Returns the cached BVH for pDesc if there is one. Otherwise builds
+        // it into pData, which must be big enough for the build, adds it to
+        // the cache and returns pData. PERFORM_UPDATE builds always refit.
+        //
+        const BYTE *FindOrBuild(
+            CpuBvh2Builder &builder,
+            _In_ const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+            _Inout_ void *pData);
+
+        //
+        // Writes the mapped and added BVHs to pPath, through a temporary
+        // file so a crash can't leave a truncated cache behind, then maps
+        // the new file in place of the old one.
+        //
+        void Save(LPCWSTR pPath);
+
+        UINT GetNumEntries() const { return m_numMappedEntries + (UINT)m_addedEntries.size(); }
+        bool IsMapped() const { return m_pView != nullptr; }
+
+    private:
+        HANDLE m_file;
+        HANDLE m_mapping;
+        const BYTE *m_pView;
+        UINT64 m_viewSize;
+        const CpuBvhCacheEntry *m_pEntries;
+        UINT m_numMappedEntries;
+
+        std::map<CpuBvhCacheKey, std::vector<BYTE>> m_addedEntries;
+    };
+}
@@ -0,0 +1,209 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    static const UINT CPU_TRAVERSAL_STACK_SIZE = 256;
+
+    struct TraversalStackEntry
+    {
+        UINT nodeIndex;
+        float tEntry;
+    };
+
+    static UINT GetRightNodeIndex(const AABBNode &node, UINT nodeIndex)
+    {
+        UNREFERENCED_PARAMETER(nodeIndex);
+        return node.rightNodeIndex;
+    }
+
+    static UINT GetRightNodeIndex(const CompressedAABBNode &node, UINT nodeIndex)
+    {
+        UNREFERENCED_PARAMETER(node);
+        return nodeIndex + 1;
+    }
+
+    // Slab test. A NaN from a ray starting on a slab with a zero direction
+    // component is ignored by the min/max, which keeps that axis unbounded.
+    static bool RayIntersectsBox(
+        const AABB &box,
+        const CpuRay &ray,
+        const float invDirection[3],
+        float tMin,
+        float tMax,
+        _Out_ float &tEntry)
+    {
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            float t0 = (box.minArr[axis] - ray.origin[axis]) * invDirection[axis];
+            float t1 = (box.maxArr[axis] - ray.origin[axis]) * invDirection[axis];
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+        }
+        tEntry = tMin;
+        return tMin <= tMax;
+    }
+
+    static float3 Subtract(const float3 &a, const float3 &b)
+    {
+        return { a.x - b.x, a.y - b.y, a.z - b.z };
+    }
+
+    static float3 Cross(const float3 &a, const float3 &b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    static float Dot(const float3 &a, const float3 &b)
+    {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    bool IntersectTriangle(const Triangle &triangle, const CpuRay &ray, float tMax, _Out_ CpuRayHit &hit)
+    {
+        const float3 origin = { ray.origin[0], ray.origin[1], ray.origin[2] };
+        const float3 direction = { ray.direction[0], ray.direction[1], ray.direction[2] };
+        const float3 edge1 = Subtract(triangle.v1, triangle.v0);
+        const float3 edge2 = Subtract(triangle.v2, triangle.v0);
+
+        const float3 p = Cross(direction, edge2);
+        const float determinant = Dot(edge1, p);
+        if (determinant == 0.0f)
+        {
+            return false;
+        }
+        const float invDeterminant = 1.0f / determinant;
+
+        const float3 s = Subtract(origin, triangle.v0);
+        const float u = Dot(s, p) * invDeterminant;
+        if (u < 0.0f || u > 1.0f)
+        {
+            return false;
+        }
+
+        const float3 q = Cross(s, edge1);
+        const float v = Dot(direction, q) * invDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+        {
+            return false;
+        }
+
+        const float t = Dot(edge2, q) * invDeterminant;
+        if (t < ray.tMin || t >= tMax)
+        {
+            return false;
+        }
+
+        hit.t = t;
+        hit.barycentrics[0] = u;
+        hit.barycentrics[1] = v;
+        return true;
+    }
+
+    template<typename NodeType>
+    static bool TraceRay(const BYTE *pData, const CpuRay &ray, _Out_ CpuRayHit &hit)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+        const NodeType *pNodes = (const NodeType *)(pData + offsets.offsetToBoxes);
+        const Primitive *pPrimitives = (const Primitive *)(pData + offsets.offsetToVertices);
+
+        float invDirection[3];
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            invDirection[axis] = 1.0f / ray.direction[axis];
+        }
+
+        hit.t = ray.tMax;
+        bool bHit = false;
+
+        TraversalStackEntry stack[CPU_TRAVERSAL_STACK_SIZE];
+        UINT stackSize = 0;
+
+        AABB box;
+        DecompressAABB(box, pNodes[0]);
+        if (RayIntersectsBox(box, ray, invDirection, ray.tMin, hit.t, stack[0].tEntry))
+        {
+            stack[stackSize++].nodeIndex = 0;
+        }
+
+        while (stackSize)
+        {
+            const TraversalStackEntry entry = stack[--stackSize];
+
+            // The closest hit may have moved in front of this node since it
+            // was pushed
+            if (entry.tEntry > hit.t)
+            {
+                continue;
+            }
+
+            const NodeType &node = pNodes[entry.nodeIndex];
+            if (node.leaf)
+            {
+                const UINT firstPrimitive = node.leafNode.firstTriangleId;
+                for (UINT i = firstPrimitive; i < firstPrimitive + node.leafNode.numTriangleIds; i++)
+                {
+                    if (pPrimitives[i].PrimitiveType == TRIANGLE_TYPE &&
+                        IntersectTriangle(pPrimitives[i].triangle, ray, hit.t, hit))
+                    {
+                        hit.primitiveId = i;
+                        bHit = true;
+                    }
+                }
+                continue;
+            }
+
+            const UINT childIndices[2] = { node.internalNode.leftNodeIndex, GetRightNodeIndex(node, entry.nodeIndex) };
+            float tChildEntry[2];
+            bool bChildHit[2];
+            for (UINT child = 0; child < 2; child++)
+            {
+                DecompressAABB(box, pNodes[childIndices[child]]);
+                bChildHit[child] = RayIntersectsBox(box, ray, invDirection, ray.tMin, hit.t, tChildEntry[child]);
+            }
+
+            if (stackSize + 2 > CPU_TRAVERSAL_STACK_SIZE)
+            {
+                ThrowFailure(E_FAIL, L"BVH is too deep for the CPU traversal stack");
+            }
+
+            // Push the far child first so the near one is visited next
+            const UINT nearChild = (bChildHit[0] && bChildHit[1] && tChildEntry[1] < tChildEntry[0]) ? 1 : 0;
+            for (UINT i = 0; i < 2; i++)
+            {
+                const UINT child = i == 0 ? 1 - nearChild : nearChild;
+                if (bChildHit[child])
+                {
+                    stack[stackSize].nodeIndex = childIndices[child];
+                    stack[stackSize].tEntry = tChildEntry[child];
+                    stackSize++;
+                }
+            }
+        }
+
+        return bHit;
+    }
+
+    bool TraceRayBVH2(const BYTE *pBvhData, const CpuRay &ray, _Out_ CpuRayHit &hit)
+    {
+        return TraceRay<AABBNode>(pBvhData, ray, hit);
+    }
+
+    bool TraceRayCompressedBVH2(const BYTE *pCompressedData, const CpuRay &ray, _Out_ CpuRayHit &hit)
+    {
+        return TraceRay<CompressedAABBNode>(pCompressedData, ray, hit);
+    }
+}
@@ -0,0 +1,42 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    struct CpuRay
+    {
+        float origin[3];
+        float direction[3];
+        float tMin;
+        float tMax;
+    };
+
+    struct CpuRayHit
+    {
+        float t;
+        float barycentrics[2];
+
+        // Index into the BVH's primitive and primitive metadata arrays
+        UINT primitiveId;
+    };
+
+    //
+    // Closest-hit traversal of bottom-level BVH2s on the CPU, mainly for
+    // validating and benchmarking the CPU builders. Only triangles are
+    // intersected and no primitive is culled. Returns false on a miss.
+    //
+    bool TraceRayBVH2(const BYTE *pBvhData, const CpuRay &ray, _Out_ CpuRayHit &hit);
+    bool TraceRayCompressedBVH2(const BYTE *pCompressedData, const CpuRay &ray, _Out_ CpuRayHit &hit);
+
+    // Moller-Trumbore, returns hits in [ray.tMin, tMax)
+    bool IntersectTriangle(const Triangle &triangle, const CpuRay &ray, float tMax, _Out_ CpuRayHit &hit);
+}
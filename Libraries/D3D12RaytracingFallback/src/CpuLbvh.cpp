@@ -0,0 +1,345 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    // Scene extents are clamped to this so flat scenes don't divide by 0
+    static const float MORTON_CODE_EPSILON = 0.00001f;
+
+    static const UINT RADIX_SORT_BITS = 8;
+    static const UINT RADIX_SORT_BUCKETS = 1 << RADIX_SORT_BITS;
+
+    // Every block of codes is counted and scattered by one task. The number
+    // of blocks is capped so their bucket offsets fit on the stack.
+    static const UINT RADIX_SORT_MAX_BLOCKS = 32;
+    static const UINT RADIX_SORT_MIN_BLOCK_SIZE = 16 * 1024;
+
+    static const UINT HIERARCHY_MIN_CHUNK_SIZE = 4 * 1024;
+
+    template<UINT BitsPerAxis>
+    static void QuantizeCentroid(const float3 &centroid, const AABB &sceneAABB, UINT32 coords[3])
+    {
+        const float maxCoord = (float)(1u << BitsPerAxis);
+        const float centroidArr[3] = { centroid.x, centroid.y, centroid.z };
+
+        // fmaxf and fminf return the other argument for a NaN, like HLSL's
+        // max and min, so a NaN centroid ends up in cell 0
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            const float sceneDimension = fmaxf(sceneAABB.maxArr[axis] - sceneAABB.minArr[axis], MORTON_CODE_EPSILON);
+            const float unitCoord = (centroidArr[axis] - sceneAABB.minArr[axis]) / sceneDimension;
+            coords[axis] = (UINT32)fminf(fmaxf(unitCoord * maxCoord, 0.0f), maxCoord - 1.0f);
+        }
+    }
+
+    // Moves bit i of a 10-bit value to bit 3 * i
+    static UINT32 SpreadBits10(UINT32 v)
+    {
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    // Moves bit i of a 21-bit value to bit 3 * i
+    static UINT64 SpreadBits21(UINT64 v)
+    {
+        v = (v | (v << 32)) & 0x001F00000000FFFFull;
+        v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+        v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+        v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+        v = (v | (v << 2)) & 0x1249249249249249ull;
+        return v;
+    }
+
+    UINT32 CalculateMortonCode30(const float3 &centroid, const AABB &sceneAABB)
+    {
+        UINT32 coords[3];
+        QuantizeCentroid<10>(centroid, sceneAABB, coords);
+        return SpreadBits10(coords[1]) | SpreadBits10(coords[0]) << 1 | SpreadBits10(coords[2]) << 2;
+    }
+
+    UINT64 CalculateMortonCode63(const float3 &centroid, const AABB &sceneAABB)
+    {
+        UINT32 coords[3];
+        QuantizeCentroid<21>(centroid, sceneAABB, coords);
+        return SpreadBits21(coords[1]) | SpreadBits21(coords[0]) << 1 | SpreadBits21(coords[2]) << 2;
+    }
+
+    template<typename MortonCode>
+    static void RadixSort(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        MortonCode *pMortonCodes,
+        UINT32 *pIndices,
+        MortonCode *pScratchMortonCodes,
+        UINT32 *pScratchIndices)
+    {
+        if (count < 2)
+        {
+            return;
+        }
+
+        // The sort is stable, so how the codes are split into blocks doesn't
+        // change the result
+        const UINT32 numBlocks = std::max(1u, std::min(std::min(RADIX_SORT_MAX_BLOCKS, taskPool.GetThreadCount() * 4), count / RADIX_SORT_MIN_BLOCK_SIZE));
+        const UINT32 blockSize = DivideAndRoundUp(count, numBlocks);
+
+        // Each block's count of every digit, turned into where the block
+        // writes its first code with that digit
+        UINT32 blockOffsets[RADIX_SORT_MAX_BLOCKS][RADIX_SORT_BUCKETS];
+
+        MortonCode *pSourceCodes = pMortonCodes;
+        UINT32 *pSourceIndices = pIndices;
+        MortonCode *pDestCodes = pScratchMortonCodes;
+        UINT32 *pDestIndices = pScratchIndices;
+
+        for (UINT shift = 0; shift < sizeof(MortonCode) * 8; shift += RADIX_SORT_BITS)
+        {
+            taskPool.ParallelFor(numBlocks, 1, [&](UINT beginBlock, UINT endBlock)
+            {
+                for (UINT block = beginBlock; block < endBlock; block++)
+                {
+                    UINT32 *pCounts = blockOffsets[block];
+                    memset(pCounts, 0, sizeof(blockOffsets[block]));
+
+                    const UINT32 end = std::min(count, (block + 1) * blockSize);
+                    for (UINT32 i = block * blockSize; i < end; i++)
+                    {
+                        pCounts[(pSourceCodes[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+                    }
+                }
+            });
+
+            // Codes go out by digit, and codes with the same digit in block order
+            bool bSingleDigit = false;
+            UINT32 offset = 0;
+            for (UINT digit = 0; digit < RADIX_SORT_BUCKETS; digit++)
+            {
+                const UINT32 digitBegin = offset;
+                for (UINT block = 0; block < numBlocks; block++)
+                {
+                    const UINT32 blockCount = blockOffsets[block][digit];
+                    blockOffsets[block][digit] = offset;
+                    offset += blockCount;
+                }
+                bSingleDigit |= offset - digitBegin == count;
+            }
+
+            // Nothing would move, e.g. the top bits of codes from a flat scene
+            if (bSingleDigit)
+            {
+                continue;
+            }
+
+            taskPool.ParallelFor(numBlocks, 1, [&](UINT beginBlock, UINT endBlock)
+            {
+                for (UINT block = beginBlock; block < endBlock; block++)
+                {
+                    UINT32 *pOffsets = blockOffsets[block];
+                    const UINT32 end = std::min(count, (block + 1) * blockSize);
+                    for (UINT32 i = block * blockSize; i < end; i++)
+                    {
+                        const UINT32 destIndex = pOffsets[(pSourceCodes[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+                        pDestCodes[destIndex] = pSourceCodes[i];
+                        pDestIndices[destIndex] = pSourceIndices[i];
+                    }
+                }
+            });
+
+            std::swap(pSourceCodes, pDestCodes);
+            std::swap(pSourceIndices, pDestIndices);
+        }
+
+        if (pSourceCodes != pMortonCodes)
+        {
+            memcpy(pMortonCodes, pSourceCodes, count * sizeof(MortonCode));
+            memcpy(pIndices, pSourceIndices, count * sizeof(UINT32));
+        }
+    }
+
+    void SortMortonCodes(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        _Inout_ UINT32 *pMortonCodes,
+        _Inout_ UINT32 *pIndices,
+        UINT32 *pScratchMortonCodes,
+        UINT32 *pScratchIndices)
+    {
+        RadixSort(taskPool, count, pMortonCodes, pIndices, pScratchMortonCodes, pScratchIndices);
+    }
+
+    void SortMortonCodes(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        _Inout_ UINT64 *pMortonCodes,
+        _Inout_ UINT32 *pIndices,
+        UINT64 *pScratchMortonCodes,
+        UINT32 *pScratchIndices)
+    {
+        RadixSort(taskPool, count, pMortonCodes, pIndices, pScratchMortonCodes, pScratchIndices);
+    }
+
+    // v is never 0, only codes or indices that differ are compared
+    static int CountLeadingZeroes(UINT32 v)
+    {
+        unsigned long index;
+        _BitScanReverse(&index, v);
+        return 31 - (int)index;
+    }
+
+    static int CountLeadingZeroes(UINT64 v)
+    {
+        unsigned long index;
+        _BitScanReverse64(&index, v);
+        return 63 - (int)index;
+    }
+
+    //
+    // What follows mirrors BuildBVHSplits.hlsli line by line, including its
+    // unsigned wrap-around for indices before the first code.
+    //
+    template<typename MortonCode>
+    struct LbvhHierarchyBuilder
+    {
+        const MortonCode *m_pMortonCodes;
+        UINT32 m_count;
+        HierarchyNode *m_pHierarchy;
+
+        int GetLongestCommonPrefix(UINT32 indexA, UINT32 indexB) const
+        {
+            if (indexA >= m_count || indexB >= m_count)
+            {
+                return -1;
+            }
+
+            const MortonCode mortonCodeA = m_pMortonCodes[indexA];
+            const MortonCode mortonCodeB = m_pMortonCodes[indexB];
+            if (mortonCodeA != mortonCodeB)
+            {
+                return CountLeadingZeroes(mortonCodeA ^ mortonCodeB);
+            }
+
+            // Equal codes are told apart by their sorted index, which the
+            // shader offsets by 31 for its 32-bit codes
+            return CountLeadingZeroes(indexA ^ indexB) + (int)(sizeof(MortonCode) * 8 - 1);
+        }
+
+        void DetermineRange(UINT32 idx, UINT32 &first, UINT32 &last) const
+        {
+            int d = GetLongestCommonPrefix(idx, idx + 1) - GetLongestCommonPrefix(idx, idx - 1);
+            d = std::max(-1, std::min(d, 1));
+            const int minPrefix = GetLongestCommonPrefix(idx, idx - d);
+
+            int maxLength = 2;
+            while (GetLongestCommonPrefix(idx, idx + maxLength * d) > minPrefix)
+            {
+                maxLength *= 4;
+            }
+
+            int length = 0;
+            for (int t = maxLength / 2; t > 0; t /= 2)
+            {
+                if (GetLongestCommonPrefix(idx, idx + (length + t) * d) > minPrefix)
+                {
+                    length = length + t;
+                }
+            }
+
+            const UINT32 j = idx + length * d;
+            first = std::min(idx, j);
+            last = std::max(idx, j);
+        }
+
+        UINT32 FindSplit(UINT32 first, UINT32 last) const
+        {
+            const int commonPrefix = GetLongestCommonPrefix(first, last);
+            UINT32 split = first;
+            UINT32 step = last - first;
+
+            do
+            {
+                step = (step + 1) >> 1;
+                const UINT32 newSplit = split + step;
+
+                if (newSplit < last)
+                {
+                    const int splitPrefix = GetLongestCommonPrefix(first, newSplit);
+                    if (splitPrefix > commonPrefix)
+                    {
+                        split = newSplit;
+                    }
+                }
+            } while (step > 1);
+
+            return split;
+        }
+
+        void GenerateHierarchy(UINT32 idx) const
+        {
+            UINT32 first, last;
+            DetermineRange(idx, first, last);
+
+            const UINT32 split = FindSplit(first, last);
+
+            const UINT32 leafNodeOffset = m_count - 1;
+            const UINT32 childAIndex = split == first ? leafNodeOffset + split : split;
+            const UINT32 childBIndex = split + 1 == last ? leafNodeOffset + split + 1 : split + 1;
+
+            m_pHierarchy[idx].LeftChildIndex = childAIndex;
+            m_pHierarchy[idx].RightChildIndex = childBIndex;
+            m_pHierarchy[childAIndex].ParentIndex = idx;
+            m_pHierarchy[childBIndex].ParentIndex = idx;
+        }
+    };
+
+    template<typename MortonCode>
+    static void ConstructHierarchy(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        const MortonCode *pSortedMortonCodes,
+        HierarchyNode *pHierarchy)
+    {
+        if (count < 2)
+        {
+            return;
+        }
+
+        const LbvhHierarchyBuilder<MortonCode> builder = { pSortedMortonCodes, count, pHierarchy };
+        taskPool.ParallelFor(count - 1, HIERARCHY_MIN_CHUNK_SIZE, [&builder](UINT begin, UINT end)
+        {
+            for (UINT idx = begin; idx < end; idx++)
+            {
+                builder.GenerateHierarchy(idx);
+            }
+        });
+    }
+
+    void ConstructLbvhHierarchy(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        const UINT32 *pSortedMortonCodes,
+        _Out_writes_(2 * count - 1) HierarchyNode *pHierarchy)
+    {
+        ConstructHierarchy(taskPool, count, pSortedMortonCodes, pHierarchy);
+    }
+
+    void ConstructLbvhHierarchy(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        const UINT64 *pSortedMortonCodes,
+        _Out_writes_(2 * count - 1) HierarchyNode *pHierarchy)
+    {
+        ConstructHierarchy(taskPool, count, pSortedMortonCodes, pHierarchy);
+    }
+}
@@ -0,0 +1,73 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    //
+    // CPU versions of the passes the GPU builder uses for its linear BVH
+    // (LBVH). Given the same inputs they produce the same output as
+    // MortonCodesCalculator, BitonicSort and ConstructHierarchyPass, bit for
+    // bit, so they double as a reference for those passes.
+    //
+
+    // Same as CalculateMortonCodesForPrimitives.hlsl: the centroid is
+    // normalized to the scene box and 10 bits per axis are interleaved, with
+    // y in the lowest bit, then x, then z
+    UINT32 CalculateMortonCode30(const float3 &centroid, const AABB &sceneAABB);
+
+    // 21 bits per axis with the same interleaving, for scenes where 10 bits
+    // leave too many primitives sharing a code
+    UINT64 CalculateMortonCode63(const float3 &centroid, const AABB &sceneAABB);
+
+    //
+    // Parallel LSD radix sort of Morton codes along with their primitive
+    // indices, 8 bits per pass. Passes where every code has the same digit
+    // are skipped. The sort is stable, so with indices that start out in
+    // order it breaks ties the same way BitonicSort does. The scratch arrays
+    // need room for count elements.
+    //
+    void SortMortonCodes(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        _Inout_ UINT32 *pMortonCodes,
+        _Inout_ UINT32 *pIndices,
+        UINT32 *pScratchMortonCodes,
+        UINT32 *pScratchIndices);
+
+    void SortMortonCodes(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        _Inout_ UINT64 *pMortonCodes,
+        _Inout_ UINT32 *pIndices,
+        UINT64 *pScratchMortonCodes,
+        UINT32 *pScratchIndices);
+
+    //
+    // Karras-style hierarchy over sorted Morton codes ("Maximizing Parallelism
+    // in the Construction of BVHs, Octrees, and k-d Trees", Karras 2012), laid
+    // out like ConstructHierarchyPass's output: internal nodes are
+    // [0, count - 1) with the root at 0, and leaf i, the i-th sorted code, is
+    // node count - 1 + i. Every internal node is computed independently, so
+    // they're spread over the task pool. The root's ParentIndex isn't written.
+    //
+    void ConstructLbvhHierarchy(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        const UINT32 *pSortedMortonCodes,
+        _Out_writes_(2 * count - 1) HierarchyNode *pHierarchy);
+
+    void ConstructLbvhHierarchy(
+        CpuTaskPool &taskPool,
+        UINT32 count,
+        const UINT64 *pSortedMortonCodes,
+        _Out_writes_(2 * count - 1) HierarchyNode *pHierarchy);
+}
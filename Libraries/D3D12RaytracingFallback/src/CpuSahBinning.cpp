@@ -0,0 +1,540 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    // Bound of an empty bin, matches the inverted box the builder starts from
+    static const float EMPTY_BIN_BOUND = -10e10f;
+
+    void SahReferenceBounds::Resize(UINT32 numReferences)
+    {
+        if (m_bounds.size() >= numReferences * (size_t)6)
+        {
+            return;
+        }
+
+        m_bounds.resize(numReferences * (size_t)6);
+        for (UINT k = 0; k < 3; k++)
+        {
+            m_pMin[k] = m_bounds.data() + numReferences * (size_t)k;
+            m_pMax[k] = m_bounds.data() + numReferences * (size_t)(k + 3);
+        }
+    }
+
+    SahPrimitiveBounds SahReferenceBounds::GetRange(UINT32 firstReference) const
+    {
+        SahPrimitiveBounds bounds;
+        for (UINT k = 0; k < 3; k++)
+        {
+            bounds.pMin[k] = m_pMin[k] + firstReference;
+            bounds.pMax[k] = m_pMax[k] + firstReference;
+        }
+        return bounds;
+    }
+
+    UINT GetSahBinIndex(float centroid, UINT dimension, const SahBinning &binning)
+    {
+        // Clamp as floats so NaNs and out of range positions land in the end
+        // bins the same way the SIMD paths clamp them
+        float binPosition = NUM_SAH_BINS * ((centroid - binning.rangeMin[dimension]) * binning.inverseExtents[dimension]);
+        binPosition = binPosition > 0.0f ? binPosition : 0.0f;
+        binPosition = binPosition < float(NUM_SAH_BINS - 1) ? binPosition : float(NUM_SAH_BINS - 1);
+        return UINT(binPosition);
+    }
+
+    AABB GetSahBinBox(const SahBinBox &binBox)
+    {
+        AABB box;
+        for (UINT i = 0; i < 3; i++)
+        {
+            box.minArr[i] = -binBox.negMin[i];
+            box.maxArr[i] = binBox.max[i];
+        }
+        return box;
+    }
+
+    static float GetCentroid(const SahPrimitiveBounds &bounds, UINT primitive, UINT dimension)
+    {
+        return (bounds.pMax[dimension][primitive] + bounds.pMin[dimension][primitive]) * 0.5f;
+    }
+
+    // Flat axes can't be split on, so none of the paths bin them
+    static void GetActiveAxes(const SahBinning &binning, bool bActiveAxes[3])
+    {
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            bActiveAxes[axis] = binning.inverseExtents[axis] != 0;
+        }
+    }
+
+    //
+    // Reference path, one axis at a time
+    //
+
+    static void BinPrimitivesScalar(
+        const SahPrimitiveBounds &bounds,
+        UINT numTris,
+        const SahBinning &binning,
+        SahBins &bins)
+    {
+        AABB binBoxes[NUM_SAH_BINS];
+
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            UINT *binCounts = bins.numTriangles[axis];
+            for (UINT j = 0; j < NUM_SAH_BINS; j++)
+            {
+                binCounts[j] = 0;
+                for (UINT k = 0; k < 3; k++)
+                {
+                    binBoxes[j].minArr[k] = -EMPTY_BIN_BOUND;
+                    binBoxes[j].maxArr[k] = EMPTY_BIN_BOUND;
+                }
+            }
+
+            if (binning.inverseExtents[axis] != 0)
+            {
+                for (UINT i = 0; i < numTris; i++)
+                {
+                    const UINT binIndex = GetSahBinIndex(GetCentroid(bounds, i, axis), axis, binning);
+
+                    binCounts[binIndex]++;
+                    for (UINT k = 0; k < 3; k++)
+                    {
+                        binBoxes[binIndex].minArr[k] = std::min(binBoxes[binIndex].minArr[k], bounds.pMin[k][i]);
+                        binBoxes[binIndex].maxArr[k] = std::max(binBoxes[binIndex].maxArr[k], bounds.pMax[k][i]);
+                    }
+                }
+            }
+
+            AABB leftBox = binBoxes[0];
+            AABB rightBox = binBoxes[NUM_SAH_BINS - 1];
+            for (UINT j = 0; j < NUM_SAH_BINS; j++)
+            {
+                const UINT rightIdx = NUM_SAH_BINS - j - 1;
+                for (UINT k = 0; k < 3; k++)
+                {
+                    leftBox.minArr[k] = std::min(leftBox.minArr[k], binBoxes[j].minArr[k]);
+                    leftBox.maxArr[k] = std::max(leftBox.maxArr[k], binBoxes[j].maxArr[k]);
+                    rightBox.minArr[k] = std::min(rightBox.minArr[k], binBoxes[rightIdx].minArr[k]);
+                    rightBox.maxArr[k] = std::max(rightBox.maxArr[k], binBoxes[rightIdx].maxArr[k]);
+
+                    bins.leftBoxes[axis][j].negMin[k] = -leftBox.minArr[k];
+                    bins.leftBoxes[axis][j].max[k] = leftBox.maxArr[k];
+                    bins.rightBoxes[axis][rightIdx].negMin[k] = -rightBox.minArr[k];
+                    bins.rightBoxes[axis][rightIdx].max[k] = rightBox.maxArr[k];
+                }
+            }
+        }
+    }
+
+    //
+    // The SIMD paths keep two copies of the bins and alternate between them,
+    // so runs of primitives landing in the same bin don't serialize on its
+    // load/max/store. The copies are merged during the prefix sweeps.
+    //
+    // A bin counts its primitives in the 4th lane of its max, which saves a
+    // second read-modify-write per update. The primitives' own 4th lane is
+    // EMPTY_BIN_BOUND so the max keeps the count, and adding COUNT_INCREMENT
+    // bumps it while leaving the other lanes alone. Counts are floats, so
+    // they're moved out to the integer counts every MAX_PRIMITIVES_PER_PASS
+    // primitives while they're still exact.
+    //
+    // The bin is the second operand of each max, which is what max returns
+    // when either is NaN, so NaN bounds are skipped the same way std::min
+    // and std::max skip them in the reference path.
+    //
+    static const UINT NUM_BIN_COPIES = 2;
+    static const UINT MAX_PRIMITIVES_PER_PASS = 1 << 24;
+
+    struct SimdSahBins
+    {
+        SahBinBox boxes[NUM_BIN_COPIES][3][NUM_SAH_BINS];
+    };
+
+    static void InitSimdSahBins(SimdSahBins &binCopies, SahBins &bins)
+    {
+        static const SahBinBox emptyBin =
+        {
+            { EMPTY_BIN_BOUND, EMPTY_BIN_BOUND, EMPTY_BIN_BOUND, EMPTY_BIN_BOUND },
+            { EMPTY_BIN_BOUND, EMPTY_BIN_BOUND, EMPTY_BIN_BOUND, 0.0f }
+        };
+
+        memset(bins.numTriangles, 0, sizeof(bins.numTriangles));
+        for (UINT copy = 0; copy < NUM_BIN_COPIES; copy++)
+        {
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                for (UINT j = 0; j < NUM_SAH_BINS; j++)
+                {
+                    binCopies.boxes[copy][axis][j] = emptyBin;
+                }
+            }
+        }
+    }
+
+    static void MoveSahBinCounts(SimdSahBins &binCopies, SahBins &bins)
+    {
+        for (UINT copy = 0; copy < NUM_BIN_COPIES; copy++)
+        {
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                for (UINT j = 0; j < NUM_SAH_BINS; j++)
+                {
+                    bins.numTriangles[axis][j] += (UINT)binCopies.boxes[copy][axis][j].max[3];
+                    binCopies.boxes[copy][axis][j].max[3] = 0.0f;
+                }
+            }
+        }
+    }
+
+    //
+    // SSE4.1 path. Bin positions are computed for four primitives at a time
+    // straight from the SoA bounds, which are then transposed into a negated
+    // min and a max per primitive. With min stored negated, updating a bin
+    // is two maxes.
+    //
+
+    CPU_TARGET("sse4.1")
+    static void AddToSahBinsSse41(
+        SahBinBox (&binCopy)[3][NUM_SAH_BINS],
+        const bool bActiveAxes[3],
+        const UINT *pBinIndices,
+        UINT binIndexStride,
+        __m128 negMin,
+        __m128 max)
+    {
+        const __m128 countIncrement = _mm_setr_ps(-0.0f, -0.0f, -0.0f, 1.0f);
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            if (!bActiveAxes[axis])
+            {
+                continue;
+            }
+
+            SahBinBox &bin = binCopy[axis][pBinIndices[axis * binIndexStride]];
+            _mm_store_ps(bin.negMin, _mm_max_ps(negMin, _mm_load_ps(bin.negMin)));
+            _mm_store_ps(bin.max, _mm_add_ps(_mm_max_ps(max, _mm_load_ps(bin.max)), countIncrement));
+        }
+    }
+
+    CPU_TARGET("sse4.1")
+    static void BinPrimitivesSse41(
+        const SahPrimitiveBounds &bounds,
+        UINT numTris,
+        const SahBinning &binning,
+        SahBins &bins)
+    {
+        const __m128 numBins = _mm_set1_ps((float)NUM_SAH_BINS);
+        const __m128 lastBin = _mm_set1_ps((float)(NUM_SAH_BINS - 1));
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 emptyBound = _mm_set1_ps(EMPTY_BIN_BOUND);
+
+        bool bActiveAxes[3];
+        GetActiveAxes(binning, bActiveAxes);
+
+        SimdSahBins binCopies;
+        InitSimdSahBins(binCopies, bins);
+
+        for (UINT first = 0; first < numTris; first += MAX_PRIMITIVES_PER_PASS)
+        {
+            const UINT end = numTris - first > MAX_PRIMITIVES_PER_PASS ? first + MAX_PRIMITIVES_PER_PASS : numTris;
+
+            UINT i = first;
+            for (; i + 4 <= end; i += 4)
+            {
+                __m128 negMin[4];
+                __m128 max[4];
+                alignas(16) UINT binIndices[3][4];
+                for (UINT k = 0; k < 3; k++)
+                {
+                    const __m128 boxMin = _mm_loadu_ps(bounds.pMin[k] + i);
+                    const __m128 boxMax = _mm_loadu_ps(bounds.pMax[k] + i);
+                    negMin[k] = _mm_xor_ps(boxMin, signMask);
+                    max[k] = boxMax;
+
+                    const __m128 centroid = _mm_mul_ps(_mm_add_ps(boxMax, boxMin), half);
+                    __m128 binPosition = _mm_mul_ps(numBins, _mm_mul_ps(_mm_sub_ps(centroid, _mm_set1_ps(binning.rangeMin[k])), _mm_set1_ps(binning.inverseExtents[k])));
+                    binPosition = _mm_min_ps(_mm_max_ps(binPosition, _mm_setzero_ps()), lastBin);
+                    _mm_store_si128((__m128i *)binIndices[k], _mm_cvttps_epi32(binPosition));
+                }
+                negMin[3] = emptyBound;
+                max[3] = emptyBound;
+
+                // Rows of components become one box per primitive
+                _MM_TRANSPOSE4_PS(negMin[0], negMin[1], negMin[2], negMin[3]);
+                _MM_TRANSPOSE4_PS(max[0], max[1], max[2], max[3]);
+
+                for (UINT p = 0; p < 4; p++)
+                {
+                    AddToSahBinsSse41(binCopies.boxes[p & 1], bActiveAxes, &binIndices[0][p], 4, negMin[p], max[p]);
+                }
+            }
+
+            for (; i < end; i++)
+            {
+                UINT binIndices[3];
+                for (UINT k = 0; k < 3; k++)
+                {
+                    binIndices[k] = GetSahBinIndex(GetCentroid(bounds, i, k), k, binning);
+                }
+
+                const __m128 negMin = _mm_setr_ps(-bounds.pMin[0][i], -bounds.pMin[1][i], -bounds.pMin[2][i], EMPTY_BIN_BOUND);
+                const __m128 max = _mm_setr_ps(bounds.pMax[0][i], bounds.pMax[1][i], bounds.pMax[2][i], EMPTY_BIN_BOUND);
+                AddToSahBinsSse41(binCopies.boxes[i & 1], bActiveAxes, binIndices, 1, negMin, max);
+            }
+
+            // The last pass' counts are picked up by the sweeps
+            if (end != numTris)
+            {
+                MoveSahBinCounts(binCopies, bins);
+            }
+        }
+
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            __m128 leftNegMin = emptyBound;
+            __m128 leftMax = emptyBound;
+            __m128 rightNegMin = emptyBound;
+            __m128 rightMax = emptyBound;
+            for (UINT j = 0; j < NUM_SAH_BINS; j++)
+            {
+                const UINT rightIdx = NUM_SAH_BINS - j - 1;
+                for (UINT copy = 0; copy < NUM_BIN_COPIES; copy++)
+                {
+                    bins.numTriangles[axis][j] += (UINT)binCopies.boxes[copy][axis][j].max[3];
+                    leftNegMin = _mm_max_ps(leftNegMin, _mm_load_ps(binCopies.boxes[copy][axis][j].negMin));
+                    leftMax = _mm_max_ps(leftMax, _mm_load_ps(binCopies.boxes[copy][axis][j].max));
+                    rightNegMin = _mm_max_ps(rightNegMin, _mm_load_ps(binCopies.boxes[copy][axis][rightIdx].negMin));
+                    rightMax = _mm_max_ps(rightMax, _mm_load_ps(binCopies.boxes[copy][axis][rightIdx].max));
+                }
+
+                _mm_store_ps(bins.leftBoxes[axis][j].negMin, leftNegMin);
+                _mm_store_ps(bins.leftBoxes[axis][j].max, leftMax);
+                _mm_store_ps(bins.rightBoxes[axis][rightIdx].negMin, rightNegMin);
+                _mm_store_ps(bins.rightBoxes[axis][rightIdx].max, rightMax);
+            }
+        }
+    }
+
+    //
+    // AVX path. A whole bin fits in one register, so updating a bin is a
+    // single max and add, and each step of the prefix sweeps a single max.
+    // Bin positions are computed for eight primitives at a time and their
+    // bounds transposed into one bin box each.
+    //
+
+    CPU_TARGET("avx")
+    static void AddToSahBinsAvx(
+        SahBinBox (&binCopy)[3][NUM_SAH_BINS],
+        const bool bActiveAxes[3],
+        const UINT *pBinIndices,
+        UINT binIndexStride,
+        __m256 binBox)
+    {
+        const __m256 countIncrement = _mm256_setr_ps(-0.0f, -0.0f, -0.0f, -0.0f, -0.0f, -0.0f, -0.0f, 1.0f);
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            if (!bActiveAxes[axis])
+            {
+                continue;
+            }
+
+            SahBinBox &bin = binCopy[axis][pBinIndices[axis * binIndexStride]];
+            _mm256_store_ps(bin.negMin, _mm256_add_ps(_mm256_max_ps(binBox, _mm256_load_ps(bin.negMin)), countIncrement));
+        }
+    }
+
+    CPU_TARGET("avx")
+    static void TransposeAvx(__m256 rows[8])
+    {
+        const __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+        const __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+        const __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+        const __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+        const __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+        const __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+        const __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+        const __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+
+        const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+        rows[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+        rows[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+        rows[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+        rows[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+        rows[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+        rows[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+        rows[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+        rows[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+    }
+
+    CPU_TARGET("avx")
+    static void BinPrimitivesAvx(
+        const SahPrimitiveBounds &bounds,
+        UINT numTris,
+        const SahBinning &binning,
+        SahBins &bins)
+    {
+        const __m256 numBins = _mm256_set1_ps((float)NUM_SAH_BINS);
+        const __m256 lastBin = _mm256_set1_ps((float)(NUM_SAH_BINS - 1));
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        const __m256 emptyBound = _mm256_set1_ps(EMPTY_BIN_BOUND);
+
+        bool bActiveAxes[3];
+        GetActiveAxes(binning, bActiveAxes);
+
+        SimdSahBins binCopies;
+        InitSimdSahBins(binCopies, bins);
+
+        for (UINT first = 0; first < numTris; first += MAX_PRIMITIVES_PER_PASS)
+        {
+            const UINT end = numTris - first > MAX_PRIMITIVES_PER_PASS ? first + MAX_PRIMITIVES_PER_PASS : numTris;
+
+            UINT i = first;
+            for (; i + 8 <= end; i += 8)
+            {
+                // Rows are the components of a bin box, negated mins first
+                __m256 binBoxes[8];
+                alignas(32) UINT binIndices[3][8];
+                for (UINT k = 0; k < 3; k++)
+                {
+                    const __m256 boxMin = _mm256_loadu_ps(bounds.pMin[k] + i);
+                    const __m256 boxMax = _mm256_loadu_ps(bounds.pMax[k] + i);
+                    binBoxes[k] = _mm256_xor_ps(boxMin, signMask);
+                    binBoxes[k + 4] = boxMax;
+
+                    const __m256 centroid = _mm256_mul_ps(_mm256_add_ps(boxMax, boxMin), half);
+                    __m256 binPosition = _mm256_mul_ps(numBins, _mm256_mul_ps(_mm256_sub_ps(centroid, _mm256_set1_ps(binning.rangeMin[k])), _mm256_set1_ps(binning.inverseExtents[k])));
+                    binPosition = _mm256_min_ps(_mm256_max_ps(binPosition, _mm256_setzero_ps()), lastBin);
+                    _mm256_store_si256((__m256i *)binIndices[k], _mm256_cvttps_epi32(binPosition));
+                }
+                binBoxes[3] = emptyBound;
+                binBoxes[7] = emptyBound;
+
+                TransposeAvx(binBoxes);
+
+                for (UINT p = 0; p < 8; p++)
+                {
+                    AddToSahBinsAvx(binCopies.boxes[p & 1], bActiveAxes, &binIndices[0][p], 8, binBoxes[p]);
+                }
+            }
+
+            for (; i < end; i++)
+            {
+                UINT binIndices[3];
+                for (UINT k = 0; k < 3; k++)
+                {
+                    binIndices[k] = GetSahBinIndex(GetCentroid(bounds, i, k), k, binning);
+                }
+
+                const __m256 binBox = _mm256_setr_ps(
+                    -bounds.pMin[0][i], -bounds.pMin[1][i], -bounds.pMin[2][i], EMPTY_BIN_BOUND,
+                    bounds.pMax[0][i], bounds.pMax[1][i], bounds.pMax[2][i], EMPTY_BIN_BOUND);
+                AddToSahBinsAvx(binCopies.boxes[i & 1], bActiveAxes, binIndices, 1, binBox);
+            }
+
+            // The last pass' counts are picked up by the sweeps
+            if (end != numTris)
+            {
+                MoveSahBinCounts(binCopies, bins);
+            }
+        }
+
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            __m256 leftBox = emptyBound;
+            __m256 rightBox = emptyBound;
+            for (UINT j = 0; j < NUM_SAH_BINS; j++)
+            {
+                const UINT rightIdx = NUM_SAH_BINS - j - 1;
+                for (UINT copy = 0; copy < NUM_BIN_COPIES; copy++)
+                {
+                    bins.numTriangles[axis][j] += (UINT)binCopies.boxes[copy][axis][j].max[3];
+                    leftBox = _mm256_max_ps(leftBox, _mm256_load_ps(binCopies.boxes[copy][axis][j].negMin));
+                    rightBox = _mm256_max_ps(rightBox, _mm256_load_ps(binCopies.boxes[copy][axis][rightIdx].negMin));
+                }
+
+                _mm256_store_ps(bins.leftBoxes[axis][j].negMin, leftBox);
+                _mm256_store_ps(bins.rightBoxes[axis][rightIdx].negMin, rightBox);
+            }
+        }
+    }
+
+    bool CpuSupportsSse41()
+    {
+        int cpuInfo[4];
+        __cpuid(cpuInfo, 1);
+        return (cpuInfo[2] & (1 << 19)) != 0;
+    }
+
+    bool CpuSupportsAvx()
+    {
+        int cpuInfo[4];
+        __cpuid(cpuInfo, 1);
+
+        // The OS also has to save the upper halves of the YMM registers
+        const bool bOsUsesXSave = (cpuInfo[2] & (1 << 27)) != 0;
+        const bool bCpuSupportsAvx = (cpuInfo[2] & (1 << 28)) != 0;
+        return bOsUsesXSave && bCpuSupportsAvx && (_xgetbv(0) & 0x6) == 0x6;
+    }
+
+    bool IsSahBinningPathSupported(SahBinningPath path)
+    {
+        switch (path)
+        {
+        case SahBinningScalar:
+            return true;
+        case SahBinningSse41:
+            return CpuSupportsSse41();
+        case SahBinningAvx:
+            return CpuSupportsAvx();
+        default:
+            return false;
+        }
+    }
+
+    SahBinningKernel GetSahBinningKernel(SahBinningPath path)
+    {
+        switch (path)
+        {
+        case SahBinningSse41:
+            return BinPrimitivesSse41;
+        case SahBinningAvx:
+            return BinPrimitivesAvx;
+        case SahBinningScalar:
+        default:
+            return BinPrimitivesScalar;
+        }
+    }
+
+    SahBinningKernel GetSahBinningKernel()
+    {
+        for (int path = NumSahBinningPaths - 1; path > SahBinningScalar; path--)
+        {
+            if (IsSahBinningPathSupported((SahBinningPath)path))
+            {
+                return GetSahBinningKernel((SahBinningPath)path);
+            }
+        }
+        return BinPrimitivesScalar;
+    }
+}
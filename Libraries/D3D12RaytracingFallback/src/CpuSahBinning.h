@@ -0,0 +1,130 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+// Lets GCC and Clang compile a function for an instruction set the rest of
+// the file isn't built for. MSVC accepts the intrinsics anywhere.
+#if defined(__GNUC__)
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_TARGET(isa)
+#endif
+
+namespace FallbackLayer
+{
+    static const UINT NUM_SAH_BINS = 64;
+
+    // Maps centroids to bins along each axis. Axes with an inverseExtents
+    // of 0 are flat and are binned but never split on.
+    struct SahBinning
+    {
+        float rangeMin[3];
+        float inverseExtents[3];
+    };
+
+    // Bounds of the primitives to bin, one array per component
+    struct SahPrimitiveBounds
+    {
+        const float *pMin[3];
+        const float *pMax[3];
+    };
+
+    //
+    // Boxes of the primitive references as SoA arrays in reference order,
+    // which is how the binning kernels stream through them. Whatever
+    // reorders the references has to move their bounds along.
+    //
+    class SahReferenceBounds
+    {
+    public:
+        // Bounds are undefined after growing
+        void Resize(UINT32 numReferences);
+
+        void SetBox(UINT32 reference, const AABB &box)
+        {
+            for (UINT k = 0; k < 3; k++)
+            {
+                m_pMin[k][reference] = box.minArr[k];
+                m_pMax[k][reference] = box.maxArr[k];
+            }
+        }
+
+        void Swap(UINT32 a, UINT32 b)
+        {
+            for (UINT k = 0; k < 3; k++)
+            {
+                std::swap(m_pMin[k][a], m_pMin[k][b]);
+                std::swap(m_pMax[k][a], m_pMax[k][b]);
+            }
+        }
+
+        float GetCentroid(UINT32 reference, UINT32 dimension) const
+        {
+            return (m_pMax[dimension][reference] + m_pMin[dimension][reference]) * 0.5f;
+        }
+
+        // Bounds of the references from firstReference on
+        SahPrimitiveBounds GetRange(UINT32 firstReference) const;
+
+    private:
+        std::vector<float> m_bounds;
+        float *m_pMin[3] = {};
+        float *m_pMax[3] = {};
+    };
+
+    // Box of a bin, with min stored negated so a single max updates both
+    // halves. The 4th lane of each half is padding and holds garbage.
+    struct alignas(32) SahBinBox
+    {
+        float negMin[4];
+        float max[4];
+    };
+
+    //
+    // Per-axis bin counts and the left/right prefix sweeps of the bin boxes:
+    //   leftBoxes[axis][j]  bounds bins [0, j]
+    //   rightBoxes[axis][j] bounds bins [j, NUM_SAH_BINS)
+    //
+    struct SahBins
+    {
+        SahBinBox leftBoxes[3][NUM_SAH_BINS];
+        SahBinBox rightBoxes[3][NUM_SAH_BINS];
+        UINT numTriangles[3][NUM_SAH_BINS];
+    };
+
+    enum SahBinningPath
+    {
+        SahBinningScalar,
+        SahBinningSse41,
+        SahBinningAvx,
+        NumSahBinningPaths
+    };
+
+    typedef void(*SahBinningKernel)(
+        const SahPrimitiveBounds &bounds,
+        UINT numTris,
+        const SahBinning &binning,
+        SahBins &bins);
+
+    UINT GetSahBinIndex(float centroid, UINT dimension, const SahBinning &binning);
+    AABB GetSahBinBox(const SahBinBox &binBox);
+
+    // All paths produce the same bins, the scalar one is the reference
+    bool IsSahBinningPathSupported(SahBinningPath path);
+    SahBinningKernel GetSahBinningKernel(SahBinningPath path);
+
+    // Fastest path supported by this CPU
+    SahBinningKernel GetSahBinningKernel();
+
+    // Also used to pick the wide BVH traversal kernels
+    bool CpuSupportsSse41();
+    bool CpuSupportsAvx();
+}
@@ -0,0 +1,185 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    struct WorkerThreadState
+    {
+        const CpuTaskPool *m_pPool;
+        UINT m_queueIndex;
+    };
+
+    static thread_local WorkerThreadState t_workerState = { nullptr, 0 };
+
+    CpuTaskPool::CpuTaskPool(UINT threadCount) : m_queuedTasks(0), m_shutdown(false)
+    {
+        const UINT numWorkers = threadCount > 1 ? threadCount - 1 : 0;
+
+        m_queues.resize(numWorkers + 1);
+        for (auto &pQueue : m_queues)
+        {
+            pQueue = std::unique_ptr<WorkQueue>(new WorkQueue());
+        }
+
+        for (UINT i = 0; i < numWorkers; i++)
+        {
+            m_threads.push_back(std::thread(&CpuTaskPool::WorkerThreadMain, this, i + 1));
+        }
+    }
+
+    CpuTaskPool::~CpuTaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeLock);
+            m_shutdown = true;
+        }
+        m_wakeCondition.notify_all();
+
+        for (auto &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    UINT CpuTaskPool::GetDefaultThreadCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    UINT CpuTaskPool::GetCurrentQueueIndex() const
+    {
+        return t_workerState.m_pPool == this ? t_workerState.m_queueIndex : 0;
+    }
+
+    void CpuTaskPool::Run(TaskGroup &group, std::function<void()> task)
+    {
+        if (m_threads.empty())
+        {
+            task();
+            return;
+        }
+
+        group.m_pendingTasks++;
+
+        WorkQueue &queue = *m_queues[GetCurrentQueueIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.m_lock);
+            queue.m_tasks.push_back(Task{ std::move(task), &group });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_wakeLock);
+            m_queuedTasks++;
+        }
+        m_wakeCondition.notify_one();
+    }
+
+    void CpuTaskPool::Wait(TaskGroup &group)
+    {
+        const UINT queueIndex = GetCurrentQueueIndex();
+        while (group.m_pendingTasks > 0)
+        {
+            if (!TryRunTask(queueIndex))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void CpuTaskPool::ParallelFor(UINT count, UINT minChunkSize, const std::function<void(UINT begin, UINT end)> &body)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        // Oversubscribe a little so a slow chunk doesn't leave the other threads idle
+        const UINT chunksPerThread = 4;
+        const UINT maxChunks = GetThreadCount() * chunksPerThread;
+        const UINT chunkSize = std::max(std::max(minChunkSize, 1u), DivideAndRoundUp(count, maxChunks));
+
+        TaskGroup group;
+        for (UINT begin = chunkSize; begin < count; begin += chunkSize)
+        {
+            const UINT end = std::min(count, begin + chunkSize);
+            Run(group, [&body, begin, end]() { body(begin, end); });
+        }
+        body(0, std::min(count, chunkSize));
+        Wait(group);
+    }
+
+    bool CpuTaskPool::TryPopTask(UINT queueIndex, Task &task)
+    {
+        WorkQueue &queue = *m_queues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.m_lock);
+        if (queue.m_tasks.empty())
+        {
+            return false;
+        }
+
+        task = std::move(queue.m_tasks.back());
+        queue.m_tasks.pop_back();
+        return true;
+    }
+
+    bool CpuTaskPool::TryStealTask(UINT thiefIndex, Task &task)
+    {
+        const UINT numQueues = (UINT)m_queues.size();
+        for (UINT i = 1; i < numQueues; i++)
+        {
+            WorkQueue &queue = *m_queues[(thiefIndex + i) % numQueues];
+            std::lock_guard<std::mutex> lock(queue.m_lock);
+            if (!queue.m_tasks.empty())
+            {
+                // Oldest tasks sit at the front and tend to be the largest subtrees
+                task = std::move(queue.m_tasks.front());
+                queue.m_tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool CpuTaskPool::TryRunTask(UINT queueIndex)
+    {
+        Task task;
+        if (!TryPopTask(queueIndex, task) && !TryStealTask(queueIndex, task))
+        {
+            return false;
+        }
+
+        m_queuedTasks--;
+        task.m_function();
+        task.m_pGroup->m_pendingTasks--;
+        return true;
+    }
+
+    void CpuTaskPool::WorkerThreadMain(UINT queueIndex)
+    {
+        t_workerState = { this, queueIndex };
+
+        for (;;)
+        {
+            if (TryRunTask(queueIndex))
+            {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wakeLock);
+            m_wakeCondition.wait(lock, [this]() { return m_shutdown || m_queuedTasks > 0; });
+            if (m_shutdown)
+            {
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,78 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    //
+    // Small work-stealing pool used by the CPU acceleration structure builders.
+    //
+    // Every worker owns a deque: it pushes and pops its own tasks from the back
+    // and steals from the front of the other deques when it runs dry. Threads
+    // that wait on a TaskGroup keep executing tasks instead of blocking, so
+    // recursive fork/join (spawn one half, build the other, wait) can't deadlock.
+    //
+    class CpuTaskPool
+    {
+    public:
+        class TaskGroup
+        {
+        public:
+            TaskGroup() : m_pendingTasks(0) {}
+        private:
+            friend class CpuTaskPool;
+            std::atomic<UINT> m_pendingTasks;
+        };
+
+        // threadCount includes the calling thread, so a count of 0 or 1
+        // runs every task inline and never spawns a worker.
+        CpuTaskPool(UINT threadCount);
+        ~CpuTaskPool();
+
+        UINT GetThreadCount() const { return (UINT)m_threads.size() + 1; }
+
+        void Run(TaskGroup &group, std::function<void()> task);
+        void Wait(TaskGroup &group);
+
+        // Splits [0, count) into roughly even chunks and blocks until all of them are done
+        void ParallelFor(UINT count, UINT minChunkSize, const std::function<void(UINT begin, UINT end)> &body);
+
+        static UINT GetDefaultThreadCount();
+
+    private:
+        struct Task
+        {
+            std::function<void()> m_function;
+            TaskGroup *m_pGroup;
+        };
+
+        struct WorkQueue
+        {
+            std::mutex m_lock;
+            std::deque<Task> m_tasks;
+        };
+
+        UINT GetCurrentQueueIndex() const;
+        bool TryPopTask(UINT queueIndex, Task &task);
+        bool TryStealTask(UINT thiefIndex, Task &task);
+        bool TryRunTask(UINT queueIndex);
+        void WorkerThreadMain(UINT queueIndex);
+
+        // Queue 0 is shared by all threads outside of the pool
+        std::vector<std::unique_ptr<WorkQueue>> m_queues;
+        std::vector<std::thread> m_threads;
+
+        std::mutex m_wakeLock;
+        std::condition_variable m_wakeCondition;
+        std::atomic<UINT> m_queuedTasks;
+        bool m_shutdown;
+    };
+}
@@ -0,0 +1,634 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    static const UINT32 INVALID_NODE_INDEX = (UINT32)-1;
+
+    static float ComputeBoxSurfaceArea(const AABB &box)
+    {
+        const float dims[3] =
+        {
+            box.max.x - box.min.x,
+            box.max.y - box.min.y,
+            box.max.z - box.min.z
+        };
+
+        return 2 * (dims[0] * dims[1] + dims[0] * dims[2] + dims[1] * dims[2]);
+    }
+
+    static AABB CombineBoxes(const AABB &a, const AABB &b)
+    {
+        AABB box;
+        for (UINT axis = 0; axis < 3; ++axis)
+        {
+            box.minArr[axis] = std::min(a.minArr[axis], b.minArr[axis]);
+            box.maxArr[axis] = std::max(a.maxArr[axis], b.maxArr[axis]);
+        }
+        return box;
+    }
+
+    static bool AreBoxesEqual(const AABB &a, const AABB &b)
+    {
+        return memcmp(&a, &b, sizeof(AABB)) == 0;
+    }
+
+    //
+    // Box of a box transformed by a row-major 3x4 matrix, after "Transforming
+    // Axes-Aligned Bounding Boxes" (Arvo 1990). Each axis picks the smaller
+    // and larger product per matrix element instead of transforming all 8
+    // corners. The terms are summed in the order transforming a corner sums
+    // them, so the box is the same as the one the corners give.
+    //
+    static AABB TransformBox(const AABB &box, _In_reads_(12) const float *pTransform)
+    {
+        AABB transformedBox;
+        for (UINT row = 0; row < 3; ++row)
+        {
+            const float *pRow = pTransform + row * 4;
+            float rowMin = 0.0f;
+            float rowMax = 0.0f;
+            for (UINT column = 0; column < 3; ++column)
+            {
+                const float a = pRow[column] * box.minArr[column];
+                const float b = pRow[column] * box.maxArr[column];
+                rowMin = column ? rowMin + std::min(a, b) : std::min(a, b);
+                rowMax = column ? rowMax + std::max(a, b) : std::max(a, b);
+            }
+            transformedBox.minArr[row] = rowMin + pRow[3];
+            transformedBox.maxArr[row] = rowMax + pRow[3];
+        }
+        return transformedBox;
+    }
+
+    // Inverse of a row-major 3x4 affine transform, through the adjugate of
+    // its 3x3 part
+    static void InvertTransform(_In_reads_(12) const float *m, _Out_writes_(12) float *pInverse)
+    {
+        const float cofactor00 = m[5] * m[10] - m[6] * m[9];
+        const float cofactor01 = m[6] * m[8] - m[4] * m[10];
+        const float cofactor02 = m[4] * m[9] - m[5] * m[8];
+        const float inverseDeterminant = 1.0f / (m[0] * cofactor00 + m[1] * cofactor01 + m[2] * cofactor02);
+
+        pInverse[0] = cofactor00 * inverseDeterminant;
+        pInverse[1] = (m[2] * m[9] - m[1] * m[10]) * inverseDeterminant;
+        pInverse[2] = (m[1] * m[6] - m[2] * m[5]) * inverseDeterminant;
+        pInverse[4] = cofactor01 * inverseDeterminant;
+        pInverse[5] = (m[0] * m[10] - m[2] * m[8]) * inverseDeterminant;
+        pInverse[6] = (m[2] * m[4] - m[0] * m[6]) * inverseDeterminant;
+        pInverse[8] = cofactor02 * inverseDeterminant;
+        pInverse[9] = (m[1] * m[8] - m[0] * m[9]) * inverseDeterminant;
+        pInverse[10] = (m[0] * m[5] - m[1] * m[4]) * inverseDeterminant;
+
+        for (UINT row = 0; row < 3; ++row)
+        {
+            float *pRow = pInverse + row * 4;
+            pRow[3] = -(pRow[0] * m[3] + pRow[1] * m[7] + pRow[2] * m[11]);
+        }
+    }
+
+    CpuTopLevelBvh2Builder::CpuTopLevelBvh2Builder(UINT threadCount) :
+        m_builder(threadCount),
+        m_pOutput(nullptr),
+        m_rootIndex(0),
+        m_areaSum(0.0),
+        m_rebuildSahCost(0.0f),
+        m_updateStamp(0)
+    {
+    }
+
+    UINT CpuTopLevelBvh2Builder::GetMaxOutputSize(UINT numInstances)
+    {
+        const UINT numNodes = numInstances ? numInstances * 2 - 1 : 1;
+        return sizeof(BVHOffsets) + numNodes * sizeof(AABBNode) + numInstances * sizeof(BVHMetadata);
+    }
+
+    void CpuTopLevelBvh2Builder::BuildRaytracingAccelerationStructure(
+        _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+        _Inout_ void *pData)
+    {
+        if (pDesc->Type != D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL)
+        {
+            ThrowFailure(E_INVALIDARG, L"CpuTopLevelBvh2Builder only builds top-level acceleration structures");
+        }
+
+        BYTE *pOutput = (BYTE *)pData;
+        LoadInstances(pDesc);
+
+        bool bUpdated = false;
+        if ((pDesc->Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE) &&
+            m_pOutput && m_instances.size() == m_builtInstances.size())
+        {
+            const BYTE *pSource = pDesc->SourceAccelerationStructureData ?
+                (const BYTE *)pDesc->SourceAccelerationStructureData : pOutput;
+            if (pSource == m_pOutput)
+            {
+                if (pSource != pOutput)
+                {
+                    memcpy(pOutput, pSource, ((const BVHOffsets *)pSource)->totalSize);
+                }
+                bUpdated = Update(pOutput);
+            }
+        }
+
+        if (!bUpdated)
+        {
+            Rebuild(pOutput);
+        }
+
+        if (pDesc->Flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE)
+        {
+            m_pOutput = pOutput;
+            m_builtInstances.swap(m_instances);
+            m_builtObjectBoxes.swap(m_objectBoxes);
+        }
+        else
+        {
+            m_pOutput = nullptr;
+        }
+    }
+
+    void CpuTopLevelBvh2Builder::LoadInstances(_In_ const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc)
+    {
+        const UINT numInstances = pDesc->NumDescs;
+        m_instances.resize(numInstances);
+        m_objectBoxes.resize(numInstances);
+        m_worldBoxes.resize(numInstances);
+
+        for (UINT i = 0; i < numInstances; ++i)
+        {
+            const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instance =
+                pDesc->DescsLayout == D3D12_ELEMENTS_LAYOUT_ARRAY_OF_POINTERS ?
+                *((const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC *const *)pDesc->InstanceDescs)[i] :
+                ((const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC *)pDesc->InstanceDescs)[i];
+            m_instances[i] = instance;
+
+            const BYTE *pBottomLevel = (const BYTE *)instance.AccelerationStructure.GpuVA;
+            const BVHOffsets &offsets = *(const BVHOffsets *)pBottomLevel;
+            DecompressAABB(m_objectBoxes[i], *(const AABBNode *)(pBottomLevel + offsets.offsetToBoxes));
+        }
+    }
+
+    void CpuTopLevelBvh2Builder::Rebuild(_Out_ BYTE *pData)
+    {
+        const UINT32 numInstances = (UINT32)m_instances.size();
+        const UINT32 numNodes = numInstances ? numInstances * 2 - 1 : 1;
+
+        BVHOffsets &offsets = *(BVHOffsets *)pData;
+        offsets.offsetToBoxes = sizeof(BVHOffsets);
+        // Top levels keep their BVHMetadata where bottom levels keep their
+        // primitives, see GetOffsetToInstanceDesc
+        offsets.offsetToVertices = offsets.offsetToBoxes + numNodes * sizeof(AABBNode);
+        offsets.offsetToPrimitiveMetaData = 0;
+        offsets.totalSize = offsets.offsetToVertices + numInstances * sizeof(BVHMetadata);
+
+        AABBNode *pNodes = (AABBNode *)(pData + offsets.offsetToBoxes);
+
+        m_stats = CpuTopLevelBuildStats();
+        m_stats.NumInstances = numInstances;
+        m_stats.NumInstancesTouched = numInstances;
+        m_stats.NumNodesRewritten = numNodes;
+        m_stats.bRebuilt = true;
+
+        m_hierarchy.resize(numNodes);
+        m_boxes.resize(numNodes);
+        m_leafInstances.resize(numNodes);
+        m_instanceLeaves.resize(numInstances);
+        m_nodeStamps.assign(numNodes, 0);
+        m_updateStamp = 0;
+        m_rootIndex = 0;
+        m_areaSum = 0.0;
+        m_rebuildSahCost = 0.0f;
+
+        if (numInstances == 0)
+        {
+            // Same as the GPU builder's empty acceleration structure
+            memset(pNodes, 0, sizeof(AABBNode));
+            memset(&m_boxes[0], 0, sizeof(AABB));
+            m_hierarchy[0] = { INVALID_NODE_INDEX, INVALID_NODE_INDEX, INVALID_NODE_INDEX };
+            m_leafInstances[0] = INVALID_NODE_INDEX;
+            return;
+        }
+
+        for (UINT32 i = 0; i < numInstances; ++i)
+        {
+            m_worldBoxes[i] = TransformBox(m_objectBoxes[i], m_instances[i].Transform);
+        }
+
+        BVH &bvh = m_bvh;
+        m_builder.BuildBoxBVH(m_worldBoxes.data(), numInstances, bvh);
+        assert(bvh.m_nodes.size() == numNodes);
+
+        //
+        // Leaves point at their instance's BVHMetadata the way the GPU
+        // builder's do, with the index of the instance and the leaf bit.
+        //
+        m_hierarchy[0].ParentIndex = INVALID_NODE_INDEX;
+        for (UINT32 i = 0; i < numNodes; ++i)
+        {
+            AABBNode node = bvh.m_nodes[i];
+            HierarchyNode &hierarchyNode = m_hierarchy[i];
+            if (node.leaf)
+            {
+                const UINT32 instanceIndex = bvh.m_metadata[node.leafNode.firstTriangleId].PrimitiveIndex;
+                node.nodeAllBits = instanceIndex;
+                node.leaf = true;
+
+                hierarchyNode.LeftChildIndex = INVALID_NODE_INDEX;
+                hierarchyNode.RightChildIndex = INVALID_NODE_INDEX;
+                m_leafInstances[i] = instanceIndex;
+                m_instanceLeaves[instanceIndex] = i;
+            }
+            else
+            {
+                hierarchyNode.LeftChildIndex = node.internalNode.leftNodeIndex;
+                hierarchyNode.RightChildIndex = i + 1;
+                m_hierarchy[hierarchyNode.LeftChildIndex].ParentIndex = i;
+                m_hierarchy[hierarchyNode.RightChildIndex].ParentIndex = i;
+                m_leafInstances[i] = INVALID_NODE_INDEX;
+            }
+            pNodes[i] = node;
+        }
+
+        // Children always come after their parent
+        for (UINT32 i = numNodes; i-- > 0;)
+        {
+            const HierarchyNode &hierarchyNode = m_hierarchy[i];
+            m_boxes[i] = m_leafInstances[i] != INVALID_NODE_INDEX ?
+                m_worldBoxes[m_leafInstances[i]] :
+                CombineBoxes(m_boxes[hierarchyNode.LeftChildIndex], m_boxes[hierarchyNode.RightChildIndex]);
+            m_areaSum += ComputeBoxSurfaceArea(m_boxes[i]);
+        }
+
+        for (UINT32 i = 0; i < numInstances; ++i)
+        {
+            WriteMetadata(i, pData);
+        }
+
+        const float rootArea = ComputeBoxSurfaceArea(m_boxes[0]);
+        m_rebuildSahCost = rootArea > 0.0f ? (float)(m_areaSum / rootArea) : 0.0f;
+        m_stats.SahCost = m_rebuildSahCost;
+    }
+
+    bool CpuTopLevelBvh2Builder::Update(_Inout_ BYTE *pData)
+    {
+        const UINT32 numInstances = (UINT32)m_instances.size();
+        if (numInstances == 0)
+        {
+            return false;
+        }
+
+        m_changedInstances.clear();
+        for (UINT32 i = 0; i < numInstances; ++i)
+        {
+            if (memcmp(&m_instances[i], &m_builtInstances[i], sizeof(D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC)) ||
+                !AreBoxesEqual(m_objectBoxes[i], m_builtObjectBoxes[i]))
+            {
+                m_changedInstances.push_back(i);
+            }
+        }
+
+        if (m_changedInstances.size() > m_settings.MaxChangedInstanceFraction * numInstances)
+        {
+            return false;
+        }
+
+        if (++m_updateStamp == 0)
+        {
+            std::fill(m_nodeStamps.begin(), m_nodeStamps.end(), 0);
+            m_updateStamp = 1;
+        }
+        m_rewrittenNodes.clear();
+        m_reinsertedInstances.clear();
+
+        //
+        // Refit the instances that stayed close to their sibling first.
+        // Those that moved far enough to blow up their parent's box are put
+        // back into the tree once everything else is in place.
+        //
+        for (UINT32 instanceIndex : m_changedInstances)
+        {
+            const AABB worldBox = TransformBox(m_objectBoxes[instanceIndex], m_instances[instanceIndex].Transform);
+            m_worldBoxes[instanceIndex] = worldBox;
+
+            const UINT32 leafIndex = m_instanceLeaves[instanceIndex];
+            if (AreBoxesEqual(worldBox, m_boxes[leafIndex]))
+            {
+                continue;
+            }
+
+            const UINT32 parentIndex = m_hierarchy[leafIndex].ParentIndex;
+            if (m_settings.ReinsertionThreshold >= 0.0f && parentIndex != INVALID_NODE_INDEX)
+            {
+                const HierarchyNode &parent = m_hierarchy[parentIndex];
+                const UINT32 siblingIndex = parent.LeftChildIndex == leafIndex ? parent.RightChildIndex : parent.LeftChildIndex;
+                const float refitArea = ComputeBoxSurfaceArea(CombineBoxes(m_boxes[siblingIndex], worldBox));
+                if (refitArea > (1.0f + m_settings.ReinsertionThreshold) * ComputeBoxSurfaceArea(m_boxes[parentIndex]))
+                {
+                    m_reinsertedInstances.push_back(instanceIndex);
+                    continue;
+                }
+            }
+
+            UpdateNodeBox(leafIndex, worldBox);
+            RefitAncestors(leafIndex);
+        }
+
+        for (UINT32 instanceIndex : m_reinsertedInstances)
+        {
+            const UINT32 leafIndex = m_instanceLeaves[instanceIndex];
+            const UINT32 parentIndex = RemoveLeaf(leafIndex);
+            UpdateNodeBox(leafIndex, m_worldBoxes[instanceIndex]);
+            InsertLeaf(leafIndex, parentIndex);
+        }
+
+        const float rootArea = ComputeBoxSurfaceArea(m_boxes[m_rootIndex]);
+        const float sahCost = rootArea > 0.0f ? (float)(m_areaSum / rootArea) : 0.0f;
+        const float sahGrowth = m_rebuildSahCost > 0.0f ? sahCost / m_rebuildSahCost : 1.0f;
+        if (sahGrowth > m_settings.MaxSahGrowth)
+        {
+            return false;
+        }
+
+        //
+        // Nothing has been written to the output up to here, so giving up
+        // for a rebuild above didn't cost more than the tree walks
+        //
+        for (UINT32 instanceIndex : m_changedInstances)
+        {
+            WriteMetadata(instanceIndex, pData);
+        }
+
+        m_stats = CpuTopLevelBuildStats();
+        if (m_reinsertedInstances.empty())
+        {
+            const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+            AABBNode *pNodes = (AABBNode *)(pData + offsets.offsetToBoxes);
+            for (UINT32 nodeIndex : m_rewrittenNodes)
+            {
+                SetNodeBox(pNodes[nodeIndex], m_boxes[nodeIndex]);
+            }
+            m_stats.NumNodesRewritten = (UINT)m_rewrittenNodes.size();
+        }
+        else
+        {
+            WriteAllNodes(pData);
+            m_stats.NumNodesRewritten = (UINT)m_boxes.size();
+        }
+
+        m_stats.NumInstances = numInstances;
+        m_stats.NumInstancesTouched = (UINT)m_changedInstances.size();
+        m_stats.NumInstancesReinserted = (UINT)m_reinsertedInstances.size();
+        m_stats.bRebuilt = false;
+        m_stats.SahCost = sahCost;
+        m_stats.SahGrowth = sahGrowth;
+        return true;
+    }
+
+    void CpuTopLevelBvh2Builder::UpdateNodeBox(UINT32 nodeIndex, const AABB &box)
+    {
+        m_areaSum += (double)ComputeBoxSurfaceArea(box) - ComputeBoxSurfaceArea(m_boxes[nodeIndex]);
+        m_boxes[nodeIndex] = box;
+
+        if (m_nodeStamps[nodeIndex] != m_updateStamp)
+        {
+            m_nodeStamps[nodeIndex] = m_updateStamp;
+            m_rewrittenNodes.push_back(nodeIndex);
+        }
+    }
+
+    // Stops at the first ancestor whose box doesn't change
+    void CpuTopLevelBvh2Builder::RefitAncestors(UINT32 nodeIndex)
+    {
+        for (UINT32 parentIndex = m_hierarchy[nodeIndex].ParentIndex;
+            parentIndex != INVALID_NODE_INDEX;
+            parentIndex = m_hierarchy[parentIndex].ParentIndex)
+        {
+            const HierarchyNode &parent = m_hierarchy[parentIndex];
+            const AABB box = CombineBoxes(m_boxes[parent.LeftChildIndex], m_boxes[parent.RightChildIndex]);
+            if (AreBoxesEqual(box, m_boxes[parentIndex]))
+            {
+                break;
+            }
+            UpdateNodeBox(parentIndex, box);
+        }
+    }
+
+    // The leaf's sibling takes the place of their parent
+    UINT32 CpuTopLevelBvh2Builder::RemoveLeaf(UINT32 leafIndex)
+    {
+        const UINT32 parentIndex = m_hierarchy[leafIndex].ParentIndex;
+        const HierarchyNode &parent = m_hierarchy[parentIndex];
+        const UINT32 siblingIndex = parent.LeftChildIndex == leafIndex ? parent.RightChildIndex : parent.LeftChildIndex;
+        const UINT32 grandparentIndex = parent.ParentIndex;
+
+        m_hierarchy[siblingIndex].ParentIndex = grandparentIndex;
+        m_hierarchy[leafIndex].ParentIndex = INVALID_NODE_INDEX;
+        if (grandparentIndex == INVALID_NODE_INDEX)
+        {
+            m_rootIndex = siblingIndex;
+        }
+        else
+        {
+            HierarchyNode &grandparent = m_hierarchy[grandparentIndex];
+            if (grandparent.LeftChildIndex == parentIndex)
+            {
+                grandparent.LeftChildIndex = siblingIndex;
+            }
+            else
+            {
+                grandparent.RightChildIndex = siblingIndex;
+            }
+        }
+
+        // The parent is out of the tree until InsertLeaf gives it a new box
+        m_areaSum -= ComputeBoxSurfaceArea(m_boxes[parentIndex]);
+        memset(&m_boxes[parentIndex], 0, sizeof(AABB));
+
+        if (grandparentIndex != INVALID_NODE_INDEX)
+        {
+            RefitAncestors(siblingIndex);
+        }
+        return parentIndex;
+    }
+
+    //
+    // Inserts a leaf next to the node that grows the sum of all node areas,
+    // and so the SahCost, the least, after "Fast Insertion-Based Optimization
+    // of Bounding Volume Hierarchies" (Bittner et al. 2013). Making a node
+    // the leaf's sibling costs the area of their new parent plus how much
+    // every ancestor of the node grows. Ancestor growth only adds up going
+    // down, so subtrees whose inherited cost alone can't beat the best
+    // sibling found are skipped, and candidates are visited cheapest first.
+    //
+    void CpuTopLevelBvh2Builder::InsertLeaf(UINT32 leafIndex, UINT32 parentIndex)
+    {
+        typedef std::pair<float, UINT32> Candidate;
+
+        const AABB leafBox = m_boxes[leafIndex];
+        const float leafArea = ComputeBoxSurfaceArea(leafBox);
+
+        UINT32 siblingIndex = m_rootIndex;
+        float bestCost = FLT_MAX;
+
+        std::vector<Candidate> &queue = m_insertQueue;
+        queue.clear();
+        queue.push_back(Candidate(0.0f, m_rootIndex));
+        while (!queue.empty())
+        {
+            std::pop_heap(queue.begin(), queue.end(), std::greater<Candidate>());
+            const Candidate candidate = queue.back();
+            queue.pop_back();
+
+            const float inheritedCost = candidate.first;
+            if (inheritedCost + leafArea >= bestCost)
+            {
+                break;
+            }
+
+            const UINT32 nodeIndex = candidate.second;
+            const float nodeArea = ComputeBoxSurfaceArea(m_boxes[nodeIndex]);
+            const float combinedArea = ComputeBoxSurfaceArea(CombineBoxes(m_boxes[nodeIndex], leafBox));
+            const float cost = inheritedCost + combinedArea;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                siblingIndex = nodeIndex;
+            }
+
+            const float childInheritedCost = inheritedCost + combinedArea - nodeArea;
+            if (m_leafInstances[nodeIndex] == INVALID_NODE_INDEX && childInheritedCost + leafArea < bestCost)
+            {
+                const HierarchyNode &node = m_hierarchy[nodeIndex];
+                queue.push_back(Candidate(childInheritedCost, node.LeftChildIndex));
+                std::push_heap(queue.begin(), queue.end(), std::greater<Candidate>());
+                queue.push_back(Candidate(childInheritedCost, node.RightChildIndex));
+                std::push_heap(queue.begin(), queue.end(), std::greater<Candidate>());
+            }
+        }
+
+        const UINT32 oldParentIndex = m_hierarchy[siblingIndex].ParentIndex;
+        HierarchyNode &parent = m_hierarchy[parentIndex];
+        parent.ParentIndex = oldParentIndex;
+        parent.LeftChildIndex = siblingIndex;
+        parent.RightChildIndex = leafIndex;
+        m_hierarchy[siblingIndex].ParentIndex = parentIndex;
+        m_hierarchy[leafIndex].ParentIndex = parentIndex;
+
+        if (oldParentIndex == INVALID_NODE_INDEX)
+        {
+            m_rootIndex = parentIndex;
+        }
+        else
+        {
+            HierarchyNode &oldParent = m_hierarchy[oldParentIndex];
+            if (oldParent.LeftChildIndex == siblingIndex)
+            {
+                oldParent.LeftChildIndex = parentIndex;
+            }
+            else
+            {
+                oldParent.RightChildIndex = parentIndex;
+            }
+        }
+
+        UpdateNodeBox(parentIndex, CombineBoxes(m_boxes[siblingIndex], leafBox));
+        RefitAncestors(parentIndex);
+    }
+
+    void CpuTopLevelBvh2Builder::WriteMetadata(UINT32 instanceIndex, _Inout_ BYTE *pData) const
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+        const D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instance = m_instances[instanceIndex];
+
+        BVHMetadata metadata;
+        metadata.instanceDesc = instance;
+        InvertTransform(instance.Transform, metadata.instanceDesc.Transform);
+        memcpy(metadata.ObjectToWorld, instance.Transform, sizeof(metadata.ObjectToWorld));
+        metadata.InstanceIndex = instanceIndex;
+
+        memcpy(pData + offsets.offsetToVertices + instanceIndex * sizeof(BVHMetadata), &metadata, sizeof(metadata));
+    }
+
+    void CpuTopLevelBvh2Builder::WriteAllNodes(_Inout_ BYTE *pData)
+    {
+        const UINT32 numNodes = (UINT32)m_boxes.size();
+
+        // Number the nodes in the order BuildBVH emits them, each node
+        // directly followed by its right subtree and then its left subtree
+        m_nodeOrder.resize(numNodes);
+        m_nodeStack.clear();
+        m_nodeStack.push_back(m_rootIndex);
+        UINT32 nextNodeIndex = 0;
+        while (!m_nodeStack.empty())
+        {
+            const UINT32 nodeIndex = m_nodeStack.back();
+            m_nodeStack.pop_back();
+
+            m_nodeOrder[nodeIndex] = nextNodeIndex++;
+            if (m_leafInstances[nodeIndex] == INVALID_NODE_INDEX)
+            {
+                m_nodeStack.push_back(m_hierarchy[nodeIndex].LeftChildIndex);
+                m_nodeStack.push_back(m_hierarchy[nodeIndex].RightChildIndex);
+            }
+        }
+        assert(nextNodeIndex == numNodes);
+
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+        AABBNode *pNodes = (AABBNode *)(pData + offsets.offsetToBoxes);
+
+        m_reorderedHierarchy.resize(numNodes);
+        m_reorderedBoxes.resize(numNodes);
+        m_reorderedLeafInstances.resize(numNodes);
+        for (UINT32 i = 0; i < numNodes; ++i)
+        {
+            const UINT32 nodeIndex = m_nodeOrder[i];
+            const HierarchyNode &hierarchyNode = m_hierarchy[i];
+            const UINT32 instanceIndex = m_leafInstances[i];
+
+            HierarchyNode &reorderedNode = m_reorderedHierarchy[nodeIndex];
+            reorderedNode.ParentIndex = hierarchyNode.ParentIndex != INVALID_NODE_INDEX ?
+                m_nodeOrder[hierarchyNode.ParentIndex] : INVALID_NODE_INDEX;
+            m_reorderedBoxes[nodeIndex] = m_boxes[i];
+            m_reorderedLeafInstances[nodeIndex] = instanceIndex;
+
+            AABBNode node;
+            SetNodeBox(node, m_boxes[i]);
+            if (instanceIndex != INVALID_NODE_INDEX)
+            {
+                reorderedNode.LeftChildIndex = INVALID_NODE_INDEX;
+                reorderedNode.RightChildIndex = INVALID_NODE_INDEX;
+                m_instanceLeaves[instanceIndex] = nodeIndex;
+
+                node.nodeAllBits = instanceIndex;
+                node.leaf = true;
+                node.rightNodeIndex = 0;
+            }
+            else
+            {
+                reorderedNode.LeftChildIndex = m_nodeOrder[hierarchyNode.LeftChildIndex];
+                reorderedNode.RightChildIndex = m_nodeOrder[hierarchyNode.RightChildIndex];
+                assert(reorderedNode.RightChildIndex == nodeIndex + 1);
+
+                node.nodeAllBits = 0;
+                node.internalNode.leftNodeIndex = reorderedNode.LeftChildIndex;
+                node.rightNodeIndex = reorderedNode.RightChildIndex;
+            }
+            pNodes[nodeIndex] = node;
+        }
+
+        m_hierarchy.swap(m_reorderedHierarchy);
+        m_boxes.swap(m_reorderedBoxes);
+        m_leafInstances.swap(m_reorderedLeafInstances);
+        m_rootIndex = 0;
+    }
+}
@@ -0,0 +1,151 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    struct CpuTopLevelBuildSettings
+    {
+        // An update turns into a full rebuild once the tree's SahCost grows
+        // past this multiple of the SahCost it was last rebuilt with
+        float MaxSahGrowth = 1.5f;
+
+        // Updates where more than this fraction of the instances changed
+        // rebuild instead, refitting that much of the tree costs about as
+        // much and gives a worse tree
+        float MaxChangedInstanceFraction = 0.25f;
+
+        // A moved instance is taken out of the tree and inserted back where
+        // it fits best when refitting would grow its parent's surface area
+        // by more than this fraction. Negative values never reinsert.
+        float ReinsertionThreshold = 0.5f;
+    };
+
+    struct CpuTopLevelBuildStats
+    {
+        UINT NumInstances = 0;
+
+        // Instances whose desc or bottom-level box changed since the last
+        // build, and how many of those were reinserted rather than refit.
+        // Full rebuilds count every instance as touched.
+        UINT NumInstancesTouched = 0;
+        UINT NumInstancesReinserted = 0;
+
+        // AABBNodes written to the output
+        UINT NumNodesRewritten = 0;
+
+        bool bRebuilt = false;
+
+        // See ComputeBVHSahCost. SahGrowth is relative to the last rebuild.
+        float SahCost = 0.0f;
+        float SahGrowth = 1.0f;
+    };
+
+    //
+    // Builds top-level BVH2s on the CPU in the same layout GpuBvh2Builder
+    // writes them: BVHOffsets, the nodes, then a BVHMetadata per instance.
+    // pDesc->InstanceDescs is the CPU address of the
+    // D3D12_RAYTRACING_FALLBACK_INSTANCE_DESCs, or of pointers to them, and
+    // each instance's AccelerationStructure.GpuVA the CPU address of a
+    // bottom-level BVH2 written by CpuBvh2Builder. Only the root box of the
+    // bottom levels is read.
+    //
+    // Builds with ALLOW_UPDATE keep the tree in the builder, so a following
+    // PERFORM_UPDATE into the same output only rewrites what changed: every
+    // instance desc and bottom-level box is compared with the last build,
+    // the metadata of changed instances is rewritten and their leaves are
+    // refit or reinserted, and only the nodes whose boxes changed are
+    // written. Updates fall back to a full rebuild as described in
+    // CpuTopLevelBuildSettings, when the instance count changes, or when
+    // the output isn't the one this builder last wrote.
+    //
+    class CpuTopLevelBvh2Builder
+    {
+    public:
+        // A threadCount of 0 uses one thread per hardware thread
+        CpuTopLevelBvh2Builder(UINT threadCount = 0);
+
+        static UINT GetMaxOutputSize(UINT numInstances);
+
+        void BuildRaytracingAccelerationStructure(
+            _In_  const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc,
+            _Inout_ void *pData);
+
+        CpuTopLevelBuildSettings &GetSettings() { return m_settings; }
+
+        // Rebuilds use the bottom-level builder's SAH settings
+        CpuBvh2BuildSettings &GetBuildSettings() { return m_builder.GetSettings(); }
+
+        const CpuTopLevelBuildStats &GetLastBuildStats() const { return m_stats; }
+
+    private:
+        void LoadInstances(_In_ const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC *pDesc);
+        void Rebuild(_Out_ BYTE *pData);
+        bool Update(_Inout_ BYTE *pData);
+
+        void UpdateNodeBox(UINT32 nodeIndex, const AABB &box);
+        void RefitAncestors(UINT32 nodeIndex);
+
+        // Returns the node that held the leaf and its sibling, which
+        // InsertLeaf reuses as the leaf's new parent
+        UINT32 RemoveLeaf(UINT32 leafIndex);
+        void InsertLeaf(UINT32 leafIndex, UINT32 parentIndex);
+
+        void WriteMetadata(UINT32 instanceIndex, _Inout_ BYTE *pData) const;
+
+        // Writes every node in pre-order and renumbers the tree to match
+        void WriteAllNodes(_Inout_ BYTE *pData);
+
+        CpuBvh2Builder m_builder;
+        CpuTopLevelBuildSettings m_settings;
+        CpuTopLevelBuildStats m_stats;
+
+        // The instances of the build in progress, their bottom-level boxes
+        // and the world boxes of the instances that were transformed
+        std::vector<D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC> m_instances;
+        std::vector<AABB> m_objectBoxes;
+        std::vector<AABB> m_worldBoxes;
+
+        //
+        // The tree the last ALLOW_UPDATE build left in m_pOutput, kept with
+        // exact boxes. Nodes are numbered as they are in the output. Leaves
+        // hold an instance, whose BVHMetadata has the same index, in
+        // m_leafInstances, which is invalid for internal nodes. m_areaSum is
+        // the sum of every node's surface area, kept up to date so updates
+        // don't walk the whole tree for their SahCost.
+        //
+        const BYTE *m_pOutput;
+        std::vector<D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC> m_builtInstances;
+        std::vector<AABB> m_builtObjectBoxes;
+        std::vector<HierarchyNode> m_hierarchy;
+        std::vector<AABB> m_boxes;
+        std::vector<UINT32> m_leafInstances;
+        std::vector<UINT32> m_instanceLeaves;
+        UINT32 m_rootIndex;
+        double m_areaSum;
+        float m_rebuildSahCost;
+
+        // Update scratch. m_nodeStamps marks the nodes rewritten by the
+        // update numbered m_updateStamp.
+        std::vector<UINT32> m_changedInstances;
+        std::vector<UINT32> m_reinsertedInstances;
+        std::vector<UINT32> m_rewrittenNodes;
+        std::vector<UINT32> m_nodeStamps;
+        UINT32 m_updateStamp;
+        std::vector<std::pair<float, UINT32>> m_insertQueue;
+        std::vector<UINT32> m_nodeStack;
+        std::vector<UINT32> m_nodeOrder;
+        std::vector<HierarchyNode> m_reorderedHierarchy;
+        std::vector<AABB> m_reorderedBoxes;
+        std::vector<UINT32> m_reorderedLeafInstances;
+        BVH m_bvh;
+    };
+}
@@ -0,0 +1,398 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    static const UINT MAX_TREELET_PARTITIONS = 1 << MAX_TREELET_SIZE;
+
+    // A treelet is only rewired if that saves more than this fraction of its
+    // cost. Anything less is float rounding between equivalent topologies.
+    static const float MIN_TREELET_IMPROVEMENT = 1e-5f;
+
+    static const UINT32 INVALID_NODE_INDEX = (UINT32)-1;
+
+    static float ComputeBoxSurfaceArea(const AABB &box)
+    {
+        const float dims[3] =
+        {
+            box.max.x - box.min.x,
+            box.max.y - box.min.y,
+            box.max.z - box.min.z
+        };
+
+        return 2 * (dims[0] * dims[1] + dims[0] * dims[2] + dims[1] * dims[2]);
+    }
+
+    static AABB CombineAABB(const AABB &aabb0, const AABB &aabb1)
+    {
+        AABB parentAABB;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            parentAABB.minArr[axis] = std::min(aabb0.minArr[axis], aabb1.minArr[axis]);
+            parentAABB.maxArr[axis] = std::max(aabb0.maxArr[axis], aabb1.maxArr[axis]);
+        }
+        return parentAABB;
+    }
+
+    static UINT32 GetNodeCount(UINT32 numLeaves)
+    {
+        return numLeaves * 2 - 1;
+    }
+
+    // mask is never 0, it always holds at least one treelet leaf
+    static UINT GetLowestBitIndex(UINT mask)
+    {
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (UINT)index;
+    }
+
+    //
+    // Children, boxes and leaf counts of every node. Leaves keep the box
+    // they were packed with, internal nodes get the union of their children.
+    // Children always come after their parent, so walking backwards visits
+    // them first.
+    //
+    static void LoadHierarchy(const AABBNode *pNodes, UINT32 numNodes, CpuTreeletReorderScratch &scratch)
+    {
+        scratch.m_hierarchy.resize(numNodes);
+        scratch.m_boxes.resize(numNodes);
+        scratch.m_leafCounts.resize(numNodes);
+
+        HierarchyNode *hierarchy = scratch.m_hierarchy.data();
+        AABB *boxes = scratch.m_boxes.data();
+        UINT32 *leafCounts = scratch.m_leafCounts.data();
+
+        for (UINT32 nodeIndex = numNodes; nodeIndex-- > 0;)
+        {
+            const AABBNode &node = pNodes[nodeIndex];
+            HierarchyNode &hierarchyNode = hierarchy[nodeIndex];
+            if (node.leaf)
+            {
+                hierarchyNode.LeftChildIndex = INVALID_NODE_INDEX;
+                hierarchyNode.RightChildIndex = INVALID_NODE_INDEX;
+                DecompressAABB(boxes[nodeIndex], node);
+                leafCounts[nodeIndex] = 1;
+            }
+            else
+            {
+                const UINT32 left = node.internalNode.leftNodeIndex;
+                const UINT32 right = nodeIndex + 1;
+                hierarchyNode.LeftChildIndex = left;
+                hierarchyNode.RightChildIndex = right;
+                boxes[nodeIndex] = CombineAABB(boxes[left], boxes[right]);
+                leafCounts[nodeIndex] = leafCounts[left] + leafCounts[right];
+            }
+        }
+    }
+
+    //
+    // FormTreelet, FindOptimalPartitions and ReformTree of
+    // TreeletReorder.hlsl for the treelet under rootIndex, done by one
+    // thread. The root must have at least treeletSize leaves under it.
+    //
+    static void ReorderTreelet(
+        UINT32 rootIndex,
+        UINT treeletSize,
+        HierarchyNode *hierarchy,
+        AABB *boxes,
+        UINT32 *leafCounts)
+    {
+        UINT32 treeletLeaves[MAX_TREELET_SIZE];
+        UINT32 internalNodes[MAX_TREELET_SIZE - 1];
+
+        internalNodes[0] = rootIndex;
+        treeletLeaves[0] = hierarchy[rootIndex].LeftChildIndex;
+        treeletLeaves[1] = hierarchy[rootIndex].RightChildIndex;
+
+        // Only the internal nodes' areas depend on the topology. The cost of
+        // everything below the treelet's leaves is the same either way.
+        float currentCost = ComputeBoxSurfaceArea(boxes[rootIndex]);
+        for (UINT numLeaves = 2; numLeaves < treeletSize; numLeaves++)
+        {
+            // There are more leaves under the root than in the treelet, so
+            // at least one treelet leaf can be opened up
+            float largestSurfaceArea = -1.0f;
+            UINT leafToOpen = 0;
+            for (UINT i = 0; i < numLeaves; i++)
+            {
+                if (leafCounts[treeletLeaves[i]] > 1)
+                {
+                    const float surfaceArea = ComputeBoxSurfaceArea(boxes[treeletLeaves[i]]);
+                    if (surfaceArea > largestSurfaceArea)
+                    {
+                        largestSurfaceArea = surfaceArea;
+                        leafToOpen = i;
+                    }
+                }
+            }
+
+            const UINT32 nodeIndex = treeletLeaves[leafToOpen];
+            internalNodes[numLeaves - 1] = nodeIndex;
+            currentCost += largestSurfaceArea;
+            treeletLeaves[leafToOpen] = hierarchy[nodeIndex].LeftChildIndex;
+            treeletLeaves[numLeaves] = hierarchy[nodeIndex].RightChildIndex;
+        }
+
+        // Lowest cost of a subtree over each subset of the treelet's leaves.
+        // A proper subset of a bitmask is always a smaller number, so
+        // counting up visits all of them before the sets containing them.
+        AABB subsetBoxes[MAX_TREELET_PARTITIONS];
+        float optimalCost[MAX_TREELET_PARTITIONS];
+        BYTE optimalPartition[MAX_TREELET_PARTITIONS];
+
+        const UINT fullPartitionMask = (1u << treeletSize) - 1;
+        for (UINT treeletBitmask = 1; treeletBitmask <= fullPartitionMask; treeletBitmask++)
+        {
+            const UINT lowestBit = treeletBitmask & (0u - treeletBitmask);
+            if (treeletBitmask == lowestBit)
+            {
+                subsetBoxes[treeletBitmask] = boxes[treeletLeaves[GetLowestBitIndex(lowestBit)]];
+                optimalCost[treeletBitmask] = 0.0f;
+                continue;
+            }
+
+            subsetBoxes[treeletBitmask] = CombineAABB(subsetBoxes[treeletBitmask ^ lowestBit], subsetBoxes[lowestBit]);
+
+            // Visits each way of splitting the subset in two once
+            float lowestCost = FLT_MAX;
+            UINT bestPartition = 0;
+            const UINT delta = (treeletBitmask - 1) & treeletBitmask;
+            UINT partitionBitmask = (0u - delta) & treeletBitmask;
+            do
+            {
+                const float cost = optimalCost[partitionBitmask] + optimalCost[treeletBitmask ^ partitionBitmask];
+                if (cost < lowestCost)
+                {
+                    lowestCost = cost;
+                    bestPartition = partitionBitmask;
+                }
+                partitionBitmask = (partitionBitmask - delta) & treeletBitmask;
+            } while (partitionBitmask != 0);
+
+            optimalCost[treeletBitmask] = ComputeBoxSurfaceArea(subsetBoxes[treeletBitmask]) + lowestCost;
+            optimalPartition[treeletBitmask] = (BYTE)bestPartition;
+        }
+
+        if (optimalCost[fullPartitionMask] >= currentCost * (1.0f - MIN_TREELET_IMPROVEMENT))
+        {
+            return;
+        }
+
+        // Reuse the treelet's internal nodes for the new topology
+        struct PartitionEntry
+        {
+            UINT Mask;
+            UINT32 NodeIndex;
+        };
+        PartitionEntry partitionStack[MAX_TREELET_SIZE];
+        UINT partitionStackSize = 1;
+        UINT nodesAllocated = 1;
+        partitionStack[0].Mask = fullPartitionMask;
+        partitionStack[0].NodeIndex = rootIndex;
+
+        while (partitionStackSize > 0)
+        {
+            const PartitionEntry partition = partitionStack[--partitionStackSize];
+
+            PartitionEntry children[2];
+            children[0].Mask = optimalPartition[partition.Mask];
+            children[1].Mask = partition.Mask ^ children[0].Mask;
+            for (PartitionEntry &child : children)
+            {
+                if (child.Mask & (child.Mask - 1))
+                {
+                    child.NodeIndex = internalNodes[nodesAllocated++];
+                    partitionStack[partitionStackSize++] = child;
+                }
+                else
+                {
+                    child.NodeIndex = treeletLeaves[GetLowestBitIndex(child.Mask)];
+                }
+            }
+
+            hierarchy[partition.NodeIndex].LeftChildIndex = children[0].NodeIndex;
+            hierarchy[partition.NodeIndex].RightChildIndex = children[1].NodeIndex;
+        }
+
+        // Nodes are handed out parents first, so going backwards is bottom-up
+        for (UINT i = treeletSize - 1; i-- > 0;)
+        {
+            const UINT32 nodeIndex = internalNodes[i];
+            const UINT32 left = hierarchy[nodeIndex].LeftChildIndex;
+            const UINT32 right = hierarchy[nodeIndex].RightChildIndex;
+            boxes[nodeIndex] = CombineAABB(boxes[left], boxes[right]);
+            leafCounts[nodeIndex] = leafCounts[left] + leafCounts[right];
+        }
+    }
+
+    //
+    // Writes the reordered hierarchy back out in pre-order, right child
+    // first, into scratch.m_reorderedNodes. Leaves are copied as they are.
+    //
+    static void WriteReorderedNodes(const AABBNode *pNodes, UINT32 numNodes, CpuTreeletReorderScratch &scratch)
+    {
+        const HierarchyNode *hierarchy = scratch.m_hierarchy.data();
+        const UINT32 *leafCounts = scratch.m_leafCounts.data();
+
+        std::vector<AABBNode> &reorderedNodes = scratch.m_reorderedNodes;
+        reorderedNodes.resize(numNodes);
+
+        // Pairs of the node to write and where it goes
+        std::vector<UINT32> &stack = scratch.m_stack;
+        stack.clear();
+        stack.push_back(0);
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            const UINT32 outputIndex = stack.back();
+            stack.pop_back();
+            const UINT32 nodeIndex = stack.back();
+            stack.pop_back();
+
+            AABBNode &node = reorderedNodes[outputIndex];
+            if (pNodes[nodeIndex].leaf)
+            {
+                node = pNodes[nodeIndex];
+                continue;
+            }
+
+            const UINT32 left = hierarchy[nodeIndex].LeftChildIndex;
+            const UINT32 right = hierarchy[nodeIndex].RightChildIndex;
+            const UINT32 rightOutputIndex = outputIndex + 1;
+            const UINT32 leftOutputIndex = rightOutputIndex + GetNodeCount(leafCounts[right]);
+
+            SetNodeBox(node, scratch.m_boxes[nodeIndex]);
+            node.nodeAllBits = 0;
+            node.rightNodeIndex = rightOutputIndex;
+            node.internalNode.leftNodeIndex = leftOutputIndex;
+
+            stack.push_back(left);
+            stack.push_back(leftOutputIndex);
+            stack.push_back(right);
+            stack.push_back(rightOutputIndex);
+        }
+    }
+
+    void ReorderTreelets(
+        CpuTaskPool &taskPool,
+        _Inout_updates_(numNodes) AABBNode *pNodes,
+        UINT32 numNodes,
+        UINT treeletSize,
+        UINT iterations,
+        UINT32 parallelThreshold,
+        CpuTreeletReorderScratch &scratch,
+        _Out_ UINT32 *pReferenceOrder,
+        _Out_writes_opt_(iterations) float *pSahCosts)
+    {
+        if (treeletSize < MIN_TREELET_SIZE || treeletSize > MAX_TREELET_SIZE)
+        {
+            ThrowFailure(E_INVALIDARG, L"Treelets must have between MIN_TREELET_SIZE and MAX_TREELET_SIZE leaves");
+        }
+
+        const UINT32 numLeaves = (numNodes + 1) / 2;
+        const UINT32 maxSerialLeaves = taskPool.GetThreadCount() > 1 ? parallelThreshold : numLeaves;
+        UINT32 minTreeletRootLeaves = treeletSize;
+        for (UINT iteration = 0; iteration < iterations; iteration++)
+        {
+            if (minTreeletRootLeaves <= numLeaves)
+            {
+                LoadHierarchy(pNodes, numNodes, scratch);
+                HierarchyNode *hierarchy = scratch.m_hierarchy.data();
+                AABB *boxes = scratch.m_boxes.data();
+                UINT32 *leafCounts = scratch.m_leafCounts.data();
+
+                // Split the tree into subtrees small enough to reorder
+                // serially and the nodes above them, like refits do
+                std::vector<UINT32> &subtrees = scratch.m_subtrees;
+                std::vector<UINT32> &topNodes = scratch.m_topNodes;
+                std::vector<UINT32> &stack = scratch.m_stack;
+                subtrees.clear();
+                topNodes.clear();
+                stack.clear();
+                stack.push_back(0);
+                while (!stack.empty())
+                {
+                    const UINT32 nodeIndex = stack.back();
+                    stack.pop_back();
+
+                    if (leafCounts[nodeIndex] <= maxSerialLeaves)
+                    {
+                        subtrees.push_back(nodeIndex);
+                    }
+                    else
+                    {
+                        topNodes.push_back(nodeIndex);
+                        stack.push_back(hierarchy[nodeIndex].LeftChildIndex);
+                        stack.push_back(hierarchy[nodeIndex].RightChildIndex);
+                    }
+                }
+
+                // A treelet only ever rewires nodes under its root, which in
+                // pre-order all come after it. Going backwards through a
+                // subtree reaches every node after all of its descendants,
+                // with its own children untouched.
+                taskPool.ParallelFor((UINT)subtrees.size(), 1, [&](UINT begin, UINT end)
+                {
+                    for (UINT i = begin; i < end; ++i)
+                    {
+                        const UINT32 root = subtrees[i];
+                        for (UINT32 nodeIndex = root + GetNodeCount(leafCounts[root]); nodeIndex-- > root;)
+                        {
+                            if (leafCounts[nodeIndex] >= minTreeletRootLeaves)
+                            {
+                                ReorderTreelet(nodeIndex, treeletSize, hierarchy, boxes, leafCounts);
+                            }
+                        }
+                    }
+                });
+
+                // Both children of a top node are either subtrees or top
+                // nodes found after it
+                for (size_t i = topNodes.size(); i-- > 0;)
+                {
+                    if (leafCounts[topNodes[i]] >= minTreeletRootLeaves)
+                    {
+                        ReorderTreelet(topNodes[i], treeletSize, hierarchy, boxes, leafCounts);
+                    }
+                }
+
+                WriteReorderedNodes(pNodes, numNodes, scratch);
+                memcpy(pNodes, scratch.m_reorderedNodes.data(), numNodes * sizeof(AABBNode));
+                minTreeletRootLeaves *= 2;
+            }
+
+            if (pSahCosts)
+            {
+                pSahCosts[iteration] = ComputeBVHSahCost(pNodes, numNodes);
+            }
+        }
+
+        // Leaves now come in a different order, renumber their references
+        UINT32 numReferences = 0;
+        for (UINT32 nodeIndex = 0; nodeIndex < numNodes; nodeIndex++)
+        {
+            AABBNode &node = pNodes[nodeIndex];
+            if (node.leaf)
+            {
+                const UINT32 firstReference = node.leafNode.firstTriangleId;
+                const UINT32 numLeafReferences = node.leafNode.numTriangleIds;
+                for (UINT32 i = 0; i < numLeafReferences; i++)
+                {
+                    pReferenceOrder[numReferences + i] = firstReference + i;
+                }
+                node.leafNode.firstTriangleId = numReferences;
+                numReferences += numLeafReferences;
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    static const UINT MIN_TREELET_SIZE = 3;
+    static const UINT MAX_TREELET_SIZE = 8;
+
+    //
+    // Memory ReorderTreelets keeps around between calls. Everything is
+    // indexed by node, in the pre-order layout the tree had at the start of
+    // the current iteration.
+    //
+    struct CpuTreeletReorderScratch
+    {
+        std::vector<HierarchyNode> m_hierarchy;
+        std::vector<AABB> m_boxes;
+        std::vector<UINT32> m_leafCounts;
+
+        // Subtrees reordered serially on a worker thread, and the nodes
+        // above them
+        std::vector<UINT32> m_subtrees;
+        std::vector<UINT32> m_topNodes;
+
+        std::vector<AABBNode> m_reorderedNodes;
+        std::vector<UINT32> m_stack;
+    };
+
+    //
+    // CPU version of TreeletReorder, the treelet restructuring from "Fast
+    // Parallel Construction of High-Quality Bounding Volume Hierarchies"
+    // (Karras and Aila 2013), for BVH2s laid out like WriteBVHToOutput's.
+    //
+    // Nodes are visited bottom-up. A node with enough leaves under it grows a
+    // treelet of treeletSize leaves by repeatedly opening up the treelet leaf
+    // with the largest surface area, the same way TreeletReorder.hlsl does,
+    // and the internal nodes of the treelet are rewired into the topology
+    // with the lowest SAH cost over all ways of partitioning its leaves.
+    // Like the GPU passes, each iteration only considers subtrees with at
+    // least twice as many leaves as the one before, starting at treeletSize.
+    //
+    // Only internal nodes move, so the node count and every leaf's box stay
+    // the same. Subtrees with no more than parallelThreshold leaves are
+    // reordered by a single task. The result doesn't depend on the number of
+    // threads.
+    //
+    // Afterwards leaves are renumbered so the references under any node are
+    // still one contiguous range, in the order the leaves now appear in.
+    // pReferenceOrder receives, for every reference, the index it had
+    // before; the caller moves its primitives and metadata to match.
+    // pSahCosts, if given, receives ComputeBVHSahCost after every iteration.
+    //
+    void ReorderTreelets(
+        CpuTaskPool &taskPool,
+        _Inout_updates_(numNodes) AABBNode *pNodes,
+        UINT32 numNodes,
+        UINT treeletSize,
+        UINT iterations,
+        UINT32 parallelThreshold,
+        CpuTreeletReorderScratch &scratch,
+        _Out_ UINT32 *pReferenceOrder,
+        _Out_writes_opt_(iterations) float *pSahCosts);
+}
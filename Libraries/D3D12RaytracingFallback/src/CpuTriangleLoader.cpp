@@ -0,0 +1,297 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    static bool IsVertexFormatSupported(DXGI_FORMAT format)
+    {
+        switch (format)
+        {
+        case DXGI_FORMAT_UNKNOWN:
+        case DXGI_FORMAT_R32G32B32_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        case DXGI_FORMAT_R32G32_FLOAT:
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R16G16_FLOAT:
+        case DXGI_FORMAT_R16G16B16A16_SNORM:
+        case DXGI_FORMAT_R16G16_SNORM:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Fp16ToFp32 turns infinities and NaNs into large finite values, which
+    // would get past the NaN check on triangle boxes
+    static float HalfToFloat(UINT16 v)
+    {
+        if ((v & 0x7C00) == 0x7C00)
+        {
+            const UINT bits = (v & 0x8000) << 16 | 0x7F800000 | (v & 0x03FF) << 13;
+            return (const float &)bits;
+        }
+        return Fp16ToFp32(v);
+    }
+
+    // -32768 and -32767 both map to -1
+    static float SnormToFloat(UINT16 v)
+    {
+        return std::max((INT16)v / 32767.0f, -1.0f);
+    }
+
+    // Position of a vertex in xyz, w is always 0. Reads only the bytes of
+    // the position, the last vertex of a buffer may be all there is.
+    template <DXGI_FORMAT VertexFormat>
+    static __m128 LoadVertex(const BYTE *pVertex)
+    {
+        const float *p = (const float *)pVertex;
+        return _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+    }
+
+    template <>
+    __m128 LoadVertex<DXGI_FORMAT_R32G32_FLOAT>(const BYTE *pVertex)
+    {
+        const float *p = (const float *)pVertex;
+        return _mm_setr_ps(p[0], p[1], 0.0f, 0.0f);
+    }
+
+    template <>
+    __m128 LoadVertex<DXGI_FORMAT_R16G16B16A16_FLOAT>(const BYTE *pVertex)
+    {
+        const UINT16 *p = (const UINT16 *)pVertex;
+        return _mm_setr_ps(HalfToFloat(p[0]), HalfToFloat(p[1]), HalfToFloat(p[2]), 0.0f);
+    }
+
+    template <>
+    __m128 LoadVertex<DXGI_FORMAT_R16G16_FLOAT>(const BYTE *pVertex)
+    {
+        const UINT16 *p = (const UINT16 *)pVertex;
+        return _mm_setr_ps(HalfToFloat(p[0]), HalfToFloat(p[1]), 0.0f, 0.0f);
+    }
+
+    template <>
+    __m128 LoadVertex<DXGI_FORMAT_R16G16B16A16_SNORM>(const BYTE *pVertex)
+    {
+        const UINT16 *p = (const UINT16 *)pVertex;
+        return _mm_setr_ps(SnormToFloat(p[0]), SnormToFloat(p[1]), SnormToFloat(p[2]), 0.0f);
+    }
+
+    template <>
+    __m128 LoadVertex<DXGI_FORMAT_R16G16_SNORM>(const BYTE *pVertex)
+    {
+        const UINT16 *p = (const UINT16 *)pVertex;
+        return _mm_setr_ps(SnormToFloat(p[0]), SnormToFloat(p[1]), 0.0f, 0.0f);
+    }
+
+    static __m128 LoadVertex(DXGI_FORMAT vertexFormat, const BYTE *pVertex)
+    {
+        switch (vertexFormat)
+        {
+        case DXGI_FORMAT_R32G32_FLOAT:
+            return LoadVertex<DXGI_FORMAT_R32G32_FLOAT>(pVertex);
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            return LoadVertex<DXGI_FORMAT_R16G16B16A16_FLOAT>(pVertex);
+        case DXGI_FORMAT_R16G16_FLOAT:
+            return LoadVertex<DXGI_FORMAT_R16G16_FLOAT>(pVertex);
+        case DXGI_FORMAT_R16G16B16A16_SNORM:
+            return LoadVertex<DXGI_FORMAT_R16G16B16A16_SNORM>(pVertex);
+        case DXGI_FORMAT_R16G16_SNORM:
+            return LoadVertex<DXGI_FORMAT_R16G16_SNORM>(pVertex);
+        default:
+            return LoadVertex<DXGI_FORMAT_R32G32B32_FLOAT>(pVertex);
+        }
+    }
+
+    // IndexType is void for geometries without an index buffer
+    template <typename IndexType>
+    static UINT32 GetVertexIndex(const void *pIndices, UINT32 index)
+    {
+        return ((const IndexType *)pIndices)[index];
+    }
+
+    template <>
+    UINT32 GetVertexIndex<void>(const void *, UINT32 index)
+    {
+        return index;
+    }
+
+    static UINT32 GetVertexIndex(DXGI_FORMAT indexFormat, const void *pIndices, UINT32 index)
+    {
+        switch (indexFormat)
+        {
+        case DXGI_FORMAT_R16_UINT:
+            return GetVertexIndex<UINT16>(pIndices, index);
+        case DXGI_FORMAT_R32_UINT:
+            return GetVertexIndex<UINT32>(pIndices, index);
+        default:
+            return GetVertexIndex<void>(pIndices, index);
+        }
+    }
+
+    static void StoreFloat3(__m128 v, float *p)
+    {
+        float lanes[4];
+        _mm_storeu_ps(lanes, v);
+        p[0] = lanes[0];
+        p[1] = lanes[1];
+        p[2] = lanes[2];
+    }
+
+    //
+    // min(v2, min(v0, v1)) and max(v2, max(v0, v1)) per axis, with the
+    // operands in the order std::min and std::max compare them so a NaN
+    // vertex gives the same box it always has. Axes where either bound
+    // still ends up NaN are emptied to 0.
+    //
+    static void ComputeTriangleBox(__m128 v0, __m128 v1, __m128 v2, AABB &box)
+    {
+        const __m128 boxMin = _mm_min_ps(_mm_min_ps(v1, v0), v2);
+        const __m128 boxMax = _mm_add_ps(_mm_max_ps(_mm_max_ps(v1, v0), v2), _mm_set1_ps(AABB_Min_Padding));
+        const __m128 nanAxes = _mm_or_ps(_mm_cmpunord_ps(boxMin, boxMin), _mm_cmpunord_ps(boxMax, boxMax));
+        StoreFloat3(_mm_andnot_ps(nanAxes, boxMin), box.minArr);
+        StoreFloat3(_mm_andnot_ps(nanAxes, boxMax), box.maxArr);
+    }
+
+    template <DXGI_FORMAT VertexFormat, typename IndexType>
+    static void LoadTriangleBoxes(
+        const BYTE *pVertices,
+        UINT64 vertexStride,
+        const void *pIndices,
+        UINT32 begin,
+        UINT32 end,
+        AABB *pBoxes)
+    {
+        for (UINT32 i = begin; i < end; i++)
+        {
+            const __m128 v0 = LoadVertex<VertexFormat>(pVertices + GetVertexIndex<IndexType>(pIndices, i * 3 + 0) * vertexStride);
+            const __m128 v1 = LoadVertex<VertexFormat>(pVertices + GetVertexIndex<IndexType>(pIndices, i * 3 + 1) * vertexStride);
+            const __m128 v2 = LoadVertex<VertexFormat>(pVertices + GetVertexIndex<IndexType>(pIndices, i * 3 + 2) * vertexStride);
+            ComputeTriangleBox(v0, v1, v2, pBoxes[i - begin]);
+        }
+    }
+
+    template <DXGI_FORMAT VertexFormat>
+    static void LoadTriangleBoxes(
+        const BYTE *pVertices,
+        UINT64 vertexStride,
+        DXGI_FORMAT indexFormat,
+        const void *pIndices,
+        UINT32 begin,
+        UINT32 end,
+        AABB *pBoxes)
+    {
+        switch (indexFormat)
+        {
+        case DXGI_FORMAT_R16_UINT:
+            LoadTriangleBoxes<VertexFormat, UINT16>(pVertices, vertexStride, pIndices, begin, end, pBoxes);
+            break;
+        case DXGI_FORMAT_R32_UINT:
+            LoadTriangleBoxes<VertexFormat, UINT32>(pVertices, vertexStride, pIndices, begin, end, pBoxes);
+            break;
+        default:
+            LoadTriangleBoxes<VertexFormat, void>(pVertices, vertexStride, pIndices, begin, end, pBoxes);
+            break;
+        }
+    }
+
+    void CpuTriangleLoader::Reset(UINT numGeometries, const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometries)
+    {
+        m_geometries.resize(numGeometries);
+        m_firstTriangles.resize(numGeometries + 1);
+
+        UINT32 numTriangles = 0;
+        for (UINT i = 0; i < numGeometries; ++i)
+        {
+            auto &geometry = pGeometries[i];
+            if (geometry.Type != D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES)
+            {
+                throw - 1; // Intersection shaders not supported yet
+            }
+
+            const D3D12_RAYTRACING_GEOMETRY_TRIANGLES_DESC &triangles = geometry.Triangles;
+            const UINT geometryTriangles = GetPrimitiveCountFromGeometryDesc(geometry);
+            if (geometryTriangles && !IsVertexFormatSupported(triangles.VertexFormat))
+            {
+                ThrowFailure(E_NOTIMPL, L"Unsupported vertex buffer format provided");
+            }
+
+            Geometry &loaderGeometry = m_geometries[i];
+            loaderGeometry.m_pVertices = (const BYTE *)triangles.VertexBuffer.StartAddress;
+            loaderGeometry.m_vertexStride = triangles.VertexBuffer.StrideInBytes;
+            loaderGeometry.m_vertexFormat = triangles.VertexFormat;
+            loaderGeometry.m_pIndices = (const void *)triangles.IndexBuffer;
+            loaderGeometry.m_indexFormat = triangles.IndexFormat;
+
+            m_firstTriangles[i] = numTriangles;
+            numTriangles += geometryTriangles;
+        }
+        m_firstTriangles[numGeometries] = numTriangles;
+    }
+
+    UINT CpuTriangleLoader::FindGeometry(UINT32 triangleIndex) const
+    {
+        // Empty geometries share their first triangle with the next one, the
+        // last geometry starting at or before triangleIndex is the one
+        return (UINT)(std::upper_bound(m_firstTriangles.begin(), m_firstTriangles.end() - 1, triangleIndex) - m_firstTriangles.begin()) - 1;
+    }
+
+    void CpuTriangleLoader::LoadTriangle(UINT geometryIndex, UINT32 triangleIndex, float *pVertices) const
+    {
+        const Geometry &geometry = m_geometries[geometryIndex];
+        for (UINT k = 0; k < 3; ++k)
+        {
+            const UINT32 vertexIndex = GetVertexIndex(geometry.m_indexFormat, geometry.m_pIndices, triangleIndex * 3 + k);
+            StoreFloat3(LoadVertex(geometry.m_vertexFormat, geometry.m_pVertices + vertexIndex * geometry.m_vertexStride), pVertices + k * 3);
+        }
+    }
+
+    void CpuTriangleLoader::LoadTriangle(UINT geometryIndex, UINT32 triangleIndex, float *pVertices, AABB &box) const
+    {
+        LoadTriangle(geometryIndex, triangleIndex, pVertices);
+        ComputeTriangleBox(
+            LoadVertex<DXGI_FORMAT_R32G32B32_FLOAT>((const BYTE *)(pVertices + 0)),
+            LoadVertex<DXGI_FORMAT_R32G32B32_FLOAT>((const BYTE *)(pVertices + 3)),
+            LoadVertex<DXGI_FORMAT_R32G32B32_FLOAT>((const BYTE *)(pVertices + 6)),
+            box);
+    }
+
+    void CpuTriangleLoader::LoadBoxes(UINT geometryIndex, UINT32 begin, UINT32 end, AABB *pBoxes) const
+    {
+        const Geometry &geometry = m_geometries[geometryIndex];
+        const BYTE *pVertices = geometry.m_pVertices;
+        const UINT64 stride = geometry.m_vertexStride;
+        const DXGI_FORMAT indexFormat = geometry.m_indexFormat;
+        const void *pIndices = geometry.m_pIndices;
+
+        switch (geometry.m_vertexFormat)
+        {
+        case DXGI_FORMAT_R32G32_FLOAT:
+            LoadTriangleBoxes<DXGI_FORMAT_R32G32_FLOAT>(pVertices, stride, indexFormat, pIndices, begin, end, pBoxes);
+            break;
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            LoadTriangleBoxes<DXGI_FORMAT_R16G16B16A16_FLOAT>(pVertices, stride, indexFormat, pIndices, begin, end, pBoxes);
+            break;
+        case DXGI_FORMAT_R16G16_FLOAT:
+            LoadTriangleBoxes<DXGI_FORMAT_R16G16_FLOAT>(pVertices, stride, indexFormat, pIndices, begin, end, pBoxes);
+            break;
+        case DXGI_FORMAT_R16G16B16A16_SNORM:
+            LoadTriangleBoxes<DXGI_FORMAT_R16G16B16A16_SNORM>(pVertices, stride, indexFormat, pIndices, begin, end, pBoxes);
+            break;
+        case DXGI_FORMAT_R16G16_SNORM:
+            LoadTriangleBoxes<DXGI_FORMAT_R16G16_SNORM>(pVertices, stride, indexFormat, pIndices, begin, end, pBoxes);
+            break;
+        default:
+            LoadTriangleBoxes<DXGI_FORMAT_R32G32B32_FLOAT>(pVertices, stride, indexFormat, pIndices, begin, end, pBoxes);
+            break;
+        }
+    }
+}
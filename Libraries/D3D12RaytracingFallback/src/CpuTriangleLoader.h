@@ -0,0 +1,73 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+// Added to the top of every triangle box, matching RayTracingHelper.hlsli
+#define AABB_Min_Padding 0.001f
+
+namespace FallbackLayer
+{
+    //
+    // Reads triangles straight out of the vertex and index buffers of a
+    // build's geometry descs, so builds and refits never keep a copy of the
+    // input vertices. Vertices can be R32G32B32_FLOAT, R32G32B32A32_FLOAT,
+    // R32G32_FLOAT, R16G16B16A16_FLOAT, R16G16_FLOAT, R16G16B16A16_SNORM or
+    // R16G16_SNORM at any stride, with R16 or R32 indices or none. The 4th
+    // component is ignored and 2 component positions have a z of 0. An
+    // UNKNOWN vertex format is read as R32G32B32_FLOAT, which is all the CPU
+    // builder used to support.
+    //
+    // Triangles are numbered across all geometries in order, the same way
+    // PrimitiveMetaData::PrimitiveIndex numbers them.
+    //
+    class CpuTriangleLoader
+    {
+    public:
+        // Throws E_NOTIMPL for formats it can't read. pGeometries must stay
+        // valid until the next Reset.
+        void Reset(UINT numGeometries, _In_reads_(numGeometries) const D3D12_RAYTRACING_GEOMETRY_DESC *pGeometries);
+
+        UINT GetNumGeometries() const { return (UINT)m_geometries.size(); }
+        UINT32 GetNumTriangles() const { return m_firstTriangles.back(); }
+        UINT32 GetFirstTriangle(UINT geometryIndex) const { return m_firstTriangles[geometryIndex]; }
+
+        // Geometry the triangle at triangleIndex across all geometries is in
+        UINT FindGeometry(UINT32 triangleIndex) const;
+
+        // Writes the 3 vertices of a triangle of a geometry as 9 floats
+        void LoadTriangle(UINT geometryIndex, UINT32 triangleIndex, _Out_writes_(9) float *pVertices) const;
+
+        // Same as above, and computes the triangle's box like LoadBoxes
+        void LoadTriangle(UINT geometryIndex, UINT32 triangleIndex, _Out_writes_(9) float *pVertices, AABB &box) const;
+
+        //
+        // Boxes of a geometry's triangles [begin, end), padded by
+        // AABB_Min_Padding. An axis with a NaN in it is left empty at 0.
+        // Decodes and bounds each triangle in SSE registers in one pass.
+        //
+        void LoadBoxes(UINT geometryIndex, UINT32 begin, UINT32 end, _Out_writes_(end - begin) AABB *pBoxes) const;
+
+    private:
+        struct Geometry
+        {
+            const BYTE *m_pVertices;
+            UINT64 m_vertexStride;
+            DXGI_FORMAT m_vertexFormat;
+            const void *m_pIndices;
+            DXGI_FORMAT m_indexFormat;
+        };
+
+        std::vector<Geometry> m_geometries;
+
+        // One more than there are geometries, the last is the total
+        std::vector<UINT32> m_firstTriangles;
+    };
+}
@@ -0,0 +1,464 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#include "pch.h"
+
+namespace FallbackLayer
+{
+    static const UINT WIDE_TRAVERSAL_STACK_SIZE = 512;
+    static const UINT WIDE_BVH_MAX_PRIMITIVES_IN_LEAF = 127;
+
+    static_assert(sizeof(Bvh4Node) == 7 * 16, "Bvh4Node should have no padding");
+    static_assert(sizeof(Bvh8Node) == 7 * 32, "Bvh8Node should have no padding");
+
+    static float ComputeSurfaceArea(const AABBNode &node)
+    {
+        AABB box;
+        DecompressAABB(box, node);
+        const float dX = box.max.x - box.min.x;
+        const float dY = box.max.y - box.min.y;
+        const float dZ = box.max.z - box.min.z;
+        return 2.0f * (dX * dY + dX * dZ + dY * dZ);
+    }
+
+    //
+    // Picks the wide layout with a bottom-up dynamic program over the BVH2.
+    // For every node and slot count i in [1, Width], m_costs holds the
+    // lowest SAH cost of covering the node's subtree with at most i child
+    // slots of a wide node:
+    //   i == 1: the node is either a leaf, if its primitives are contiguous
+    //           and few enough, or a wide node whose slots are spread over
+    //           its two children
+    //   i > 1:  the node isn't a wide node itself and its i slots are split
+    //           between its two children
+    //
+    template<UINT Width>
+    class WideBvhCollapser
+    {
+    public:
+        WideBvhCollapser(const BYTE *pBvhData, const WideBvhCollapseSettings &settings) :
+            m_pBvhData(pBvhData),
+            m_settings(settings)
+        {
+            const BVHOffsets &offsets = *(const BVHOffsets *)pBvhData;
+            m_pNodes = (const AABBNode *)(pBvhData + offsets.offsetToBoxes);
+            m_numNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode);
+            assert(settings.MaxPrimitivesInLeaf <= WIDE_BVH_MAX_PRIMITIVES_IN_LEAF);
+        }
+
+        void Collapse(_Out_ BYTE *pWideData)
+        {
+            ComputeCosts();
+
+            std::vector<WideBvhNode<Width>> wideNodes;
+            std::deque<std::pair<UINT, UINT>> nodesToEmit;
+            std::vector<UINT> slots;
+
+            // The root is always a wide node, even when it's cheaper as a leaf
+            wideNodes.push_back(WideBvhNode<Width>());
+            nodesToEmit.push_back(std::make_pair(0u, 0u));
+            while (nodesToEmit.size())
+            {
+                const UINT nodeIndex = nodesToEmit.front().first;
+                const UINT wideNodeIndex = nodesToEmit.front().second;
+                nodesToEmit.pop_front();
+
+                slots.clear();
+                const AABBNode &node = m_pNodes[nodeIndex];
+                if (node.leaf)
+                {
+                    slots.push_back(nodeIndex);
+                }
+                else
+                {
+                    const UINT split = m_wideNodeSplits[nodeIndex];
+                    CollectSlots(node.rightNodeIndex, split, slots);
+                    CollectSlots(node.internalNode.leftNodeIndex, Width - split, slots);
+                }
+                assert(slots.size() <= Width);
+
+                WideBvhNode<Width> wideNode;
+                for (UINT child = 0; child < Width; child++)
+                {
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        wideNode.childBounds[axis][0][child] = FLT_MAX;
+                        wideNode.childBounds[axis][1][child] = -FLT_MAX;
+                    }
+                    wideNode.children[child] = WIDE_BVH_EMPTY_CHILD;
+                }
+
+                for (UINT child = 0; child < slots.size(); child++)
+                {
+                    const UINT slotNodeIndex = slots[child];
+                    AABB box;
+                    DecompressAABB(box, m_pNodes[slotNodeIndex]);
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        wideNode.childBounds[axis][0][child] = box.minArr[axis];
+                        wideNode.childBounds[axis][1][child] = box.maxArr[axis];
+                    }
+
+                    if (m_isLeaf[slotNodeIndex])
+                    {
+                        wideNode.children[child] = WIDE_BVH_LEAF_FLAG |
+                            m_numPrimitives[slotNodeIndex] << 24 |
+                            m_firstPrimitive[slotNodeIndex];
+                    }
+                    else
+                    {
+                        wideNode.children[child] = (UINT)wideNodes.size();
+                        nodesToEmit.push_back(std::make_pair(slotNodeIndex, (UINT)wideNodes.size()));
+                        wideNodes.push_back(WideBvhNode<Width>());
+                    }
+                }
+                wideNodes[wideNodeIndex] = wideNode;
+            }
+
+            const BVHOffsets &offsets = *(const BVHOffsets *)m_pBvhData;
+            BVHOffsets wideOffsets;
+            wideOffsets.offsetToBoxes = sizeof(BVHOffsets);
+            wideOffsets.offsetToVertices = wideOffsets.offsetToBoxes + (UINT)(wideNodes.size() * sizeof(WideBvhNode<Width>));
+            wideOffsets.offsetToPrimitiveMetaData = wideOffsets.offsetToVertices + (offsets.offsetToPrimitiveMetaData - offsets.offsetToVertices);
+            wideOffsets.totalSize = wideOffsets.offsetToPrimitiveMetaData + (offsets.totalSize - offsets.offsetToPrimitiveMetaData);
+
+            memcpy(pWideData, &wideOffsets, sizeof(wideOffsets));
+            memcpy(pWideData + wideOffsets.offsetToBoxes, wideNodes.data(), wideNodes.size() * sizeof(WideBvhNode<Width>));
+            memcpy(pWideData + wideOffsets.offsetToVertices,
+                m_pBvhData + offsets.offsetToVertices,
+                offsets.totalSize - offsets.offsetToVertices);
+        }
+
+    private:
+        float &Cost(UINT nodeIndex, UINT numSlots) { return m_costs[nodeIndex * Width + numSlots - 1]; }
+        BYTE &Split(UINT nodeIndex, UINT numSlots) { return m_splits[nodeIndex * Width + numSlots - 1]; }
+
+        // Cheapest way of giving numSlots slots to the two children of a node,
+        // returns the number of slots that go to the right child
+        UINT DistributeSlots(const AABBNode &node, UINT numSlots, float &cost)
+        {
+            UINT bestSplit = 1;
+            cost = FLT_MAX;
+            for (UINT split = 1; split < numSlots; split++)
+            {
+                const float splitCost =
+                    Cost(node.rightNodeIndex, split) +
+                    Cost(node.internalNode.leftNodeIndex, numSlots - split);
+                if (splitCost < cost)
+                {
+                    cost = splitCost;
+                    bestSplit = split;
+                }
+            }
+            return bestSplit;
+        }
+
+        void ComputeCosts()
+        {
+            m_costs.resize(m_numNodes * Width);
+            m_splits.assign(m_numNodes * Width, 0);
+            m_wideNodeSplits.resize(m_numNodes);
+            m_isLeaf.resize(m_numNodes);
+            m_firstPrimitive.resize(m_numNodes);
+            m_numPrimitives.resize(m_numNodes);
+            m_isContiguous.resize(m_numNodes);
+
+            // Children always come after their parent
+            for (UINT nodeIndex = m_numNodes; nodeIndex-- > 0;)
+            {
+                const AABBNode &node = m_pNodes[nodeIndex];
+                const float surfaceArea = ComputeSurfaceArea(node);
+
+                if (node.leaf)
+                {
+                    m_firstPrimitive[nodeIndex] = node.leafNode.firstTriangleId;
+                    m_numPrimitives[nodeIndex] = node.leafNode.numTriangleIds;
+                    m_isContiguous[nodeIndex] = true;
+                    m_isLeaf[nodeIndex] = true;
+
+                    const float leafCost = surfaceArea * m_numPrimitives[nodeIndex] * m_settings.IntersectionCost;
+                    for (UINT numSlots = 1; numSlots <= Width; numSlots++)
+                    {
+                        Cost(nodeIndex, numSlots) = leafCost;
+                    }
+                    continue;
+                }
+
+                // A subtree can only become a leaf if its primitives are
+                // one contiguous range, which the CPU builder guarantees
+                const UINT left = node.internalNode.leftNodeIndex;
+                const UINT right = node.rightNodeIndex;
+                m_firstPrimitive[nodeIndex] = std::min(m_firstPrimitive[left], m_firstPrimitive[right]);
+                m_numPrimitives[nodeIndex] = m_numPrimitives[left] + m_numPrimitives[right];
+                m_isContiguous[nodeIndex] = m_isContiguous[left] && m_isContiguous[right] &&
+                    (m_firstPrimitive[right] + m_numPrimitives[right] == m_firstPrimitive[left] ||
+                     m_firstPrimitive[left] + m_numPrimitives[left] == m_firstPrimitive[right]);
+
+                float distributedCost;
+                m_wideNodeSplits[nodeIndex] = DistributeSlots(node, Width, distributedCost);
+                const float wideNodeCost = surfaceArea * m_settings.TraversalCost + distributedCost;
+
+                float leafCost = FLT_MAX;
+                if (m_isContiguous[nodeIndex] && m_numPrimitives[nodeIndex] <= m_settings.MaxPrimitivesInLeaf)
+                {
+                    leafCost = surfaceArea * m_numPrimitives[nodeIndex] * m_settings.IntersectionCost;
+                }
+
+                m_isLeaf[nodeIndex] = leafCost <= wideNodeCost;
+                Cost(nodeIndex, 1) = std::min(leafCost, wideNodeCost);
+
+                for (UINT numSlots = 2; numSlots <= Width; numSlots++)
+                {
+                    float cost;
+                    const UINT split = DistributeSlots(node, numSlots, cost);
+                    if (cost < Cost(nodeIndex, numSlots - 1))
+                    {
+                        Cost(nodeIndex, numSlots) = cost;
+                        Split(nodeIndex, numSlots) = (BYTE)split;
+                    }
+                    else
+                    {
+                        Cost(nodeIndex, numSlots) = Cost(nodeIndex, numSlots - 1);
+                    }
+                }
+            }
+        }
+
+        // Appends the BVH2 nodes that cover nodeIndex's subtree with at most
+        // numSlots slots, following the choices made by ComputeCosts
+        void CollectSlots(UINT nodeIndex, UINT numSlots, std::vector<UINT> &slots)
+        {
+            while (numSlots > 1 && Split(nodeIndex, numSlots) == 0)
+            {
+                numSlots--;
+            }
+
+            if (numSlots == 1)
+            {
+                slots.push_back(nodeIndex);
+                return;
+            }
+
+            const AABBNode &node = m_pNodes[nodeIndex];
+            const UINT split = Split(nodeIndex, numSlots);
+            CollectSlots(node.rightNodeIndex, split, slots);
+            CollectSlots(node.internalNode.leftNodeIndex, numSlots - split, slots);
+        }
+
+        const BYTE *m_pBvhData;
+        const AABBNode *m_pNodes;
+        UINT m_numNodes;
+        const WideBvhCollapseSettings &m_settings;
+
+        std::vector<float> m_costs;
+        std::vector<BYTE> m_splits;
+        std::vector<BYTE> m_wideNodeSplits;
+        std::vector<BYTE> m_isLeaf;
+        std::vector<BYTE> m_isContiguous;
+        std::vector<UINT> m_firstPrimitive;
+        std::vector<UINT> m_numPrimitives;
+    };
+
+    UINT GetMaxWideBVHSize(const BYTE *pBvhData, UINT width)
+    {
+        assert(width == 4 || width == 8);
+        const BVHOffsets &offsets = *(const BVHOffsets *)pBvhData;
+        const UINT numNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(AABBNode);
+
+        // Every wide node comes from a different internal BVH2 node, except
+        // for a root that's a leaf
+        const UINT maxWideNodes = std::max(1u, numNodes / 2);
+        const UINT wideNodeSize = width == 4 ? sizeof(Bvh4Node) : sizeof(Bvh8Node);
+        return sizeof(BVHOffsets) + maxWideNodes * wideNodeSize + (offsets.totalSize - offsets.offsetToVertices);
+    }
+
+    void CollapseBVH4(const BYTE *pBvhData, const WideBvhCollapseSettings &settings, _Out_ BYTE *pWideData)
+    {
+        WideBvhCollapser<4>(pBvhData, settings).Collapse(pWideData);
+    }
+
+    void CollapseBVH8(const BYTE *pBvhData, const WideBvhCollapseSettings &settings, _Out_ BYTE *pWideData)
+    {
+        WideBvhCollapser<8>(pBvhData, settings).Collapse(pWideData);
+    }
+
+    struct WideTraversalRay
+    {
+        float origin[3];
+        float invDirection[3];
+
+        // 0 when the ray enters children through their min planes, 1 when
+        // through their max planes
+        UINT nearPlane[3];
+    };
+
+    struct WideTraversalStackEntry
+    {
+        UINT child;
+        float tEntry;
+    };
+
+    //
+    // Child tests return a bit per child hit within [tMin, tMax], along with
+    // the distance at which the ray enters each child. A NaN from a ray
+    // starting on a plane it's parallel to leaves that axis unbounded.
+    //
+
+    template<UINT Width>
+    static UINT IntersectChildrenScalar(const WideBvhNode<Width> &node, const WideTraversalRay &ray, float tMin, float tMax, _Out_writes_(Width) float *pEntry)
+    {
+        UINT hitMask = 0;
+        for (UINT child = 0; child < Width; child++)
+        {
+            float tNear = tMin;
+            float tFar = tMax;
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                const float axisNear = (node.childBounds[axis][ray.nearPlane[axis]][child] - ray.origin[axis]) * ray.invDirection[axis];
+                const float axisFar = (node.childBounds[axis][1 - ray.nearPlane[axis]][child] - ray.origin[axis]) * ray.invDirection[axis];
+                tNear = axisNear > tNear ? axisNear : tNear;
+                tFar = axisFar < tFar ? axisFar : tFar;
+            }
+            pEntry[child] = tNear;
+            hitMask |= (tNear <= tFar ? 1u : 0u) << child;
+        }
+        return hitMask;
+    }
+
+    static UINT IntersectChildrenSse(const Bvh4Node &node, const WideTraversalRay &ray, float tMin, float tMax, _Out_writes_(4) float *pEntry)
+    {
+        __m128 tNear = _mm_set1_ps(tMin);
+        __m128 tFar = _mm_set1_ps(tMax);
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            const __m128 origin = _mm_set1_ps(ray.origin[axis]);
+            const __m128 invDirection = _mm_set1_ps(ray.invDirection[axis]);
+            const __m128 nearPlanes = _mm_loadu_ps(node.childBounds[axis][ray.nearPlane[axis]]);
+            const __m128 farPlanes = _mm_loadu_ps(node.childBounds[axis][1 - ray.nearPlane[axis]]);
+
+            // maxps/minps return the second operand when either one is a NaN
+            tNear = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(nearPlanes, origin), invDirection), tNear);
+            tFar = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(farPlanes, origin), invDirection), tFar);
+        }
+        _mm_storeu_ps(pEntry, tNear);
+        return (UINT)_mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+    }
+
+    CPU_TARGET("avx")
+    static UINT IntersectChildrenAvx(const Bvh8Node &node, const WideTraversalRay &ray, float tMin, float tMax, _Out_writes_(8) float *pEntry)
+    {
+        __m256 tNear = _mm256_set1_ps(tMin);
+        __m256 tFar = _mm256_set1_ps(tMax);
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+            const __m256 invDirection = _mm256_set1_ps(ray.invDirection[axis]);
+            const __m256 nearPlanes = _mm256_loadu_ps(node.childBounds[axis][ray.nearPlane[axis]]);
+            const __m256 farPlanes = _mm256_loadu_ps(node.childBounds[axis][1 - ray.nearPlane[axis]]);
+
+            tNear = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(nearPlanes, origin), invDirection), tNear);
+            tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(farPlanes, origin), invDirection), tFar);
+        }
+        _mm256_storeu_ps(pEntry, tNear);
+        return (UINT)_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+    }
+
+    template<UINT Width>
+    using IntersectChildrenKernel = UINT(*)(const WideBvhNode<Width> &, const WideTraversalRay &, float, float, float *);
+
+    template<UINT Width>
+    static bool TraceRayWide(IntersectChildrenKernel<Width> intersectChildren, const BYTE *pData, const CpuRay &ray, _Out_ CpuRayHit &hit)
+    {
+        const BVHOffsets &offsets = *(const BVHOffsets *)pData;
+        const WideBvhNode<Width> *pNodes = (const WideBvhNode<Width> *)(pData + offsets.offsetToBoxes);
+        const Primitive *pPrimitives = (const Primitive *)(pData + offsets.offsetToVertices);
+
+        WideTraversalRay traversalRay;
+        for (UINT axis = 0; axis < 3; axis++)
+        {
+            traversalRay.origin[axis] = ray.origin[axis];
+            traversalRay.invDirection[axis] = 1.0f / ray.direction[axis];
+            traversalRay.nearPlane[axis] = traversalRay.invDirection[axis] < 0.0f ? 1 : 0;
+        }
+
+        hit.t = ray.tMax;
+        bool bHit = false;
+
+        WideTraversalStackEntry stack[WIDE_TRAVERSAL_STACK_SIZE];
+        UINT stackSize = 0;
+        stack[stackSize++] = { 0, ray.tMin };
+
+        while (stackSize)
+        {
+            const WideTraversalStackEntry entry = stack[--stackSize];
+            if (entry.tEntry > hit.t)
+            {
+                continue;
+            }
+
+            if (entry.child & WIDE_BVH_LEAF_FLAG)
+            {
+                const UINT firstPrimitive = entry.child & 0xFFFFFF;
+                const UINT numPrimitives = (entry.child >> 24) & WIDE_BVH_MAX_PRIMITIVES_IN_LEAF;
+                for (UINT i = firstPrimitive; i < firstPrimitive + numPrimitives; i++)
+                {
+                    if (pPrimitives[i].PrimitiveType == TRIANGLE_TYPE &&
+                        IntersectTriangle(pPrimitives[i].triangle, ray, hit.t, hit))
+                    {
+                        hit.primitiveId = i;
+                        bHit = true;
+                    }
+                }
+                continue;
+            }
+
+            const WideBvhNode<Width> &node = pNodes[entry.child];
+            float tEntry[Width];
+            const UINT hitMask = intersectChildren(node, traversalRay, ray.tMin, hit.t, tEntry);
+
+            if (stackSize + Width > WIDE_TRAVERSAL_STACK_SIZE)
+            {
+                ThrowFailure(E_FAIL, L"BVH is too deep for the CPU traversal stack");
+            }
+
+            // Insertion sort the children hit far to near, so the nearest
+            // one is visited next
+            const UINT firstPushed = stackSize;
+            for (UINT child = 0; child < Width; child++)
+            {
+                if (hitMask & (1u << child))
+                {
+                    const WideTraversalStackEntry childEntry = { node.children[child], tEntry[child] };
+                    UINT position = stackSize++;
+                    while (position > firstPushed && stack[position - 1].tEntry < childEntry.tEntry)
+                    {
+                        stack[position] = stack[position - 1];
+                        position--;
+                    }
+                    stack[position] = childEntry;
+                }
+            }
+        }
+
+        return bHit;
+    }
+
+    bool TraceRayBVH4(const BYTE *pWideData, const CpuRay &ray, _Out_ CpuRayHit &hit)
+    {
+        return TraceRayWide<4>(IntersectChildrenSse, pWideData, ray, hit);
+    }
+
+    bool TraceRayBVH8(const BYTE *pWideData, const CpuRay &ray, _Out_ CpuRayHit &hit)
+    {
+        static const IntersectChildrenKernel<8> s_intersectChildren = CpuSupportsAvx() ?
+            IntersectChildrenAvx : IntersectChildrenScalar<8>;
+        return TraceRayWide<8>(s_intersectChildren, pWideData, ray, hit);
+    }
+}
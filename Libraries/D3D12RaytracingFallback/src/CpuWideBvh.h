@@ -0,0 +1,67 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+#pragma once
+
+namespace FallbackLayer
+{
+    //
+    // A child slot of a wide node holds one of:
+    //   - the index of another wide node
+    //   - a leaf, flagged with WIDE_BVH_LEAF_FLAG, with its primitive count in
+    //     bits 24-30 and the index of its first primitive in bits 0-23
+    //   - WIDE_BVH_EMPTY_CHILD, whose bounds are inverted so no ray hits them
+    //
+    static const UINT WIDE_BVH_LEAF_FLAG = 0x80000000;
+    static const UINT WIDE_BVH_EMPTY_CHILD = 0xFFFFFFFF;
+
+    // Bounds of all children are stored SoA, so the ray can be tested
+    // against every child at once. childBounds[axis][0] holds the minimums
+    // and childBounds[axis][1] the maximums.
+    template<UINT Width>
+    struct alignas(Width * sizeof(float)) WideBvhNode
+    {
+        float childBounds[3][2][Width];
+        UINT children[Width];
+    };
+
+    typedef WideBvhNode<4> Bvh4Node;
+    typedef WideBvhNode<8> Bvh8Node;
+
+    struct WideBvhCollapseSettings
+    {
+        // SAH costs of testing a ray against all the children of a wide node
+        // and against a single primitive
+        float TraversalCost = 1.0f;
+        float IntersectionCost = 1.0f;
+
+        // Subtrees with up to this many primitives can collapse into a leaf
+        UINT MaxPrimitivesInLeaf = 4;
+    };
+
+    //
+    // Collapses a bottom-level BVH2 written by WriteBVHToOutput into a 4 or
+    // 8-wide BVH. Which BVH2 nodes become wide nodes, children and leaves is
+    // picked bottom-up to minimize the SAH cost of the result. The output uses
+    // the same BVHOffsets header, with wide nodes instead of AABBNodes and the
+    // primitives and their metadata copied as-is.
+    //
+    // GetMaxWideBVHSize is an upper bound, the header's totalSize has the
+    // actual size.
+    //
+    UINT GetMaxWideBVHSize(const BYTE *pBvhData, UINT width);
+    void CollapseBVH4(const BYTE *pBvhData, const WideBvhCollapseSettings &settings, _Out_ BYTE *pWideData);
+    void CollapseBVH8(const BYTE *pBvhData, const WideBvhCollapseSettings &settings, _Out_ BYTE *pWideData);
+
+    // Closest-hit traversal with the same semantics as TraceRayBVH2. BVH4
+    // tests the children of a node with SSE, BVH8 with AVX when supported.
+    bool TraceRayBVH4(const BYTE *pWideData, const CpuRay &ray, _Out_ CpuRayHit &hit);
+    bool TraceRayBVH8(const BYTE *pWideData, const CpuRay &ray, _Out_ CpuRayHit &hit);
+}
@@ -120,6 +120,99 @@ namespace FallbackLayerUnitTests
         return geometryDesc;
     }
 
+    // The CPU builders read their input in place, so the descs point straight at the CPU arrays
+    D3D12_RAYTRACING_GEOMETRY_DESC GetCpuGeometryDesc(const CpuGeometryDescriptor &geomDesc)
+    {
+        D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc = GetGeometryDesc(geomDesc);
+        geometryDesc.Triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)geomDesc.m_pIndexBuffer;
+        geometryDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)geomDesc.m_pVertexData;
+        return geometryDesc;
+    }
+
+    D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC GetBottomLevelBuildDesc(
+        const D3D12_RAYTRACING_GEOMETRY_DESC &geometryDesc,
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE)
+    {
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc{};
+        desc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        desc.NumDescs = 1;
+        desc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+        desc.Flags = flags;
+        desc.pGeometryDescs = &geometryDesc;
+        return desc;
+    }
+
+    // Enough for a CPU-built bottom level with one leaf per primitive reference, updatable or not
+    UINT GetMaxCpuBottomLevelSize(UINT numReferences)
+    {
+        return sizeof(BVHOffsets) + sizeof(FallbackLayer::CpuBvh2UpdateInfo) +
+            numReferences * (2 * sizeof(AABBNode) + sizeof(Primitive) + sizeof(PrimitiveMetaData));
+    }
+
+    float RandomFloat(float range)
+    {
+        return range * ((float)rand() / RAND_MAX * 2.0f - 1.0f);
+    }
+
+    // Triangles the CPU builders read in place, along with the descriptors
+    // that point at them
+    struct CpuTriangleSoup
+    {
+        std::vector<float> vertices;
+        std::vector<UINT16> indices;
+        CpuGeometryDescriptor descriptor;
+        D3D12_RAYTRACING_GEOMETRY_DESC geometryDesc;
+
+        UINT GetTriangleCount() const { return (UINT)(indices.empty() ? vertices.size() / 9 : indices.size() / 3); }
+    };
+
+    // Leave indices empty for an unindexed soup
+    CpuTriangleSoup MakeTriangleSoup(std::vector<float> vertices, std::vector<UINT16> indices = {})
+    {
+        CpuTriangleSoup soup;
+        soup.vertices = std::move(vertices);
+        soup.indices = std::move(indices);
+        if (soup.indices.empty())
+        {
+            soup.descriptor = CpuGeometryDescriptor(soup.vertices.data(), (UINT)(soup.vertices.size() / 3));
+        }
+        else
+        {
+            soup.descriptor = CpuGeometryDescriptor(soup.vertices.data(), (UINT)(soup.vertices.size() / 3), soup.indices.data(), (UINT)soup.indices.size());
+        }
+        soup.geometryDesc = GetCpuGeometryDesc(soup.descriptor);
+        return soup;
+    }
+
+    // Small triangles scattered at random: every vertex lies within a unit of
+    // its triangle's center, and the centers within range of the origin
+    CpuTriangleSoup MakeRandomTriangleSoup(UINT numTriangles, UINT seed, float range = 50.0f, bool bIndexed = true)
+    {
+        srand(seed);
+        std::vector<float> vertices;
+        std::vector<UINT16> indices;
+        for (UINT i = 0; i < numTriangles; i++)
+        {
+            float center[3];
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                center[axis] = RandomFloat(range);
+            }
+            for (UINT v = 0; v < 3; v++)
+            {
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    vertices.push_back(center[axis] + RandomFloat(1.0f));
+                }
+                if (bIndexed)
+                {
+                    indices.push_back((UINT16)(i * 3 + v));
+                }
+            }
+        }
+        return MakeTriangleSoup(std::move(vertices), std::move(indices));
+    }
+
     void GenerateRandomTranformation(float *pMatrix)
     {
         // Identity matrix
@@ -605,6 +698,27 @@ namespace FallbackLayerUnitTests
         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17
     };
 
+    // ReferenceVerticies0 stacked numCopies times, each copy a unit further
+    // along every axis than the last
+    CpuTriangleSoup MakeReferenceTriangleSoup(UINT numCopies)
+    {
+        std::vector<float> vertices;
+        std::vector<UINT16> indices;
+        for (UINT i = 0; i < numCopies; i++)
+        {
+            for (float f : ReferenceVerticies0)
+            {
+                vertices.push_back(f + i);
+            }
+
+            for (UINT16 index : ReferenceIndices0)
+            {
+                indices.push_back(index + (UINT16)ARRAYSIZE(ReferenceIndices0) * i);
+            }
+        }
+        return MakeTriangleSoup(std::move(vertices), std::move(indices));
+    }
+
     TEST_CLASS(AccelerationStructureUnitTests)
     {
     public:
@@ -777,6 +891,1194 @@ namespace FallbackLayerUnitTests
                 testCase);
         }
 
+        TEST_METHOD(MultithreadedBottomLevelCpuBVHBuilderMatchesSerialBuild)
+        {
+            CpuTriangleSoup soup = MakeReferenceTriangleSoup(1000);
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT numTriangles = soup.GetTriangleCount();
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pSerialData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pParallelData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+
+            FallbackLayer::CpuBvh2Builder serialBuilder(1);
+            serialBuilder.BuildRaytracingAccelerationStructure(&desc, pSerialData.get());
+
+            // Force small subtrees onto the pool so the stitching path is exercised
+            FallbackLayer::CpuBvh2Builder parallelBuilder(4);
+            parallelBuilder.GetSettings().ParallelBuildThreshold = 64;
+            parallelBuilder.BuildRaytracingAccelerationStructure(&desc, pParallelData.get());
+
+            const UINT serialSize = ((BVHOffsets *)pSerialData.get())->totalSize;
+            Assert::AreEqual(serialSize, ((BVHOffsets *)pParallelData.get())->totalSize, L"Multithreaded build produced a different size");
+            Assert::IsTrue(memcmp(pSerialData.get(), pParallelData.get(), serialSize) == 0, L"Multithreaded build doesn't match the serial build");
+
+            std::wstring errorMessage;
+            auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+            if (!validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pParallelData.get(), errorMessage))
+            {
+                Assert::Fail(errorMessage.c_str());
+            }
+
+            // CPU builds through the builder factory use its thread count. The
+            // device is only needed by the GPU builder.
+            FallbackLayer::AccelerationStructureBuilderFactory factory(nullptr, 0, 4);
+            Assert::AreEqual(4u, factory.GetCpuBvh2Builder().GetThreadCount(), L"Factory's CPU builder ignored the thread count it was created with");
+            factory.SetCpuBuildThreadCount(2);
+            Assert::AreEqual(2u, factory.GetCpuBvh2Builder().GetThreadCount(), L"Factory's CPU builder ignored the new thread count");
+            factory.GetCpuBvh2Builder().GetSettings().ParallelBuildThreshold = 64;
+            factory.BuildRaytracingAccelerationStructureOnCpu(&desc, pParallelData.get());
+            Assert::IsTrue(memcmp(pSerialData.get(), pParallelData.get(), serialSize) == 0, L"Factory's CPU build doesn't match the serial build");
+        }
+
+        TEST_METHOD(RebuildWithCpuBVHBuilderMatchesFreshBuild)
+        {
+            const CpuTriangleSoup largeSoup = MakeReferenceTriangleSoup(1000);
+            CpuTriangleSoup smallSoup = MakeReferenceTriangleSoup(1);
+
+            auto BuildWith = [](FallbackLayer::CpuBvh2Builder &builder, const CpuTriangleSoup &soup, std::unique_ptr<BYTE[]> &pData)
+            {
+                const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+                pData = std::unique_ptr<BYTE[]>(new BYTE[GetMaxCpuBottomLevelSize(soup.GetTriangleCount())]);
+                builder.BuildRaytracingAccelerationStructure(&desc, pData.get());
+                return ((BVHOffsets *)pData.get())->totalSize;
+            };
+
+            for (UINT threadCount : { 1u, 4u })
+            {
+                std::unique_ptr<BYTE[]> pFreshData;
+                FallbackLayer::CpuBvh2Builder freshBuilder(threadCount);
+                const UINT freshSize = BuildWith(freshBuilder, smallSoup, pFreshData);
+
+                // Scratch memory left over from a larger build must not leak into the next one
+                std::unique_ptr<BYTE[]> pLargeData;
+                std::unique_ptr<BYTE[]> pRebuiltData;
+                FallbackLayer::CpuBvh2Builder reusedBuilder(threadCount);
+                reusedBuilder.GetSettings().ParallelBuildThreshold = 64;
+                BuildWith(reusedBuilder, largeSoup, pLargeData);
+                const UINT rebuiltSize = BuildWith(reusedBuilder, smallSoup, pRebuiltData);
+
+                Assert::AreEqual(freshSize, rebuiltSize, L"Rebuild produced a different size");
+                Assert::IsTrue(memcmp(pFreshData.get(), pRebuiltData.get(), freshSize) == 0, L"Rebuild doesn't match a build with a fresh builder");
+
+                std::wstring errorMessage;
+                auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+                if (!validator.VerifyBottomLevelOutput(&smallSoup.descriptor, 1, pRebuiltData.get(), errorMessage))
+                {
+                    Assert::Fail(errorMessage.c_str());
+                }
+            }
+        }
+
+        TEST_METHOD(SimdSahBinningMatchesScalarReference)
+        {
+            const UINT numBoxes = 10000;
+            FallbackLayer::SahReferenceBounds bounds;
+            bounds.Resize(numBoxes);
+            for (UINT i = 0; i < numBoxes; i++)
+            {
+                AABB box;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    box.minArr[axis] = (float)((i * 7919 + axis * 104729) % 1000) - 500.0f;
+                    box.maxArr[axis] = box.minArr[axis] + (float)((i * 31 + axis) % 17);
+                }
+
+                // NaN bounds are skipped by every path
+                if (i == 7)
+                {
+                    box.minArr[2] = std::numeric_limits<float>::quiet_NaN();
+                }
+                bounds.SetBox(i, box);
+            }
+
+            // Aligned by their type, which new doesn't honor before C++17
+            FallbackLayer::SahBins referenceBins;
+            FallbackLayer::SahBins simdBins;
+
+            // Odd counts cover the tail of the paths that bin several primitives
+            // at a time, and an odd start a range that isn't aligned to a vector
+            const struct { UINT first; UINT numTris; bool bFlatYAxis; } testCases[] =
+            {
+                { 0, 1, false }, { 0, 3, false }, { 0, 13, false }, { 5, 9995, false }, { 0, 10000, false }, { 0, 10000, true }
+            };
+            for (auto &testCase : testCases)
+            {
+                const UINT numTris = testCase.numTris;
+                const FallbackLayer::SahPrimitiveBounds rangeBounds = bounds.GetRange(testCase.first);
+
+                FallbackLayer::SahBinning binning;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    binning.rangeMin[axis] = -500.0f;
+                    binning.inverseExtents[axis] = 1.0f / 1016.0f;
+                }
+                if (testCase.bFlatYAxis)
+                {
+                    binning.inverseExtents[1] = 0.0f;
+                }
+
+                FallbackLayer::GetSahBinningKernel(FallbackLayer::SahBinningScalar)(rangeBounds, numTris, binning, referenceBins);
+                for (UINT path = FallbackLayer::SahBinningScalar + 1; path < FallbackLayer::NumSahBinningPaths; path++)
+                {
+                    if (!FallbackLayer::IsSahBinningPathSupported((FallbackLayer::SahBinningPath)path))
+                    {
+                        continue;
+                    }
+
+                    FallbackLayer::GetSahBinningKernel((FallbackLayer::SahBinningPath)path)(rangeBounds, numTris, binning, simdBins);
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        if (binning.inverseExtents[axis] == 0.0f)
+                        {
+                            continue;
+                        }
+
+                        for (UINT j = 0; j < FallbackLayer::NUM_SAH_BINS; j++)
+                        {
+                            Assert::AreEqual(referenceBins.numTriangles[axis][j], simdBins.numTriangles[axis][j], L"SIMD binning put a different number of primitives in a bin");
+
+                            const AABB referenceLeft = FallbackLayer::GetSahBinBox(referenceBins.leftBoxes[axis][j]);
+                            const AABB referenceRight = FallbackLayer::GetSahBinBox(referenceBins.rightBoxes[axis][j]);
+                            const AABB left = FallbackLayer::GetSahBinBox(simdBins.leftBoxes[axis][j]);
+                            const AABB right = FallbackLayer::GetSahBinBox(simdBins.rightBoxes[axis][j]);
+                            for (UINT k = 0; k < 3; k++)
+                            {
+                                Assert::IsTrue(referenceLeft.minArr[k] == left.minArr[k] && referenceLeft.maxArr[k] == left.maxArr[k], L"SIMD binning produced a different left sweep");
+                                Assert::IsTrue(referenceRight.minArr[k] == right.minArr[k] && referenceRight.maxArr[k] == right.maxArr[k], L"SIMD binning produced a different right sweep");
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        TEST_METHOD(CompressedCpuBVHEnclosesTrianglesAndTracesLikeUncompressed)
+        {
+            CpuTriangleSoup soup = MakeReferenceTriangleSoup(1000);
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT numTriangles = soup.GetTriangleCount();
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            FallbackLayer::CpuBvh2Builder builder(1);
+            builder.BuildRaytracingAccelerationStructure(&desc, pData.get());
+
+            const UINT compressedSize = FallbackLayer::GetCompressedBVHSize(pData.get());
+            std::unique_ptr<BYTE[]> pCompressedData = std::unique_ptr<BYTE[]>(new BYTE[compressedSize]);
+            Assert::IsTrue(FallbackLayer::CompressBVH(pData.get(), pCompressedData.get()), L"Reference geometry should fit in fp16");
+
+            const BVHOffsets &offsets = *(BVHOffsets *)pData.get();
+            const BVHOffsets &compressedOffsets = *(BVHOffsets *)pCompressedData.get();
+            Assert::AreEqual(compressedSize, compressedOffsets.totalSize, L"Compressed size doesn't match the compressed header");
+            Assert::AreEqual((offsets.offsetToVertices - offsets.offsetToBoxes) / 2, compressedOffsets.offsetToVertices - compressedOffsets.offsetToBoxes, L"Compressed nodes should be half the size");
+
+            std::wstring errorMessage;
+            auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::CompressedBVH2);
+            if (!validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pCompressedData.get(), errorMessage))
+            {
+                Assert::Fail(errorMessage.c_str());
+            }
+
+            // The triangles are stacked in z a unit apart, so a ray going up
+            // from just below each triangle's centroid hits that triangle first
+            const PrimitiveMetaData *pMetadata = (PrimitiveMetaData *)(pCompressedData.get() + compressedOffsets.offsetToPrimitiveMetaData);
+            for (UINT triangleIndex = 0; triangleIndex < numTriangles; triangleIndex++)
+            {
+                FallbackLayer::CpuRay ray;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    float centroid = 0.0f;
+                    for (UINT v = 0; v < 3; v++)
+                    {
+                        const UINT vertexIndex = soup.indices[triangleIndex * 3 + v];
+                        centroid += soup.vertices[vertexIndex * 3 + axis] / 3.0f;
+                    }
+                    ray.origin[axis] = centroid;
+                    ray.direction[axis] = axis == 2 ? 1.0f : 0.0f;
+                }
+                ray.origin[2] -= 0.25f;
+                ray.tMin = 0.0f;
+                ray.tMax = FLT_MAX;
+
+                FallbackLayer::CpuRayHit hit;
+                FallbackLayer::CpuRayHit compressedHit;
+                Assert::IsTrue(FallbackLayer::TraceRayBVH2(pData.get(), ray, hit), L"Ray missed the uncompressed BVH");
+                Assert::IsTrue(FallbackLayer::TraceRayCompressedBVH2(pCompressedData.get(), ray, compressedHit), L"Ray missed the compressed BVH");
+                Assert::AreEqual(hit.primitiveId, compressedHit.primitiveId, L"Compressed BVH returned a different closest hit");
+                Assert::AreEqual(triangleIndex, pMetadata[compressedHit.primitiveId].PrimitiveIndex, L"Ray hit the wrong triangle");
+            }
+
+            // Collapsing a leaf's box must be caught
+            CompressedAABBNode *pNodes = (CompressedAABBNode *)(pCompressedData.get() + compressedOffsets.offsetToBoxes);
+            CompressedAABBNode *pLeaf = pNodes;
+            while (!pLeaf->leaf)
+            {
+                pLeaf++;
+            }
+            memset(pLeaf->halfDim, 0, sizeof(pLeaf->halfDim));
+            Assert::IsFalse(validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pCompressedData.get(), errorMessage), L"Validator accepted a leaf that doesn't enclose its triangle");
+        }
+
+        template <UINT Width>
+        void VerifyWideBvhPrimitives(const BYTE *pWideData, UINT numPrimitives)
+        {
+            const BVHOffsets &offsets = *(BVHOffsets *)pWideData;
+            const FallbackLayer::WideBvhNode<Width> *pNodes = (FallbackLayer::WideBvhNode<Width> *)(pWideData + offsets.offsetToBoxes);
+            const UINT numNodes = (offsets.offsetToVertices - offsets.offsetToBoxes) / sizeof(*pNodes);
+
+            std::vector<UINT> primitiveReferences(numPrimitives);
+            std::vector<UINT> nodeReferences(numNodes);
+            nodeReferences[0] = 1;
+            for (UINT nodeIndex = 0; nodeIndex < numNodes; nodeIndex++)
+            {
+                for (UINT child : pNodes[nodeIndex].children)
+                {
+                    if (child == FallbackLayer::WIDE_BVH_EMPTY_CHILD)
+                    {
+                        continue;
+                    }
+
+                    if (child & FallbackLayer::WIDE_BVH_LEAF_FLAG)
+                    {
+                        const UINT firstPrimitive = child & 0xFFFFFF;
+                        const UINT leafPrimitives = (child >> 24) & 0x7F;
+                        Assert::IsTrue(leafPrimitives > 0 && firstPrimitive + leafPrimitives <= numPrimitives, L"Wide leaf references invalid primitives");
+                        for (UINT i = firstPrimitive; i < firstPrimitive + leafPrimitives; i++)
+                        {
+                            primitiveReferences[i]++;
+                        }
+                    }
+                    else
+                    {
+                        Assert::IsTrue(child > nodeIndex && child < numNodes, L"Wide node references an invalid child");
+                        nodeReferences[child]++;
+                    }
+                }
+            }
+
+            for (UINT references : nodeReferences)
+            {
+                Assert::AreEqual(1u, references, L"Every wide node should have exactly one parent");
+            }
+            for (UINT references : primitiveReferences)
+            {
+                Assert::AreEqual(1u, references, L"Every primitive should be in exactly one wide leaf");
+            }
+        }
+
+        TEST_METHOD(WideCpuBVHCollapseTracesLikeBinaryBVH)
+        {
+            const CpuTriangleSoup soup = MakeReferenceTriangleSoup(1000);
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT numTriangles = soup.GetTriangleCount();
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            FallbackLayer::CpuBvh2Builder builder(1);
+            builder.BuildRaytracingAccelerationStructure(&desc, pData.get());
+
+            FallbackLayer::WideBvhCollapseSettings settings;
+            std::unique_ptr<BYTE[]> pBvh4Data = std::unique_ptr<BYTE[]>(new BYTE[FallbackLayer::GetMaxWideBVHSize(pData.get(), 4)]);
+            std::unique_ptr<BYTE[]> pBvh8Data = std::unique_ptr<BYTE[]>(new BYTE[FallbackLayer::GetMaxWideBVHSize(pData.get(), 8)]);
+            FallbackLayer::CollapseBVH4(pData.get(), settings, pBvh4Data.get());
+            FallbackLayer::CollapseBVH8(pData.get(), settings, pBvh8Data.get());
+            VerifyWideBvhPrimitives<4>(pBvh4Data.get(), numTriangles);
+            VerifyWideBvhPrimitives<8>(pBvh8Data.get(), numTriangles);
+
+            // Rays through every triangle's centroid, from far enough that
+            // they cross several others first
+            for (UINT triangleIndex = 0; triangleIndex < numTriangles; triangleIndex++)
+            {
+                FallbackLayer::CpuRay ray;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    float centroid = 0.0f;
+                    for (UINT v = 0; v < 3; v++)
+                    {
+                        const UINT vertexIndex = soup.indices[triangleIndex * 3 + v];
+                        centroid += soup.vertices[vertexIndex * 3 + axis] / 3.0f;
+                    }
+                    ray.direction[axis] = axis == 1 ? -1.0f : 0.5f;
+                    ray.origin[axis] = centroid - ray.direction[axis] * 10.0f;
+                }
+                ray.tMin = 0.0f;
+                ray.tMax = FLT_MAX;
+
+                FallbackLayer::CpuRayHit hit;
+                FallbackLayer::CpuRayHit bvh4Hit;
+                FallbackLayer::CpuRayHit bvh8Hit;
+                Assert::IsTrue(FallbackLayer::TraceRayBVH2(pData.get(), ray, hit), L"Ray missed the binary BVH");
+                Assert::IsTrue(FallbackLayer::TraceRayBVH4(pBvh4Data.get(), ray, bvh4Hit), L"Ray missed the BVH4");
+                Assert::IsTrue(FallbackLayer::TraceRayBVH8(pBvh8Data.get(), ray, bvh8Hit), L"Ray missed the BVH8");
+                Assert::AreEqual(hit.primitiveId, bvh4Hit.primitiveId, L"BVH4 returned a different closest hit");
+                Assert::AreEqual(hit.primitiveId, bvh8Hit.primitiveId, L"BVH8 returned a different closest hit");
+            }
+        }
+
+        TEST_METHOD(SpatialSplitCpuBVHLowersSahAndTracesLikeObjectSplitBVH)
+        {
+            // Long, thin triangles at random orientations, whose boxes overlap
+            // too much for centroid splits to separate them well
+            const UINT numTriangles = 2000;
+            std::vector<float> vertices;
+            srand(10);
+            for (UINT i = 0; i < numTriangles; i++)
+            {
+                float center[3];
+                float halfLength[3];
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    center[axis] = 50.0f + RandomFloat(50.0f);
+                    halfLength[axis] = RandomFloat(20.0f);
+                }
+
+                // Both ends of a long axis, then a point close to the middle
+                for (UINT v = 0; v < 3; v++)
+                {
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        const float offset = v == 2 ? RandomFloat(0.5f) : (v == 0 ? -halfLength[axis] : halfLength[axis]);
+                        vertices.push_back(center[axis] + offset);
+                    }
+                }
+            }
+            const CpuTriangleSoup soup = MakeTriangleSoup(vertices);
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            FallbackLayer::CpuBvh2Builder objectSplitBuilder(1);
+            FallbackLayer::CpuBvh2Builder spatialSplitBuilder(1);
+            spatialSplitBuilder.GetSettings().SpatialSplits = true;
+            const float budget = spatialSplitBuilder.GetSettings().SpatialSplitBudget;
+
+            const UINT maxReferences = numTriangles + (UINT)(numTriangles * budget);
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(maxReferences);
+            std::unique_ptr<BYTE[]> pObjectSplitData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pSpatialSplitData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            objectSplitBuilder.BuildRaytracingAccelerationStructure(&desc, pObjectSplitData.get());
+            spatialSplitBuilder.BuildRaytracingAccelerationStructure(&desc, pSpatialSplitData.get());
+
+            const FallbackLayer::CpuBvh2BuildStats &objectSplitStats = objectSplitBuilder.GetLastBuildStats();
+            const FallbackLayer::CpuBvh2BuildStats &stats = spatialSplitBuilder.GetLastBuildStats();
+            Assert::AreEqual(0u, objectSplitStats.NumDuplicatedReferences, L"Only spatial splits should duplicate references");
+            Assert::IsTrue(stats.NumDuplicatedReferences > 0, L"Expected spatial splits on overlapping triangles");
+            Assert::IsTrue(stats.NumReferences <= maxReferences, L"Spatial splits went over the duplication budget");
+            Assert::AreEqual(numTriangles + stats.NumDuplicatedReferences, stats.NumReferences, L"Reference count doesn't add up");
+            Assert::AreEqual(stats.NumReferences * 2 - 1, stats.NumNodes, L"Every leaf should hold a single reference");
+            Assert::IsTrue(stats.SahCost < objectSplitStats.SahCost, L"Spatial splits should lower the SAH cost");
+
+            // Every reference is a copy of a triangle it points at, and every
+            // triangle is referenced at least once
+            const BVHOffsets &offsets = *(BVHOffsets *)pSpatialSplitData.get();
+            const Primitive *pPrimitives = (Primitive *)(pSpatialSplitData.get() + offsets.offsetToVertices);
+            const PrimitiveMetaData *pMetadata = (PrimitiveMetaData *)(pSpatialSplitData.get() + offsets.offsetToPrimitiveMetaData);
+            Assert::AreEqual(stats.NumReferences * (UINT)sizeof(PrimitiveMetaData), offsets.totalSize - offsets.offsetToPrimitiveMetaData, L"Metadata doesn't match the reference count");
+
+            std::vector<UINT> triangleReferences(numTriangles);
+            for (UINT i = 0; i < stats.NumReferences; i++)
+            {
+                const UINT triangleIndex = pMetadata[i].PrimitiveIndex;
+                Assert::IsTrue(triangleIndex < numTriangles, L"Reference to an invalid triangle");
+                Assert::IsTrue(memcmp(&pPrimitives[i].triangle, &vertices[triangleIndex * 9], sizeof(Triangle)) == 0, L"Reference doesn't match its triangle");
+                triangleReferences[triangleIndex]++;
+            }
+            for (UINT references : triangleReferences)
+            {
+                Assert::IsTrue(references > 0, L"Triangle missing from the BVH");
+            }
+
+            const PrimitiveMetaData *pObjectSplitMetadata = (PrimitiveMetaData *)(pObjectSplitData.get() + ((BVHOffsets *)pObjectSplitData.get())->offsetToPrimitiveMetaData);
+            for (UINT rayIndex = 0; rayIndex < 10000; rayIndex++)
+            {
+                FallbackLayer::CpuRay ray;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    ray.origin[axis] = 50.0f + RandomFloat(50.0f);
+                    ray.direction[axis] = RandomFloat(1.0f);
+                }
+                ray.tMin = 0.0f;
+                ray.tMax = FLT_MAX;
+
+                FallbackLayer::CpuRayHit hit;
+                FallbackLayer::CpuRayHit spatialSplitHit;
+                const bool bHit = FallbackLayer::TraceRayBVH2(pObjectSplitData.get(), ray, hit);
+                Assert::AreEqual(bHit, FallbackLayer::TraceRayBVH2(pSpatialSplitData.get(), ray, spatialSplitHit), L"Spatial splits changed whether a ray hits");
+                if (bHit)
+                {
+                    Assert::IsTrue(hit.t == spatialSplitHit.t, L"Spatial splits changed the closest hit distance");
+                    Assert::AreEqual(pObjectSplitMetadata[hit.primitiveId].PrimitiveIndex, pMetadata[spatialSplitHit.primitiveId].PrimitiveIndex, L"Spatial splits changed the closest hit");
+                }
+            }
+        }
+
+        TEST_METHOD(RefitCpuBVHTracesLikeRebuiltBVH)
+        {
+            const UINT numTriangles = 2000;
+            CpuTriangleSoup soup = MakeRandomTriangleSoup(numTriangles, 20);
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE);
+
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pBuiltData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pRefitData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pParallelRefitData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pRebuiltData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+
+            FallbackLayer::CpuBvh2Builder builder(1);
+            builder.BuildRaytracingAccelerationStructure(&desc, pBuiltData.get());
+            const UINT totalSize = ((BVHOffsets *)pBuiltData.get())->totalSize;
+            Assert::IsFalse(builder.GetLastBuildStats().bRefit, L"A build shouldn't be reported as a refit");
+
+            // Refitting unchanged geometry reproduces the build exactly
+            memcpy(pRefitData.get(), pBuiltData.get(), totalSize);
+            desc.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            builder.BuildRaytracingAccelerationStructure(&desc, pRefitData.get());
+            Assert::IsTrue(builder.GetLastBuildStats().bRefit, L"Expected the update to be reported as a refit");
+            Assert::AreEqual(1.0f, builder.GetLastBuildStats().SahGrowth, L"Refitting unchanged geometry shouldn't change the SAH cost");
+            Assert::IsTrue(memcmp(pBuiltData.get(), pRefitData.get(), totalSize) == 0, L"Refitting unchanged geometry changed the BVH");
+
+            for (UINT i = 0; i < soup.vertices.size(); i += 3)
+            {
+                const float x = soup.vertices[i];
+                soup.vertices[i] += 5.0f * sinf(soup.vertices[i + 1] * 0.1f);
+                soup.vertices[i + 1] += 5.0f * cosf(x * 0.1f);
+                soup.vertices[i + 2] *= 1.2f;
+            }
+            builder.BuildRaytracingAccelerationStructure(&desc, pRefitData.get());
+            Assert::IsTrue(builder.GetLastBuildStats().SahGrowth > 1.0f, L"Deforming the geometry should degrade the refit BVH");
+
+            // Splitting the refit across threads doesn't change the result,
+            // and reading from a separate source leaves the source intact
+            FallbackLayer::CpuBvh2Builder parallelBuilder(4);
+            parallelBuilder.GetSettings().ParallelBuildThreshold = 64;
+            desc.SourceAccelerationStructureData = (D3D12_GPU_VIRTUAL_ADDRESS)pBuiltData.get();
+            parallelBuilder.BuildRaytracingAccelerationStructure(&desc, pParallelRefitData.get());
+            Assert::IsTrue(memcmp(pRefitData.get(), pParallelRefitData.get(), totalSize) == 0, L"Multithreaded refit doesn't match the serial refit");
+
+            std::wstring errorMessage;
+            auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+            if (!validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pRefitData.get(), errorMessage))
+            {
+                Assert::Fail(errorMessage.c_str());
+            }
+
+            desc.SourceAccelerationStructureData = 0;
+            desc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+            builder.BuildRaytracingAccelerationStructure(&desc, pRebuiltData.get());
+
+            const PrimitiveMetaData *pRefitMetadata = (PrimitiveMetaData *)(pRefitData.get() + ((BVHOffsets *)pRefitData.get())->offsetToPrimitiveMetaData);
+            const PrimitiveMetaData *pRebuiltMetadata = (PrimitiveMetaData *)(pRebuiltData.get() + ((BVHOffsets *)pRebuiltData.get())->offsetToPrimitiveMetaData);
+            for (UINT rayIndex = 0; rayIndex < 10000; rayIndex++)
+            {
+                FallbackLayer::CpuRay ray;
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    ray.origin[axis] = RandomFloat(60.0f);
+                    ray.direction[axis] = RandomFloat(1.0f);
+                }
+                ray.tMin = 0.0f;
+                ray.tMax = FLT_MAX;
+
+                FallbackLayer::CpuRayHit hit;
+                FallbackLayer::CpuRayHit refitHit;
+                const bool bHit = FallbackLayer::TraceRayBVH2(pRebuiltData.get(), ray, hit);
+                Assert::AreEqual(bHit, FallbackLayer::TraceRayBVH2(pRefitData.get(), ray, refitHit), L"Refit BVH disagrees on whether a ray hits");
+                if (bHit)
+                {
+                    Assert::IsTrue(hit.t == refitHit.t, L"Refit BVH returned a different closest hit distance");
+                    Assert::AreEqual(pRebuiltMetadata[hit.primitiveId].PrimitiveIndex, pRefitMetadata[refitHit.primitiveId].PrimitiveIndex, L"Refit BVH returned a different closest hit");
+                }
+            }
+        }
+
+        TEST_METHOD(LinearCpuBVHTracesLikeSahBVH)
+        {
+            const UINT numTriangles = 2000;
+            CpuTriangleSoup soup = MakeRandomTriangleSoup(numTriangles, 30);
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pSahData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pLinearData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pParallelLinearData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+
+            FallbackLayer::CpuBvh2Builder sahBuilder(1);
+            sahBuilder.BuildRaytracingAccelerationStructure(&desc, pSahData.get());
+            const PrimitiveMetaData *pSahMetadata = (PrimitiveMetaData *)(pSahData.get() + ((BVHOffsets *)pSahData.get())->offsetToPrimitiveMetaData);
+
+            for (UINT mortonCodeBits : { 30u, 63u })
+            {
+                FallbackLayer::CpuBvh2Builder linearBuilder(1);
+                FallbackLayer::CpuBvh2Builder parallelLinearBuilder(4);
+                for (FallbackLayer::CpuBvh2Builder *pBuilder : { &linearBuilder, &parallelLinearBuilder })
+                {
+                    pBuilder->GetSettings().Algorithm = FallbackLayer::CpuBvh2LbvhBuild;
+                    pBuilder->GetSettings().LbvhMortonCodeBits = mortonCodeBits;
+                }
+                parallelLinearBuilder.GetSettings().ParallelBuildThreshold = 64;
+
+                linearBuilder.BuildRaytracingAccelerationStructure(&desc, pLinearData.get());
+                parallelLinearBuilder.BuildRaytracingAccelerationStructure(&desc, pParallelLinearData.get());
+
+                const UINT totalSize = ((BVHOffsets *)pLinearData.get())->totalSize;
+                Assert::AreEqual(totalSize, ((BVHOffsets *)pParallelLinearData.get())->totalSize, L"Multithreaded LBVH build produced a different size");
+                Assert::IsTrue(memcmp(pLinearData.get(), pParallelLinearData.get(), totalSize) == 0, L"Multithreaded LBVH build doesn't match the serial build");
+                Assert::AreEqual(numTriangles * 2 - 1, linearBuilder.GetLastBuildStats().NumNodes, L"Every LBVH leaf should hold a single triangle");
+
+                std::wstring errorMessage;
+                auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+                if (!validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pLinearData.get(), errorMessage))
+                {
+                    Assert::Fail(errorMessage.c_str());
+                }
+
+                const PrimitiveMetaData *pLinearMetadata = (PrimitiveMetaData *)(pLinearData.get() + ((BVHOffsets *)pLinearData.get())->offsetToPrimitiveMetaData);
+                for (UINT rayIndex = 0; rayIndex < 10000; rayIndex++)
+                {
+                    FallbackLayer::CpuRay ray;
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        ray.origin[axis] = RandomFloat(60.0f);
+                        ray.direction[axis] = RandomFloat(1.0f);
+                    }
+                    ray.tMin = 0.0f;
+                    ray.tMax = FLT_MAX;
+
+                    FallbackLayer::CpuRayHit hit;
+                    FallbackLayer::CpuRayHit linearHit;
+                    const bool bHit = FallbackLayer::TraceRayBVH2(pSahData.get(), ray, hit);
+                    Assert::AreEqual(bHit, FallbackLayer::TraceRayBVH2(pLinearData.get(), ray, linearHit), L"LBVH disagrees on whether a ray hits");
+                    if (bHit)
+                    {
+                        Assert::IsTrue(hit.t == linearHit.t, L"LBVH returned a different closest hit distance");
+                        Assert::AreEqual(pSahMetadata[hit.primitiveId].PrimitiveIndex, pLinearMetadata[linearHit.primitiveId].PrimitiveIndex, L"LBVH returned a different closest hit");
+                    }
+                }
+            }
+        }
+
+        TEST_METHOD(CpuLbvhPassesMatchShaderLogic)
+        {
+            // Interleaving as written out in CalculateMortonCodesForPrimitives.hlsl
+            auto ReferenceMortonCode = [](const float3 &centroid, const AABB &sceneAABB, UINT bitsPerAxis)
+            {
+                const float maxCoord = (float)(1u << bitsPerAxis);
+                const float centroidArr[3] = { centroid.x, centroid.y, centroid.z };
+                UINT coords[3];
+                for (UINT axis = 0; axis < 3; axis++)
+                {
+                    const float sceneDimension = fmaxf(sceneAABB.maxArr[axis] - sceneAABB.minArr[axis], 0.00001f);
+                    const float unitCoord = (centroidArr[axis] - sceneAABB.minArr[axis]) / sceneDimension;
+                    coords[axis] = (UINT)fminf(fmaxf(unitCoord * maxCoord, 0.0f), maxCoord - 1.0f);
+                }
+
+                const UINT orderedCoords[3] = { coords[1], coords[0], coords[2] };
+                UINT64 mortonCode = 0;
+                for (UINT bitIndex = 0; bitIndex < bitsPerAxis; bitIndex++)
+                {
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        if (orderedCoords[axis] & (1u << bitIndex))
+                        {
+                            mortonCode |= 1ull << (bitIndex * 3 + axis);
+                        }
+                    }
+                }
+                return mortonCode;
+            };
+
+            const UINT numElements = 50000;
+            AABB sceneAABB;
+            sceneAABB.min = { -100.0f, -10.0f, 0.0f };
+            sceneAABB.max = { 100.0f, 10.0f, 0.0f };
+
+            srand(40);
+            std::vector<UINT> mortonCodes(numElements);
+            std::vector<UINT> indices(numElements);
+            for (UINT i = 0; i < numElements; i++)
+            {
+                const float3 centroid = { RandomFloat(110.0f), RandomFloat(10.0f), 0.0f };
+                mortonCodes[i] = FallbackLayer::CalculateMortonCode30(centroid, sceneAABB);
+                indices[i] = i;
+                Assert::AreEqual(ReferenceMortonCode(centroid, sceneAABB, 10), (UINT64)mortonCodes[i], L"30-bit Morton code doesn't match the shader");
+                Assert::AreEqual(ReferenceMortonCode(centroid, sceneAABB, 21), FallbackLayer::CalculateMortonCode63(centroid, sceneAABB), L"63-bit Morton code doesn't match the shader");
+            }
+
+            // BitonicSort breaks ties by index, which is what a stable sort does
+            std::vector<std::pair<UINT, UINT>> expectedOrder(numElements);
+            for (UINT i = 0; i < numElements; i++)
+            {
+                expectedOrder[i] = { mortonCodes[i], i };
+            }
+            std::sort(expectedOrder.begin(), expectedOrder.end());
+
+            FallbackLayer::CpuTaskPool taskPool(4);
+            std::vector<UINT> scratchMortonCodes(numElements);
+            std::vector<UINT> scratchIndices(numElements);
+            FallbackLayer::SortMortonCodes(taskPool, numElements, mortonCodes.data(), indices.data(), scratchMortonCodes.data(), scratchIndices.data());
+            for (UINT i = 0; i < numElements; i++)
+            {
+                Assert::AreEqual(expectedOrder[i].first, mortonCodes[i], L"Morton codes aren't sorted");
+                Assert::AreEqual(expectedOrder[i].second, indices[i], L"Equal Morton codes should stay in index order");
+            }
+
+            // Walking down from the root reaches every node exactly once, and
+            // every child points back at its parent
+            const UINT numInternalNodes = numElements - 1;
+            std::vector<HierarchyNode> hierarchy(numInternalNodes + numElements);
+            FallbackLayer::ConstructLbvhHierarchy(taskPool, numElements, mortonCodes.data(), hierarchy.data());
+
+            std::vector<UINT> visits(hierarchy.size());
+            std::vector<UINT> stack(1, 0);
+            while (!stack.empty())
+            {
+                const UINT nodeIndex = stack.back();
+                stack.pop_back();
+                visits[nodeIndex]++;
+                if (nodeIndex < numInternalNodes)
+                {
+                    for (UINT child : { hierarchy[nodeIndex].LeftChildIndex, hierarchy[nodeIndex].RightChildIndex })
+                    {
+                        Assert::IsTrue(child < hierarchy.size(), L"Hierarchy references an invalid node");
+                        Assert::AreEqual(nodeIndex, hierarchy[child].ParentIndex, L"Child doesn't point back at its parent");
+                        stack.push_back(child);
+                    }
+                }
+            }
+            for (UINT nodeVisits : visits)
+            {
+                Assert::AreEqual(1u, nodeVisits, L"Every hierarchy node should be reached exactly once");
+            }
+        }
+
+        TEST_METHOD(TreeletReorderedCpuBVHLowersSahAndTracesLikeSahBVH)
+        {
+            const UINT numTriangles = 2000;
+            CpuTriangleSoup soup = MakeRandomTriangleSoup(numTriangles, 50);
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pSahData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pReorderedData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pParallelReorderedData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+
+            FallbackLayer::CpuBvh2Builder sahBuilder(1);
+            sahBuilder.BuildRaytracingAccelerationStructure(&desc, pSahData.get());
+            const PrimitiveMetaData *pSahMetadata = (PrimitiveMetaData *)(pSahData.get() + ((BVHOffsets *)pSahData.get())->offsetToPrimitiveMetaData);
+
+            FallbackLayer::CpuBvh2Builder linearBuilder(1);
+            linearBuilder.GetSettings().Algorithm = FallbackLayer::CpuBvh2LbvhBuild;
+            linearBuilder.BuildRaytracingAccelerationStructure(&desc, pReorderedData.get());
+            const float linearSahCost = linearBuilder.GetLastBuildStats().SahCost;
+
+            const UINT iterations = 3;
+            FallbackLayer::CpuBvh2Builder reorderingBuilder(1);
+            FallbackLayer::CpuBvh2Builder parallelReorderingBuilder(4);
+            for (FallbackLayer::CpuBvh2Builder *pBuilder : { &reorderingBuilder, &parallelReorderingBuilder })
+            {
+                pBuilder->GetSettings().Algorithm = FallbackLayer::CpuBvh2LbvhBuild;
+                pBuilder->GetSettings().TreeletReorderIterations = iterations;
+            }
+            parallelReorderingBuilder.GetSettings().ParallelBuildThreshold = 64;
+
+            reorderingBuilder.BuildRaytracingAccelerationStructure(&desc, pReorderedData.get());
+            parallelReorderingBuilder.BuildRaytracingAccelerationStructure(&desc, pParallelReorderedData.get());
+
+            const UINT totalSize = ((BVHOffsets *)pReorderedData.get())->totalSize;
+            Assert::AreEqual(totalSize, ((BVHOffsets *)pParallelReorderedData.get())->totalSize, L"Multithreaded treelet reordering produced a different size");
+            Assert::IsTrue(memcmp(pReorderedData.get(), pParallelReorderedData.get(), totalSize) == 0, L"Multithreaded treelet reordering doesn't match the serial one");
+
+            const FallbackLayer::CpuBvh2BuildStats &stats = reorderingBuilder.GetLastBuildStats();
+            Assert::AreEqual(numTriangles * 2 - 1, stats.NumNodes, L"Treelet reordering shouldn't change the number of nodes");
+            Assert::AreEqual((size_t)iterations + 1, stats.TreeletReorderSahCosts.size(), L"Expected the SAH cost before reordering and after every iteration");
+            Assert::AreEqual(linearSahCost, stats.TreeletReorderSahCosts.front(), L"First SAH cost should be that of the plain LBVH build");
+            Assert::AreEqual(stats.SahCost, stats.TreeletReorderSahCosts.back(), L"Last SAH cost should be that of the output");
+            for (UINT i = 1; i <= iterations; i++)
+            {
+                Assert::IsTrue(stats.TreeletReorderSahCosts[i] <= stats.TreeletReorderSahCosts[i - 1], L"A treelet reordering iteration raised the SAH cost");
+            }
+            Assert::IsTrue(stats.SahCost < linearSahCost, L"Treelet reordering should lower the SAH cost of an LBVH");
+
+            // Refits reorder too, and primitives move along with their leaves
+            desc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+            reorderingBuilder.BuildRaytracingAccelerationStructure(&desc, pParallelReorderedData.get());
+            desc.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            reorderingBuilder.GetSettings().TreeletSize = 4;
+            reorderingBuilder.BuildRaytracingAccelerationStructure(&desc, pParallelReorderedData.get());
+            Assert::IsTrue(reorderingBuilder.GetLastBuildStats().SahCost <= reorderingBuilder.GetLastBuildStats().TreeletReorderSahCosts.front(), L"Treelet reordering raised the SAH cost of a refit");
+
+            for (const BYTE *pData : { pReorderedData.get(), pParallelReorderedData.get() })
+            {
+                std::wstring errorMessage;
+                auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+                if (!validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pData, errorMessage))
+                {
+                    Assert::Fail(errorMessage.c_str());
+                }
+
+                const PrimitiveMetaData *pMetadata = (PrimitiveMetaData *)(pData + ((BVHOffsets *)pData)->offsetToPrimitiveMetaData);
+                for (UINT rayIndex = 0; rayIndex < 10000; rayIndex++)
+                {
+                    FallbackLayer::CpuRay ray;
+                    for (UINT axis = 0; axis < 3; axis++)
+                    {
+                        ray.origin[axis] = RandomFloat(60.0f);
+                        ray.direction[axis] = RandomFloat(1.0f);
+                    }
+                    ray.tMin = 0.0f;
+                    ray.tMax = FLT_MAX;
+
+                    FallbackLayer::CpuRayHit hit;
+                    FallbackLayer::CpuRayHit reorderedHit;
+                    const bool bHit = FallbackLayer::TraceRayBVH2(pSahData.get(), ray, hit);
+                    Assert::AreEqual(bHit, FallbackLayer::TraceRayBVH2(pData, ray, reorderedHit), L"Reordered BVH disagrees on whether a ray hits");
+                    if (bHit)
+                    {
+                        Assert::IsTrue(hit.t == reorderedHit.t, L"Reordered BVH returned a different closest hit distance");
+                        Assert::AreEqual(pSahMetadata[hit.primitiveId].PrimitiveIndex, pMetadata[reorderedHit.primitiveId].PrimitiveIndex, L"Reordered BVH returned a different closest hit");
+                    }
+                }
+            }
+        }
+
+        TEST_METHOD(CachedCpuBVHMatchesFreshBuild)
+        {
+            const UINT numTriangles = 2000;
+            CpuTriangleSoup soup = MakeRandomTriangleSoup(numTriangles, 30);
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pBuiltData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pOutputData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+
+            WCHAR tempDirectory[MAX_PATH];
+            GetTempPathW(MAX_PATH, tempDirectory);
+            const std::wstring cachePath = std::wstring(tempDirectory) + L"FallbackLayerUnitTests.bvhcache";
+            DeleteFileW(cachePath.c_str());
+
+            FallbackLayer::CpuBvh2Builder builder(1);
+            {
+                FallbackLayer::CpuBvhCache cache;
+                Assert::IsFalse(cache.Open(cachePath.c_str()), L"A missing cache file shouldn't open");
+                Assert::IsTrue(cache.FindOrBuild(builder, &desc, pBuiltData.get()) == pBuiltData.get(), L"An empty cache should build into the output");
+                cache.Save(cachePath.c_str());
+            }
+            const UINT totalSize = ((BVHOffsets *)pBuiltData.get())->totalSize;
+
+            FallbackLayer::CpuBvhCache cache;
+            Assert::IsTrue(cache.Open(cachePath.c_str()), L"Failed to map the saved cache");
+            Assert::AreEqual(1u, cache.GetNumEntries(), L"The saved cache should hold the one BVH built");
+            const BYTE *pCachedData = cache.FindOrBuild(builder, &desc, pOutputData.get());
+            Assert::IsTrue(pCachedData != pOutputData.get(), L"Unchanged geometry should come from the cache");
+            Assert::IsTrue(memcmp(pCachedData, pBuiltData.get(), totalSize) == 0, L"Cached BVH doesn't match the build it came from");
+
+            // Attributes interleaved with the positions don't change the key
+            std::vector<float> interleavedVertices;
+            for (UINT i = 0; i < soup.vertices.size(); i += 3)
+            {
+                interleavedVertices.insert(interleavedVertices.end(), { soup.vertices[i], soup.vertices[i + 1], soup.vertices[i + 2], RandomFloat(1.0f) });
+            }
+            D3D12_RAYTRACING_GEOMETRY_DESC interleavedGeomDesc = soup.geometryDesc;
+            interleavedGeomDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)interleavedVertices.data();
+            interleavedGeomDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(float) * 4;
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC interleavedDesc = desc;
+            interleavedDesc.pGeometryDescs = &interleavedGeomDesc;
+            Assert::IsTrue(cache.FindOrBuild(builder, &interleavedDesc, pOutputData.get()) == pCachedData, L"Interleaved copy of the same positions missed the cache");
+
+            // Anything the output depends on does
+            desc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+            Assert::IsTrue(cache.Find(FallbackLayer::ComputeCpuBvhCacheKey(&desc, builder.GetSettings())) == nullptr, L"Different build flags hit the cache");
+            desc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+            builder.GetSettings().Algorithm = FallbackLayer::CpuBvh2LbvhBuild;
+            Assert::IsTrue(cache.Find(FallbackLayer::ComputeCpuBvhCacheKey(&desc, builder.GetSettings())) == nullptr, L"Different build settings hit the cache");
+            builder.GetSettings().Algorithm = FallbackLayer::CpuBvh2SahBuild;
+            soup.vertices[7] += 1.0f;
+            Assert::IsTrue(cache.Find(FallbackLayer::ComputeCpuBvhCacheKey(&desc, builder.GetSettings())) == nullptr, L"Moved vertex hit the cache");
+
+            cache.Close();
+            DeleteFileW(cachePath.c_str());
+        }
+
+        TEST_METHOD(PackedVertexFormatsBuildSameCpuBVHAsFloat3)
+        {
+            const UINT numVertices = 1500;
+            const UINT numTriangles = 2000;
+
+            // Multiples of 1/64 below 16 are exact in fp16, and the SNORM
+            // reference is decoded the same way the builder decodes it
+            std::vector<float> vertices;
+            std::vector<float> interleavedVertices;
+            std::vector<UINT16> halfVertices;
+            std::vector<float> snormReferenceVertices;
+            std::vector<UINT16> snormVertices;
+            srand(12);
+            for (UINT i = 0; i < numVertices; i++)
+            {
+                for (UINT axis = 0; axis < 4; axis++)
+                {
+                    const float value = (float)(rand() % 2048 - 1024) / 64.0f;
+                    const INT16 snorm = (INT16)(rand() % 65535 - 32767);
+                    if (axis < 3)
+                    {
+                        vertices.push_back(value);
+                        snormReferenceVertices.push_back(snorm / 32767.0f);
+                    }
+                    interleavedVertices.push_back(value);
+                    halfVertices.push_back(FallbackLayer::Fp32ToFp16(value));
+                    snormVertices.push_back((UINT16)snorm);
+                }
+            }
+
+            std::vector<UINT16> indices;
+            std::vector<UINT32> r32Indices;
+            std::vector<float> unindexedVertices;
+            for (UINT i = 0; i < numTriangles * 3; i++)
+            {
+                const UINT16 index = (UINT16)(rand() % numVertices);
+                indices.push_back(index);
+                r32Indices.push_back(index);
+                unindexedVertices.insert(unindexedVertices.end(), &vertices[index * 3], &vertices[index * 3] + 3);
+            }
+
+            const CpuTriangleSoup soup = MakeTriangleSoup(std::move(vertices), std::move(indices));
+            const D3D12_RAYTRACING_GEOMETRY_DESC &geomDesc = soup.geometryDesc;
+
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            FallbackLayer::CpuBvh2Builder builder(4);
+            auto Build = [&](const D3D12_RAYTRACING_GEOMETRY_DESC &geometry)
+            {
+                std::vector<BYTE> output(maxOutputSize);
+                const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(geometry);
+                builder.BuildRaytracingAccelerationStructure(&desc, output.data());
+                output.resize(((BVHOffsets *)output.data())->totalSize);
+                return output;
+            };
+            const std::vector<BYTE> referenceOutput = Build(geomDesc);
+
+            D3D12_RAYTRACING_GEOMETRY_DESC r32IndexDesc = geomDesc;
+            r32IndexDesc.Triangles.IndexBuffer = (D3D12_GPU_VIRTUAL_ADDRESS)r32Indices.data();
+            r32IndexDesc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
+            Assert::IsTrue(Build(r32IndexDesc) == referenceOutput, L"R32 indices built a different BVH");
+
+            D3D12_RAYTRACING_GEOMETRY_DESC unindexedDesc = geomDesc;
+            unindexedDesc.Triangles.IndexBuffer = 0;
+            unindexedDesc.Triangles.IndexFormat = DXGI_FORMAT_UNKNOWN;
+            unindexedDesc.Triangles.IndexCount = 0;
+            unindexedDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)unindexedVertices.data();
+            unindexedDesc.Triangles.VertexCount = numTriangles * 3;
+            Assert::IsTrue(Build(unindexedDesc) == referenceOutput, L"Unindexed vertices built a different BVH");
+
+            D3D12_RAYTRACING_GEOMETRY_DESC interleavedDesc = geomDesc;
+            interleavedDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)interleavedVertices.data();
+            interleavedDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(float) * 4;
+            Assert::IsTrue(Build(interleavedDesc) == referenceOutput, L"Strided vertices built a different BVH");
+
+            D3D12_RAYTRACING_GEOMETRY_DESC halfDesc = geomDesc;
+            halfDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)halfVertices.data();
+            halfDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(UINT16) * 4;
+            halfDesc.Triangles.VertexFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
+            Assert::IsTrue(Build(halfDesc) == referenceOutput, L"R16G16B16A16_FLOAT vertices built a different BVH");
+
+            D3D12_RAYTRACING_GEOMETRY_DESC snormReferenceDesc = geomDesc;
+            snormReferenceDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)snormReferenceVertices.data();
+            const std::vector<BYTE> snormReferenceOutput = Build(snormReferenceDesc);
+
+            D3D12_RAYTRACING_GEOMETRY_DESC snormDesc = geomDesc;
+            snormDesc.Triangles.VertexBuffer.StartAddress = (D3D12_GPU_VIRTUAL_ADDRESS)snormVertices.data();
+            snormDesc.Triangles.VertexBuffer.StrideInBytes = sizeof(UINT16) * 4;
+            snormDesc.Triangles.VertexFormat = DXGI_FORMAT_R16G16B16A16_SNORM;
+            Assert::IsTrue(Build(snormDesc) == snormReferenceOutput, L"R16G16B16A16_SNORM vertices built a different BVH");
+
+            // Refits read vertices the same way
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(geomDesc, D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE);
+            std::vector<BYTE> refitOutput(maxOutputSize);
+            builder.BuildRaytracingAccelerationStructure(&desc, refitOutput.data());
+            desc.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+            desc.SourceAccelerationStructureData = (D3D12_GPU_VIRTUAL_ADDRESS)refitOutput.data();
+            desc.pGeometryDescs = &halfDesc;
+            const std::vector<BYTE> builtOutput = refitOutput;
+            builder.BuildRaytracingAccelerationStructure(&desc, refitOutput.data());
+            Assert::IsTrue(refitOutput == builtOutput, L"Refitting with R16G16B16A16_FLOAT copies of the vertices changed the BVH");
+        }
+
+        TEST_METHOD(IncrementalTopLevelCpuBVHUpdateMatchesRebuild)
+        {
+            const UINT numInstances = 200;
+
+            // A couple of bottom levels shared by all the instances
+            const UINT numBottomLevels = 2;
+            const UINT numTriangles = 64;
+            CpuTriangleSoup soups[numBottomLevels];
+            std::unique_ptr<BYTE[]> pBottomLevels[numBottomLevels];
+            FallbackLayer::CpuBvh2Builder bottomLevelBuilder(1);
+            for (UINT level = 0; level < numBottomLevels; level++)
+            {
+                soups[level] = MakeRandomTriangleSoup(numTriangles, 40 + level, level + 1.0f, false);
+                const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soups[level].geometryDesc);
+
+                pBottomLevels[level] = std::unique_ptr<BYTE[]>(new BYTE[GetMaxCpuBottomLevelSize(numTriangles)]);
+                bottomLevelBuilder.BuildRaytracingAccelerationStructure(&desc, pBottomLevels[level].get());
+            }
+
+            srand(40);
+            std::vector<D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC> instances(numInstances);
+            for (UINT i = 0; i < numInstances; i++)
+            {
+                D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instance = instances[i];
+                instance = {};
+                GenerateRandomTranformation(instance.Transform);
+                instance.Transform[3] += RandomFloat(100.0f);
+                instance.Transform[7] += RandomFloat(100.0f);
+                instance.Transform[11] += RandomFloat(100.0f);
+                instance.InstanceID = i;
+                instance.InstanceMask = 0xFF;
+                instance.AccelerationStructure.GpuVA = (D3D12_GPU_VIRTUAL_ADDRESS)pBottomLevels[i % numBottomLevels].get();
+            }
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc{};
+            desc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            desc.NumDescs = numInstances;
+            desc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+            desc.InstanceDescs = (D3D12_GPU_VIRTUAL_ADDRESS)instances.data();
+
+            const UINT numNodes = numInstances * 2 - 1;
+            const UINT maxOutputSize = FallbackLayer::CpuTopLevelBvh2Builder::GetMaxOutputSize(numInstances);
+            std::unique_ptr<BYTE[]> pUpdatedData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pRebuiltData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+
+            FallbackLayer::CpuTopLevelBvh2Builder builder(1);
+            FallbackLayer::CpuTopLevelBvh2Builder rebuildBuilder(1);
+
+            //
+            // An updated tree has to hold every instance once, with the same
+            // leaf box and metadata a rebuild gives it, and every node has
+            // to enclose its children
+            //
+            auto VerifyUpdate = [&](const wchar_t *pStep)
+            {
+                D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC rebuildDesc = desc;
+                rebuildDesc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
+                rebuildBuilder.BuildRaytracingAccelerationStructure(&rebuildDesc, pRebuiltData.get());
+
+                const BVHOffsets &offsets = *(BVHOffsets *)pUpdatedData.get();
+                const BVHOffsets &rebuiltOffsets = *(BVHOffsets *)pRebuiltData.get();
+                Assert::AreEqual(rebuiltOffsets.totalSize, offsets.totalSize, pStep);
+                Assert::IsTrue(memcmp(pUpdatedData.get() + offsets.offsetToVertices, pRebuiltData.get() + rebuiltOffsets.offsetToVertices,
+                    numInstances * sizeof(BVHMetadata)) == 0, pStep);
+
+                const AABBNode *pNodes = (AABBNode *)(pUpdatedData.get() + offsets.offsetToBoxes);
+                const AABBNode *pRebuiltNodes = (AABBNode *)(pRebuiltData.get() + rebuiltOffsets.offsetToBoxes);
+                std::vector<const AABBNode *> rebuiltLeaves(numInstances);
+                for (UINT i = 0; i < numNodes; i++)
+                {
+                    if (pRebuiltNodes[i].leaf)
+                    {
+                        rebuiltLeaves[pRebuiltNodes[i].leafNode.firstTriangleId] = &pRebuiltNodes[i];
+                    }
+                }
+
+                std::vector<bool> instanceFound(numInstances);
+                for (UINT i = 0; i < numNodes; i++)
+                {
+                    const AABBNode &node = pNodes[i];
+                    if (node.leaf)
+                    {
+                        const UINT instanceIndex = node.leafNode.firstTriangleId;
+                        Assert::AreEqual(0u, (UINT)node.leafNode.numTriangleIds, pStep);
+                        Assert::IsFalse(instanceFound[instanceIndex], pStep);
+                        instanceFound[instanceIndex] = true;
+                        Assert::IsTrue(memcmp(node.center, rebuiltLeaves[instanceIndex]->center, sizeof(node.center)) == 0 &&
+                            memcmp(node.halfDim, rebuiltLeaves[instanceIndex]->halfDim, sizeof(node.halfDim)) == 0, pStep);
+                        continue;
+                    }
+
+                    Assert::AreEqual(i + 1, (UINT)node.rightNodeIndex, pStep);
+                    AABB box;
+                    FallbackLayer::DecompressAABB(box, node);
+                    for (UINT childIndex : { (UINT)node.internalNode.leftNodeIndex, i + 1 })
+                    {
+                        Assert::IsTrue(childIndex > i && childIndex < numNodes, pStep);
+                        AABB childBox;
+                        FallbackLayer::DecompressAABB(childBox, pNodes[childIndex]);
+                        for (UINT axis = 0; axis < 3; axis++)
+                        {
+                            const float epsilon = 1e-4f * (1.0f + std::abs(box.minArr[axis]) + std::abs(box.maxArr[axis]));
+                            Assert::IsTrue(childBox.minArr[axis] >= box.minArr[axis] - epsilon && childBox.maxArr[axis] <= box.maxArr[axis] + epsilon, pStep);
+                        }
+                    }
+                }
+                Assert::IsTrue(std::find(instanceFound.begin(), instanceFound.end(), false) == instanceFound.end(), pStep);
+            };
+
+            desc.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE;
+            builder.BuildRaytracingAccelerationStructure(&desc, pUpdatedData.get());
+            Assert::IsTrue(builder.GetLastBuildStats().bRebuilt, L"The first build has nothing to update");
+            Assert::AreEqual(numInstances, builder.GetLastBuildStats().NumInstancesTouched);
+            VerifyUpdate(L"Initial build");
+
+            const D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS updateFlags =
+                D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+
+            // Instances nudged a little are refit in place
+            for (UINT i = 0; i < 5; i++)
+            {
+                instances[i * 37].Transform[3] += 0.01f;
+            }
+            desc.Flags = updateFlags;
+            builder.BuildRaytracingAccelerationStructure(&desc, pUpdatedData.get());
+            const FallbackLayer::CpuTopLevelBuildStats stats = builder.GetLastBuildStats();
+            Assert::IsFalse(stats.bRebuilt, L"Small moves shouldn't rebuild");
+            Assert::AreEqual(5u, stats.NumInstancesTouched);
+            Assert::AreEqual(0u, stats.NumInstancesReinserted);
+            Assert::IsTrue(stats.NumNodesRewritten > 0 && stats.NumNodesRewritten < numNodes, L"A refit should only rewrite the moved leaves and their ancestors");
+            VerifyUpdate(L"Refit");
+
+            // Changing anything but the box rewrites metadata only
+            instances[3].InstanceMask = 0x1;
+            builder.BuildRaytracingAccelerationStructure(&desc, pUpdatedData.get());
+            Assert::AreEqual(1u, builder.GetLastBuildStats().NumInstancesTouched);
+            Assert::AreEqual(0u, builder.GetLastBuildStats().NumNodesRewritten);
+            VerifyUpdate(L"Instance mask change");
+
+            // Instances moved across the scene are reinserted
+            builder.GetSettings().MaxSahGrowth = FLT_MAX;
+            for (UINT i = 0; i < 4; i++)
+            {
+                instances[i * 11 + 1].Transform[3] = -instances[i * 11 + 1].Transform[3];
+                instances[i * 11 + 1].Transform[7] += 150.0f;
+            }
+            builder.BuildRaytracingAccelerationStructure(&desc, pUpdatedData.get());
+            Assert::IsFalse(builder.GetLastBuildStats().bRebuilt);
+            Assert::AreEqual(4u, builder.GetLastBuildStats().NumInstancesTouched);
+            Assert::IsTrue(builder.GetLastBuildStats().NumInstancesReinserted > 0, L"Far moves should reinsert instead of refitting");
+            Assert::AreEqual(numNodes, builder.GetLastBuildStats().NumNodesRewritten);
+            VerifyUpdate(L"Reinsertion");
+
+            // Moving too many instances, or degrading the tree too much, rebuilds
+            for (UINT i = 0; i < numInstances / 2; i++)
+            {
+                instances[i].Transform[11] += 1.0f;
+            }
+            builder.BuildRaytracingAccelerationStructure(&desc, pUpdatedData.get());
+            Assert::IsTrue(builder.GetLastBuildStats().bRebuilt, L"Updating half the instances should rebuild");
+            VerifyUpdate(L"Rebuild");
+
+            builder.GetSettings().MaxSahGrowth = 1.0f;
+            builder.GetSettings().ReinsertionThreshold = -1.0f;
+            for (UINT axis = 0; axis < 3; axis++)
+            {
+                instances[0].Transform[axis * 4 + 3] = -instances[0].Transform[axis * 4 + 3];
+            }
+            builder.BuildRaytracingAccelerationStructure(&desc, pUpdatedData.get());
+            Assert::IsTrue(builder.GetLastBuildStats().bRebuilt, L"Growing the SAH cost past MaxSahGrowth should rebuild");
+            VerifyUpdate(L"SAH growth rebuild");
+        }
+
+        TEST_METHOD(BvhValidatorRejectsCorruptedCpuBVH)
+        {
+            const UINT numTriangles = 20000;
+            CpuTriangleSoup soup = MakeRandomTriangleSoup(numTriangles, 50, 200.0f, false);
+            const D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC desc = GetBottomLevelBuildDesc(soup.geometryDesc);
+
+            const UINT maxOutputSize = GetMaxCpuBottomLevelSize(numTriangles);
+            std::unique_ptr<BYTE[]> pBottomLevel = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            std::unique_ptr<BYTE[]> pCorruptedData = std::unique_ptr<BYTE[]>(new BYTE[maxOutputSize]);
+            FallbackLayer::CpuBvh2Builder builder;
+            builder.BuildRaytracingAccelerationStructure(&desc, pBottomLevel.get());
+
+            const BVHOffsets &offsets = *(BVHOffsets *)pBottomLevel.get();
+            AABBNode *pNodes = (AABBNode *)(pCorruptedData.get() + offsets.offsetToBoxes);
+            Primitive *pPrimitives = (Primitive *)(pCorruptedData.get() + offsets.offsetToVertices);
+            auto &validator = FallbackLayer::GetAccelerationStructureValidator(FallbackLayer::BVH2);
+
+            // Validates a copy of the bottom level after corrupting it,
+            // returning the error or an empty string if it's valid
+            auto ValidateCorruptedBottomLevel = [&](const std::function<void()> &corrupt)
+            {
+                memcpy(pCorruptedData.get(), pBottomLevel.get(), offsets.totalSize);
+                corrupt();
+
+                std::wstring errorMessage;
+                validator.VerifyBottomLevelOutput(&soup.descriptor, 1, pCorruptedData.get(), errorMessage);
+                return errorMessage;
+            };
+
+            const AABBNode *pBuiltNodes = (AABBNode *)(pBottomLevel.get() + offsets.offsetToBoxes);
+            UINT leafIndex = 0;
+            while (!pBuiltNodes[leafIndex].leaf)
+            {
+                leafIndex = pBuiltNodes[leafIndex].rightNodeIndex;
+            }
+
+            std::wstring errorMessage = ValidateCorruptedBottomLevel([] {});
+            Assert::IsTrue(errorMessage.empty(), errorMessage.c_str());
+
+            errorMessage = ValidateCorruptedBottomLevel([&] { pPrimitives[0].triangle.v0.x += 0.0005f; });
+            Assert::IsTrue(errorMessage.empty(), L"Vertices within the validation epsilon should still match");
+
+            errorMessage = ValidateCorruptedBottomLevel([&] { pNodes[0].internalNode.leftNodeIndex = 0; });
+            Assert::AreEqual(std::wstring(L"Circular referance to root node"), errorMessage, errorMessage.c_str());
+
+            errorMessage = ValidateCorruptedBottomLevel([&] { pNodes[leafIndex].center[0] += 1000.0f; });
+            Assert::AreEqual(std::wstring(L"AABB not contained by parent"), errorMessage, errorMessage.c_str());
+
+            errorMessage = ValidateCorruptedBottomLevel([&]
+            {
+                Triangle &triangle = pPrimitives[pBuiltNodes[leafIndex].leafNode.firstTriangleId].triangle;
+                triangle.v0.x += 10.0f;
+                triangle.v1.x += 10.0f;
+                triangle.v2.x += 10.0f;
+            });
+            Assert::IsFalse(errorMessage.empty(), L"A triangle missing from the BVH should fail validation");
+
+            //
+            // Instances rotated and scaled by their transforms have to be
+            // contained by the top level's leaves with all 8 of their
+            // corners transformed
+            //
+            const UINT numInstances = 100;
+            AABB bottomLevelBox;
+            FallbackLayer::DecompressAABB(bottomLevelBox, *(AABBNode *)(pBottomLevel.get() + offsets.offsetToBoxes));
+
+            std::vector<D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC> instances(numInstances);
+            std::vector<AABB> instanceBoxes(numInstances, bottomLevelBox);
+            std::vector<float *> instanceTransforms(numInstances);
+            for (UINT i = 0; i < numInstances; i++)
+            {
+                D3D12_RAYTRACING_FALLBACK_INSTANCE_DESC &instance = instances[i];
+                instance = {};
+                GenerateRandomTranformation(instance.Transform);
+                instance.Transform[3] += RandomFloat(1000.0f);
+                instance.InstanceMask = 0xFF;
+                instance.AccelerationStructure.GpuVA = (D3D12_GPU_VIRTUAL_ADDRESS)pBottomLevel.get();
+                instanceTransforms[i] = instance.Transform;
+            }
+
+            D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC topLevelDesc{};
+            topLevelDesc.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+            topLevelDesc.NumDescs = numInstances;
+            topLevelDesc.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+            topLevelDesc.InstanceDescs = (D3D12_GPU_VIRTUAL_ADDRESS)instances.data();
+
+            std::unique_ptr<BYTE[]> pTopLevel = std::unique_ptr<BYTE[]>(new BYTE[FallbackLayer::CpuTopLevelBvh2Builder::GetMaxOutputSize(numInstances)]);
+            FallbackLayer::CpuTopLevelBvh2Builder topLevelBuilder;
+            topLevelBuilder.BuildRaytracingAccelerationStructure(&topLevelDesc, pTopLevel.get());
+
+            if (!validator.VerifyTopLevelOutput(instanceBoxes.data(), instanceTransforms.data(), numInstances, pTopLevel.get(), errorMessage))
+            {
+                Assert::Fail(errorMessage.c_str());
+            }
+
+            AABBNode *pTopLevelNodes = (AABBNode *)(pTopLevel.get() + ((BVHOffsets *)pTopLevel.get())->offsetToBoxes);
+            UINT instanceLeafIndex = 0;
+            while (!pTopLevelNodes[instanceLeafIndex].leaf)
+            {
+                instanceLeafIndex = pTopLevelNodes[instanceLeafIndex].internalNode.leftNodeIndex;
+            }
+            instanceBoxes[pTopLevelNodes[instanceLeafIndex].nodeAllBits & 0x7FFFFFFF].max.y += 1.0e6f;
+            Assert::IsFalse(validator.VerifyTopLevelOutput(instanceBoxes.data(), instanceTransforms.data(), numInstances, pTopLevel.get(), errorMessage),
+                L"An instance outside of every top-level leaf should fail validation");
+        }
+
         template <UINT numBottomLevels>
         void SimpleTopLevelGpuBVHBuilder(
             D3D12_ELEMENTS_LAYOUT layoutToTest,
@@ -29,14 +29,12 @@ struct float4
     float   x, y, z, w;
 };
 
-__declspec(align(16))
-struct uint4
+struct alignas(16) uint4
 {
     UINT    x, y, z, w;
 };
 
-__declspec(align(16))
-struct float4x4
+struct alignas(16) float4x4
 {
     float   mat[16];
 };
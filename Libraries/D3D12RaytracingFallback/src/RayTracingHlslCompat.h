@@ -400,6 +400,48 @@ struct AABBNode
 static_assert(sizeof(AABBNode) == SizeOfAABBNode, L"Incorrect sizeof for AABB");
 #endif
 
+// AABBNode with its center and half extents stored as fp16. The half extents
+// are rounded outward so the decoded box always encloses the original one.
+// The right child isn't stored, it always directly follows its parent.
+struct CompressedAABBNode
+{
+#ifdef HLSL
+    uint    centerXY;
+    uint    centerZHalfDimX;
+    uint    halfDimYZ;
+    uint    flags;
+#else
+    UINT16  center[3];
+    UINT16  halfDim[3];
+    union
+    {
+        struct
+        {
+            uint    leftNodeIndex : 24;
+            uint    separatingAxis : 3;
+        } internalNode;
+
+        struct
+        {
+            uint    firstTriangleId : 24;
+            uint    numTriangleIds  : 7;
+        } leafNode;
+
+        uint nodeAllBits;
+
+        struct
+        {
+            uint         : 31;
+            uint    leaf : 1;
+        };
+    };
+#endif
+};
+#define SizeOfCompressedAABBNode (4 * 4)
+#ifndef HLSL
+static_assert(sizeof(CompressedAABBNode) == SizeOfCompressedAABBNode, L"Incorrect sizeof for CompressedAABBNode");
+#endif
+
 // BVH description for the traversal shader
 struct BVHOffsets
 {
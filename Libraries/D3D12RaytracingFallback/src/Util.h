@@ -49,6 +49,7 @@ template <typename T> T AlignPowerOfTwo(T value)
     return value == 0 ? 0 : 1 << Log2(value);
 }
 
+#ifndef FALLBACK_CPU_BUILDERS_ONLY
 static void CreateRootSignatureHelper(ID3D12Device *pDevice, D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, ID3D12RootSignature **ppRootSignature)
 {
     CComPtr<ID3DBlob> pRootSignatureBlob;
@@ -73,6 +74,7 @@ static void CreatePSOHelper(
     psoDesc.CS = byteCode;
     ThrowFailure(pDevice->CreateComputePipelineState(&psoDesc, IID_PPV_ARGS(ppPSO)));
 }
+#endif
 
 static bool IsVertexBufferFormatSupported(DXGI_FORMAT format)
 {
@@ -100,7 +102,7 @@ static bool IsIndexBufferFormatSupported(DXGI_FORMAT format)
 }
 
 template<typename RAYTRACING_ACCELERATION_STRUCTURE_DESC>
-static const D3D12_RAYTRACING_GEOMETRY_DESC &GetGeometryDesc(const typename RAYTRACING_ACCELERATION_STRUCTURE_DESC &desc, UINT geometryIndex)
+static const D3D12_RAYTRACING_GEOMETRY_DESC &GetGeometryDesc(const RAYTRACING_ACCELERATION_STRUCTURE_DESC &desc, UINT geometryIndex)
 {
     switch (desc.DescsLayout)
     {
@@ -149,7 +151,7 @@ static UINT GetPrimitiveCountFromGeometryDesc(const D3D12_RAYTRACING_GEOMETRY_DE
 }
 
 template<typename RAYTRACING_ACCELERATION_STRUCTURE_DESC>
-static UINT GetTotalPrimitiveCount(const typename RAYTRACING_ACCELERATION_STRUCTURE_DESC &desc)
+static UINT GetTotalPrimitiveCount(const RAYTRACING_ACCELERATION_STRUCTURE_DESC &desc)
 {
     UINT totalTriangles = 0;
     for (UINT elementIndex = 0; elementIndex < desc.NumDescs; elementIndex++)
@@ -166,6 +168,7 @@ static UINT GetNumberOfInternalNodes(UINT numLeaves)
     return std::max(0, (INT)(numLeaves - 1));
 }
 
+#ifndef FALLBACK_CPU_BUILDERS_ONLY
 static UINT GetNumParameters(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc)
 {
     UINT numParameters = (UINT)-1;
@@ -182,3 +185,4 @@ static UINT GetNumParameters(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc)
     }
     return numParameters;
 }
+#endif
@@ -10,10 +10,41 @@
 //*********************************************************
 #pragma once
 
+#ifdef FALLBACK_CPU_BUILDERS_ONLY
+// Just the CPU builders, built without the Windows SDK by
+// CpuBvhBenchmark/CMakeLists.txt
+#include "CpuBvhBenchmark/D3D12Shim.h"
+#include <assert.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "Util.h"
+
+#include "RayTracingHlslCompat.h"
+#include "AccelerationStructureValidator.h"
+#include "BVHValidator.h"
+#include "CpuTaskPool.h"
+#include "CpuSahBinning.h"
+#include "CpuLbvh.h"
+#include "CpuTreeletReorder.h"
+#include "CpuTriangleLoader.h"
+#include "CpuBvh2Builder.h"
+#include "CpuBvh2Compression.h"
+#include "CpuBvhTraversal.h"
+#include "CpuWideBvh.h"
+#else
 #ifndef NOMINMAX
 #define NOMINMAX
 #endif
 #include <windows.h>
+#include <intrin.h>
 #include <DirectXMath.h>
 #include <assert.h>
 #include <comdef.h>
@@ -25,6 +56,11 @@
 #include <map>
 #include <deque>
 #include <string>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <strsafe.h>
 #include "d3d12_1.h"
 #include "d3dx12.h"
@@ -48,6 +84,17 @@
 #include "DxilShaderPatcher.h"
 #include "AccelerationStructureValidator.h"
 #include "AccelerationStructureBuilder.h"
+#include "CpuTaskPool.h"
+#include "CpuSahBinning.h"
+#include "CpuLbvh.h"
+#include "CpuTreeletReorder.h"
+#include "CpuTriangleLoader.h"
+#include "CpuBvh2Builder.h"
+#include "CpuTopLevelBvh2Builder.h"
+#include "CpuBvh2Compression.h"
+#include "CpuBvhTraversal.h"
+#include "CpuWideBvh.h"
+#include "CpuBvhCache.h"
 #include "AccelerationStructureBuilderFactory.h"
 #include "TraversalShaderBuilder.h"
 #include "RaytracingProgram.h"
@@ -85,3 +132,4 @@
 #include <pix3.h>
 static const UINT FallbackPixColor = PIX_COLOR(10, 10, 255);
 #endif
+#endif
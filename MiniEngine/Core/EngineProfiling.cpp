@@ -451,6 +451,21 @@ namespace EngineProfiling
         return Paused;
     }
 
+    vector<pair<wstring, uint32_t>> s_Counters;
+
+    void SetCounter(const wstring& name, uint32_t value)
+    {
+        for (auto& counter : s_Counters)
+        {
+            if (counter.first == name)
+            {
+                counter.second = value;
+                return;
+            }
+        }
+        s_Counters.emplace_back(name, value);
+    }
+
     void DisplayFrameRate( TextContext& Text )
     {
         if (!DrawFrameRate)
@@ -491,6 +506,23 @@ namespace EngineProfiling
             Text.SetColor( Color(1.0f, 1.0f, 1.0f) );
 
             NestedTimingTree::Display( Text, x );
+
+            if (!s_Counters.empty())
+            {
+                Text.SetLeftMargin(x);
+                Text.SetCursorX(x);
+                Text.NewLine();
+                Text.SetColor( Color(0.5f, 1.0f, 1.0f) );
+                Text.DrawString("Counters\n");
+                Text.SetColor( Color(1.0f, 1.0f, 1.0f) );
+                for (const auto& counter : s_Counters)
+                {
+                    Text.SetCursorX(x);
+                    Text.DrawString(counter.first);
+                    Text.SetCursorX(x + 300.0f);
+                    Text.DrawFormattedString("%6u\n", counter.second);
+                }
+            }
         }
 
         Text.GetCommandContext().SetScissor(0, 0, g_DisplayWidth, g_DisplayHeight);
@@ -29,6 +29,10 @@ namespace EngineProfiling
     void DisplayPerfGraph(GraphicsContext& Text);
     void Display(TextContext& Text, float x, float y, float w, float h);
     bool IsPaused();
+
+    // Counters are listed under the timings, in the order they were first
+    // set, and keep their last value. Set them from the main thread.
+    void SetCounter(const std::wstring& name, uint32_t value);
 }
 
 #ifdef RELEASE
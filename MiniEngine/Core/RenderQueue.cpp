@@ -0,0 +1,109 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "pch.h"
+#include "RenderQueue.h"
+#include <algorithm>
+
+uint32_t RenderQueue::ComputeDepthBucket( float Depth, float NearZ, float FarZ )
+{
+    if (!(Depth > NearZ))
+        return 0;
+    if (!(Depth < FarZ))
+        return kDepthBuckets - 1;
+
+    float t = logf(Depth / NearZ) / logf(FarZ / NearZ);
+    return (uint32_t)(t * (kDepthBuckets - 1));
+}
+
+void RenderQueue::Reset( void )
+{
+    m_Packets.clear();
+    m_Sorted.clear();
+    memset(m_PassStart, 0, sizeof(m_PassStart));
+}
+
+void RenderQueue::AddDraw( uint32_t Pass, uint32_t DepthBucket, const DrawPacket& Packet )
+{
+    ASSERT(Pass < kMaxPasses && Packet.PSO < kMaxPSOs && Packet.Material < kMaxMaterials && DepthBucket < kDepthBuckets,
+        "Render queue key field out of range");
+
+    m_Packets.push_back(Packet);
+    m_Packets.back().SortKey = MakeSortKey(Pass, Packet.PSO, Packet.Material, DepthBucket);
+}
+
+void RenderQueue::Sort( void )
+{
+    const uint32_t Count = (uint32_t)m_Packets.size();
+    m_Sorted.resize(Count);
+    m_Scratch.resize(Count);
+
+    // Count every byte of the keys in one sweep
+    uint32_t Histograms[8][256] = {};
+    for (uint32_t i = 0; i < Count; ++i)
+    {
+        uint64_t Key = m_Packets[i].SortKey;
+        m_Sorted[i].SortKey = Key;
+        m_Sorted[i].PacketIndex = i;
+        for (uint32_t Digit = 0; Digit < 8; ++Digit)
+            ++Histograms[Digit][(Key >> (Digit * 8)) & 0xFF];
+    }
+
+    // Least significant byte first.  Each pass is stable, so equal keys keep their order.
+    SortItem* Src = m_Sorted.data();
+    SortItem* Dst = m_Scratch.data();
+    for (uint32_t Digit = 0; Digit < 8 && Count > 0; ++Digit)
+    {
+        const uint32_t Shift = Digit * 8;
+
+        // A byte every key shares (such as the unused low bits) would not change the order
+        if (Histograms[Digit][(Src[0].SortKey >> Shift) & 0xFF] == Count)
+            continue;
+
+        uint32_t Offsets[256];
+        uint32_t Offset = 0;
+        for (uint32_t Value = 0; Value < 256; ++Value)
+        {
+            Offsets[Value] = Offset;
+            Offset += Histograms[Digit][Value];
+        }
+
+        for (uint32_t i = 0; i < Count; ++i)
+            Dst[Offsets[(Src[i].SortKey >> Shift) & 0xFF]++] = Src[i];
+
+        std::swap(Src, Dst);
+    }
+
+    if (Src != m_Sorted.data())
+        m_Sorted.swap(m_Scratch);
+
+    // The pass is the top nibble of the top byte, so the top byte's counts give each pass its range
+    uint32_t Start = 0;
+    for (uint32_t Pass = 0; Pass < kMaxPasses; ++Pass)
+    {
+        m_PassStart[Pass] = Start;
+        for (uint32_t Value = Pass << 4; Value < (Pass + 1) << 4; ++Value)
+            Start += Histograms[7][Value];
+    }
+    m_PassStart[kMaxPasses] = Start;
+}
+
+void RenderQueue::FindPSORange( uint32_t Pass, uint32_t PSO, uint32_t& First, uint32_t& Last ) const
+{
+    // Within a pass the PSO is the most significant field, so its draws form one sorted run
+    const SortItem* Begin = m_Sorted.data() + m_PassStart[Pass];
+    const SortItem* End = m_Sorted.data() + m_PassStart[Pass + 1];
+    const SortItem* RunStart = std::partition_point(Begin, End, [PSO]( const SortItem& Item ) { return GetPSO(Item.SortKey) < PSO; });
+    const SortItem* RunEnd = std::partition_point(RunStart, End, [PSO]( const SortItem& Item ) { return GetPSO(Item.SortKey) == PSO; });
+
+    First = (uint32_t)(RunStart - m_Sorted.data());
+    Last = (uint32_t)(RunEnd - m_Sorted.data());
+}
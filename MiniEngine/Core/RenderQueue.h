@@ -0,0 +1,175 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+//
+// A render queue collects the draws of a frame as packets with 64-bit sort keys, sorts them with a
+// radix sort, and submits them one pass at a time, only changing the state that differs from the
+// previous draw.  From the most significant bits down, a key holds:
+//
+//     pass (4 bits) | pipeline state (12 bits) | material (16 bits) | depth bucket (16 bits) | unused (16 bits)
+//
+// The queue knows nothing about D3D.  Pipeline states, materials and geometry are ids the application
+// gives meaning to through the binder it submits with, so keys can be built and sorted without a device.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class RenderQueue
+{
+public:
+    enum { kPassBits = 4, kPSOBits = 12, kMaterialBits = 16, kDepthBits = 16 };
+    enum { kPassShift = 60, kPSOShift = 48, kMaterialShift = 32, kDepthShift = 16 };
+    enum { kMaxPasses = 1 << kPassBits, kMaxPSOs = 1 << kPSOBits, kMaxMaterials = 1 << kMaterialBits, kDepthBuckets = 1 << kDepthBits };
+
+    static uint64_t MakeSortKey( uint32_t Pass, uint32_t PSO, uint32_t Material, uint32_t DepthBucket )
+    {
+        return (uint64_t)Pass << kPassShift | (uint64_t)PSO << kPSOShift |
+            (uint64_t)Material << kMaterialShift | (uint64_t)DepthBucket << kDepthShift;
+    }
+
+    static uint32_t GetPass( uint64_t SortKey ) { return (uint32_t)(SortKey >> kPassShift); }
+    static uint32_t GetPSO( uint64_t SortKey ) { return (uint32_t)(SortKey >> kPSOShift) & (kMaxPSOs - 1); }
+    static uint32_t GetMaterial( uint64_t SortKey ) { return (uint32_t)(SortKey >> kMaterialShift) & (kMaxMaterials - 1); }
+    static uint32_t GetDepthBucket( uint64_t SortKey ) { return (uint32_t)(SortKey >> kDepthShift) & (kDepthBuckets - 1); }
+
+    // Buckets view depth logarithmically between the near and far planes, so nearby draws are told apart
+    // as finely as distant ones relative to their distance.  Nearer draws get lower buckets; subtract the
+    // bucket from kDepthBuckets - 1 to sort back to front.
+    static uint32_t ComputeDepthBucket( float Depth, float NearZ, float FarZ );
+
+    struct DrawPacket
+    {
+        uint64_t SortKey;
+        uint32_t PSO;
+        uint32_t Material;
+        uint32_t Geometry;      // e.g. which index buffer view to bind
+        uint32_t IndexCount;
+        uint32_t StartIndex;
+        int32_t BaseVertex;
+        uint32_t UserData;      // passed through to the binder untouched
+    };
+
+    struct SubmitStats
+    {
+        uint32_t Draws;
+        uint32_t PSOChanges;
+        uint32_t MaterialChanges;
+        uint32_t GeometryChanges;
+
+        // Compared to binding every state for every draw
+        uint32_t StateChangesAvoided( void ) const { return Draws * 3 - (PSOChanges + MaterialChanges + GeometryChanges); }
+
+        SubmitStats& operator+=( const SubmitStats& Other )
+        {
+            Draws += Other.Draws;
+            PSOChanges += Other.PSOChanges;
+            MaterialChanges += Other.MaterialChanges;
+            GeometryChanges += Other.GeometryChanges;
+            return *this;
+        }
+    };
+
+    // Empties the queue but keeps its memory for the next frame
+    void Reset( void );
+
+    // The packet's key is built from the pass, its PSO and material and the depth bucket
+    void AddDraw( uint32_t Pass, uint32_t DepthBucket, const DrawPacket& Packet );
+
+    // Sorts the draws by key.  Draws with equal keys keep the order they were added in.
+    void Sort( void );
+
+    uint32_t GetDrawCount( void ) const { return (uint32_t)m_Packets.size(); }
+    uint32_t GetDrawCount( uint32_t Pass ) const { return m_PassStart[Pass + 1] - m_PassStart[Pass]; }
+
+    // The sorted packets of a pass, valid until the next Reset().
+    const DrawPacket& GetSortedDraw( uint32_t Pass, uint32_t Index ) const
+    {
+        return m_Packets[m_Sorted[m_PassStart[Pass] + Index].PacketIndex];
+    }
+
+    // Submits the sorted draws of one pass.  The binder is only asked to change a state when it differs
+    // from the previous draw's, starting from nothing bound.  It provides:
+    //
+    //     void SetPipelineState( ContextType&, uint32_t PSO );
+    //     void SetMaterial( ContextType&, uint32_t Material );
+    //     void SetGeometry( ContextType&, uint32_t Geometry );
+    //     void Draw( ContextType&, const DrawPacket& Packet );
+    template <typename ContextType, typename BinderType>
+    SubmitStats Submit( ContextType& Context, BinderType& Binder, uint32_t Pass ) const
+    {
+        return SubmitRange(Context, Binder, m_PassStart[Pass], m_PassStart[Pass + 1]);
+    }
+
+    // Submits only the draws of a pass that use one PSO.  Sorting keeps them together, so they can be
+    // submitted (and timed) apart from the rest of the pass.
+    template <typename ContextType, typename BinderType>
+    SubmitStats Submit( ContextType& Context, BinderType& Binder, uint32_t Pass, uint32_t PSO ) const
+    {
+        uint32_t First, Last;
+        FindPSORange(Pass, PSO, First, Last);
+        return SubmitRange(Context, Binder, First, Last);
+    }
+
+private:
+    template <typename ContextType, typename BinderType>
+    SubmitStats SubmitRange( ContextType& Context, BinderType& Binder, uint32_t First, uint32_t Last ) const
+    {
+        SubmitStats Stats = {};
+        uint32_t PSO = ~0u;
+        uint32_t Material = ~0u;
+        uint32_t Geometry = ~0u;
+
+        for (uint32_t i = First; i < Last; ++i)
+        {
+            const DrawPacket& Packet = m_Packets[m_Sorted[i].PacketIndex];
+
+            if (Packet.PSO != PSO)
+            {
+                PSO = Packet.PSO;
+                Binder.SetPipelineState(Context, PSO);
+                ++Stats.PSOChanges;
+            }
+            if (Packet.Material != Material)
+            {
+                Material = Packet.Material;
+                Binder.SetMaterial(Context, Material);
+                ++Stats.MaterialChanges;
+            }
+            if (Packet.Geometry != Geometry)
+            {
+                Geometry = Packet.Geometry;
+                Binder.SetGeometry(Context, Geometry);
+                ++Stats.GeometryChanges;
+            }
+
+            Binder.Draw(Context, Packet);
+            ++Stats.Draws;
+        }
+
+        return Stats;
+    }
+
+    void FindPSORange( uint32_t Pass, uint32_t PSO, uint32_t& First, uint32_t& Last ) const;
+
+    struct SortItem
+    {
+        uint64_t SortKey;
+        uint32_t PacketIndex;
+    };
+
+    std::vector<DrawPacket> m_Packets;
+    std::vector<SortItem> m_Sorted;
+    std::vector<SortItem> m_Scratch;
+    uint32_t m_PassStart[kMaxPasses + 1] = {};
+};
@@ -35,6 +35,7 @@ std::unique_ptr<Model> AssimpModelLoader::LoadModel(const char *filename)
 	// max triangles and vertices per mesh, splits above this threshold
 	importer.SetPropertyInteger(AI_CONFIG_PP_SLM_TRIANGLE_LIMIT, INT_MAX);
 	importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, 0xfffe); // avoid the primitive restart index
+	unsigned int splitLargeMeshes = m_SplitLargeMeshes ? aiProcess_SplitLargeMeshes : 0;
 
 																		// remove points and lines
 	importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
@@ -45,7 +46,7 @@ std::unique_ptr<Model> AssimpModelLoader::LoadModel(const char *filename)
 		aiProcess_Triangulate |
 		aiProcess_RemoveComponent |
 		aiProcess_GenSmoothNormals |
-		aiProcess_SplitLargeMeshes |
+		splitLargeMeshes |
 		aiProcess_ValidateDataStructure |
 		//aiProcess_ImproveCacheLocality | // handled by optimizePostTransform()
 		aiProcess_RemoveRedundantMaterials |
@@ -352,11 +353,23 @@ std::unique_ptr<Model> AssimpModelLoader::LoadModel(const char *filename)
 		dstMesh->vertexDataByteOffset = model->m_Header.vertexDataByteSize;
 		dstMesh->vertexCount = srcMesh->mNumVertices;
 
+		// 16-bit indices whenever they can address every vertex without
+		// using the primitive restart index
+		if (dstMesh->vertexCount > 0xffff)
+		{
+			dstMesh->indexFormat = index_format_uint32;
+			model->m_Header.indexDataByteSize = (model->m_Header.indexDataByteSize + 3) & ~3u;
+		}
+		else
+		{
+			dstMesh->indexFormat = index_format_uint16;
+		}
+
 		dstMesh->indexDataByteOffset = model->m_Header.indexDataByteSize;
 		dstMesh->indexCount = srcMesh->mNumFaces * 3;
 
 		model->m_Header.vertexDataByteSize += dstMesh->vertexStride * dstMesh->vertexCount;
-		model->m_Header.indexDataByteSize += sizeof(uint16_t) * dstMesh->indexCount;
+		model->m_Header.indexDataByteSize += IndexFormatSize(dstMesh->indexFormat) * dstMesh->indexCount;
 
 		// depth-only rendering
 		dstMesh->vertexDataByteOffsetDepth = model->m_Header.vertexDataByteSizeDepth;
@@ -374,6 +387,10 @@ std::unique_ptr<Model> AssimpModelLoader::LoadModel(const char *filename)
 	model->m_pVertexDataDepth = new unsigned char[model->m_Header.vertexDataByteSizeDepth];
 	model->m_pIndexDataDepth = new unsigned char[model->m_Header.indexDataByteSize];
 
+	// zero the padding that aligns 32-bit index data
+	memset(model->m_pIndexData, 0, model->m_Header.indexDataByteSize);
+	memset(model->m_pIndexDataDepth, 0, model->m_Header.indexDataByteSize);
+
 	// second pass, fill in vertex and index data
 	for (unsigned int meshIndex = 0; meshIndex < scene->mNumMeshes; meshIndex++)
 	{
@@ -532,24 +549,51 @@ std::unique_ptr<Model> AssimpModelLoader::LoadModel(const char *filename)
 			}*/
 		}
 
-		uint16_t *dstIndex = (uint16_t*)(model->m_pIndexData + dstMesh->indexDataByteOffset);
-		uint16_t *dstIndexDepth = (uint16_t*)(model->m_pIndexDataDepth + dstMesh->indexDataByteOffset);
-		for (unsigned int f = 0; f < srcMesh->mNumFaces; f++)
+		if (dstMesh->indexFormat == index_format_uint32)
+		{
+			uint32_t *dstIndex = (uint32_t*)(model->m_pIndexData + dstMesh->indexDataByteOffset);
+			uint32_t *dstIndexDepth = (uint32_t*)(model->m_pIndexDataDepth + dstMesh->indexDataByteOffset);
+			for (unsigned int f = 0; f < srcMesh->mNumFaces; f++)
+			{
+				ASSERT(srcMesh->mFaces[f].mNumIndices == 3);
+
+				*dstIndex++ = srcMesh->mFaces[f].mIndices[0];
+				*dstIndex++ = srcMesh->mFaces[f].mIndices[1];
+				*dstIndex++ = srcMesh->mFaces[f].mIndices[2];
+
+				*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[0];
+				*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[1];
+				*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[2];
+			}
+		}
+		else
 		{
-			ASSERT(srcMesh->mFaces[f].mNumIndices == 3);
+			uint16_t *dstIndex = (uint16_t*)(model->m_pIndexData + dstMesh->indexDataByteOffset);
+			uint16_t *dstIndexDepth = (uint16_t*)(model->m_pIndexDataDepth + dstMesh->indexDataByteOffset);
+			for (unsigned int f = 0; f < srcMesh->mNumFaces; f++)
+			{
+				ASSERT(srcMesh->mFaces[f].mNumIndices == 3);
 
-			*dstIndex++ = srcMesh->mFaces[f].mIndices[0];
-			*dstIndex++ = srcMesh->mFaces[f].mIndices[1];
-			*dstIndex++ = srcMesh->mFaces[f].mIndices[2];
+				*dstIndex++ = srcMesh->mFaces[f].mIndices[0];
+				*dstIndex++ = srcMesh->mFaces[f].mIndices[1];
+				*dstIndex++ = srcMesh->mFaces[f].mIndices[2];
 
-			*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[0];
-			*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[1];
-			*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[2];
+				*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[0];
+				*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[1];
+				*dstIndexDepth++ = srcMesh->mFaces[f].mIndices[2];
+			}
 		}
 	}
 
 	model->ComputeAllBoundingBoxes();
-	//Optimize();
+	if (m_Optimize)
+		Optimize();
+	if (m_LodCount > 0)
+		BuildLods();
+	if (m_BuildMeshlets)
+		BuildMeshlets();
+	if (m_QuantizeVertices)
+		Quantize();
 
 	DEBUGPRINT("vertex count %d", model->m_pMesh[0].vertexCount);
 	DEBUGPRINT("index count %d", model->m_pMesh[0].indexCount);
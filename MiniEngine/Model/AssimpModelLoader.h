@@ -12,6 +12,8 @@
 #pragma once
 
 #include "ModelLoader.h"
+#include "VertexQuantize.h"
+#include <vector>
 
 class AssimpModelLoader : public IModelLoader
 {
@@ -19,11 +21,97 @@ public:
 	std::unique_ptr<Model> LoadModel(const char* filename) override;
 	std::unique_ptr<SkinnedModel> LoadSkinnedModel(const char* filename) override;
 
+	// Vertices whose positions, texcoords and normals round to the same
+	// multiple of the epsilon are welded together by the optimizer, keeping
+	// the first one. An epsilon of 0 only welds exact duplicates.
+	void SetWeldEpsilon(float epsilon) { m_WeldEpsilon = epsilon; }
+
+	// Splits meshes with more vertices than 16-bit indices can address into
+	// several meshes on import. When off, those meshes keep 32-bit indices
+	// instead and every other mesh stays 16-bit. On by default.
+	void SetSplitLargeMeshes(bool split) { m_SplitLargeMeshes = split; }
+
+	// Runs the optimizer on loaded models, welding vertices and reordering
+	// triangles for the post-transform cache, then running the enabled
+	// stages below. Off by default.
+	void SetOptimize(bool optimize) { m_Optimize = optimize; }
+
+	// Reorders clusters of the cache optimized triangles to reduce overdraw
+	void SetOptimizeOverdraw(bool optimize) { m_OptimizeOverdraw = optimize; }
+
+	// Reorders vertices into the order the triangles first use them
+	void SetOptimizeVertexFetch(bool optimize) { m_OptimizeVertexFetch = optimize; }
+
+	// Simulated costs of the full vertex streams before and after each
+	// enabled stage of the last optimized model, averaged over its meshes
+	// by triangle count
+	struct OptimizeStats
+	{
+		float overdrawBefore = 0.0f;
+		float overdrawAfter = 0.0f;
+		float overdrawAcmrBefore = 0.0f;
+		float overdrawAcmrAfter = 0.0f;
+		float overfetchBefore = 0.0f;
+		float overfetchAfter = 0.0f;
+	};
+	const OptimizeStats& GetOptimizeStats() const { return m_OptimizeStats; }
+
+	// Builds lodCount coarser levels of detail of every mesh, see
+	// SimplifyMesh, each with about triangleRatio of the triangles of the
+	// level before it. A level that can't get below 90% of the level before
+	// ends the mesh's chain early. Runs after the optimizer. None by default.
+	void SetLodChain(uint32_t lodCount, float triangleRatio) { m_LodCount = lodCount; m_LodRatio = triangleRatio; }
+
+	// Splits each mesh's triangles into meshlets with bounds to cull them
+	// by, see BuildMeshlets. Runs after the optimizer, on the full stream's
+	// index list. Off by default.
+	void SetBuildMeshlets(bool build) { m_BuildMeshlets = build; }
+
+	// Quantizes the vertices of loaded models into the compact H3D v2
+	// layout, see GetQuantizedLayout. Runs after the optimizer. Off by
+	// default.
+	void SetQuantizeVertices(bool quantize) { m_QuantizeVertices = quantize; }
+
+	// Largest errors over every mesh of the last quantized model
+	const QuantizeStats& GetQuantizeStats() const { return m_QuantizeStats; }
+
 private:
+	// One mesh's vertices and indices in either the full or the depth-only
+	// stream, optimized as a task of its own. The vertices are read from
+	// the model and written to vertexData, the indices are rewritten in place.
+	struct MeshStream
+	{
+		const VertexAttrib* attribs;
+		uint32_t vertexStride;
+		uint32_t vertexCount;
+		const unsigned char* sourceVertexData;
+		std::vector<unsigned char> vertexData;
+		unsigned char* indexData;
+		uint32_t indexFormat;
+		uint32_t indexCount;
+		OptimizeStats stats;
+	};
+
 	void Optimize();
-	void OptimizeRemoveDuplicateVertices(bool depth);
-	void OptimizePostTransform(bool depth);
-	void OptimizePreTransform(bool depth);
+	void BuildLods();
+	void BuildMeshlets();
+	void Quantize();
+	template <typename IndexType> void OptimizeStream(MeshStream &stream) const;
+	template <typename IndexType> void OptimizeRemoveDuplicateVertices(MeshStream &stream) const;
+	template <typename IndexType> void OptimizePostTransform(MeshStream &stream) const;
+	template <typename IndexType> void OptimizeOverdraw(MeshStream &stream) const;
+	template <typename IndexType> void OptimizePreTransform(MeshStream &stream) const;
 
 	Model* m_pCurrentModel = nullptr;
+	float m_WeldEpsilon = 0.0f;
+	bool m_SplitLargeMeshes = true;
+	bool m_Optimize = false;
+	bool m_OptimizeOverdraw = false;
+	bool m_OptimizeVertexFetch = true;
+	OptimizeStats m_OptimizeStats;
+	uint32_t m_LodCount = 0;
+	float m_LodRatio = 0.5f;
+	bool m_BuildMeshlets = false;
+	bool m_QuantizeVertices = false;
+	QuantizeStats m_QuantizeStats;
 };
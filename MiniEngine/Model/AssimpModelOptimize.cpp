@@ -14,174 +14,611 @@
 #include "AssimpModelLoader.h"
 #include "Model.h"
 #include "IndexOptimizePostTransform.h"
+#include "IndexOptimizeOverdraw.h"
+#include "MeshletBuild.h"
+#include "MeshSimplify.h"
 
 #include <string.h>
+#include <math.h>
+#include <float.h>
+#include <ppl.h>
+#include <algorithm>
+#include <vector>
 
-void AssimpModelLoader::OptimizeRemoveDuplicateVertices(bool depth)
+namespace
 {
-    unsigned char *deduplicatedVertexData = new unsigned char [depth ? m_pCurrentModel->m_Header.vertexDataByteSizeDepth : m_pCurrentModel->m_Header.vertexDataByteSize];
-    uint32_t deduplicatedVertexDataSize = 0;
-
-    for (unsigned int meshIndex = 0; meshIndex < m_pCurrentModel->m_Header.meshCount; meshIndex++)
-    {
-        Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
-        unsigned int vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
-        unsigned char *meshVertexData = depth ? (m_pCurrentModel->m_pVertexDataDepth + mesh->vertexDataByteOffsetDepth) : (m_pCurrentModel->m_pVertexData + mesh->vertexDataByteOffset);
+    // LRU size OptimizeFaces scores vertices with
+    enum {lruCacheSize = 64};
 
-        unsigned char *meshDeduplicatedVertexData = deduplicatedVertexData + deduplicatedVertexDataSize;
-        unsigned int deduplicatedCount = 0;
+    // FIFO size the overdraw clusters and the stats are simulated with,
+    // closer to real hardware than the LRU size OptimizeFaces scores with
+    enum {fifoCacheSize = 32};
 
-        unsigned int vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
-        uint32_t *vertexRemap = new uint32_t [vertexCount];
-        memset(vertexRemap, (uint32_t)-1, sizeof(uint32_t) * vertexCount);
-        assert(vertexCount <= (uint32_t)-1);
+    // how much a cluster's ACMR may exceed its run's before the overdraw
+    // stage splits it off
+    const float overdrawThreshold = 1.05f;
 
-        for (unsigned int v1 = 0; v1 < vertexCount; v1++)
+    uint32_t HashVertex(const unsigned char *data, unsigned int size)
+    {
+        // FNV-1a over 32-bit words, then over whatever bytes are left
+        uint32_t hash = 2166136261u;
+        unsigned int n = 0;
+        for (; n + 4 <= size; n += 4)
         {
-            if (vertexRemap[v1] != (uint32_t)-1)
-                continue; // this was already found to be a duplicate
+            uint32_t word;
+            memcpy(&word, data + n, sizeof(word));
+            hash = (hash ^ word) * 16777619u;
+        }
+        for (; n < size; n++)
+        {
+            hash = (hash ^ data[n]) * 16777619u;
+        }
 
-            const unsigned char *v1Data = meshVertexData + v1 * vertexStride;
+        // spread the low bits, which are the ones used for the bucket
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        return hash;
+    }
 
-            // this is a new unique vertex
-            uint32_t remappedSlot = deduplicatedCount++;
-            vertexRemap[v1] = remappedSlot;
-            memcpy(meshDeduplicatedVertexData + remappedSlot * vertexStride, v1Data, vertexStride);
+    // Rewrites the float components of the position, texcoord and normal
+    // attributes of a vertex as integers quantised to the weld epsilon, so
+    // that vertices within the same epsilon cell compare equal
+    void QuantiseWeldKey(unsigned char *key, const VertexAttrib *attribs, float weldEpsilon)
+    {
+        static const int weldedAttribs[] = { attrib_position, attrib_texcoord0, attrib_normal };
+        for (int attrib : weldedAttribs)
+        {
+            if (attribs[attrib].format != attrib_format_float)
+                continue;
 
-            // scan for duplicates
-            for (unsigned int v2 = v1 + 1; v2 < vertexCount; v2++)
+            for (unsigned int c = 0; c < attribs[attrib].components; c++)
             {
-                if (vertexRemap[v2] != (uint32_t)-1)
-                    continue; // this was already found to be a duplicate of another vertex
+                unsigned char *component = key + attribs[attrib].offset + c * sizeof(float);
+                float value;
+                memcpy(&value, component, sizeof(value));
+                double cell = floor((double)value / weldEpsilon + 0.5);
+                if (!(fabs(cell) < 2147483647.0))
+                    continue; // leave NaNs and values too large to quantise as they are
+
+                int32_t quantised = (int32_t)cell;
+                memcpy(component, &quantised, sizeof(quantised));
+            }
+        }
+    }
 
-                const unsigned char *v2Data = meshVertexData + v2 * vertexStride;
+    template <typename IndexType>
+    std::vector<IndexType> SimplifyLevel(const std::vector<IndexType> &source, const unsigned char *positions, uint32_t positionStride,
+        uint32_t vertexCount, uint32_t targetIndexCount, float &error)
+    {
+        std::vector<IndexType> simplified(source.size());
+        uint32_t indexCount = SimplifyMesh<IndexType>(source.data(), (uint32_t)source.size(), positions, positionStride, vertexCount,
+            targetIndexCount, FLT_MAX, simplified.data(), error);
+
+        // re-order indices for post transform cache
+        std::vector<IndexType> optimized(indexCount);
+        if (indexCount > 0)
+            OptimizeFaces<IndexType>(simplified.data(), indexCount, optimized.data(), lruCacheSize);
+        return optimized;
+    }
 
-                if (0 == memcmp(v1Data, v2Data, vertexStride))
-                {
-                    vertexRemap[v2] = remappedSlot;
-                }
-            }
+    // A mesh's coarser levels, with their indices until they are merged
+    // into the model's index data
+    struct MeshLods
+    {
+        std::vector<MeshLod> lods;
+        std::vector<std::vector<unsigned char>> indexData;
+        std::vector<std::vector<unsigned char>> indexDataDepth;
+    };
+
+    template <typename IndexType>
+    void BuildMeshLods(const Model &model, const Mesh &mesh, uint32_t lodCount, float lodRatio, MeshLods &result)
+    {
+        const unsigned char *positions = model.m_pVertexData + mesh.vertexDataByteOffset + mesh.attrib[attrib_position].offset;
+        const unsigned char *positionsDepth = model.m_pVertexDataDepth + mesh.vertexDataByteOffsetDepth + mesh.attribDepth[attrib_position].offset;
+        const IndexType *indices = (const IndexType*)(model.m_pIndexData + mesh.indexDataByteOffset);
+        const IndexType *indicesDepth = (const IndexType*)(model.m_pIndexDataDepth + mesh.indexDataByteOffset);
+
+        // each level is simplified from the one before, and its error adds
+        // to theirs
+        std::vector<IndexType> source(indices, indices + mesh.indexCount);
+        std::vector<IndexType> sourceDepth(indicesDepth, indicesDepth + mesh.indexCount);
+        float error = 0.0f;
+        for (uint32_t lod = 0; lod < lodCount; lod++)
+        {
+            uint32_t targetIndexCount = (uint32_t)(source.size() / 3 * lodRatio) * 3;
+            float levelError;
+            std::vector<IndexType> levelIndices = SimplifyLevel(source, positions, mesh.vertexStride, mesh.vertexCount, targetIndexCount, levelError);
+            if (levelIndices.empty() || levelIndices.size() > source.size() * 9 / 10)
+                break;
+
+            // the depth-only stream has its own vertices, and is simplified
+            // to the full stream's triangle count
+            float levelErrorDepth;
+            std::vector<IndexType> levelIndicesDepth = SimplifyLevel(sourceDepth, positionsDepth, mesh.vertexStrideDepth, mesh.vertexCountDepth,
+                (uint32_t)levelIndices.size(), levelErrorDepth);
+
+            error += levelError;
+            MeshLod meshLod = { 0, (uint32_t)levelIndices.size(), (uint32_t)levelIndicesDepth.size(), error };
+            result.lods.push_back(meshLod);
+            result.indexData.emplace_back((const unsigned char*)levelIndices.data(), (const unsigned char*)(levelIndices.data() + levelIndices.size()));
+            result.indexDataDepth.emplace_back((const unsigned char*)levelIndicesDepth.data(), (const unsigned char*)(levelIndicesDepth.data() + levelIndicesDepth.size()));
+
+            source.swap(levelIndices);
+            sourceDepth.swap(levelIndicesDepth);
         }
+    }
+}
 
-        unsigned int indexCount = mesh->indexCount;
-        uint16_t *indexArray = (uint16_t*)((depth ? m_pCurrentModel->m_pIndexDataDepth : m_pCurrentModel->m_pIndexData) + mesh->indexDataByteOffset);
-        for (unsigned int n = 0; n < indexCount; n++)
+template <typename IndexType>
+void AssimpModelLoader::OptimizeRemoveDuplicateVertices(MeshStream &stream) const
+{
+    const unsigned char *meshVertexData = stream.sourceVertexData;
+    unsigned int vertexStride = stream.vertexStride;
+    unsigned int vertexCount = stream.vertexCount;
+
+    stream.vertexData.resize(vertexCount * vertexStride);
+    unsigned char *meshDeduplicatedVertexData = stream.vertexData.data();
+    unsigned int deduplicatedCount = 0;
+
+    uint32_t *vertexRemap = new uint32_t [vertexCount];
+    assert(vertexCount <= (uint32_t)-1);
+
+    // Vertices are compared by their bytes, or by the bytes of their
+    // quantised copies when welding with an epsilon
+    const unsigned char *weldKeys = meshVertexData;
+    std::vector<unsigned char> quantisedKeys;
+    if (m_WeldEpsilon > 0.0f)
+    {
+        quantisedKeys.assign(meshVertexData, meshVertexData + vertexCount * vertexStride);
+        for (unsigned int v = 0; v < vertexCount; v++)
         {
-            indexArray[n] = vertexRemap[indexArray[n]];
+            QuantiseWeldKey(quantisedKeys.data() + v * vertexStride, stream.attribs, m_WeldEpsilon);
         }
+        weldKeys = quantisedKeys.data();
+    }
 
-        delete [] vertexRemap;
+    // open addressed table of the first vertex seen with each key, at
+    // most half full
+    uint32_t tableSize = 16;
+    while (tableSize < vertexCount * 2)
+        tableSize *= 2;
+    std::vector<uint32_t> table(tableSize, (uint32_t)-1);
 
-        if (depth)
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        const unsigned char *vKey = weldKeys + v * vertexStride;
+
+        uint32_t slot = HashVertex(vKey, vertexStride) & (tableSize - 1);
+        while (table[slot] != (uint32_t)-1 && 0 != memcmp(weldKeys + table[slot] * vertexStride, vKey, vertexStride))
         {
-            mesh->vertexCountDepth = deduplicatedCount;
-            mesh->vertexDataByteOffsetDepth = deduplicatedVertexDataSize;
+            slot = (slot + 1) & (tableSize - 1);
         }
-        else
+
+        if (table[slot] != (uint32_t)-1)
         {
-            mesh->vertexCount = deduplicatedCount;
-            mesh->vertexDataByteOffset = deduplicatedVertexDataSize;
+            // duplicate of a vertex already kept
+            vertexRemap[v] = vertexRemap[table[slot]];
+            continue;
         }
-        deduplicatedVertexDataSize += deduplicatedCount * vertexStride;
-    }
 
-    if (depth)
-    {
-        delete [] m_pCurrentModel->m_pVertexDataDepth;
-        m_pCurrentModel->m_pVertexDataDepth = deduplicatedVertexData;
-        m_pCurrentModel->m_Header.vertexDataByteSizeDepth = deduplicatedVertexDataSize;
+        // this is a new unique vertex
+        table[slot] = v;
+        uint32_t remappedSlot = deduplicatedCount++;
+        vertexRemap[v] = remappedSlot;
+        memcpy(meshDeduplicatedVertexData + remappedSlot * vertexStride, meshVertexData + v * vertexStride, vertexStride);
     }
-    else
+
+    IndexType *indexArray = (IndexType*)stream.indexData;
+    for (unsigned int n = 0; n < stream.indexCount; n++)
     {
-        delete [] m_pCurrentModel->m_pVertexData;
-        m_pCurrentModel->m_pVertexData = deduplicatedVertexData;
-        m_pCurrentModel->m_Header.vertexDataByteSize = deduplicatedVertexDataSize;
+        indexArray[n] = (IndexType)vertexRemap[indexArray[n]];
     }
+
+    delete [] vertexRemap;
+
+    stream.vertexCount = deduplicatedCount;
+    stream.vertexData.resize(deduplicatedCount * vertexStride);
 }
 
-void AssimpModelLoader::OptimizePostTransform(bool depth)
+template <typename IndexType>
+void AssimpModelLoader::OptimizePostTransform(MeshStream &stream) const
 {
-    enum {lruCacheSize = 64};
+    IndexType *srcIndices = new IndexType [stream.indexCount];
+    IndexType *dstIndices = (IndexType*)stream.indexData;
+    memcpy(srcIndices, dstIndices, sizeof(IndexType) * stream.indexCount);
 
-    for (unsigned int meshIndex = 0; meshIndex < m_pCurrentModel->m_Header.meshCount; meshIndex++)
-    {
-        Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
+    OptimizeFaces<IndexType>(srcIndices, stream.indexCount, dstIndices, lruCacheSize);
 
-        uint16_t *srcIndices = new uint16_t [mesh->indexCount];
-        uint16_t *dstIndices = (uint16_t*)((depth ? m_pCurrentModel->m_pIndexDataDepth : m_pCurrentModel->m_pIndexData) + mesh->indexDataByteOffset);
-        memcpy(srcIndices, dstIndices, sizeof(uint16_t) * mesh->indexCount);
+    delete [] srcIndices;
+}
+
+template <typename IndexType>
+void AssimpModelLoader::OptimizeOverdraw(MeshStream &stream) const
+{
+    const VertexAttrib &position = stream.attribs[attrib_position];
+    if (position.format != attrib_format_float || position.components < 3 || stream.indexCount == 0)
+        return;
 
-        OptimizeFaces<uint16_t>(srcIndices, mesh->indexCount, dstIndices, lruCacheSize);
+    const unsigned char *positions = stream.vertexData.data() + position.offset;
+    IndexType *srcIndices = new IndexType [stream.indexCount];
+    IndexType *dstIndices = (IndexType*)stream.indexData;
+    memcpy(srcIndices, dstIndices, sizeof(IndexType) * stream.indexCount);
+
+    ::OptimizeOverdraw<IndexType>(srcIndices, stream.indexCount, positions, stream.vertexStride, dstIndices, fifoCacheSize, overdrawThreshold);
+
+    stream.stats.overdrawBefore = ComputeOverdrawStats(srcIndices, stream.indexCount, positions, stream.vertexStride).overdraw;
+    stream.stats.overdrawAfter = ComputeOverdrawStats(dstIndices, stream.indexCount, positions, stream.vertexStride).overdraw;
+    stream.stats.overdrawAcmrBefore = ComputeVertexCacheStats(srcIndices, stream.indexCount, fifoCacheSize).acmr;
+    stream.stats.overdrawAcmrAfter = ComputeVertexCacheStats(dstIndices, stream.indexCount, fifoCacheSize).acmr;
+
+    delete [] srcIndices;
+}
+
+template <typename IndexType>
+void AssimpModelLoader::OptimizePreTransform(MeshStream &stream) const
+{
+    IndexType *indexArray = (IndexType*)stream.indexData;
+    stream.stats.overfetchBefore = ComputeVertexFetchStats(indexArray, stream.indexCount, stream.vertexStride, fifoCacheSize).overfetch;
+
+    unsigned int indexCount = stream.indexCount;
+    unsigned int vertexStride = stream.vertexStride;
+    const unsigned char *meshVertexData = stream.vertexData.data();
+
+    // vertices no index refers to are left zeroed at the end
+    std::vector<unsigned char> reorderedVertexData(stream.vertexData.size(), 0);
+    unsigned char *meshReorderedVertexData = reorderedVertexData.data();
+    unsigned int reorderedCount = 0;
+
+    unsigned int vertexCount = stream.vertexCount;
+    uint32_t *vertexRemap = new uint32_t [vertexCount];
+    memset(vertexRemap, (uint32_t)-1, sizeof(uint32_t) * vertexCount);
+    assert(vertexCount <= (uint32_t)-1);
+
+    for (unsigned int n = 0; n < indexCount; n++)
+    {
+        IndexType index = indexArray[n];
+        if (vertexRemap[index] == (uint32_t)-1)
+        {
+            // not relocated yet
+            const unsigned char *vSrc = meshVertexData + index * vertexStride;
+            unsigned char *vDst = meshReorderedVertexData + reorderedCount * vertexStride;
+            memcpy(vDst, vSrc, vertexStride);
 
-        delete [] srcIndices;
+            vertexRemap[index] = reorderedCount;
+            reorderedCount++;
+        }
+        indexArray[n] = (IndexType)vertexRemap[index];
     }
+
+    delete [] vertexRemap;
+
+    stream.vertexData.swap(reorderedVertexData);
+
+    stream.stats.overfetchAfter = ComputeVertexFetchStats(indexArray, stream.indexCount, stream.vertexStride, fifoCacheSize).overfetch;
 }
 
-void AssimpModelLoader::OptimizePreTransform(bool depth)
+template <typename IndexType>
+void AssimpModelLoader::OptimizeStream(MeshStream &stream) const
 {
-    unsigned char *reorderedVertexData = new unsigned char [depth ? m_pCurrentModel->m_Header.vertexDataByteSizeDepth : m_pCurrentModel->m_Header.vertexDataByteSize];
+    OptimizeRemoveDuplicateVertices<IndexType>(stream);
 
-    for (unsigned int meshIndex = 0; meshIndex < m_pCurrentModel->m_Header.meshCount; meshIndex++)
+    // re-order indices for post transform cache
+    OptimizePostTransform<IndexType>(stream);
+
+    // re-order clusters of indices for less overdraw
+    if (m_OptimizeOverdraw)
+        OptimizeOverdraw<IndexType>(stream);
+
+    // re-order vertices for linear memory access
+    if (m_OptimizeVertexFetch)
+        OptimizePreTransform<IndexType>(stream);
+}
+
+void AssimpModelLoader::Optimize()
+{
+	assert(m_pCurrentModel);
+
+    // Every mesh's full and depth-only streams are optimized as separate
+    // tasks, each into its own vertex buffer. Indices are rewritten in
+    // place since every mesh has its own range of them.
+    uint32_t meshCount = m_pCurrentModel->m_Header.meshCount;
+    std::vector<MeshStream> streams(meshCount * 2);
+    concurrency::parallel_for(0u, meshCount * 2, [&](unsigned int streamIndex)
     {
-        Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
-        unsigned int indexCount = mesh->indexCount;
-        unsigned int vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
-        unsigned char *meshVertexData = depth ? (m_pCurrentModel->m_pVertexDataDepth + mesh->vertexDataByteOffsetDepth) : (m_pCurrentModel->m_pVertexData + mesh->vertexDataByteOffset);
+        Mesh *mesh = m_pCurrentModel->m_pMesh + streamIndex / 2;
+        bool depth = (streamIndex & 1) != 0;
+
+        MeshStream &stream = streams[streamIndex];
+        stream.attribs = depth ? mesh->attribDepth : mesh->attrib;
+        stream.vertexStride = depth ? mesh->vertexStrideDepth : mesh->vertexStride;
+        stream.vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
+        stream.sourceVertexData = depth ? (m_pCurrentModel->m_pVertexDataDepth + mesh->vertexDataByteOffsetDepth) : (m_pCurrentModel->m_pVertexData + mesh->vertexDataByteOffset);
+        stream.indexData = (depth ? m_pCurrentModel->m_pIndexDataDepth : m_pCurrentModel->m_pIndexData) + mesh->indexDataByteOffset;
+        stream.indexFormat = mesh->indexFormat;
+        stream.indexCount = mesh->indexCount;
+
+        if (stream.indexFormat == index_format_uint32)
+            OptimizeStream<uint32_t>(stream);
+        else
+            OptimizeStream<uint16_t>(stream);
+    });
 
-        unsigned char *meshReorderedVertexData = reorderedVertexData + (depth ? mesh->vertexDataByteOffsetDepth : mesh->vertexDataByteOffset);
-        unsigned int reorderedCount = 0;
+    // average the full streams' stats by triangle count
+    m_OptimizeStats = OptimizeStats();
+    uint64_t triangleCount = 0;
+    for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
+    {
+        triangleCount += streams[meshIndex * 2].indexCount / 3;
+    }
+    for (unsigned int meshIndex = 0; meshIndex < meshCount && triangleCount > 0; meshIndex++)
+    {
+        const OptimizeStats &stats = streams[meshIndex * 2].stats;
+        float weight = (float)(streams[meshIndex * 2].indexCount / 3) / triangleCount;
+        m_OptimizeStats.overdrawBefore += stats.overdrawBefore * weight;
+        m_OptimizeStats.overdrawAfter += stats.overdrawAfter * weight;
+        m_OptimizeStats.overdrawAcmrBefore += stats.overdrawAcmrBefore * weight;
+        m_OptimizeStats.overdrawAcmrAfter += stats.overdrawAcmrAfter * weight;
+        m_OptimizeStats.overfetchBefore += stats.overfetchBefore * weight;
+        m_OptimizeStats.overfetchAfter += stats.overfetchAfter * weight;
+    }
 
-        unsigned int vertexCount = depth ? mesh->vertexCountDepth : mesh->vertexCount;
-        uint32_t *vertexRemap = new uint32_t [vertexCount];
-        memset(vertexRemap, (uint32_t)-1, sizeof(uint32_t) * vertexCount);
-        assert(vertexCount <= (uint32_t)-1);
+    // merge the meshes back in order, so the result doesn't depend on how
+    // the tasks were scheduled
+    for (int depth = 0; depth < 2; depth++)
+    {
+        uint32_t vertexDataByteSize = 0;
+        for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
+        {
+            vertexDataByteSize += (uint32_t)streams[meshIndex * 2 + depth].vertexData.size();
+        }
 
-        uint16_t *indexArray = (uint16_t*)((depth ? m_pCurrentModel->m_pIndexDataDepth : m_pCurrentModel->m_pIndexData) + mesh->indexDataByteOffset);
-        for (unsigned int n = 0; n < indexCount; n++)
+        unsigned char *vertexData = new unsigned char [vertexDataByteSize];
+        uint32_t vertexDataByteOffset = 0;
+        for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
         {
-            uint16_t index = indexArray[n];
-            if (vertexRemap[index] == (uint32_t)-1)
-            {
-                // not relocated yet
-                const unsigned char *vSrc = meshVertexData + index * vertexStride;
-                unsigned char *vDst = meshReorderedVertexData + reorderedCount * vertexStride;
-                memcpy(vDst, vSrc, vertexStride);
+            Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
+            const MeshStream &stream = streams[meshIndex * 2 + depth];
+            if (!stream.vertexData.empty())
+                memcpy(vertexData + vertexDataByteOffset, stream.vertexData.data(), stream.vertexData.size());
 
-                vertexRemap[index] = reorderedCount;
-                reorderedCount++;
+            if (depth)
+            {
+                mesh->vertexCountDepth = stream.vertexCount;
+                mesh->vertexDataByteOffsetDepth = vertexDataByteOffset;
+            }
+            else
+            {
+                mesh->vertexCount = stream.vertexCount;
+                mesh->vertexDataByteOffset = vertexDataByteOffset;
             }
-            indexArray[n] = vertexRemap[index];
+            vertexDataByteOffset += (uint32_t)stream.vertexData.size();
         }
 
-        delete [] vertexRemap;
+        if (depth)
+        {
+            delete [] m_pCurrentModel->m_pVertexDataDepth;
+            m_pCurrentModel->m_pVertexDataDepth = vertexData;
+            m_pCurrentModel->m_Header.vertexDataByteSizeDepth = vertexDataByteSize;
+        }
+        else
+        {
+            delete [] m_pCurrentModel->m_pVertexData;
+            m_pCurrentModel->m_pVertexData = vertexData;
+            m_pCurrentModel->m_Header.vertexDataByteSize = vertexDataByteSize;
+        }
     }
+}
 
-    if (depth)
+void AssimpModelLoader::BuildLods()
+{
+	assert(m_pCurrentModel);
+
+    // every mesh's chain is built as a task of its own
+    uint32_t meshCount = m_pCurrentModel->m_Header.meshCount;
+    std::vector<MeshLods> meshLods(meshCount);
+    concurrency::parallel_for(0u, meshCount, [&](unsigned int meshIndex)
     {
-        delete [] m_pCurrentModel->m_pVertexDataDepth;
-        m_pCurrentModel->m_pVertexDataDepth = reorderedVertexData;
+        const Mesh &mesh = m_pCurrentModel->m_pMesh[meshIndex];
+        const VertexAttrib &position = mesh.attrib[attrib_position];
+        const VertexAttrib &positionDepth = mesh.attribDepth[attrib_position];
+        if (position.format != attrib_format_float || position.components < 3 ||
+            positionDepth.format != attrib_format_float || positionDepth.components < 3)
+        {
+            return;
+        }
+
+        if (mesh.indexFormat == index_format_uint32)
+            BuildMeshLods<uint32_t>(*m_pCurrentModel, mesh, m_LodCount, m_LodRatio, meshLods[meshIndex]);
+        else
+            BuildMeshLods<uint16_t>(*m_pCurrentModel, mesh, m_LodCount, m_LodRatio, meshLods[meshIndex]);
+    });
+
+    // Append the levels to the index data in mesh order. A level's full
+    // and depth-only indices share their offset, so each takes the room
+    // of the larger.
+    uint32_t indexDataByteSize = m_pCurrentModel->m_Header.indexDataByteSize;
+    m_pCurrentModel->m_LodRanges.resize(meshCount);
+    m_pCurrentModel->m_Lods.clear();
+    for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
+    {
+        uint32_t indexSize = IndexFormatSize(m_pCurrentModel->m_pMesh[meshIndex].indexFormat);
+        MeshLods &result = meshLods[meshIndex];
+        for (size_t lod = 0; lod < result.lods.size(); lod++)
+        {
+            indexDataByteSize = (indexDataByteSize + indexSize - 1) & ~(indexSize - 1);
+            result.lods[lod].indexDataByteOffset = indexDataByteSize;
+            indexDataByteSize += (uint32_t)std::max(result.indexData[lod].size(), result.indexDataDepth[lod].size());
+        }
+
+        m_pCurrentModel->m_LodRanges[meshIndex].offset = (uint32_t)m_pCurrentModel->m_Lods.size();
+        m_pCurrentModel->m_LodRanges[meshIndex].count = (uint32_t)result.lods.size();
+        m_pCurrentModel->m_Lods.insert(m_pCurrentModel->m_Lods.end(), result.lods.begin(), result.lods.end());
     }
-    else
+
+    unsigned char *indexData = new unsigned char [indexDataByteSize];
+    unsigned char *indexDataDepth = new unsigned char [indexDataByteSize];
+    memset(indexData, 0, indexDataByteSize);
+    memset(indexDataDepth, 0, indexDataByteSize);
+    memcpy(indexData, m_pCurrentModel->m_pIndexData, m_pCurrentModel->m_Header.indexDataByteSize);
+    memcpy(indexDataDepth, m_pCurrentModel->m_pIndexDataDepth, m_pCurrentModel->m_Header.indexDataByteSize);
+    for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
     {
-        delete [] m_pCurrentModel->m_pVertexData;
-        m_pCurrentModel->m_pVertexData = reorderedVertexData;
+        const MeshLods &result = meshLods[meshIndex];
+        for (size_t lod = 0; lod < result.lods.size(); lod++)
+        {
+            memcpy(indexData + result.lods[lod].indexDataByteOffset, result.indexData[lod].data(), result.indexData[lod].size());
+            memcpy(indexDataDepth + result.lods[lod].indexDataByteOffset, result.indexDataDepth[lod].data(), result.indexDataDepth[lod].size());
+        }
     }
+
+    delete [] m_pCurrentModel->m_pIndexData;
+    delete [] m_pCurrentModel->m_pIndexDataDepth;
+    m_pCurrentModel->m_pIndexData = indexData;
+    m_pCurrentModel->m_pIndexDataDepth = indexDataDepth;
+    m_pCurrentModel->m_Header.indexDataByteSize = indexDataByteSize;
 }
 
-void AssimpModelLoader::Optimize()
+void AssimpModelLoader::BuildMeshlets()
 {
 	assert(m_pCurrentModel);
 
-    // TODO: quantize/compress vertex data
+    // Every mesh is split as a task of its own, then the meshlets are
+    // merged in mesh order
+    struct MeshMeshlets
+    {
+        std::vector<Meshlet> meshlets;
+        std::vector<uint32_t> vertices;
+        std::vector<uint32_t> primitives;
+    };
+
+    uint32_t meshCount = m_pCurrentModel->m_Header.meshCount;
+    std::vector<MeshMeshlets> meshMeshlets(meshCount);
+    concurrency::parallel_for(0u, meshCount, [&](unsigned int meshIndex)
+    {
+        const Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
+        const VertexAttrib &position = mesh->attrib[attrib_position];
+        if (position.format != attrib_format_float || position.components < 3)
+            return;
+
+        const unsigned char *positions = m_pCurrentModel->m_pVertexData + mesh->vertexDataByteOffset + position.offset;
+        const unsigned char *indexData = m_pCurrentModel->m_pIndexData + mesh->indexDataByteOffset;
+        MeshMeshlets &result = meshMeshlets[meshIndex];
+        if (mesh->indexFormat == index_format_uint32)
+            ::BuildMeshlets((const uint32_t*)indexData, mesh->indexCount, positions, mesh->vertexStride, result.meshlets, result.vertices, result.primitives);
+        else
+            ::BuildMeshlets((const uint16_t*)indexData, mesh->indexCount, positions, mesh->vertexStride, result.meshlets, result.vertices, result.primitives);
+    });
+
+    m_pCurrentModel->m_MeshletRanges.resize(meshCount);
+    m_pCurrentModel->m_Meshlets.clear();
+    m_pCurrentModel->m_MeshletVertices.clear();
+    m_pCurrentModel->m_MeshletPrimitives.clear();
+    for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
+    {
+        MeshMeshlets &result = meshMeshlets[meshIndex];
+        uint32_t vertexOffset = (uint32_t)m_pCurrentModel->m_MeshletVertices.size();
+        uint32_t primitiveOffset = (uint32_t)m_pCurrentModel->m_MeshletPrimitives.size();
+        for (Meshlet &meshlet : result.meshlets)
+        {
+            meshlet.vertexOffset += vertexOffset;
+            meshlet.primitiveOffset += primitiveOffset;
+        }
 
-    OptimizeRemoveDuplicateVertices(false);
-    OptimizeRemoveDuplicateVertices(true);
+        m_pCurrentModel->m_MeshletRanges[meshIndex].offset = (uint32_t)m_pCurrentModel->m_Meshlets.size();
+        m_pCurrentModel->m_MeshletRanges[meshIndex].count = (uint32_t)result.meshlets.size();
+        m_pCurrentModel->m_Meshlets.insert(m_pCurrentModel->m_Meshlets.end(), result.meshlets.begin(), result.meshlets.end());
+        m_pCurrentModel->m_MeshletVertices.insert(m_pCurrentModel->m_MeshletVertices.end(), result.vertices.begin(), result.vertices.end());
+        m_pCurrentModel->m_MeshletPrimitives.insert(m_pCurrentModel->m_MeshletPrimitives.end(), result.primitives.begin(), result.primitives.end());
+    }
+}
 
-    // re-order indices for post transform cache
-    OptimizePostTransform(false);
-    OptimizePostTransform(true);
+void AssimpModelLoader::Quantize()
+{
+	assert(m_pCurrentModel);
 
-    // re-order vertices for linear memory access
-    OptimizePreTransform(false);
-    OptimizePreTransform(true);
+    // Every mesh has the same float layout, so they all quantize to the
+    // same layout and the model keeps a single stride
+    uint32_t meshCount = m_pCurrentModel->m_Header.meshCount;
+    if (meshCount == 0)
+        return;
+
+    for (int depth = 0; depth < 2; depth++)
+    {
+        const Mesh &firstMesh = m_pCurrentModel->m_pMesh[0];
+        VertexAttrib attribs[maxAttribs];
+        uint32_t attribsEnabled = 0;
+        uint32_t vertexStride = depth
+            ? GetQuantizedLayout(firstMesh.attribDepth, firstMesh.attribsEnabledDepth, attribs, attribsEnabled)
+            : GetQuantizedLayout(firstMesh.attrib, firstMesh.attribsEnabled, attribs, attribsEnabled);
+
+        uint32_t vertexDataByteSize = 0;
+        std::vector<uint32_t> vertexDataByteOffsets(meshCount);
+        for (unsigned int meshIndex = 0; meshIndex < meshCount; meshIndex++)
+        {
+            const Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
+            assert(depth
+                ? mesh->attribsEnabledDepth == firstMesh.attribsEnabledDepth && memcmp(mesh->attribDepth, firstMesh.attribDepth, sizeof(attribs)) == 0
+                : mesh->attribsEnabled == firstMesh.attribsEnabled && memcmp(mesh->attrib, firstMesh.attrib, sizeof(attribs)) == 0);
+            vertexDataByteOffsets[meshIndex] = vertexDataByteSize;
+            vertexDataByteSize += vertexStride * (depth ? mesh->vertexCountDepth : mesh->vertexCount);
+        }
+
+        unsigned char *srcVertexData = depth ? m_pCurrentModel->m_pVertexDataDepth : m_pCurrentModel->m_pVertexData;
+        unsigned char *vertexData = new unsigned char [vertexDataByteSize];
+        std::vector<QuantizeStats> stats(meshCount);
+        concurrency::parallel_for(0u, meshCount, [&](unsigned int meshIndex)
+        {
+            Mesh *mesh = m_pCurrentModel->m_pMesh + meshIndex;
+            if (depth)
+            {
+                stats[meshIndex] = QuantizeVertices(srcVertexData + mesh->vertexDataByteOffsetDepth, mesh->vertexStrideDepth, mesh->attribDepth,
+                    vertexData + vertexDataByteOffsets[meshIndex], vertexStride, attribs, mesh->vertexCountDepth, mesh->boundingBox);
+
+                memcpy(mesh->attribDepth, attribs, sizeof(attribs));
+                mesh->attribsEnabledDepth = attribsEnabled;
+                mesh->vertexStrideDepth = vertexStride;
+                mesh->vertexDataByteOffsetDepth = vertexDataByteOffsets[meshIndex];
+            }
+            else
+            {
+                stats[meshIndex] = QuantizeVertices(srcVertexData + mesh->vertexDataByteOffset, mesh->vertexStride, mesh->attrib,
+                    vertexData + vertexDataByteOffsets[meshIndex], vertexStride, attribs, mesh->vertexCount, mesh->boundingBox);
+
+                memcpy(mesh->attrib, attribs, sizeof(attribs));
+                mesh->attribsEnabled = attribsEnabled;
+                mesh->vertexStride = vertexStride;
+                mesh->vertexDataByteOffset = vertexDataByteOffsets[meshIndex];
+            }
+        });
+
+        // the depth-only stream only has positions, the full stream has
+        // every attribute and is the one reported
+        if (!depth)
+        {
+            m_QuantizeStats = QuantizeStats();
+            for (const QuantizeStats &meshStats : stats)
+            {
+                m_QuantizeStats.positionError = std::max(m_QuantizeStats.positionError, meshStats.positionError);
+                m_QuantizeStats.positionErrorBound = std::max(m_QuantizeStats.positionErrorBound, meshStats.positionErrorBound);
+                m_QuantizeStats.normalError = std::max(m_QuantizeStats.normalError, meshStats.normalError);
+                m_QuantizeStats.tangentError = std::max(m_QuantizeStats.tangentError, meshStats.tangentError);
+                m_QuantizeStats.texcoordError = std::max(m_QuantizeStats.texcoordError, meshStats.texcoordError);
+            }
+        }
+
+        delete [] srcVertexData;
+        if (depth)
+        {
+            m_pCurrentModel->m_pVertexDataDepth = vertexData;
+            m_pCurrentModel->m_Header.vertexDataByteSizeDepth = vertexDataByteSize;
+            m_pCurrentModel->m_VertexStrideDepth = vertexStride;
+        }
+        else
+        {
+            m_pCurrentModel->m_pVertexData = vertexData;
+            m_pCurrentModel->m_Header.vertexDataByteSize = vertexDataByteSize;
+            m_pCurrentModel->m_VertexStride = vertexStride;
+        }
+    }
 }
@@ -19,8 +19,476 @@
 #include "DescriptorHeap.h"
 #include "CommandContext.h"
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    // Files from version 2 on start with the tag and their version. Version
+    // 1 files start straight with the model header. Version 2 adds the
+    // quantized vertex layout of GetQuantizedLayout, with positions relative
+    // to each mesh's bounding box. Version 3 adds flags to the preamble and
+    // aligns the data sections, see GetDataLayout. Version 4 adds chunks of
+    // optional data after the data sections, see ReadChunks.
+    const char kH3DFileTag[4] = { 'H', '3', 'D', '\0' };
+    const uint32_t kH3DVersion = 4;
+
+    enum
+    {
+        // the depth-only stream draws with the same indices as the full
+        // stream, and they are only stored once
+        kH3DFlagSharedIndices = (1 << 0),
+    };
+
+    struct FilePreamble
+    {
+        char tag[4];
+        uint32_t version;
+        uint32_t flags;     // version 3
+        uint32_t reserved;  // version 3
+    };
+
+    uint32_t GetPreambleSize(uint32_t version)
+    {
+        return version >= 3 ? sizeof(FilePreamble) : version == 2 ? offsetof(FilePreamble, flags) : 0;
+    }
+
+    // File offsets of the data sections that follow the header, meshes and
+    // materials
+    struct DataLayout
+    {
+        uint64_t vertexData;
+        uint64_t indexData;
+        uint64_t vertexDataDepth;
+        uint64_t indexDataDepth;
+        uint64_t end;
+    };
+
+    DataLayout GetDataLayout(const Model::Header& header, uint32_t version, uint32_t flags)
+    {
+        // Version 3 starts every data section 16 byte aligned and pads it to
+        // a multiple of 16 bytes, as SIMDMemCopy reads it when uploading
+        // straight from the mapped file. Older versions pack them.
+        const uint64_t alignment = version >= 3 ? 16 : 1;
+        auto alignUp = [alignment](uint64_t offset) { return (offset + alignment - 1) & ~(alignment - 1); };
+
+        DataLayout layout;
+        uint64_t offset = GetPreambleSize(version) + sizeof(Model::Header)
+            + (uint64_t)header.meshCount * sizeof(Mesh) + (uint64_t)header.materialCount * sizeof(Material);
+        layout.vertexData = alignUp(offset);
+        layout.indexData = alignUp(layout.vertexData + header.vertexDataByteSize);
+        layout.vertexDataDepth = alignUp(layout.indexData + header.indexDataByteSize);
+        layout.end = alignUp(layout.vertexDataDepth + header.vertexDataByteSizeDepth);
+        if (flags & kH3DFlagSharedIndices)
+        {
+            layout.indexDataDepth = layout.indexData;
+        }
+        else
+        {
+            layout.indexDataDepth = layout.end;
+            layout.end = alignUp(layout.indexDataDepth + header.indexDataByteSize);
+        }
+        return layout;
+    }
+
+    // Checks that every mesh's vertices and indices are within the model's
+    // data, so a damaged file fails to load instead of reading out of bounds
+    bool ValidateModel(Model& model, uint32_t version)
+    {
+        if (model.m_Header.meshCount == 0)
+            return false;
+
+        model.m_VertexStride = model.m_pMesh[0].vertexStride;
+        model.m_VertexStrideDepth = model.m_pMesh[0].vertexStrideDepth;
+        if (model.m_VertexStride == 0 || model.m_VertexStrideDepth == 0)
+            return false;
+
+        for (uint32_t meshIndex = 0; meshIndex < model.m_Header.meshCount; ++meshIndex)
+        {
+            const Mesh& mesh = model.m_pMesh[meshIndex];
+            if (mesh.vertexStride != model.m_VertexStride || mesh.vertexStrideDepth != model.m_VertexStrideDepth)
+                return false;
+            if (mesh.indexFormat >= index_formats || mesh.indexDataByteOffset % IndexFormatSize(mesh.indexFormat) != 0)
+                return false;
+            if (mesh.materialIndex >= model.m_Header.materialCount)
+                return false;
+
+            if ((uint64_t)mesh.vertexDataByteOffset + (uint64_t)mesh.vertexCount * mesh.vertexStride > model.m_Header.vertexDataByteSize ||
+                (uint64_t)mesh.vertexDataByteOffsetDepth + (uint64_t)mesh.vertexCountDepth * mesh.vertexStrideDepth > model.m_Header.vertexDataByteSizeDepth ||
+                (uint64_t)mesh.indexDataByteOffset + (uint64_t)mesh.indexCount * IndexFormatSize(mesh.indexFormat) > model.m_Header.indexDataByteSize)
+            {
+                return false;
+            }
+
+#if _DEBUG
+            ASSERT( mesh.attribsEnabled ==
+                (attrib_mask_position | attrib_mask_texcoord0 | attrib_mask_normal | attrib_mask_tangent | attrib_mask_bitangent) );
+            if (mesh.attrib[0].format == attrib_format_float)
+            {
+                ASSERT(mesh.attrib[0].components == 3 && mesh.attrib[0].format == attrib_format_float); // position
+                ASSERT(mesh.attrib[1].components == 2 && mesh.attrib[1].format == attrib_format_float); // texcoord0
+                ASSERT(mesh.attrib[2].components == 3 && mesh.attrib[2].format == attrib_format_float); // normal
+                ASSERT(mesh.attrib[3].components == 3 && mesh.attrib[3].format == attrib_format_float); // tangent
+                ASSERT(mesh.attrib[4].components == 3 && mesh.attrib[4].format == attrib_format_float); // bitangent
+            }
+            else
+            {
+                ASSERT(version >= 2);
+                ASSERT(mesh.attrib[0].components == 3 && mesh.attrib[0].format == attrib_format_ushort); // position
+                ASSERT(mesh.attrib[1].components == 2 && mesh.attrib[1].format == attrib_format_half); // texcoord0
+                ASSERT(mesh.attrib[2].components == 2 && mesh.attrib[2].format == attrib_format_short); // octahedral normal
+                ASSERT(mesh.attrib[3].components == 2 && mesh.attrib[3].format == attrib_format_short); // octahedral tangent
+                ASSERT(mesh.attrib[4].components == 1 && mesh.attrib[4].format == attrib_format_short); // bitangent sign
+            }
+
+            ASSERT( mesh.attribsEnabledDepth ==
+                (attrib_mask_position) );
+#else
+            (version);
+#endif
+        }
+        return true;
+    }
+
+    void CreateBuffers(Model& model, const unsigned char* vertexData, const unsigned char* indexData,
+        const unsigned char* vertexDataDepth, const unsigned char* indexDataDepth)
+    {
+        model.m_VertexBuffer.Create(L"VertexBuffer", model.m_Header.vertexDataByteSize / model.m_VertexStride, model.m_VertexStride, vertexData);
+        // meshes may mix index formats, so the index buffers are created with
+        // 16-bit elements and meshes with 32-bit indices bind their own view
+        model.m_IndexBuffer.Create(L"IndexBuffer", model.m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t), indexData);
+
+        model.m_VertexBufferDepth.Create(L"VertexBufferDepth", model.m_Header.vertexDataByteSizeDepth / model.m_VertexStrideDepth, model.m_VertexStrideDepth,
+            vertexDataDepth);
+        model.m_IndexBufferDepth.Create(L"IndexBufferDepth", model.m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t), indexDataDepth);
+    }
+
+    // Each chunk starts 16 byte aligned with its header, and its data is
+    // padded to a multiple of 16 bytes. Loaders skip chunks they don't know.
+    struct ChunkHeader
+    {
+        char id[4];
+        uint32_t byteSize; // of the data, without the header or padding
+        uint32_t reserved[2];
+    };
+
+    const char kMeshletChunkId[4] = { 'M', 'L', 'E', 'T' };
+    const char kLodChunkId[4] = { 'L', 'O', 'D', 'S' };
+
+    // The meshlet chunk holds these counts, then the model's meshlet
+    // ranges, meshlets, meshlet vertices and meshlet primitives
+    struct MeshletChunk
+    {
+        uint32_t meshCount;
+        uint32_t meshletCount;
+        uint32_t vertexCount;
+        uint32_t primitiveCount;
+    };
+
+    uint64_t GetMeshletChunkSize(const MeshletChunk& chunk)
+    {
+        return sizeof(MeshletChunk) + (uint64_t)chunk.meshCount * sizeof(Model::MeshletRange)
+            + (uint64_t)chunk.meshletCount * sizeof(Meshlet)
+            + ((uint64_t)chunk.vertexCount + chunk.primitiveCount) * sizeof(uint32_t);
+    }
+
+    template <typename T>
+    void ReadArray(std::vector<T>& array, uint32_t count, const unsigned char*& data)
+    {
+        array.resize(count);
+        if (count > 0)
+            memcpy(array.data(), data, sizeof(T) * count);
+        data += sizeof(T) * count;
+    }
+
+    bool ReadMeshletChunk(Model& model, const unsigned char* data, uint64_t size)
+    {
+        MeshletChunk chunk;
+        if (size < sizeof(chunk))
+            return false;
+        memcpy(&chunk, data, sizeof(chunk));
+        if (chunk.meshCount != model.m_Header.meshCount || GetMeshletChunkSize(chunk) != size)
+            return false;
+
+        data += sizeof(chunk);
+        ReadArray(model.m_MeshletRanges, chunk.meshCount, data);
+        ReadArray(model.m_Meshlets, chunk.meshletCount, data);
+        ReadArray(model.m_MeshletVertices, chunk.vertexCount, data);
+        ReadArray(model.m_MeshletPrimitives, chunk.primitiveCount, data);
+
+        for (uint32_t meshIndex = 0; meshIndex < chunk.meshCount; ++meshIndex)
+        {
+            const Model::MeshletRange& range = model.m_MeshletRanges[meshIndex];
+            if ((uint64_t)range.offset + range.count > chunk.meshletCount)
+                return false;
+
+            const Mesh& mesh = model.m_pMesh[meshIndex];
+            for (uint32_t n = range.offset; n < range.offset + range.count; ++n)
+            {
+                const Meshlet& meshlet = model.m_Meshlets[n];
+                if (meshlet.vertexCount > meshletMaxVertices || meshlet.triangleCount > meshletMaxTriangles ||
+                    (uint64_t)meshlet.vertexOffset + meshlet.vertexCount > chunk.vertexCount ||
+                    (uint64_t)meshlet.primitiveOffset + meshlet.triangleCount > chunk.primitiveCount ||
+                    (uint64_t)meshlet.firstIndex + meshlet.triangleCount * 3 > mesh.indexCount)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // The level of detail chunk holds these counts, then the model's level
+    // of detail ranges and levels of detail
+    struct LodChunk
+    {
+        uint32_t meshCount;
+        uint32_t lodCount;
+    };
+
+    uint64_t GetLodChunkSize(const LodChunk& chunk)
+    {
+        return sizeof(LodChunk) + (uint64_t)chunk.meshCount * sizeof(Model::LodRange) + (uint64_t)chunk.lodCount * sizeof(MeshLod);
+    }
+
+    bool ReadLodChunk(Model& model, const unsigned char* data, uint64_t size)
+    {
+        LodChunk chunk;
+        if (size < sizeof(chunk))
+            return false;
+        memcpy(&chunk, data, sizeof(chunk));
+        if (chunk.meshCount != model.m_Header.meshCount || GetLodChunkSize(chunk) != size)
+            return false;
+
+        data += sizeof(chunk);
+        ReadArray(model.m_LodRanges, chunk.meshCount, data);
+        ReadArray(model.m_Lods, chunk.lodCount, data);
+
+        for (uint32_t meshIndex = 0; meshIndex < chunk.meshCount; ++meshIndex)
+        {
+            const Model::LodRange& range = model.m_LodRanges[meshIndex];
+            if ((uint64_t)range.offset + range.count > chunk.lodCount)
+                return false;
+
+            uint32_t indexSize = IndexFormatSize(model.m_pMesh[meshIndex].indexFormat);
+            for (uint32_t n = range.offset; n < range.offset + range.count; ++n)
+            {
+                const MeshLod& lod = model.m_Lods[n];
+                uint64_t indexCount = std::max(lod.indexCount, lod.indexCountDepth);
+                if (lod.indexDataByteOffset % indexSize != 0 ||
+                    lod.indexDataByteOffset + indexCount * indexSize > model.m_Header.indexDataByteSize)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Reads the chunks that follow the data sections. A damaged chunk fails
+    // the whole model, since whatever uses it would read out of bounds.
+    bool ReadChunks(Model& model, const unsigned char* data, uint64_t size)
+    {
+        uint64_t offset = 0;
+        while (offset + sizeof(ChunkHeader) <= size)
+        {
+            ChunkHeader header;
+            memcpy(&header, data + offset, sizeof(header));
+            offset += sizeof(header);
+            if (header.byteSize > size - offset)
+                return false;
+
+            if (0 == memcmp(header.id, kMeshletChunkId, sizeof(kMeshletChunkId)))
+            {
+                if (!ReadMeshletChunk(model, data + offset, header.byteSize))
+                    return false;
+            }
+            else if (0 == memcmp(header.id, kLodChunkId, sizeof(kLodChunkId)))
+            {
+                if (!ReadLodChunk(model, data + offset, header.byteSize))
+                    return false;
+            }
+            offset += (header.byteSize + 15) & ~15ull;
+        }
+        return true;
+    }
+
+    bool WriteChunkPadding(FILE* file, uint64_t byteSize)
+    {
+        static const unsigned char padding[16] = {};
+        size_t paddingSize = (size_t)(((byteSize + 15) & ~15ull) - byteSize);
+        return paddingSize == 0 || 1 == fwrite(padding, paddingSize, 1, file);
+    }
+
+    template <typename T>
+    bool WriteArray(FILE* file, const std::vector<T>& array)
+    {
+        return array.empty() || 1 == fwrite(array.data(), sizeof(T) * array.size(), 1, file);
+    }
+
+    bool WriteMeshletChunk(FILE* file, const Model& model)
+    {
+        MeshletChunk chunk;
+        chunk.meshCount = (uint32_t)model.m_MeshletRanges.size();
+        chunk.meshletCount = (uint32_t)model.m_Meshlets.size();
+        chunk.vertexCount = (uint32_t)model.m_MeshletVertices.size();
+        chunk.primitiveCount = (uint32_t)model.m_MeshletPrimitives.size();
+
+        ChunkHeader header = {};
+        memcpy(header.id, kMeshletChunkId, sizeof(kMeshletChunkId));
+        header.byteSize = (uint32_t)GetMeshletChunkSize(chunk);
+
+        return 1 == fwrite(&header, sizeof(header), 1, file)
+            && 1 == fwrite(&chunk, sizeof(chunk), 1, file)
+            && WriteArray(file, model.m_MeshletRanges)
+            && WriteArray(file, model.m_Meshlets)
+            && WriteArray(file, model.m_MeshletVertices)
+            && WriteArray(file, model.m_MeshletPrimitives)
+            && WriteChunkPadding(file, header.byteSize);
+    }
+
+    bool WriteLodChunk(FILE* file, const Model& model)
+    {
+        LodChunk chunk;
+        chunk.meshCount = (uint32_t)model.m_LodRanges.size();
+        chunk.lodCount = (uint32_t)model.m_Lods.size();
+
+        ChunkHeader header = {};
+        memcpy(header.id, kLodChunkId, sizeof(kLodChunkId));
+        header.byteSize = (uint32_t)GetLodChunkSize(chunk);
+
+        return 1 == fwrite(&header, sizeof(header), 1, file)
+            && 1 == fwrite(&chunk, sizeof(chunk), 1, file)
+            && WriteArray(file, model.m_LodRanges)
+            && WriteArray(file, model.m_Lods)
+            && WriteChunkPadding(file, header.byteSize);
+    }
+
+    // A read-only view of a whole file
+    class MappedFile
+    {
+    public:
+        ~MappedFile()
+        {
+            if (m_View != nullptr)
+                UnmapViewOfFile(m_View);
+            if (m_Mapping != nullptr)
+                CloseHandle(m_Mapping);
+            if (m_File != INVALID_HANDLE_VALUE)
+                CloseHandle(m_File);
+        }
+
+        bool Open(const char* filename)
+        {
+            std::wstring wideFilename = MakeWStr(filename);
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+            m_File = CreateFile2(wideFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+#else
+            m_File = CreateFileW(wideFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+#endif
+            if (m_File == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER fileSize = {};
+            if (!GetFileSizeEx(m_File, &fileSize) || fileSize.QuadPart == 0)
+                return false;
+
+#if WINAPI_FAMILY_PARTITION(WINAPI_PARTITION_DESKTOP)
+            m_Mapping = CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_Mapping == nullptr)
+                return false;
+            m_View = MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+            m_Mapping = CreateFileMappingFromApp(m_File, nullptr, PAGE_READONLY, 0, nullptr);
+            if (m_Mapping == nullptr)
+                return false;
+            m_View = MapViewOfFileFromApp(m_Mapping, FILE_MAP_READ, 0, 0);
+#endif
+            m_Size = (uint64_t)fileSize.QuadPart;
+            return m_View != nullptr;
+        }
+
+        const unsigned char* GetData() const { return (const unsigned char*)m_View; }
+        uint64_t GetSize() const { return m_Size; }
+
+    private:
+        HANDLE m_File = INVALID_HANDLE_VALUE;
+        HANDLE m_Mapping = nullptr;
+        void* m_View = nullptr;
+        uint64_t m_Size = 0;
+    };
+}
 
 std::unique_ptr<Model> H3DModelLoader::LoadModel(const char *filename)
+{
+    if (m_MemoryMapped)
+    {
+        std::unique_ptr<Model> model;
+        if (LoadModelMapped(filename, model))
+            return model;
+    }
+    return LoadModelStream(filename);
+}
+
+bool H3DModelLoader::LoadModelMapped(const char *filename, std::unique_ptr<Model>& model) const
+{
+    MappedFile file;
+    if (!file.Open(filename))
+        return false;
+
+    // older files don't have aligned data, and are read instead
+    const unsigned char *data = file.GetData();
+    const uint64_t size = file.GetSize();
+    FilePreamble preamble;
+    if (size < sizeof(preamble))
+        return false;
+    memcpy(&preamble, data, sizeof(preamble));
+    if (0 != memcmp(preamble.tag, kH3DFileTag, sizeof(kH3DFileTag)) || preamble.version < 3)
+        return false;
+
+    // from here on the file is a version 3 file or damaged, the model is
+    // left null when it fails to load
+    if (preamble.version > kH3DVersion)
+        return true;
+
+    uint64_t offset = sizeof(preamble);
+    auto loaded = std::make_unique<Model>();
+    if (offset + sizeof(Model::Header) > size)
+        return true;
+    memcpy(&loaded->m_Header, data + offset, sizeof(Model::Header));
+    offset += sizeof(Model::Header);
+
+    const Model::Header& header = loaded->m_Header;
+    uint64_t meshByteSize = (uint64_t)header.meshCount * sizeof(Mesh);
+    uint64_t materialByteSize = (uint64_t)header.materialCount * sizeof(Material);
+    if (offset + meshByteSize + materialByteSize > size)
+        return true;
+
+    // the meshes and materials stay on the CPU and are copied out, the
+    // vertices and indices are uploaded straight from the mapping
+    loaded->m_pMesh = new Mesh [header.meshCount];
+    loaded->m_pMaterial = new Material [header.materialCount];
+    memcpy(loaded->m_pMesh, data + offset, (size_t)meshByteSize);
+    memcpy(loaded->m_pMaterial, data + offset + meshByteSize, (size_t)materialByteSize);
+
+    DataLayout layout = GetDataLayout(header, preamble.version, preamble.flags);
+    if (layout.end > size || !ValidateModel(*loaded, preamble.version))
+        return true;
+
+    if (preamble.version >= 4 && !ReadChunks(*loaded, data + layout.end, size - layout.end))
+        return true;
+
+    CreateBuffers(*loaded, data + layout.vertexData, data + layout.indexData, data + layout.vertexDataDepth, data + layout.indexDataDepth);
+
+    loaded->LoadTextures();
+
+    model = std::move(loaded);
+    return true;
+}
+
+std::unique_ptr<Model> H3DModelLoader::LoadModelStream(const char *filename) const
 {
     FILE *file = nullptr;
 	if (0 != fopen_s(&file, filename, "rb")) {
@@ -28,6 +496,26 @@ std::unique_ptr<Model> H3DModelLoader::LoadModel(const char *filename)
 	}
     bool ok = false;
 	auto model = std::make_unique<Model>();
+    FilePreamble preamble = {};
+    preamble.version = 1;
+    DataLayout layout;
+    bool sharedIndices = false;
+    int64_t fileSize = 0;
+    std::vector<unsigned char> chunks;
+
+    if (1 != fread(preamble.tag, sizeof(preamble.tag), 1, file)) goto h3d_load_fail;
+    if (0 == memcmp(preamble.tag, kH3DFileTag, sizeof(kH3DFileTag)))
+    {
+        if (1 != fread(&preamble.version, sizeof(preamble.version), 1, file)) goto h3d_load_fail;
+        if (preamble.version < 2 || preamble.version > kH3DVersion) goto h3d_load_fail;
+        if (preamble.version >= 3)
+            if (1 != fread(&preamble.flags, sizeof(preamble.flags) + sizeof(preamble.reserved), 1, file)) goto h3d_load_fail;
+    }
+    else
+    {
+        preamble.version = 1;
+        fseek(file, 0, SEEK_SET);
+    }
 
     if (1 != fread(&model->m_Header, sizeof(Model::Header), 1, file)) goto h3d_load_fail;
 
@@ -39,58 +527,59 @@ std::unique_ptr<Model> H3DModelLoader::LoadModel(const char *filename)
     if (model->m_Header.materialCount > 0)
         if (1 != fread(model->m_pMaterial, sizeof(Material) * model->m_Header.materialCount, 1, file)) goto h3d_load_fail;
 
-	model->m_VertexStride = model->m_pMesh[0].vertexStride;
-	model->m_VertexStrideDepth = model->m_pMesh[0].vertexStrideDepth;
-#if _DEBUG
-    for (uint32_t meshIndex = 1; meshIndex < model->m_Header.meshCount; ++meshIndex)
-    {
-        const Mesh& mesh = model->m_pMesh[meshIndex];
-        ASSERT(mesh.vertexStride == model->m_VertexStride);
-        ASSERT(mesh.vertexStrideDepth == model->m_VertexStrideDepth);
-    }
-    for (uint32_t meshIndex = 0; meshIndex < model->m_Header.meshCount; ++meshIndex)
-    {
-        const Mesh& mesh = model->m_pMesh[meshIndex];
+    if (!ValidateModel(*model, preamble.version)) goto h3d_load_fail;
 
-        ASSERT( mesh.attribsEnabled ==
-            (attrib_mask_position | attrib_mask_texcoord0 | attrib_mask_normal | attrib_mask_tangent | attrib_mask_bitangent) );
-        ASSERT(mesh.attrib[0].components == 3 && mesh.attrib[0].format == attrib_format_float); // position
-        ASSERT(mesh.attrib[1].components == 2 && mesh.attrib[1].format == attrib_format_float); // texcoord0
-        ASSERT(mesh.attrib[2].components == 3 && mesh.attrib[2].format == attrib_format_float); // normal
-        ASSERT(mesh.attrib[3].components == 3 && mesh.attrib[3].format == attrib_format_float); // tangent
-        ASSERT(mesh.attrib[4].components == 3 && mesh.attrib[4].format == attrib_format_float); // bitangent
-
-        ASSERT( mesh.attribsEnabledDepth ==
-            (attrib_mask_position) );
-        ASSERT(mesh.attrib[0].components == 3 && mesh.attrib[0].format == attrib_format_float); // position
-    }
-#endif
+    layout = GetDataLayout(model->m_Header, preamble.version, preamble.flags);
+    sharedIndices = (preamble.flags & kH3DFlagSharedIndices) != 0;
 
 	model->m_pVertexData = new unsigned char[model->m_Header.vertexDataByteSize];
 	model->m_pIndexData = new unsigned char[model->m_Header.indexDataByteSize];
 	model->m_pVertexDataDepth = new unsigned char[model->m_Header.vertexDataByteSizeDepth];
-	model->m_pIndexDataDepth = new unsigned char[model->m_Header.indexDataByteSize];
+    if (!sharedIndices)
+	    model->m_pIndexDataDepth = new unsigned char[model->m_Header.indexDataByteSize];
 
     if (model->m_Header.vertexDataByteSize > 0)
+    {
+        if (0 != _fseeki64(file, layout.vertexData, SEEK_SET)) goto h3d_load_fail;
         if (1 != fread(model->m_pVertexData, model->m_Header.vertexDataByteSize, 1, file)) goto h3d_load_fail;
+    }
     if (model->m_Header.indexDataByteSize > 0)
+    {
+        if (0 != _fseeki64(file, layout.indexData, SEEK_SET)) goto h3d_load_fail;
         if (1 != fread(model->m_pIndexData, model->m_Header.indexDataByteSize, 1, file)) goto h3d_load_fail;
+    }
 
     if (model->m_Header.vertexDataByteSizeDepth > 0)
+    {
+        if (0 != _fseeki64(file, layout.vertexDataDepth, SEEK_SET)) goto h3d_load_fail;
         if (1 != fread(model->m_pVertexDataDepth, model->m_Header.vertexDataByteSizeDepth, 1, file)) goto h3d_load_fail;
-    if (model->m_Header.indexDataByteSize > 0)
+    }
+    if (model->m_Header.indexDataByteSize > 0 && !sharedIndices)
+    {
+        if (0 != _fseeki64(file, layout.indexDataDepth, SEEK_SET)) goto h3d_load_fail;
         if (1 != fread(model->m_pIndexDataDepth, model->m_Header.indexDataByteSize, 1, file)) goto h3d_load_fail;
+    }
+
+    if (preamble.version >= 4)
+    {
+        if (0 != _fseeki64(file, 0, SEEK_END)) goto h3d_load_fail;
+        fileSize = _ftelli64(file);
+        if (fileSize < (int64_t)layout.end) goto h3d_load_fail;
+        chunks.resize((size_t)(fileSize - layout.end));
+        if (!chunks.empty())
+        {
+            if (0 != _fseeki64(file, layout.end, SEEK_SET)) goto h3d_load_fail;
+            if (1 != fread(chunks.data(), chunks.size(), 1, file)) goto h3d_load_fail;
+        }
+        if (!ReadChunks(*model, chunks.data(), chunks.size())) goto h3d_load_fail;
+    }
 
-	model->m_VertexBuffer.Create(L"VertexBuffer", model->m_Header.vertexDataByteSize / model->m_VertexStride, model->m_VertexStride, model->m_pVertexData);
-	model->m_IndexBuffer.Create(L"IndexBuffer", model->m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t), model->m_pIndexData);
+    CreateBuffers(*model, model->m_pVertexData, model->m_pIndexData, model->m_pVertexDataDepth,
+        sharedIndices ? model->m_pIndexData : model->m_pIndexDataDepth);
     delete [] model->m_pVertexData;
 	model->m_pVertexData = nullptr;
     delete [] model->m_pIndexData;
 	model->m_pIndexData = nullptr;
-
-	model->m_VertexBufferDepth.Create(L"VertexBufferDepth", model->m_Header.vertexDataByteSizeDepth / model->m_VertexStrideDepth, model->m_VertexStrideDepth, 
-		model->m_pVertexDataDepth);
-	model->m_IndexBufferDepth.Create(L"IndexBufferDepth", model->m_Header.indexDataByteSize / sizeof(uint16_t), sizeof(uint16_t), model->m_pIndexDataDepth);
     delete [] model->m_pVertexDataDepth;
 	model->m_pVertexDataDepth = nullptr;
     delete [] model->m_pIndexDataDepth;
@@ -118,6 +607,32 @@ bool H3DModelLoader::Save(Model* model, const char *filename) const
 	}
     bool ok = false;
 
+    const Model::Header& header = model->m_Header;
+    FilePreamble preamble = {};
+    memcpy(preamble.tag, kH3DFileTag, sizeof(kH3DFileTag));
+    preamble.version = kH3DVersion;
+    if (header.indexDataByteSize == 0 || 0 == memcmp(model->m_pIndexData, model->m_pIndexDataDepth, header.indexDataByteSize))
+        preamble.flags |= kH3DFlagSharedIndices;
+    DataLayout layout = GetDataLayout(header, preamble.version, preamble.flags);
+
+    // writes the data section at the offset it has in the layout, padding
+    // the file up to it with zeros
+    uint64_t fileOffset = sizeof(preamble) + sizeof(Model::Header)
+        + (uint64_t)header.meshCount * sizeof(Mesh) + (uint64_t)header.materialCount * sizeof(Material);
+    auto writeSection = [file, &fileOffset](uint64_t sectionOffset, const void* data, uint32_t byteSize) -> bool
+    {
+        static const unsigned char padding[16] = {};
+        ASSERT(sectionOffset >= fileOffset && sectionOffset - fileOffset <= sizeof(padding));
+        size_t paddingSize = (size_t)(sectionOffset - fileOffset);
+        if (paddingSize > 0 && 1 != fwrite(padding, paddingSize, 1, file))
+            return false;
+        if (byteSize > 0 && 1 != fwrite(data, byteSize, 1, file))
+            return false;
+        fileOffset = sectionOffset + byteSize;
+        return true;
+    };
+
+    if (1 != fwrite(&preamble, sizeof(preamble), 1, file)) goto h3d_save_fail;
     if (1 != fwrite(&model->m_Header, sizeof(Model::Header), 1, file)) goto h3d_save_fail;
 
     if (model->m_Header.meshCount > 0)
@@ -125,15 +640,17 @@ bool H3DModelLoader::Save(Model* model, const char *filename) const
     if (model->m_Header.materialCount > 0)
         if (1 != fwrite(model->m_pMaterial, sizeof(Material) * model->m_Header.materialCount, 1, file)) goto h3d_save_fail;
 
-    if (model->m_Header.vertexDataByteSize > 0)
-        if (1 != fwrite(model->m_pVertexData, model->m_Header.vertexDataByteSize, 1, file)) goto h3d_save_fail;
-    if (model->m_Header.indexDataByteSize > 0)
-        if (1 != fwrite(model->m_pIndexData, model->m_Header.indexDataByteSize, 1, file)) goto h3d_save_fail;
+    if (!writeSection(layout.vertexData, model->m_pVertexData, header.vertexDataByteSize)) goto h3d_save_fail;
+    if (!writeSection(layout.indexData, model->m_pIndexData, header.indexDataByteSize)) goto h3d_save_fail;
+    if (!writeSection(layout.vertexDataDepth, model->m_pVertexDataDepth, header.vertexDataByteSizeDepth)) goto h3d_save_fail;
+    if (!(preamble.flags & kH3DFlagSharedIndices))
+        if (!writeSection(layout.indexDataDepth, model->m_pIndexDataDepth, header.indexDataByteSize)) goto h3d_save_fail;
+    if (!writeSection(layout.end, nullptr, 0)) goto h3d_save_fail;
 
-    if (model->m_Header.vertexDataByteSizeDepth > 0)
-        if (1 != fwrite(model->m_pVertexDataDepth, model->m_Header.vertexDataByteSizeDepth, 1, file)) goto h3d_save_fail;
-    if (model->m_Header.indexDataByteSize > 0)
-        if (1 != fwrite(model->m_pIndexDataDepth, model->m_Header.indexDataByteSize, 1, file)) goto h3d_save_fail;
+    if (!model->m_Meshlets.empty())
+        if (!WriteMeshletChunk(file, *model)) goto h3d_save_fail;
+    if (!model->m_Lods.empty())
+        if (!WriteLodChunk(file, *model)) goto h3d_save_fail;
 
     ok = true;
 
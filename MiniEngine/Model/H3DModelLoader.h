@@ -8,4 +8,15 @@ public:
 	std::unique_ptr<SkinnedModel> LoadSkinnedModel(const char* filename) override;
 	
 	bool Save(Model* model, const char *filename) const;
+
+	// Version 3 files are memory mapped, and their vertices and indices are
+	// uploaded straight from the mapping. Older files are always read.
+	void SetMemoryMapped(bool memoryMapped) { m_MemoryMapped = memoryMapped; }
+
+private:
+	// returns false when the file is not a version 3 file, to read it instead
+	bool LoadModelMapped(const char* filename, std::unique_ptr<Model>& model) const;
+	std::unique_ptr<Model> LoadModelStream(const char* filename) const;
+
+	bool m_MemoryMapped = true;
 };
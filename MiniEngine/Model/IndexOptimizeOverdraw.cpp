@@ -0,0 +1,342 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+#include "IndexOptimizeOverdraw.h"
+
+namespace
+{
+    // resolution of the depth buffer each side of the mesh is drawn into
+    enum {kOverdrawViewSize = 256};
+
+    struct Float3
+    {
+        float x, y, z;
+    };
+
+    inline Float3 LoadPosition(const unsigned char* positions, uint32_t positionStride, uint32_t index)
+    {
+        Float3 p;
+        memcpy(&p, positions + (size_t)index * positionStride, sizeof(p));
+        return p;
+    }
+
+    inline Float3 Sub(const Float3& a, const Float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Float3 Add(const Float3& a, const Float3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Float3 Scale(const Float3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Float3 Cross(const Float3& a, const Float3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    // Simulates a FIFO post-transform cache. A vertex is in the cache when it
+    // was transformed less than cacheSize misses ago, 0 marks vertices that
+    // were never transformed.
+    class FifoCache
+    {
+    public:
+        FifoCache(uint32_t vertexCount, uint16_t cacheSize)
+            : m_transformedAt(vertexCount, 0)
+            , m_transformCount(0)
+            , m_cacheSize(cacheSize)
+        {
+        }
+
+        // returns the number of vertices of the face that had to be transformed
+        template <typename IndexType>
+        uint32_t AddFace(const IndexType* face)
+        {
+            uint32_t misses = 0;
+            for (uint32_t v = 0; v < 3; v++)
+            {
+                uint32_t& vertexTransformedAt = m_transformedAt[face[v]];
+                if (vertexTransformedAt != 0 && m_transformCount - vertexTransformedAt < m_cacheSize)
+                    continue;
+
+                vertexTransformedAt = ++m_transformCount;
+                misses++;
+            }
+            return misses;
+        }
+
+        // evicts everything, as if a different part of the mesh was drawn
+        void Flush()
+        {
+            m_transformCount += m_cacheSize;
+        }
+
+    private:
+        std::vector<uint32_t> m_transformedAt;
+        uint32_t m_transformCount;
+        uint32_t m_cacheSize;
+    };
+
+    template <typename IndexType>
+    uint32_t FindVertexCount(const IndexType* indexList, uint32_t indexCount)
+    {
+        uint32_t maxIndex = 0;
+        for (uint32_t i = 0; i < indexCount; i++)
+        {
+            maxIndex = std::max(maxIndex, (uint32_t)indexList[i]);
+        }
+        return indexCount > 0 ? maxIndex + 1 : 0;
+    }
+
+    // Draws a triangle in pixel coordinates into the depth buffer with a
+    // less-than depth test, returning the number of pixels that passed.
+    // Pixels are covered when their center is inside the triangle.
+    uint32_t RasterizeTriangle(float* depthBuffer, Float3 v0, Float3 v1, Float3 v2)
+    {
+        // clockwise triangles face away and are culled
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (!(area > 0.0f))
+            return 0;
+
+        int minX = std::max((int)floorf(std::min(v0.x, std::min(v1.x, v2.x))), 0);
+        int minY = std::max((int)floorf(std::min(v0.y, std::min(v1.y, v2.y))), 0);
+        int maxX = std::min((int)ceilf(std::max(v0.x, std::max(v1.x, v2.x))), (int)kOverdrawViewSize - 1);
+        int maxY = std::min((int)ceilf(std::max(v0.y, std::max(v1.y, v2.y))), (int)kOverdrawViewSize - 1);
+
+        const float invArea = 1.0f / area;
+        uint32_t pixelsShaded = 0;
+        for (int y = minY; y <= maxY; y++)
+        {
+            float py = y + 0.5f;
+            for (int x = minX; x <= maxX; x++)
+            {
+                float px = x + 0.5f;
+                float w0 = (v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (px - v1.x);
+                float w1 = (v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (px - v2.x);
+                float w2 = (v1.x - v0.x) * (py - v0.y) - (v1.y - v0.y) * (px - v0.x);
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+
+                float depth = (w0 * v0.z + w1 * v1.z + w2 * v2.z) * invArea;
+                float& pixelDepth = depthBuffer[y * kOverdrawViewSize + x];
+                if (depth < pixelDepth)
+                {
+                    pixelDepth = depth;
+                    pixelsShaded++;
+                }
+            }
+        }
+        return pixelsShaded;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//  OptimizeOverdraw
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+void OptimizeOverdraw(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    IndexType* newIndexList, uint16_t cacheSize, float threshold)
+{
+    uint32_t faceCount = indexCount / 3;
+    uint32_t vertexCount = FindVertexCount(indexList, indexCount);
+
+    // Hard boundaries are where the cache optimizer ran out of vertices in
+    // the cache and started over somewhere else, so the input already pays
+    // for a cold cache there, and the runs between them can be moved
+    // around freely.
+    std::vector<uint32_t> hardBoundaries;
+    std::vector<float> hardAcmr;
+    {
+        FifoCache cache(vertexCount, cacheSize);
+        uint32_t runMisses = 0;
+        for (uint32_t f = 0; f < faceCount; f++)
+        {
+            uint32_t misses = cache.AddFace(indexList + f * 3);
+            if (f == 0 || misses == 3)
+            {
+                if (f != 0)
+                    hardAcmr.push_back((float)runMisses / (f - hardBoundaries.back()));
+                hardBoundaries.push_back(f);
+                runMisses = 0;
+            }
+            runMisses += misses;
+        }
+        if (faceCount > 0)
+            hardAcmr.push_back((float)runMisses / (faceCount - hardBoundaries.back()));
+    }
+
+    // Soft boundaries split the runs further, starting a new cluster as soon
+    // as the cluster so far is within threshold of its run's ACMR, drawing
+    // each cluster from a cold cache as it will be once they're reordered
+    std::vector<uint32_t> clusterStarts;
+    {
+        FifoCache cache(vertexCount, cacheSize);
+        for (size_t run = 0; run < hardBoundaries.size(); run++)
+        {
+            uint32_t runEnd = run + 1 < hardBoundaries.size() ? hardBoundaries[run + 1] : faceCount;
+            float maxAcmr = hardAcmr[run] * threshold;
+
+            cache.Flush();
+            clusterStarts.push_back(hardBoundaries[run]);
+            uint32_t clusterMisses = 0;
+            uint32_t clusterFaces = 0;
+            for (uint32_t f = hardBoundaries[run]; f < runEnd; f++)
+            {
+                clusterMisses += cache.AddFace(indexList + f * 3);
+                clusterFaces++;
+
+                if (f + 1 < runEnd && clusterMisses <= maxAcmr * clusterFaces)
+                {
+                    cache.Flush();
+                    clusterStarts.push_back(f + 1);
+                    clusterMisses = 0;
+                    clusterFaces = 0;
+                }
+            }
+        }
+    }
+    uint32_t clusterCount = (uint32_t)clusterStarts.size();
+    clusterStarts.push_back(faceCount);
+
+    // Area weighted centroid and normal of each cluster and of the mesh.
+    // The cross product of two edges is the normal scaled by twice the area.
+    std::vector<Float3> clusterCentroids(clusterCount);
+    std::vector<Float3> clusterNormals(clusterCount);
+    Float3 meshCentroid = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+    for (uint32_t c = 0; c < clusterCount; c++)
+    {
+        Float3 centroid = { 0.0f, 0.0f, 0.0f };
+        Float3 normal = { 0.0f, 0.0f, 0.0f };
+        float area = 0.0f;
+        for (uint32_t f = clusterStarts[c]; f < clusterStarts[c + 1]; f++)
+        {
+            Float3 p0 = LoadPosition(positions, positionStride, indexList[f * 3 + 0]);
+            Float3 p1 = LoadPosition(positions, positionStride, indexList[f * 3 + 1]);
+            Float3 p2 = LoadPosition(positions, positionStride, indexList[f * 3 + 2]);
+
+            Float3 faceNormal = Cross(Sub(p1, p0), Sub(p2, p0));
+            float faceArea = sqrtf(Dot(faceNormal, faceNormal));
+            centroid = Add(centroid, Scale(Add(Add(p0, p1), p2), faceArea / 3.0f));
+            normal = Add(normal, faceNormal);
+            area += faceArea;
+        }
+
+        meshCentroid = Add(meshCentroid, centroid);
+        meshArea += area;
+        clusterCentroids[c] = area > 0.0f ? Scale(centroid, 1.0f / area) : centroid;
+
+        float normalLength = sqrtf(Dot(normal, normal));
+        clusterNormals[c] = normalLength > 0.0f ? Scale(normal, 1.0f / normalLength) : normal;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid = Scale(meshCentroid, 1.0f / meshArea);
+
+    // Clusters facing away from the center are on the outside of the mesh
+    // and are drawn first. Degenerate clusters without a normal score 0.
+    std::vector<float> clusterSortKeys(clusterCount);
+    std::vector<uint32_t> clusterOrder(clusterCount);
+    for (uint32_t c = 0; c < clusterCount; c++)
+    {
+        float key = Dot(Sub(clusterCentroids[c], meshCentroid), clusterNormals[c]);
+        clusterSortKeys[c] = key == key ? key : 0.0f;
+        clusterOrder[c] = c;
+    }
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+        [&clusterSortKeys](uint32_t a, uint32_t b) { return clusterSortKeys[a] > clusterSortKeys[b]; });
+
+    IndexType* newIndex = newIndexList;
+    for (uint32_t c : clusterOrder)
+    {
+        uint32_t begin = clusterStarts[c] * 3;
+        uint32_t end = clusterStarts[c + 1] * 3;
+        memcpy(newIndex, indexList + begin, sizeof(IndexType) * (end - begin));
+        newIndex += end - begin;
+    }
+
+    // a trailing partial face is kept at the end
+    memcpy(newIndex, indexList + faceCount * 3, sizeof(IndexType) * (indexCount - faceCount * 3));
+}
+
+//-----------------------------------------------------------------------------
+//  ComputeOverdrawStats
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+OverdrawStats ComputeOverdrawStats(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride)
+{
+    OverdrawStats stats = {};
+    uint32_t faceCount = indexCount / 3;
+    if (faceCount == 0)
+        return stats;
+
+    // fit the bounding box of the referenced vertices into the views,
+    // keeping the aspect ratio
+    Float3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    Float3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32_t i = 0; i < faceCount * 3; i++)
+    {
+        Float3 p = LoadPosition(positions, positionStride, indexList[i]);
+        boundsMin = { std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z) };
+        boundsMax = { std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z) };
+    }
+    float extent = std::max(boundsMax.x - boundsMin.x, std::max(boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z));
+    float scale = extent > 0.0f ? (kOverdrawViewSize - 1) / extent : 0.0f;
+
+    std::vector<Float3> scaledPositions(faceCount * 3);
+    for (uint32_t i = 0; i < faceCount * 3; i++)
+    {
+        scaledPositions[i] = Scale(Sub(LoadPosition(positions, positionStride, indexList[i]), boundsMin), scale);
+    }
+
+    // Look down each axis from both sides, the depth being the distance
+    // from the side looked from. The axes are rotated so the projected
+    // triangles wind the way their normals point, and mirrored when looking
+    // from the low side so the ones facing it are counter-clockwise.
+    std::vector<float> depthBuffer(kOverdrawViewSize * kOverdrawViewSize);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int side = 0; side < 2; side++)
+        {
+            std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+
+            for (uint32_t f = 0; f < faceCount; f++)
+            {
+                Float3 v[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    const Float3& p = scaledPositions[f * 3 + k];
+                    switch (axis)
+                    {
+                    case 0: v[k] = { p.y, p.z, p.x }; break;
+                    case 1: v[k] = { p.z, p.x, p.y }; break;
+                    default: v[k] = { p.x, p.y, p.z }; break;
+                    }
+                    if (side == 0)
+                        v[k].x = kOverdrawViewSize - v[k].x;
+                    else
+                        v[k].z = kOverdrawViewSize - v[k].z;
+                }
+                stats.pixelsShaded += RasterizeTriangle(depthBuffer.data(), v[0], v[1], v[2]);
+            }
+
+            for (float depth : depthBuffer)
+            {
+                if (depth != FLT_MAX)
+                    stats.pixelsCovered++;
+            }
+        }
+    }
+
+    stats.overdraw = stats.pixelsCovered > 0 ? (float)stats.pixelsShaded / stats.pixelsCovered : 1.0f;
+    return stats;
+}
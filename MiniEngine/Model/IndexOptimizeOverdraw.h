@@ -0,0 +1,81 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+//  OptimizeOverdraw
+//-----------------------------------------------------------------------------
+//  Reorders clusters of triangles of an index list already optimized with
+//  OptimizeFaces, drawing the clusters that face away from the center of
+//  the mesh first so they occlude more of what is drawn after them, as in
+//  Sander, Nehab and Barczak's "Fast Triangle Reordering for Vertex Locality
+//  and Reduced Overdraw" (Tipsify).
+//
+//  Parameters:
+//      indexList
+//          input index list
+//      indexCount
+//          the number of indices in the list
+//      positions
+//          the float3 position of the first vertex
+//      positionStride
+//          the number of bytes from one vertex's position to the next
+//      newIndexList
+//          a pointer to a preallocated buffer the same size as indexList to
+//          hold the optimized index list
+//      cacheSize
+//          the size of the simulated FIFO post-transform cache used to find
+//          where the list can be split into clusters
+//      threshold
+//          how much worse than the input's ACMR a cluster's ACMR may get
+//          before it is split, 1.05 allows 5%
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+void OptimizeOverdraw(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    IndexType* newIndexList, uint16_t cacheSize, float threshold);
+
+template void OptimizeOverdraw<uint16_t>(const uint16_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    uint16_t* newIndexList, uint16_t cacheSize, float threshold);
+template void OptimizeOverdraw<uint32_t>(const uint32_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    uint32_t* newIndexList, uint16_t cacheSize, float threshold);
+
+//-----------------------------------------------------------------------------
+//  ComputeOverdrawStats
+//-----------------------------------------------------------------------------
+//  Rasterizes the triangles in order into a small depth buffer from each
+//  side of the mesh's bounding box, culling the ones whose edges' cross
+//  product points away from the view. OptimizeOverdraw tells the outside of
+//  the mesh from the inside the same way.
+//
+//  Parameters:
+//      indexList, indexCount, positions, positionStride
+//          as for OptimizeOverdraw
+//  Returns:
+//      pixelsCovered
+//          pixels covered by at least one triangle, summed over the views
+//      pixelsShaded
+//          pixels that passed the depth test, summed over the views
+//      overdraw
+//          pixels shaded per pixel covered (1.0 is the best case)
+//-----------------------------------------------------------------------------
+struct OverdrawStats
+{
+    uint32_t pixelsCovered;
+    uint32_t pixelsShaded;
+    float overdraw;
+};
+
+template <typename IndexType>
+OverdrawStats ComputeOverdrawStats(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride);
+
+template OverdrawStats ComputeOverdrawStats<uint16_t>(const uint16_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride);
+template OverdrawStats ComputeOverdrawStats<uint32_t>(const uint32_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride);
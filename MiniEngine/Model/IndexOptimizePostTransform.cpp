@@ -17,9 +17,11 @@
 // modified from original source to improve performance (especially in debug builds), memory allocations, etc.
 
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
 #include <algorithm>
+#include <vector>
 
 #include "IndexOptimizePostTransform.h"
 
@@ -79,7 +81,7 @@ namespace
 
 
     enum {kMaxVertexCacheSize = 64};
-    enum {kMaxPrecomputedVertexValenceScores = 64};
+    enum {kMaxPrecomputedVertexValenceScores = 256};
     float s_vertexCacheScores[kMaxVertexCacheSize+1][kMaxVertexCacheSize];
     float s_vertexValenceScores[kMaxPrecomputedVertexValenceScores];
 
@@ -173,34 +175,71 @@ struct IndexSortCompareIndexed
     }
 };
 
-template <typename T, typename IndexType>
-struct FaceValenceSort
+// Unprocessed faces bucketed by the sum of their vertices' valences, lower
+// sums scoring higher, in intrusive doubly linked lists. Valences only ever
+// go down, so the lowest bucket holding a face is tracked by moving down on
+// inserts and up when that bucket runs empty, and finding the best face to
+// restart from never has to re-sort or rescan the faces.
+class FaceValenceBuckets
 {
-    const OptimizeVertexData<IndexType> *_vertexData;
+public:
+    enum : uint32_t { kNoFace = 0xFFFFFFFF };
+
+    FaceValenceBuckets(uint32_t faceCount, uint32_t bucketCount)
+        : m_bucketHeads(bucketCount, kNoFace)
+        , m_next(faceCount)
+        , m_prev(faceCount)
+        , m_valence(faceCount)
+        , m_lowestBucket(bucketCount)
+    {
+    }
 
-    FaceValenceSort(const OptimizeVertexData<IndexType> *vertexData)
-        : _vertexData(vertexData)
+    void Insert(uint32_t face, uint32_t valence)
     {
+        m_valence[face] = valence;
+        m_prev[face] = kNoFace;
+        m_next[face] = m_bucketHeads[valence];
+        if (m_next[face] != kNoFace)
+            m_prev[m_next[face]] = face;
+        m_bucketHeads[valence] = face;
+        m_lowestBucket = std::min(m_lowestBucket, valence);
     }
 
-    bool operator()(T a, T b) const
+    void Remove(uint32_t face)
     {
-        const OptimizeVertexData<IndexType> *vA0 = _vertexData + a * 3 + 0;
-        const OptimizeVertexData<IndexType> *vA1 = _vertexData + a * 3 + 1;
-        const OptimizeVertexData<IndexType> *vA2 = _vertexData + a * 3 + 2;
-        const OptimizeVertexData<IndexType> *vB0 = _vertexData + b * 3 + 0;
-        const OptimizeVertexData<IndexType> *vB1 = _vertexData + b * 3 + 1;
-        const OptimizeVertexData<IndexType> *vB2 = _vertexData + b * 3 + 2;
-
-        int aValence = vA0->activeFaceListSize + vA1->activeFaceListSize + vA2->activeFaceListSize;
-        int bValence = vB0->activeFaceListSize + vB1->activeFaceListSize + vB2->activeFaceListSize;
-
-        // higher scoring faces are those with lower valence totals
-        // reverse sort (reverse of reverse)
-        if (aValence < bValence)
-            return true;
-        return false;
+        if (m_prev[face] != kNoFace)
+            m_next[m_prev[face]] = m_next[face];
+        else
+            m_bucketHeads[m_valence[face]] = m_next[face];
+
+        if (m_next[face] != kNoFace)
+            m_prev[m_next[face]] = m_prev[face];
     }
+
+    // one of the face's vertices lost an active face
+    void DecrementValence(uint32_t face)
+    {
+        uint32_t valence = m_valence[face];
+        assert(valence > 0);
+        Remove(face);
+        Insert(face, valence - 1);
+    }
+
+    uint32_t FindLowest()
+    {
+        while (m_lowestBucket < m_bucketHeads.size() && m_bucketHeads[m_lowestBucket] == kNoFace)
+        {
+            m_lowestBucket++;
+        }
+        return m_lowestBucket < m_bucketHeads.size() ? m_bucketHeads[m_lowestBucket] : kNoFace;
+    }
+
+private:
+    std::vector<uint32_t> m_bucketHeads;
+    std::vector<uint32_t> m_next;
+    std::vector<uint32_t> m_prev;
+    std::vector<uint32_t> m_valence;
+    uint32_t m_lowestBucket;
 };
 
 //-----------------------------------------------------------------------------
@@ -229,8 +268,6 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
     uint32_t faceCount = indexCount / 3;
     uint8_t *processedFaceList = new uint8_t [faceCount];
     memset(processedFaceList, 0, sizeof(uint8_t) * faceCount);
-    unsigned int *faceSorted = new unsigned int [faceCount];
-    unsigned int *faceReverseLookup = new unsigned int [faceCount];
 
     // build the vertex remap table
     unsigned int uniqueVertexCount = 0;
@@ -288,18 +325,6 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
         assert(curActiveFaceListPos == indexCount);
     }
 
-    // sort unprocessed faces by highest score
-    for (uint32_t f = 0; f < faceCount; f++)
-    {
-        faceSorted[f] = f;
-    }
-    FaceValenceSort<unsigned int, IndexType> faceValenceSort(vertexDataList);
-    std::sort(faceSorted, faceSorted + faceCount, faceValenceSort);
-    for (uint32_t f = 0; f < faceCount; f++)
-    {
-        faceReverseLookup[faceSorted[f]] = f;
-    }
-
     // fill out face list per vertex
     for (uint32_t i=0; i<indexCount; i+=3)
     {
@@ -311,6 +336,25 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
         }
     }
 
+    // bucket unprocessed faces by their total valence, inserting in reverse
+    // so each bucket lists its faces in index order
+    uint32_t maxFaceValence = 0;
+    for (uint32_t i = 0; i < indexCount; i += 3)
+    {
+        uint32_t faceValence = vertexDataList[vertexRemap[i]].activeFaceListSize
+            + vertexDataList[vertexRemap[i + 1]].activeFaceListSize
+            + vertexDataList[vertexRemap[i + 2]].activeFaceListSize;
+        maxFaceValence = std::max(maxFaceValence, faceValence);
+    }
+    FaceValenceBuckets faceBuckets(faceCount, maxFaceValence + 1);
+    for (uint32_t f = faceCount; f-- > 0;)
+    {
+        uint32_t face = f * 3;
+        faceBuckets.Insert(f, vertexDataList[vertexRemap[face]].activeFaceListSize
+            + vertexDataList[vertexRemap[face + 1]].activeFaceListSize
+            + vertexDataList[vertexRemap[face + 2]].activeFaceListSize);
+    }
+
     IndexType vertexCacheBuffer[(kMaxVertexCacheSize+3)*2];
     IndexType* cache0 = vertexCacheBuffer;
     IndexType* cache1 = vertexCacheBuffer+(kMaxVertexCacheSize+3);
@@ -321,40 +365,30 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
 
     const float maxValenceScore = FindVertexScore(1, kEvictedCacheIndex, lruCacheSize) * 3.f;
 
-    unsigned int nextBestFace = 0;
     for (uint32_t i = 0; i < indexCount; i += 3)
     {
         if (bestScore < 0.f)
         {
             // no verts in the cache are used by any unprocessed faces so
-            // search all unprocessed faces for a new starting point
-            for (; nextBestFace < faceCount; nextBestFace++)
-            {
-                unsigned int faceIndex = faceSorted[nextBestFace];
-                if (processedFaceList[faceIndex] == 0)
-                {
-                    uint32_t face = faceIndex * 3;
-                    float faceScore = 0.f;
-                    for (uint32_t k=0; k<3; ++k)
-                    {
-                        //assert(vertexData.activeFaceListSize > 0);
-                        //assert(vertexData.cachePos0 >= lruCacheSize);
+            // start again from the unprocessed face with the lowest valence
+            uint32_t faceIndex = faceBuckets.FindLowest();
+            assert(faceIndex != FaceValenceBuckets::kNoFace);
 
-                        float vertexScore = vertexDataList[vertexRemap[face + k]].score;
-                        faceScore += vertexScore; 
-                    }
-
-                    bestScore = faceScore;
-                    bestFace = face;
-
-                    nextBestFace++;
-                    break; // we're searching a pre-sorted list, first one we find will be the best
-                }
+            uint32_t face = faceIndex * 3;
+            float faceScore = 0.f;
+            for (uint32_t k=0; k<3; ++k)
+            {
+                float vertexScore = vertexDataList[vertexRemap[face + k]].score;
+                faceScore += vertexScore;
             }
+
+            bestScore = faceScore;
+            bestFace = face;
             assert(bestScore >= 0.f);
         }
 
         processedFaceList[bestFace / 3] = 1;
+        faceBuckets.Remove(bestFace / 3);
         uint16_t entriesInCache1 = 0;
 
         // add bestFace to LRU cache and to newIndexList
@@ -386,28 +420,14 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
             --vertexData.activeFaceListSize;
             vertexData.score = FindVertexScore(vertexData.activeFaceListSize, vertexData.cachePos1, lruCacheSize);
 
-            // need to re-sort the faces that use this vertex, as their score will change due to activeFaceListSize shrinking
+            // move the faces that use this vertex to their lower valence bucket,
+            // skipping a degenerate bestFace that uses the vertex twice
             for (uint32_t *fi = begin; fi != end - 1; ++fi)
             {
                 unsigned int faceIndex = *fi / 3;
-
-                unsigned int n = faceReverseLookup[faceIndex];
-                assert(faceSorted[n] == faceIndex);
-
-                // found it, now move it up
-                while (n > 0)
+                if (processedFaceList[faceIndex] == 0)
                 {
-                    if (faceValenceSort(n, n - 1))
-                    {
-                        faceReverseLookup[faceSorted[n]] = n - 1;
-                        faceReverseLookup[faceSorted[n - 1]] = n;
-                        std::swap(faceSorted[n], faceSorted[n - 1]);
-                        n--;
-                    }
-                    else
-                    {
-                        break;
-                    }
+                    faceBuckets.DecrementValence(faceIndex);
                 }
             }
         }
@@ -458,6 +478,106 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
     delete [] vertexRemap;
     delete [] activeFaceList;
     delete [] processedFaceList;
-    delete [] faceSorted;
-    delete [] faceReverseLookup;
+}
+
+//-----------------------------------------------------------------------------
+//  ComputeVertexCacheStats
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+VertexCacheStats ComputeVertexCacheStats(const IndexType* indexList, uint32_t indexCount, uint16_t cacheSize)
+{
+    VertexCacheStats stats = {};
+    if (indexCount < 3)
+        return stats;
+
+    uint32_t maxIndex = 0;
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        maxIndex = std::max(maxIndex, (uint32_t)indexList[i]);
+    }
+
+    // a vertex is in the FIFO when it was transformed less than cacheSize
+    // misses ago; 0 marks vertices that were never transformed
+    std::vector<uint32_t> transformedAt(maxIndex + 1, 0);
+    uint32_t transformCount = 0;
+    uint32_t uniqueVertexCount = 0;
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        uint32_t& vertexTransformedAt = transformedAt[indexList[i]];
+        if (vertexTransformedAt == 0)
+            uniqueVertexCount++;
+        else if (transformCount - vertexTransformedAt < cacheSize)
+            continue;
+
+        vertexTransformedAt = ++transformCount;
+    }
+
+    stats.acmr = (float)transformCount / (indexCount / 3);
+    stats.atvr = (float)transformCount / uniqueVertexCount;
+    return stats;
+}
+
+//-----------------------------------------------------------------------------
+//  ComputeVertexFetchStats
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+VertexFetchStats ComputeVertexFetchStats(const IndexType* indexList, uint32_t indexCount, uint32_t vertexStride, uint16_t cacheSize)
+{
+    enum {kCacheLineSize = 64, kCacheSets = 64, kCacheWays = 4};
+
+    VertexFetchStats stats = {};
+    if (indexCount == 0 || vertexStride == 0)
+        return stats;
+
+    uint32_t maxIndex = 0;
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        maxIndex = std::max(maxIndex, (uint32_t)indexList[i]);
+    }
+
+    // the post-transform FIFO as in ComputeVertexCacheStats, only its misses
+    // fetch the vertex
+    std::vector<uint32_t> transformedAt(maxIndex + 1, 0);
+    uint32_t transformCount = 0;
+    uint32_t uniqueVertexCount = 0;
+
+    // set associative LRU cache of lines, each set ordered most recently
+    // used first with -1 marking empty ways
+    uint64_t cacheLines[kCacheSets][kCacheWays];
+    memset(cacheLines, 0xFF, sizeof(cacheLines));
+    uint64_t linesFetched = 0;
+
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        uint32_t& vertexTransformedAt = transformedAt[indexList[i]];
+        if (vertexTransformedAt == 0)
+            uniqueVertexCount++;
+        else if (transformCount - vertexTransformedAt < cacheSize)
+            continue;
+
+        vertexTransformedAt = ++transformCount;
+
+        uint64_t vertexBegin = (uint64_t)indexList[i] * vertexStride;
+        uint64_t firstLine = vertexBegin / kCacheLineSize;
+        uint64_t lastLine = (vertexBegin + vertexStride - 1) / kCacheLineSize;
+        for (uint64_t line = firstLine; line <= lastLine; line++)
+        {
+            uint64_t* ways = cacheLines[line % kCacheSets];
+            uint32_t way = 0;
+            while (way < kCacheWays - 1 && ways[way] != line)
+                way++;
+
+            if (ways[way] != line)
+                linesFetched++;
+
+            // move the line to the front, evicting the last way on a miss
+            for (; way > 0; way--)
+                ways[way] = ways[way - 1];
+            ways[0] = line;
+        }
+    }
+
+    stats.bytesFetched = linesFetched * kCacheLineSize;
+    stats.overfetch = (float)stats.bytesFetched / ((uint64_t)uniqueVertexCount * vertexStride);
+    return stats;
 }
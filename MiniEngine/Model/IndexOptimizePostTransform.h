@@ -32,3 +32,67 @@ void OptimizeFaces(const IndexType* indexList, uint32_t indexCount, IndexType* n
 
 template void OptimizeFaces<uint16_t>(const uint16_t* indexList, uint32_t indexCount, uint16_t* newIndexList, uint16_t lruCacheSize);
 template void OptimizeFaces<uint32_t>(const uint32_t* indexList, uint32_t indexCount, uint32_t* newIndexList, uint16_t lruCacheSize);
+
+//-----------------------------------------------------------------------------
+//  ComputeVertexCacheStats
+//-----------------------------------------------------------------------------
+//  Parameters:
+//      indexList
+//          input index list
+//      indexCount
+//          the number of indices in the list
+//      cacheSize
+//          the size of the simulated FIFO post-transform cache
+//  Returns:
+//      acmr
+//          average cache miss ratio, vertices transformed per triangle
+//          (0.5 is the best case, 3.0 the worst)
+//      atvr
+//          average transform to vertex ratio, vertices transformed per
+//          unique vertex (1.0 is the best case)
+//-----------------------------------------------------------------------------
+struct VertexCacheStats
+{
+    float acmr;
+    float atvr;
+};
+
+template <typename IndexType>
+VertexCacheStats ComputeVertexCacheStats(const IndexType* indexList, uint32_t indexCount, uint16_t cacheSize);
+
+template VertexCacheStats ComputeVertexCacheStats<uint16_t>(const uint16_t* indexList, uint32_t indexCount, uint16_t cacheSize);
+template VertexCacheStats ComputeVertexCacheStats<uint32_t>(const uint32_t* indexList, uint32_t indexCount, uint16_t cacheSize);
+
+//-----------------------------------------------------------------------------
+//  ComputeVertexFetchStats
+//-----------------------------------------------------------------------------
+//  Simulates fetching the vertices that miss a FIFO post-transform cache
+//  through a 16KB, 4 way set associative cache of 64 byte lines.
+//
+//  Parameters:
+//      indexList
+//          input index list
+//      indexCount
+//          the number of indices in the list
+//      vertexStride
+//          the size of a vertex in bytes
+//      cacheSize
+//          the size of the simulated FIFO post-transform cache
+//  Returns:
+//      bytesFetched
+//          the bytes of every cache line read from memory
+//      overfetch
+//          bytes fetched per byte of the vertices used (1.0 is the best
+//          case when vertices are aligned to cache lines)
+//-----------------------------------------------------------------------------
+struct VertexFetchStats
+{
+    uint64_t bytesFetched;
+    float overfetch;
+};
+
+template <typename IndexType>
+VertexFetchStats ComputeVertexFetchStats(const IndexType* indexList, uint32_t indexCount, uint32_t vertexStride, uint16_t cacheSize);
+
+template VertexFetchStats ComputeVertexFetchStats<uint16_t>(const uint16_t* indexList, uint32_t indexCount, uint32_t vertexStride, uint16_t cacheSize);
+template VertexFetchStats ComputeVertexFetchStats<uint32_t>(const uint32_t* indexList, uint32_t indexCount, uint32_t vertexStride, uint16_t cacheSize);
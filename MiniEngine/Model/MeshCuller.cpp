@@ -0,0 +1,111 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "MeshCuller.h"
+
+void MeshCuller::Initialize(const Model& model)
+{
+    m_MeshCount = model.m_Header.meshCount;
+    m_Batches.resize((m_MeshCount + 3) / 4);
+
+    for (uint32_t batchIndex = 0; batchIndex < m_Batches.size(); ++batchIndex)
+    {
+        // lanes past the last mesh get an empty box at the origin, and are
+        // masked off when culling
+        XMFLOAT4 center[3] = {}, extent[3] = {};
+        for (uint32_t lane = 0; lane < 4; ++lane)
+        {
+            uint32_t meshIndex = batchIndex * 4 + lane;
+            if (meshIndex >= m_MeshCount)
+                break;
+
+            const BoundingBox& box = model.m_pMesh[meshIndex].boundingBox;
+            XMFLOAT3 meshCenter, meshExtent;
+            XMStoreFloat3(&meshCenter, (box.min + box.max) * 0.5f);
+            XMStoreFloat3(&meshExtent, (box.max - box.min) * 0.5f);
+            (&center[0].x)[lane] = meshCenter.x;
+            (&center[1].x)[lane] = meshCenter.y;
+            (&center[2].x)[lane] = meshCenter.z;
+            (&extent[0].x)[lane] = meshExtent.x;
+            (&extent[1].x)[lane] = meshExtent.y;
+            (&extent[2].x)[lane] = meshExtent.z;
+        }
+
+        Batch& batch = m_Batches[batchIndex];
+        batch.centerX = XMLoadFloat4(&center[0]);
+        batch.centerY = XMLoadFloat4(&center[1]);
+        batch.centerZ = XMLoadFloat4(&center[2]);
+        batch.extentX = XMLoadFloat4(&extent[0]);
+        batch.extentY = XMLoadFloat4(&extent[1]);
+        batch.extentZ = XMLoadFloat4(&extent[2]);
+    }
+}
+
+void MeshCuller::Cull(const Matrix4& viewProjMat, std::vector<uint32_t>& visibleMeshes) const
+{
+    visibleMeshes.clear();
+
+    // The clip space planes -w <= x <= w, -w <= y <= w and 0 <= z <= w,
+    // taken from the rows of the view projection. Matrix4 keeps its
+    // columns in the XMMATRIX rows, so the transpose has the rows.
+    XMMATRIX rows = XMMatrixTranspose((XMMATRIX)viewProjMat);
+    XMVECTOR planes[6] =
+    {
+        XMVectorAdd(rows.r[3], rows.r[0]),
+        XMVectorSubtract(rows.r[3], rows.r[0]),
+        XMVectorAdd(rows.r[3], rows.r[1]),
+        XMVectorSubtract(rows.r[3], rows.r[1]),
+        rows.r[2],
+        XMVectorSubtract(rows.r[3], rows.r[2]),
+    };
+
+    // each plane's components splatted across the four lanes of a batch
+    XMVECTOR planeX[6], planeY[6], planeZ[6], planeW[6];
+    XMVECTOR absPlaneX[6], absPlaneY[6], absPlaneZ[6];
+    for (int i = 0; i < 6; ++i)
+    {
+        planeX[i] = XMVectorSplatX(planes[i]);
+        planeY[i] = XMVectorSplatY(planes[i]);
+        planeZ[i] = XMVectorSplatZ(planes[i]);
+        planeW[i] = XMVectorSplatW(planes[i]);
+        absPlaneX[i] = XMVectorAbs(planeX[i]);
+        absPlaneY[i] = XMVectorAbs(planeY[i]);
+        absPlaneZ[i] = XMVectorAbs(planeZ[i]);
+    }
+
+    for (uint32_t batchIndex = 0; batchIndex < m_Batches.size(); ++batchIndex)
+    {
+        const Batch& batch = m_Batches[batchIndex];
+
+        // a box is outside a plane when its center is further behind it
+        // than the box's projection onto the plane's normal
+        XMVECTOR visible = XMVectorTrueInt();
+        for (int i = 0; i < 6; ++i)
+        {
+            XMVECTOR distance = XMVectorMultiplyAdd(batch.centerX, planeX[i],
+                XMVectorMultiplyAdd(batch.centerY, planeY[i], XMVectorMultiplyAdd(batch.centerZ, planeZ[i], planeW[i])));
+            XMVECTOR radius = XMVectorMultiplyAdd(batch.extentX, absPlaneX[i],
+                XMVectorMultiplyAdd(batch.extentY, absPlaneY[i], XMVectorMultiply(batch.extentZ, absPlaneZ[i])));
+            visible = XMVectorAndInt(visible, XMVectorGreaterOrEqual(XMVectorAdd(distance, radius), XMVectorZero()));
+        }
+
+        uint32_t laneMask = (uint32_t)_mm_movemask_ps(visible);
+        uint32_t laneCount = m_MeshCount - batchIndex * 4;
+        if (laneCount < 4)
+            laneMask &= (1u << laneCount) - 1;
+
+        for (uint32_t lane = 0; laneMask != 0; ++lane, laneMask >>= 1)
+        {
+            if (laneMask & 1)
+                visibleMeshes.push_back(batchIndex * 4 + lane);
+        }
+    }
+}
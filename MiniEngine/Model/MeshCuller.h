@@ -0,0 +1,46 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#pragma once
+
+#include "Model.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//  MeshCuller
+//-----------------------------------------------------------------------------
+//  Tests the bounding boxes of a model's meshes against the frustum of a
+//  view, four meshes at a time. The boxes are stored as centers and extents
+//  in structure of arrays form, and tested against the planes of the view's
+//  clip space, so any view projection matrix works. Cull only reads the
+//  culler, so several views can be culled at once from different threads.
+//-----------------------------------------------------------------------------
+class MeshCuller
+{
+public:
+	void Initialize(const Model& model);
+
+	// Fills visibleMeshes with the indices of the meshes whose bounding
+	// boxes intersect the view, in mesh order
+	void Cull(const Matrix4& viewProjMat, std::vector<uint32_t>& visibleMeshes) const;
+
+	uint32_t GetMeshCount() const { return m_MeshCount; }
+
+private:
+	struct Batch
+	{
+		XMVECTOR centerX, centerY, centerZ;
+		XMVECTOR extentX, extentY, extentZ;
+	};
+
+	std::vector<Batch> m_Batches;
+	uint32_t m_MeshCount = 0;
+};
@@ -0,0 +1,343 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <vector>
+
+#include "MeshSimplify.h"
+
+namespace
+{
+    // a triangle whose normal turns further than this cosine is a flip
+    const float kMaxFlipCos = 0.25f;
+
+    // each pass collapses edges up to this many times the error of the
+    // cheapest collapse that would reach the target on its own, since many
+    // of the cheaper ones get skipped for touching an earlier one
+    const float kPassErrorScale = 1.5f;
+
+    struct Float3
+    {
+        float x, y, z;
+    };
+
+    inline Float3 LoadPosition(const unsigned char* positions, uint32_t positionStride, uint32_t index)
+    {
+        Float3 p;
+        memcpy(&p, positions + (size_t)index * positionStride, sizeof(p));
+        return p;
+    }
+
+    inline Float3 Sub(const Float3& a, const Float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline float Length(const Float3& a) { return sqrtf(Dot(a, a)); }
+    inline Float3 Cross(const Float3& a, const Float3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    // Sum of the squared distances to a set of planes, weighted by the area
+    // of the triangles they came from
+    struct Quadric
+    {
+        double a00, a11, a22, a01, a02, a12;
+        double b0, b1, b2;
+        double c;
+        double weight;
+    };
+
+    void AddTriangle(Quadric& q, const Float3& p0, const Float3& p1, const Float3& p2)
+    {
+        Float3 normal = Cross(Sub(p1, p0), Sub(p2, p0));
+        float length = Length(normal);
+        if (length == 0.0f)
+            return;
+
+        double area = 0.5 * length;
+        double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+        double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+        q.a00 += area * nx * nx; q.a11 += area * ny * ny; q.a22 += area * nz * nz;
+        q.a01 += area * nx * ny; q.a02 += area * nx * nz; q.a12 += area * ny * nz;
+        q.b0 += area * nx * d; q.b1 += area * ny * d; q.b2 += area * nz * d;
+        q.c += area * d * d;
+        q.weight += area;
+    }
+
+    void Add(Quadric& q, const Quadric& other)
+    {
+        q.a00 += other.a00; q.a11 += other.a11; q.a22 += other.a22;
+        q.a01 += other.a01; q.a02 += other.a02; q.a12 += other.a12;
+        q.b0 += other.b0; q.b1 += other.b1; q.b2 += other.b2;
+        q.c += other.c;
+        q.weight += other.weight;
+    }
+
+    // the mean squared distance of p to the planes
+    float Evaluate(const Quadric& q, const Float3& p)
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double r = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+            + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+            + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+        return q.weight > 0.0 ? (float)(fabs(r) / q.weight) : 0.0f;
+    }
+
+    struct Collapse
+    {
+        uint32_t source;
+        uint32_t target;
+        float error;
+    };
+
+    // Finds the vertices that may be moved, and the ones that may be moved
+    // onto. Vertices sharing a position are seams, which are left alone, and
+    // so are the ends of any edge not shared by exactly two triangles
+    // facing the same way.
+    void ClassifyVertices(const uint32_t* indices, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+        uint32_t vertexCount, std::vector<bool>& movable, std::vector<bool>& target)
+    {
+        std::vector<uint32_t> order(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++)
+            order[v] = v;
+        auto positionOf = [&](uint32_t v) { return positions + (size_t)v * positionStride; };
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+        {
+            int compare = memcmp(positionOf(a), positionOf(b), sizeof(Float3));
+            return compare < 0 || (compare == 0 && a < b);
+        });
+
+        // each vertex's wedge is the first vertex with its position
+        std::vector<uint32_t> wedge(vertexCount);
+        std::vector<bool> seam(vertexCount, false);
+        for (uint32_t n = 0; n < vertexCount; )
+        {
+            uint32_t end = n + 1;
+            while (end < vertexCount && 0 == memcmp(positionOf(order[n]), positionOf(order[end]), sizeof(Float3)))
+                end++;
+            for (uint32_t k = n; k < end; k++)
+            {
+                wedge[order[k]] = order[n];
+                seam[order[k]] = end - n > 1;
+            }
+            n = end;
+        }
+
+        std::vector<uint64_t> edges;
+        edges.reserve(indexCount);
+        for (uint32_t n = 0; n < indexCount; n += 3)
+        {
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                uint32_t a = wedge[indices[n + k]], b = wedge[indices[n + (k + 1) % 3]];
+                edges.push_back((uint64_t)a << 32 | b);
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        auto countEdges = [&](uint64_t edge)
+        {
+            auto range = std::equal_range(edges.begin(), edges.end(), edge);
+            return range.second - range.first;
+        };
+
+        std::vector<bool> borderWedge(vertexCount, false);
+        for (size_t n = 0; n < edges.size(); n++)
+        {
+            if (n > 0 && edges[n] == edges[n - 1])
+                continue;
+            uint32_t a = (uint32_t)(edges[n] >> 32), b = (uint32_t)edges[n];
+            if (countEdges(edges[n]) != 1 || countEdges((uint64_t)b << 32 | a) != 1)
+                borderWedge[a] = borderWedge[b] = true;
+        }
+
+        movable.assign(vertexCount, false);
+        target.assign(vertexCount, false);
+        for (uint32_t v = 0; v < vertexCount; v++)
+        {
+            target[v] = !seam[v];
+            movable[v] = !seam[v] && !borderWedge[wedge[v]];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//  SimplifyMesh
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+uint32_t SimplifyMesh(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    uint32_t vertexCount, uint32_t targetIndexCount, float maxError, IndexType* newIndexList, float& resultError)
+{
+    resultError = 0.0f;
+    indexCount -= indexCount % 3;
+    std::vector<uint32_t> indices(indexList, indexList + indexCount);
+
+    std::vector<bool> movable, target;
+    ClassifyVertices(indices.data(), indexCount, positions, positionStride, vertexCount, movable, target);
+
+    std::vector<Float3> vertexPositions(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++)
+        vertexPositions[v] = LoadPosition(positions, positionStride, v);
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric());
+    for (uint32_t n = 0; n < indexCount; n += 3)
+    {
+        Quadric q = {};
+        AddTriangle(q, vertexPositions[indices[n]], vertexPositions[indices[n + 1]], vertexPositions[indices[n + 2]]);
+        for (uint32_t k = 0; k < 3; k++)
+            Add(quadrics[indices[n + k]], q);
+    }
+
+    const float maxErrorSquared = maxError * maxError;
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<bool> locked(vertexCount);
+
+    // Each pass collapses a batch of the cheapest edges, skipping any that
+    // touch a vertex an earlier collapse of the pass changed, then drops
+    // the triangles that collapsed
+    while (indexCount > targetIndexCount)
+    {
+        // the triangles around each vertex
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (uint32_t n = 0; n < indexCount; n++)
+            adjacencyOffsets[indices[n] + 1]++;
+        for (uint32_t v = 0; v < vertexCount; v++)
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        adjacency.resize(indexCount);
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (uint32_t n = 0; n < indexCount; n++)
+                adjacency[fill[indices[n]]++] = n / 3;
+        }
+
+        // Every edge shows up once with its lower index first, except
+        // border edges whose ends are never moved. Each edge collapses in
+        // whichever direction costs less.
+        collapses.clear();
+        for (uint32_t n = 0; n < indexCount; n += 3)
+        {
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                uint32_t a = indices[n + k], b = indices[n + (k + 1) % 3];
+                if (a >= b)
+                    continue;
+
+                Collapse collapse = { 0, 0, FLT_MAX };
+                if (movable[a] && target[b])
+                {
+                    Quadric q = quadrics[a];
+                    Add(q, quadrics[b]);
+                    collapse = { a, b, Evaluate(q, vertexPositions[b]) };
+                }
+                if (movable[b] && target[a])
+                {
+                    Quadric q = quadrics[b];
+                    Add(q, quadrics[a]);
+                    float error = Evaluate(q, vertexPositions[a]);
+                    if (error < collapse.error)
+                        collapse = { b, a, error };
+                }
+                if (collapse.error <= maxErrorSquared)
+                    collapses.push_back(collapse);
+            }
+        }
+        if (collapses.empty())
+            break;
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        // every collapse removes about two triangles
+        uint32_t trianglesToRemove = (indexCount - targetIndexCount + 2) / 3;
+        size_t collapseGoal = std::max<size_t>(trianglesToRemove / 2, 1);
+        float errorGoal = collapseGoal < collapses.size() ? collapses[collapseGoal].error * kPassErrorScale : FLT_MAX;
+
+        std::fill(locked.begin(), locked.end(), false);
+        uint32_t trianglesRemoved = 0;
+        uint32_t collapseCount = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapse.error > errorGoal || trianglesRemoved >= trianglesToRemove)
+                break;
+            if (locked[collapse.source] || locked[collapse.target])
+                continue;
+
+            // reject collapses that would turn a triangle over
+            const Float3& to = vertexPositions[collapse.target];
+            bool flips = false;
+            uint32_t collapsedTriangles = 0;
+            for (uint32_t a = adjacencyOffsets[collapse.source]; a < adjacencyOffsets[collapse.source + 1] && !flips; a++)
+            {
+                const uint32_t* triangle = indices.data() + adjacency[a] * 3;
+                if (triangle[0] == collapse.target || triangle[1] == collapse.target || triangle[2] == collapse.target)
+                {
+                    collapsedTriangles++;
+                    continue;
+                }
+
+                Float3 p[3], moved[3];
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    p[k] = vertexPositions[triangle[k]];
+                    moved[k] = triangle[k] == collapse.source ? to : p[k];
+                }
+                Float3 before = Cross(Sub(p[1], p[0]), Sub(p[2], p[0]));
+                Float3 after = Cross(Sub(moved[1], moved[0]), Sub(moved[2], moved[0]));
+                float beforeLength = Length(before);
+                if (beforeLength > 0.0f && Dot(before, after) <= kMaxFlipCos * beforeLength * Length(after))
+                    flips = true;
+            }
+            if (flips)
+                continue;
+
+            for (uint32_t a = adjacencyOffsets[collapse.source]; a < adjacencyOffsets[collapse.source + 1]; a++)
+            {
+                uint32_t* triangle = indices.data() + adjacency[a] * 3;
+                for (uint32_t k = 0; k < 3; k++)
+                {
+                    if (triangle[k] == collapse.source)
+                        triangle[k] = collapse.target;
+                }
+            }
+            Add(quadrics[collapse.target], quadrics[collapse.source]);
+            locked[collapse.source] = locked[collapse.target] = true;
+
+            resultError = std::max(resultError, collapse.error);
+            trianglesRemoved += collapsedTriangles;
+            collapseCount++;
+        }
+        if (collapseCount == 0)
+            break;
+
+        // drop the triangles that collapsed to a line
+        uint32_t keptCount = 0;
+        for (uint32_t n = 0; n < indexCount; n += 3)
+        {
+            uint32_t a = indices[n], b = indices[n + 1], c = indices[n + 2];
+            if (a == b || b == c || c == a)
+                continue;
+            indices[keptCount++] = a;
+            indices[keptCount++] = b;
+            indices[keptCount++] = c;
+        }
+        indexCount = keptCount;
+    }
+
+    for (uint32_t n = 0; n < indexCount; n++)
+        newIndexList[n] = (IndexType)indices[n];
+
+    resultError = sqrtf(resultError);
+    return indexCount;
+}
@@ -0,0 +1,57 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#pragma once
+
+//-----------------------------------------------------------------------------
+//  SimplifyMesh
+//-----------------------------------------------------------------------------
+//  Reduces the triangles of an index list by collapsing edges onto one of
+//  their vertices, cheapest first by Garland and Heckbert's quadric error
+//  metric. Collapses only rewrite indices, so the result draws from the same
+//  vertices as the input. Vertices that share their position with another
+//  vertex sit on an attribute seam, and are never moved or collapsed onto,
+//  and neither are vertices on an open or non-manifold edge, which keeps
+//  seams and borders where they are.
+//
+//  Parameters:
+//      indexList
+//          input index list
+//      indexCount
+//          the number of indices in the list
+//      positions
+//          the float3 position of the first vertex
+//      positionStride
+//          the number of bytes from one vertex's position to the next
+//      vertexCount
+//          the number of vertices the indices refer to
+//      targetIndexCount
+//          the number of indices to stop at
+//      maxError
+//          the largest distance in model units a collapse may move the
+//          surface by, which may stop the simplifier before it reaches
+//          targetIndexCount
+//      newIndexList
+//          a pointer to a preallocated buffer the same size as indexList to
+//          hold the simplified index list
+//      resultError
+//          receives the largest distance the surface moved by
+//  Returns:
+//      the number of indices in the simplified index list
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+uint32_t SimplifyMesh(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    uint32_t vertexCount, uint32_t targetIndexCount, float maxError, IndexType* newIndexList, float& resultError);
+
+template uint32_t SimplifyMesh<uint16_t>(const uint16_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    uint32_t vertexCount, uint32_t targetIndexCount, float maxError, uint16_t* newIndexList, float& resultError);
+template uint32_t SimplifyMesh<uint32_t>(const uint32_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    uint32_t vertexCount, uint32_t targetIndexCount, float maxError, uint32_t* newIndexList, float& resultError);
@@ -0,0 +1,224 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "MeshletBuild.h"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+namespace
+{
+    // below this, the triangles face too many ways for the cone to cull
+    // anything worth the test
+    const float kMinConeDot = 0.1f;
+
+    const uint8_t kNotInMeshlet = 0xff;
+
+    struct Float3
+    {
+        float x, y, z;
+    };
+
+    inline Float3 LoadPosition(const unsigned char* positions, uint32_t positionStride, uint32_t index)
+    {
+        Float3 p;
+        memcpy(&p, positions + (size_t)index * positionStride, sizeof(p));
+        return p;
+    }
+
+    inline Float3 Sub(const Float3& a, const Float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Float3 Add(const Float3& a, const Float3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Float3 Scale(const Float3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    inline float Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline float Length(const Float3& a) { return sqrtf(Dot(a, a)); }
+    inline Float3 Cross(const Float3& a, const Float3& b)
+    {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    uint32_t FarthestFrom(const Float3& from, const Float3* points, uint32_t pointCount)
+    {
+        uint32_t farthest = 0;
+        float farthestDistance = -1.0f;
+        for (uint32_t n = 0; n < pointCount; n++)
+        {
+            float distance = Dot(Sub(points[n], from), Sub(points[n], from));
+            if (distance > farthestDistance)
+            {
+                farthest = n;
+                farthestDistance = distance;
+            }
+        }
+        return farthest;
+    }
+
+    // Ritter's bounding sphere: start from two points far apart, then grow
+    // the sphere to take in any point outside it
+    void ComputeBoundingSphere(const Float3* points, uint32_t pointCount, Float3& center, float& radius)
+    {
+        uint32_t a = FarthestFrom(points[0], points, pointCount);
+        uint32_t b = FarthestFrom(points[a], points, pointCount);
+        center = Scale(Add(points[a], points[b]), 0.5f);
+        radius = Length(Sub(points[b], points[a])) * 0.5f;
+
+        for (uint32_t n = 0; n < pointCount; n++)
+        {
+            Float3 offset = Sub(points[n], center);
+            float distance = Length(offset);
+            if (distance > radius)
+            {
+                float newRadius = (radius + distance) * 0.5f;
+                center = Add(center, Scale(offset, (newRadius - radius) / distance));
+                radius = newRadius;
+            }
+        }
+    }
+
+    void ComputeMeshletBounds(Meshlet& meshlet, const uint32_t* vertices, const uint32_t* primitives,
+        const unsigned char* positions, uint32_t positionStride)
+    {
+        Float3 points[meshletMaxVertices];
+        for (uint32_t v = 0; v < meshlet.vertexCount; v++)
+        {
+            points[v] = LoadPosition(positions, positionStride, vertices[v]);
+        }
+
+        Float3 center;
+        ComputeBoundingSphere(points, meshlet.vertexCount, center, meshlet.radius);
+        meshlet.center = XMFLOAT3(center.x, center.y, center.z);
+
+        // the cone's axis is the average of the triangles' normals, and it
+        // is as wide as the normal farthest from it
+        Float3 normals[meshletMaxTriangles];
+        Float3 corners[meshletMaxTriangles];
+        uint32_t normalCount = 0;
+        Float3 axis = { 0.0f, 0.0f, 0.0f };
+        for (uint32_t t = 0; t < meshlet.triangleCount; t++)
+        {
+            uint32_t i0, i1, i2;
+            UnpackMeshletTriangle(primitives[t], i0, i1, i2);
+            Float3 normal = Cross(Sub(points[i1], points[i0]), Sub(points[i2], points[i0]));
+            float length = Length(normal);
+            if (length == 0.0f)
+                continue; // degenerate triangles face no way at all
+
+            normals[normalCount] = Scale(normal, 1.0f / length);
+            corners[normalCount] = points[i0];
+            axis = Add(axis, normals[normalCount]);
+            normalCount++;
+        }
+
+        float axisLength = Length(axis);
+        float minDot = 1.0f;
+        if (axisLength > 0.0f)
+        {
+            axis = Scale(axis, 1.0f / axisLength);
+            for (uint32_t n = 0; n < normalCount; n++)
+            {
+                minDot = std::min(minDot, Dot(axis, normals[n]));
+            }
+        }
+
+        if (normalCount == 0 || axisLength == 0.0f || minDot < kMinConeDot)
+        {
+            meshlet.coneApex = meshlet.center;
+            meshlet.coneAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+            meshlet.coneCutoff = 1.0f;
+            return;
+        }
+
+        // Move the apex back along the axis until it is behind every
+        // triangle's plane, so any viewer inside the cone sees the backs of
+        // all of them
+        float maxT = 0.0f;
+        for (uint32_t n = 0; n < normalCount; n++)
+        {
+            float t = Dot(Sub(center, corners[n]), normals[n]) / Dot(axis, normals[n]);
+            maxT = std::max(maxT, t);
+        }
+
+        Float3 apex = Sub(center, Scale(axis, maxT));
+        meshlet.coneApex = XMFLOAT3(apex.x, apex.y, apex.z);
+        meshlet.coneAxis = XMFLOAT3(axis.x, axis.y, axis.z);
+        meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//  BuildMeshlets
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+void BuildMeshlets(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint32_t>& meshletPrimitives)
+{
+    uint32_t vertexCount = 0;
+    for (uint32_t n = 0; n < indexCount; n++)
+    {
+        vertexCount = std::max(vertexCount, (uint32_t)indexList[n] + 1);
+    }
+
+    // each vertex's index within the current meshlet
+    std::vector<uint8_t> localIndex(vertexCount, kNotInMeshlet);
+
+    Meshlet meshlet = {};
+    meshlet.vertexOffset = (uint32_t)meshletVertices.size();
+    meshlet.primitiveOffset = (uint32_t)meshletPrimitives.size();
+
+    auto finishMeshlet = [&](uint32_t nextIndex)
+    {
+        if (meshlet.triangleCount == 0)
+            return;
+
+        const uint32_t *vertices = meshletVertices.data() + meshlet.vertexOffset;
+        ComputeMeshletBounds(meshlet, vertices, meshletPrimitives.data() + meshlet.primitiveOffset, positions, positionStride);
+        for (uint32_t v = 0; v < meshlet.vertexCount; v++)
+        {
+            localIndex[vertices[v]] = kNotInMeshlet;
+        }
+        meshlets.push_back(meshlet);
+
+        meshlet = Meshlet();
+        meshlet.firstIndex = nextIndex;
+        meshlet.vertexOffset = (uint32_t)meshletVertices.size();
+        meshlet.primitiveOffset = (uint32_t)meshletPrimitives.size();
+    };
+
+    for (uint32_t n = 0; n + 3 <= indexCount; n += 3)
+    {
+        const IndexType *triangle = indexList + n;
+        uint32_t newVertexCount = 0;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+            if (!repeated && localIndex[triangle[k]] == kNotInMeshlet)
+                newVertexCount++;
+        }
+
+        if (meshlet.vertexCount + newVertexCount > meshletMaxVertices || meshlet.triangleCount + 1 > meshletMaxTriangles)
+            finishMeshlet(n);
+
+        uint32_t local[3];
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            uint8_t &index = localIndex[triangle[k]];
+            if (index == kNotInMeshlet)
+            {
+                index = (uint8_t)meshlet.vertexCount++;
+                meshletVertices.push_back(triangle[k]);
+            }
+            local[k] = index;
+        }
+        meshletPrimitives.push_back(PackMeshletTriangle(local[0], local[1], local[2]));
+        meshlet.triangleCount++;
+    }
+
+    finishMeshlet(indexCount);
+}
@@ -0,0 +1,65 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#pragma once
+
+#include "Model.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+//  BuildMeshlets
+//-----------------------------------------------------------------------------
+//  Splits an index list into meshlets of consecutive triangles, starting a
+//  new meshlet whenever the next triangle would take the current one past
+//  meshletMaxVertices or meshletMaxTriangles. Run on a list optimized with
+//  OptimizeFaces, neighboring triangles share vertices and the meshlets come
+//  out close to full. Each meshlet gets a bounding sphere and a backface
+//  cone, see Meshlet.
+//
+//  Parameters:
+//      indexList
+//          input index list
+//      indexCount
+//          the number of indices in the list
+//      positions
+//          the float3 position of the first vertex
+//      positionStride
+//          the number of bytes from one vertex's position to the next
+//      meshlets, meshletVertices, meshletPrimitives
+//          the meshlets, their vertices and their packed triangles are
+//          appended to these, with offsets into the vectors as passed
+//-----------------------------------------------------------------------------
+template <typename IndexType>
+void BuildMeshlets(const IndexType* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint32_t>& meshletPrimitives);
+
+template void BuildMeshlets<uint16_t>(const uint16_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint32_t>& meshletPrimitives);
+template void BuildMeshlets<uint32_t>(const uint32_t* indexList, uint32_t indexCount, const unsigned char* positions, uint32_t positionStride,
+    std::vector<Meshlet>& meshlets, std::vector<uint32_t>& meshletVertices, std::vector<uint32_t>& meshletPrimitives);
+
+//-----------------------------------------------------------------------------
+//  PackMeshletTriangle, UnpackMeshletTriangle
+//-----------------------------------------------------------------------------
+//  A meshlet primitive holds its triangle's three meshlet vertex indices in
+//  10 bits each, the low bits holding the first.
+//-----------------------------------------------------------------------------
+inline uint32_t PackMeshletTriangle(uint32_t i0, uint32_t i1, uint32_t i2)
+{
+    return (i0 & 0x3ff) | ((i1 & 0x3ff) << 10) | ((i2 & 0x3ff) << 20);
+}
+
+inline void UnpackMeshletTriangle(uint32_t primitive, uint32_t& i0, uint32_t& i1, uint32_t& i2)
+{
+    i0 = primitive & 0x3ff;
+    i1 = (primitive >> 10) & 0x3ff;
+    i2 = (primitive >> 20) & 0x3ff;
+}
@@ -60,6 +60,13 @@ void Model::Clear()
     m_Header.vertexDataByteSizeDepth = 0;
     m_pIndexDataDepth = nullptr;
 
+    m_MeshletRanges.clear();
+    m_Meshlets.clear();
+    m_MeshletVertices.clear();
+    m_MeshletPrimitives.clear();
+    m_LodRanges.clear();
+    m_Lods.clear();
+
     m_Header.boundingBox.min = Vector3(0.0f);
     m_Header.boundingBox.max = Vector3(0.0f);
 }
@@ -177,3 +184,39 @@ void Model::ComputeAllBoundingBoxes()
     }
     ComputeGlobalBoundingBox(m_Header.boundingBox);
 }
+
+uint32_t Model::GetLodCount(uint32_t meshIndex) const
+{
+    return 1 + (meshIndex < m_LodRanges.size() ? m_LodRanges[meshIndex].count : 0);
+}
+
+uint32_t Model::SelectLod(uint32_t meshIndex, float distance, float projectionScale, float maxPixelError) const
+{
+    // the levels' errors only grow, so take the last that is still fine
+    uint32_t lodCount = GetLodCount(meshIndex);
+    uint32_t lod = 0;
+    while (lod + 1 < lodCount)
+    {
+        float error = m_Lods[m_LodRanges[meshIndex].offset + lod].error;
+        if (error * projectionScale > maxPixelError * distance)
+            break;
+        lod++;
+    }
+    return lod;
+}
+
+void Model::GetLodIndices(uint32_t meshIndex, uint32_t lod, bool depth, uint32_t& indexDataByteOffset, uint32_t& indexCount) const
+{
+    ASSERT(lod < GetLodCount(meshIndex));
+    const Mesh& mesh = m_pMesh[meshIndex];
+    if (lod == 0)
+    {
+        indexDataByteOffset = mesh.indexDataByteOffset;
+        indexCount = mesh.indexCount;
+        return;
+    }
+
+    const MeshLod& meshLod = m_Lods[m_LodRanges[meshIndex].offset + lod - 1];
+    indexDataByteOffset = meshLod.indexDataByteOffset;
+    indexCount = depth ? meshLod.indexCountDepth : meshLod.indexCount;
+}
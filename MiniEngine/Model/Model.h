@@ -17,6 +17,7 @@
 #include "VectorMath.h"
 #include "TextureManager.h"
 #include "GpuBuffer.h"
+#include <vector>
 
 using namespace Math;
 
@@ -88,10 +89,24 @@ enum
 	attrib_format_ushort,
 	attrib_format_short,
 	attrib_format_float,
+	attrib_format_half,
 
 	attrib_formats
 };
 
+enum
+{
+	index_format_uint16 = 0,
+	index_format_uint32,
+
+	index_formats
+};
+
+inline unsigned int IndexFormatSize(unsigned int format)
+{
+	return format == index_format_uint32 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
 struct VertexAttrib
 {
 	uint16_t offset; // byte offset from the start of the vertex
@@ -126,6 +141,52 @@ struct Mesh
 
 	unsigned int vertexDataByteOffsetDepth;
 	unsigned int vertexCountDepth;
+
+	// 32-bit index data starts 4 byte aligned. This sits in what used to be
+	// the struct's tail padding, which the converter always zeroed, so
+	// older H3D files read as 16-bit.
+	unsigned int indexFormat;
+};
+
+// A cluster of at most 64 vertices and 124 triangles of a mesh, small
+// enough to cull on its own. Its triangles are a contiguous range of the
+// mesh's index list, and are also listed by their local vertices for mesh
+// shaders.
+struct Meshlet
+{
+	XMFLOAT3 center; // bounding sphere of the triangles
+	float radius;
+
+	// Every triangle faces away from a viewer at p when
+	// dot(normalize(coneApex - p), coneAxis) >= coneCutoff. A cutoff of 1 or
+	// more means the triangles face too many ways to cull them together.
+	XMFLOAT3 coneApex;
+	float coneCutoff;
+	XMFLOAT3 coneAxis;
+
+	uint32_t firstIndex; // of the first triangle, in the mesh's index list
+	uint32_t vertexOffset; // into Model::m_MeshletVertices
+	uint32_t primitiveOffset; // into Model::m_MeshletPrimitives
+	uint16_t vertexCount;
+	uint16_t triangleCount;
+	uint32_t reserved;
+};
+
+enum
+{
+	meshletMaxVertices = 64,
+	meshletMaxTriangles = 124
+};
+
+// A simplified copy of a mesh's triangles, drawn from the mesh's own
+// vertices. The full and depth-only indices of a level share the byte offset
+// into their index data, as the mesh's own indices do.
+struct MeshLod
+{
+	unsigned int indexDataByteOffset;
+	unsigned int indexCount;
+	unsigned int indexCountDepth;
+	float error; // largest distance from the mesh's surface, in model units
 };
 
 struct Material
@@ -163,6 +224,21 @@ public:
 
 	void ComputeAllBoundingBoxes();
 	const BoundingBox& GetBoundingBox() const { return m_Header.boundingBox; }
+
+	// Levels of detail of each mesh, 0 being the mesh itself. Coarser levels
+	// come from m_Lods, and there are none unless the model was built with
+	// them.
+	uint32_t GetLodCount(uint32_t meshIndex) const;
+
+	// Picks the coarsest level of the mesh whose error, projected onto the
+	// screen, stays within maxPixelError. projectionScale is the viewport
+	// height over 2 * tan(fovY / 2), the pixels a unit at distance 1 covers,
+	// and distance is from the camera to the nearest point of the mesh.
+	uint32_t SelectLod(uint32_t meshIndex, float distance, float projectionScale, float maxPixelError) const;
+
+	// The byte offset into the full or depth-only index data and the index
+	// count of a level of the mesh
+	void GetLodIndices(uint32_t meshIndex, uint32_t lod, bool depth, uint32_t& indexDataByteOffset, uint32_t& indexCount) const;
 	
 	D3D12_CPU_DESCRIPTOR_HANDLE* GetSRVs(uint32_t materialIdx) const { return m_SRVs + materialIdx * 6; }
 
@@ -195,6 +271,30 @@ public:
 
 	D3D12_CPU_DESCRIPTOR_HANDLE* m_SRVs;
 
+	// Meshlets of every mesh, empty unless the model was built with them.
+	// Mesh n's meshlets are m_Meshlets[m_MeshletRanges[n].offset] onwards.
+	// Meshlet vertices are indices relative to the mesh's first vertex, and
+	// primitives pack a triangle's three local vertex indices 10 bits each.
+	struct MeshletRange
+	{
+		uint32_t offset;
+		uint32_t count;
+	};
+	std::vector<MeshletRange> m_MeshletRanges;
+	std::vector<Meshlet> m_Meshlets;
+	std::vector<uint32_t> m_MeshletVertices;
+	std::vector<uint32_t> m_MeshletPrimitives;
+
+	// Mesh n's coarser levels of detail are m_Lods[m_LodRanges[n].offset]
+	// onwards, finest first
+	struct LodRange
+	{
+		uint32_t offset;
+		uint32_t count;
+	};
+	std::vector<LodRange> m_LodRanges;
+	std::vector<MeshLod> m_Lods;
+
 protected:
 	void ComputeMeshBoundingBox(unsigned int meshIndex, BoundingBox &bbox) const;
 	void ComputeGlobalBoundingBox(BoundingBox &bbox) const;
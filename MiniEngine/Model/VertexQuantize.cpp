@@ -0,0 +1,235 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#include "VertexQuantize.h"
+#include <DirectXPackedVector.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace DirectX::PackedVector;
+
+namespace
+{
+    uint32_t AttribFormatSize(uint32_t format)
+    {
+        switch (format)
+        {
+        case attrib_format_ubyte:
+        case attrib_format_byte:
+            return 1;
+        case attrib_format_ushort:
+        case attrib_format_short:
+        case attrib_format_half:
+            return 2;
+        case attrib_format_float:
+            return 4;
+        }
+        return 0;
+    }
+
+    bool IsFloat3(const VertexAttrib* attribs, uint32_t attribsEnabled, int attrib)
+    {
+        return (attribsEnabled & (1 << attrib)) != 0
+            && attribs[attrib].format == attrib_format_float && attribs[attrib].components >= 3;
+    }
+
+    XMVECTOR LoadFloat3(const unsigned char* vertex, const VertexAttrib& attrib)
+    {
+        XMFLOAT3 value;
+        memcpy(&value, vertex + attrib.offset, sizeof(value));
+        return XMLoadFloat3(&value);
+    }
+
+    XMVECTOR LoadFloat2(const unsigned char* vertex, const VertexAttrib& attrib)
+    {
+        XMFLOAT2 value;
+        memcpy(&value, vertex + attrib.offset, sizeof(value));
+        return XMLoadFloat2(&value);
+    }
+
+    // 1 or -1 for each component, positive zero counting as positive
+    XMVECTOR SignNotZero(FXMVECTOR v)
+    {
+        return XMVectorSelect(XMVectorNegate(g_XMOne), g_XMOne, XMVectorGreaterOrEqual(v, XMVectorZero()));
+    }
+
+    float AngleBetweenDegrees(FXMVECTOR original, FXMVECTOR decoded)
+    {
+        XMVECTOR length = XMVector3Length(original);
+        if (!(XMVectorGetX(length) > 0.0f))
+            return 0.0f; // a degenerate direction has no angle to keep
+        return XMConvertToDegrees(XMVectorGetX(XMVector3AngleBetweenNormals(XMVectorDivide(original, length), decoded)));
+    }
+}
+
+XMVECTOR EncodeOctahedral(FXMVECTOR direction)
+{
+    // project onto the octahedron |x| + |y| + |z| = 1, then fold the lower
+    // half over the diagonals of the upper half
+    XMVECTOR l1 = XMVector3Dot(XMVectorAbs(direction), g_XMOne);
+    XMVECTOR p = XMVectorSelect(XMVectorDivide(direction, l1), XMVectorZero(), XMVectorEqual(l1, XMVectorZero()));
+
+    XMVECTOR folded = XMVectorMultiply(XMVectorSubtract(g_XMOne, XMVectorAbs(XMVectorSwizzle<1, 0, 2, 3>(p))), SignNotZero(p));
+    XMVECTOR lowerHalf = XMVectorLess(XMVectorSplatZ(p), XMVectorZero());
+    return XMVectorSelect(p, folded, lowerHalf);
+}
+
+XMVECTOR DecodeOctahedral(FXMVECTOR encoded)
+{
+    XMVECTOR z = XMVectorSubtract(XMVectorSubtract(g_XMOne, XMVectorAbs(XMVectorSplatX(encoded))), XMVectorAbs(XMVectorSplatY(encoded)));
+
+    XMVECTOR folded = XMVectorMultiply(XMVectorSubtract(g_XMOne, XMVectorAbs(XMVectorSwizzle<1, 0, 2, 3>(encoded))), SignNotZero(encoded));
+    XMVECTOR xy = XMVectorSelect(encoded, folded, XMVectorLess(z, XMVectorZero()));
+    return XMVector3Normalize(XMVectorSelect(xy, z, XMVectorSelectControl(0, 0, 1, 1)));
+}
+
+//-----------------------------------------------------------------------------
+//  GetQuantizedLayout
+//-----------------------------------------------------------------------------
+uint32_t GetQuantizedLayout(const VertexAttrib* srcAttribs, uint32_t srcAttribsEnabled,
+    VertexAttrib* dstAttribs, uint32_t& dstAttribsEnabled)
+{
+    memset(dstAttribs, 0, sizeof(VertexAttrib) * maxAttribs);
+    dstAttribsEnabled = 0;
+    uint32_t stride = 0;
+
+    bool handled[maxAttribs] = {};
+    auto addAttrib = [&](int attrib, uint16_t offset, uint16_t normalized, uint16_t components, uint16_t format)
+    {
+        dstAttribs[attrib].offset = offset;
+        dstAttribs[attrib].normalized = normalized;
+        dstAttribs[attrib].components = components;
+        dstAttribs[attrib].format = format;
+        dstAttribsEnabled |= 1 << attrib;
+        handled[attrib] = true;
+    };
+
+    if (IsFloat3(srcAttribs, srcAttribsEnabled, attrib_position))
+    {
+        addAttrib(attrib_position, 0, 1, 3, attrib_format_ushort);
+
+        // the bitangent only needs its handedness when the normal and
+        // tangent are there to rebuild it from
+        if (IsFloat3(srcAttribs, srcAttribsEnabled, attrib_normal) &&
+            IsFloat3(srcAttribs, srcAttribsEnabled, attrib_tangent) &&
+            IsFloat3(srcAttribs, srcAttribsEnabled, attrib_bitangent))
+        {
+            addAttrib(attrib_bitangent, 6, 1, 1, attrib_format_short);
+        }
+        stride = 8;
+    }
+
+    if ((srcAttribsEnabled & attrib_mask_texcoord0) && srcAttribs[attrib_texcoord0].format == attrib_format_float &&
+        srcAttribs[attrib_texcoord0].components == 2)
+    {
+        addAttrib(attrib_texcoord0, (uint16_t)stride, 0, 2, attrib_format_half);
+        stride += 4;
+    }
+
+    static const int octahedralAttribs[] = { attrib_normal, attrib_tangent };
+    for (int attrib : octahedralAttribs)
+    {
+        if (IsFloat3(srcAttribs, srcAttribsEnabled, attrib))
+        {
+            addAttrib(attrib, (uint16_t)stride, 1, 2, attrib_format_short);
+            stride += 4;
+        }
+    }
+
+    for (int attrib = 0; attrib < maxAttribs; attrib++)
+    {
+        if (handled[attrib] || !(srcAttribsEnabled & (1 << attrib)))
+            continue;
+
+        const VertexAttrib& src = srcAttribs[attrib];
+        addAttrib(attrib, (uint16_t)stride, src.normalized, src.components, src.format);
+        stride += src.components * AttribFormatSize(src.format);
+    }
+
+    return (stride + 3) & ~3u;
+}
+
+//-----------------------------------------------------------------------------
+//  QuantizeVertices
+//-----------------------------------------------------------------------------
+QuantizeStats QuantizeVertices(const unsigned char* srcVertices, uint32_t srcStride, const VertexAttrib* srcAttribs,
+    unsigned char* dstVertices, uint32_t dstStride, const VertexAttrib* dstAttribs,
+    uint32_t vertexCount, const BoundingBox& bounds)
+{
+    QuantizeStats stats = {};
+
+    XMVECTOR boundsMin = bounds.min;
+    XMVECTOR extent = XMVectorSubtract(bounds.max, bounds.min);
+    XMVECTOR invExtent = XMVectorSelect(XMVectorZero(), XMVectorReciprocal(extent), XMVectorGreater(extent, XMVectorZero()));
+    stats.positionErrorBound = 0.5f * XMVectorGetX(XMVector3Length(XMVectorScale(extent, 1.0f / 65535.0f)));
+
+    memset(dstVertices, 0, (size_t)vertexCount * dstStride);
+
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        const unsigned char* src = srcVertices + (size_t)v * srcStride;
+        unsigned char* dst = dstVertices + (size_t)v * dstStride;
+
+        for (int attrib = 0; attrib < maxAttribs; attrib++)
+        {
+            const VertexAttrib& dstAttrib = dstAttribs[attrib];
+            const VertexAttrib& srcAttrib = srcAttribs[attrib];
+            if (dstAttrib.format == attrib_format_none)
+                continue;
+
+            if (attrib == attrib_position && dstAttrib.format == attrib_format_ushort && srcAttrib.format == attrib_format_float)
+            {
+                XMVECTOR position = LoadFloat3(src, srcAttrib);
+                XMUSHORTN4 packed;
+                XMStoreUShortN4(&packed, XMVectorMultiply(XMVectorSubtract(position, boundsMin), invExtent));
+                memcpy(dst + dstAttrib.offset, &packed, sizeof(uint16_t) * 3);
+
+                XMVECTOR decoded = XMVectorMultiplyAdd(XMLoadUShortN4(&packed), extent, boundsMin);
+                stats.positionError = std::max(stats.positionError, XMVectorGetX(XMVector3Length(XMVectorSubtract(decoded, position))));
+            }
+            else if (attrib == attrib_bitangent && dstAttrib.components == 1 && srcAttrib.format == attrib_format_float)
+            {
+                XMVECTOR normal = LoadFloat3(src, srcAttribs[attrib_normal]);
+                XMVECTOR tangent = LoadFloat3(src, srcAttribs[attrib_tangent]);
+                XMVECTOR bitangent = LoadFloat3(src, srcAttrib);
+                int16_t sign = XMVectorGetX(XMVector3Dot(XMVector3Cross(normal, tangent), bitangent)) < 0.0f ? -32767 : 32767;
+                memcpy(dst + dstAttrib.offset, &sign, sizeof(sign));
+            }
+            else if (dstAttrib.format == attrib_format_half && srcAttrib.format == attrib_format_float)
+            {
+                XMVECTOR texcoord = LoadFloat2(src, srcAttrib);
+                XMHALF2 packed;
+                XMStoreHalf2(&packed, texcoord);
+                memcpy(dst + dstAttrib.offset, &packed, sizeof(packed));
+
+                XMVECTOR error = XMVectorAbs(XMVectorSubtract(XMLoadHalf2(&packed), texcoord));
+                stats.texcoordError = std::max(stats.texcoordError, std::max(XMVectorGetX(error), XMVectorGetY(error)));
+            }
+            else if (dstAttrib.components == 2 && srcAttrib.format == attrib_format_float && (attrib == attrib_normal || attrib == attrib_tangent))
+            {
+                XMVECTOR direction = LoadFloat3(src, srcAttrib);
+                XMSHORTN2 packed;
+                XMStoreShortN2(&packed, EncodeOctahedral(direction));
+                memcpy(dst + dstAttrib.offset, &packed, sizeof(packed));
+
+                float angle = AngleBetweenDegrees(direction, DecodeOctahedral(XMLoadShortN2(&packed)));
+                float& maxAngle = attrib == attrib_normal ? stats.normalError : stats.tangentError;
+                maxAngle = std::max(maxAngle, angle);
+            }
+            else
+            {
+                memcpy(dst + dstAttrib.offset, src + srcAttrib.offset, dstAttrib.components * AttribFormatSize(dstAttrib.format));
+            }
+        }
+    }
+
+    return stats;
+}
@@ -0,0 +1,93 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+#pragma once
+
+#include "Model.h"
+
+//-----------------------------------------------------------------------------
+//  GetQuantizedLayout
+//-----------------------------------------------------------------------------
+//  Builds the compact vertex layout QuantizeVertices writes for a layout of
+//  float attributes:
+//      position        3 x ushort normalized within the mesh bounding box
+//      bitangent       1 x short normalized at the position's w, the sign of
+//                      the bitangent relative to cross(normal, tangent)
+//      texcoord0       2 x half
+//      normal          2 x short normalized, octahedral encoded
+//      tangent         2 x short normalized, octahedral encoded
+//  A normal or tangent with 2 components is always octahedral encoded, and a
+//  bitangent with 1 component is only a sign. Any other attribute is copied
+//  as it is. The full vertex of a textured, tangent space mesh takes 20
+//  bytes instead of 56.
+//
+//  Parameters:
+//      srcAttribs
+//          the float attributes, indexed by attrib_position, etc.
+//      srcAttribsEnabled
+//          the mask of the enabled attributes
+//      dstAttribs
+//          receives the quantized attributes
+//      dstAttribsEnabled
+//          receives the mask of the quantized attributes
+//  Returns:
+//      the quantized vertex stride
+//-----------------------------------------------------------------------------
+uint32_t GetQuantizedLayout(const VertexAttrib* srcAttribs, uint32_t srcAttribsEnabled,
+    VertexAttrib* dstAttribs, uint32_t& dstAttribsEnabled);
+
+//-----------------------------------------------------------------------------
+//  QuantizeVertices
+//-----------------------------------------------------------------------------
+//  Encodes vertices into the layout returned by GetQuantizedLayout, and
+//  decodes them again to measure the error.
+//
+//  Parameters:
+//      srcVertices, srcStride, srcAttribs
+//          the float vertices
+//      dstVertices, dstStride, dstAttribs
+//          the quantized vertices, as returned by GetQuantizedLayout
+//      vertexCount
+//          the number of vertices
+//      bounds
+//          the bounding box the positions are quantized within
+//  Returns:
+//      positionError
+//          the largest distance of a decoded position from the original
+//      positionErrorBound
+//          half the diagonal of a quantization cell, what positionError can
+//          never exceed
+//      normalError, tangentError
+//          the largest angle between a decoded direction and the original,
+//          in degrees
+//      texcoordError
+//          the largest difference of a decoded texcoord from the original
+//-----------------------------------------------------------------------------
+struct QuantizeStats
+{
+    float positionError;
+    float positionErrorBound;
+    float normalError;
+    float tangentError;
+    float texcoordError;
+};
+
+QuantizeStats QuantizeVertices(const unsigned char* srcVertices, uint32_t srcStride, const VertexAttrib* srcAttribs,
+    unsigned char* dstVertices, uint32_t dstStride, const VertexAttrib* dstAttribs,
+    uint32_t vertexCount, const BoundingBox& bounds);
+
+//-----------------------------------------------------------------------------
+//  Octahedral encoding of unit vectors, as stored in the quantized normal and
+//  tangent. Both are exposed for anything that decodes H3D v2 vertices on
+//  the CPU.
+//-----------------------------------------------------------------------------
+XMVECTOR EncodeOctahedral(FXMVECTOR direction);
+XMVECTOR DecodeOctahedral(FXMVECTOR encoded);
@@ -14,14 +14,37 @@
 #include "AssimpModelLoader.h"
 #include "Model.h"
 #include "H3DModelLoader.h"
+#include "IndexOptimizePostTransform.h"
+#include "RenderQueue.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// FIFO size the cache stats are reported for, closer to real hardware than
+// the LRU size the optimizer scores vertices with
+enum {statsCacheSize = 32};
+enum {optimizeCacheSize = 64};
 
 void PrintHelp()
 {
     printf("model_convert\n");
 
     printf("usage:\n");
-    printf("model_convert input_file output_file\n");
+    printf("model_convert [options] input_file output_file\n");
+    printf("model_convert -benchmark input_file [input_file ...]\n");
+    printf("options:\n");
+    printf("  -optimize         weld vertices and reorder triangles for the vertex cache\n");
+    printf("  -overdraw         also reorder triangle clusters for less overdraw (implies -optimize)\n");
+    printf("  -no_vertex_fetch  don't reorder vertices into first use order\n");
+    printf("  -weld_epsilon e   also weld vertices that round to the same multiple of e (implies -optimize)\n");
+    printf("  -index32          keep meshes above 65535 vertices whole with 32-bit indices\n");
+    printf("  -quantize         write compact quantized vertices (H3D v2)\n");
+    printf("  -lods n           build n coarser levels of detail of every mesh\n");
+    printf("  -lod_ratio r      the share of triangles each level keeps (default 0.5)\n");
+    printf("  -meshlets         split meshes into meshlets with culling bounds (H3D v4)\n");
 }
 
 void PrintModelStats(const Model *model)
@@ -66,12 +89,42 @@ void PrintModelStats(const Model *model)
             case attrib_format_float:
                 printf("float");
                 break;
+
+            case attrib_format_half:
+                printf("half");
+                break;
             }
         };
 
         printf("mesh %u\n", meshIndex);
         printf("vertices: %u\n", mesh->vertexCount);
-        printf("indices: %u\n", mesh->indexCount);
+        printf("indices: %u (%u-bit)\n", mesh->indexCount, IndexFormatSize(mesh->indexFormat) * 8);
+        if (mesh->indexCount > 0)
+        {
+            const unsigned char *indexData = model->m_pIndexData + mesh->indexDataByteOffset;
+            VertexCacheStats stats = mesh->indexFormat == index_format_uint32
+                ? ComputeVertexCacheStats((const uint32_t *)indexData, mesh->indexCount, statsCacheSize)
+                : ComputeVertexCacheStats((const uint16_t *)indexData, mesh->indexCount, statsCacheSize);
+            printf("acmr: %.3f, atvr: %.3f (fifo %d)\n", stats.acmr, stats.atvr, (int)statsCacheSize);
+        }
+        if (meshIndex < model->m_MeshletRanges.size())
+        {
+            const Model::MeshletRange &range = model->m_MeshletRanges[meshIndex];
+            uint32_t meshletVertexCount = 0;
+            for (uint32_t n = range.offset; n < range.offset + range.count; n++)
+            {
+                meshletVertexCount += model->m_Meshlets[n].vertexCount;
+            }
+            printf("meshlets: %u, %.1f vertices and %.1f triangles per meshlet\n", range.count
+                , range.count ? (float)meshletVertexCount / range.count : 0.0f
+                , range.count ? (float)(mesh->indexCount / 3) / range.count : 0.0f);
+        }
+        for (uint32_t lod = 1; lod < model->GetLodCount(meshIndex); lod++)
+        {
+            const MeshLod &meshLod = model->m_Lods[model->m_LodRanges[meshIndex].offset + lod - 1];
+            printf("lod %u: %u triangles, %u depth-only, error %g\n", lod
+                , meshLod.indexCount / 3, meshLod.indexCountDepth / 3, meshLod.error);
+        }
         printf("vertex stride: %u\n", mesh->vertexStride);
         for (int n = 0; n < maxAttribs; n++)
         {
@@ -111,21 +164,299 @@ void PrintModelStats(const Model *model)
     printf("\n");
 }
 
+// Reports the share of the meshlets' triangles the backface cones cull, seen
+// from far away along each axis, as an estimate of what culling meshlets saves
+void PrintMeshletCullStats(const Model *model)
+{
+    const BoundingBox &bounds = model->GetBoundingBox();
+    Vector3 center = (bounds.min + bounds.max) * 0.5f;
+    float distance = 10.0f * Length(bounds.max - bounds.min);
+
+    static const float directions[6][3] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+    uint64_t triangleCount = 0;
+    uint64_t culledCount = 0;
+    for (const float *direction : directions)
+    {
+        Vector3 viewer = center + Vector3(direction[0], direction[1], direction[2]) * distance;
+        for (const Meshlet &meshlet : model->m_Meshlets)
+        {
+            triangleCount += meshlet.triangleCount;
+            Vector3 toApex = Normalize(Vector3(meshlet.coneApex) - viewer);
+            if ((float)Dot(toApex, Vector3(meshlet.coneAxis)) >= meshlet.coneCutoff)
+                culledCount += meshlet.triangleCount;
+        }
+    }
+
+    printf("meshlets: %u, backface cones cull %.1f%% of triangles from the 6 axis views\n"
+        , (uint32_t)model->m_Meshlets.size(), triangleCount ? 100.0 * culledCount / triangleCount : 0.0);
+}
+
+// Times OptimizeFaces over every mesh of the model with 16 and 32-bit
+// indices, and reports the cache stats before and after. Meshes stored with
+// 32-bit indices are only timed with 32-bit indices.
+void BenchmarkOptimizeFaces(const Model *model)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+
+    uint64_t totalTriangles = 0;
+    double totalMs16 = 0.0;
+    double totalMs32 = 0.0;
+    for (unsigned int meshIndex = 0; meshIndex < model->m_Header.meshCount; meshIndex++)
+    {
+        const Mesh *mesh = model->m_pMesh + meshIndex;
+        if (mesh->indexCount == 0)
+            continue;
+
+        const unsigned char *indexData = model->m_pIndexData + mesh->indexDataByteOffset;
+        bool is32Bit = mesh->indexFormat == index_format_uint32;
+        std::vector<uint16_t> optimized16(is32Bit ? 0 : mesh->indexCount);
+        std::vector<uint32_t> indices32(mesh->indexCount);
+        std::vector<uint32_t> optimized32(mesh->indexCount);
+        if (is32Bit)
+            memcpy(indices32.data(), indexData, sizeof(uint32_t) * mesh->indexCount);
+        else
+            std::copy((const uint16_t *)indexData, (const uint16_t *)indexData + mesh->indexCount, indices32.begin());
+
+        auto start = Clock::now();
+        if (!is32Bit)
+            OptimizeFaces<uint16_t>((const uint16_t *)indexData, mesh->indexCount, optimized16.data(), optimizeCacheSize);
+        auto end16 = Clock::now();
+        OptimizeFaces<uint32_t>(indices32.data(), mesh->indexCount, optimized32.data(), optimizeCacheSize);
+        auto end32 = Clock::now();
+
+        double ms16 = std::chrono::duration<double, std::milli>(end16 - start).count();
+        double ms32 = std::chrono::duration<double, std::milli>(end32 - end16).count();
+        totalTriangles += mesh->indexCount / 3;
+        totalMs16 += ms16;
+        totalMs32 += ms32;
+
+        VertexCacheStats before = ComputeVertexCacheStats(indices32.data(), mesh->indexCount, statsCacheSize);
+        VertexCacheStats after = ComputeVertexCacheStats(optimized32.data(), mesh->indexCount, statsCacheSize);
+        printf("mesh %u: %u triangles, 16-bit %.2f ms, 32-bit %.2f ms, acmr %.3f -> %.3f, atvr %.3f -> %.3f\n"
+            , meshIndex, mesh->indexCount / 3, ms16, ms32
+            , before.acmr, after.acmr, before.atvr, after.atvr);
+    }
+
+    printf("total: %llu triangles, 16-bit %.2f ms, 32-bit %.2f ms\n"
+        , (unsigned long long)totalTriangles, totalMs16, totalMs32);
+    printf("\n");
+}
+
+// Stands in for a graphics context, so submission can be timed without a device
+struct NullBinder
+{
+    uint64_t indexCount;
+
+    void SetPipelineState(int &, uint32_t) {}
+    void SetMaterial(int &, uint32_t) {}
+    void SetGeometry(int &, uint32_t) {}
+    void Draw(int &, const RenderQueue::DrawPacket &packet) { indexCount += packet.IndexCount; }
+};
+
+// Times building, sorting and submitting a render queue with ModelViewer's
+// four passes over every mesh, viewed from each axis in turn, and compares
+// the state changes against submitting the meshes in file order
+void BenchmarkRenderQueue(const Model *model)
+{
+    typedef std::chrono::high_resolution_clock Clock;
+    enum { passCount = 4, frameCount = 60 };
+
+    // cutout materials are picked by name, as ModelViewer does
+    std::vector<uint32_t> materialPSO(model->m_Header.materialCount);
+    for (unsigned int materialIndex = 0; materialIndex < model->m_Header.materialCount; materialIndex++)
+    {
+        const char *path = model->m_pMaterial[materialIndex].texDiffusePath;
+        materialPSO[materialIndex] = strstr(path, "thorn") || strstr(path, "plant") || strstr(path, "chain") ? 1 : 0;
+    }
+
+    RenderQueue::SubmitStats fileOrder = {};
+    for (uint32_t pass = 0; pass < passCount; pass++)
+    {
+        uint32_t pso = ~0u, material = ~0u, geometry = ~0u;
+        for (unsigned int meshIndex = 0; meshIndex < model->m_Header.meshCount; meshIndex++)
+        {
+            const Mesh &mesh = model->m_pMesh[meshIndex];
+            fileOrder.PSOChanges += materialPSO[mesh.materialIndex] != pso;
+            fileOrder.MaterialChanges += mesh.materialIndex != material;
+            fileOrder.GeometryChanges += mesh.indexFormat != geometry;
+            fileOrder.Draws++;
+            pso = materialPSO[mesh.materialIndex];
+            material = mesh.materialIndex;
+            geometry = mesh.indexFormat;
+        }
+    }
+
+    const BoundingBox &bounds = model->GetBoundingBox();
+    Vector3 center = (bounds.min + bounds.max) * 0.5f;
+    float farZ = 2.0f * Length(bounds.max - bounds.min);
+    static const float directions[6][3] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+
+    RenderQueue queue;
+    NullBinder binder = {};
+    int context = 0;
+    RenderQueue::SubmitStats sorted = {};
+    double buildMs = 0.0, sortMs = 0.0, submitMs = 0.0;
+    for (uint32_t frame = 0; frame < frameCount; frame++)
+    {
+        const float *direction = directions[frame % 6];
+        Vector3 viewer = center + Vector3(direction[0], direction[1], direction[2]) * (0.5f * farZ);
+
+        auto start = Clock::now();
+        queue.Reset();
+        for (uint32_t pass = 0; pass < passCount; pass++)
+        {
+            for (unsigned int meshIndex = 0; meshIndex < model->m_Header.meshCount; meshIndex++)
+            {
+                const Mesh &mesh = model->m_pMesh[meshIndex];
+                RenderQueue::DrawPacket packet = {};
+                packet.PSO = materialPSO[mesh.materialIndex];
+                packet.Material = mesh.materialIndex;
+                packet.Geometry = mesh.indexFormat;
+                packet.IndexCount = mesh.indexCount;
+                packet.StartIndex = mesh.indexDataByteOffset / IndexFormatSize(mesh.indexFormat);
+                packet.BaseVertex = mesh.vertexDataByteOffset / model->m_VertexStride;
+                packet.UserData = meshIndex;
+
+                Vector3 meshCenter = (mesh.boundingBox.min + mesh.boundingBox.max) * 0.5f;
+                queue.AddDraw(pass, RenderQueue::ComputeDepthBucket(Length(meshCenter - viewer), 1.0f, farZ), packet);
+            }
+        }
+        auto endBuild = Clock::now();
+        queue.Sort();
+        auto endSort = Clock::now();
+        sorted = {};
+        for (uint32_t pass = 0; pass < passCount; pass++)
+        {
+            RenderQueue::SubmitStats stats = queue.Submit(context, binder, pass);
+            sorted.Draws += stats.Draws;
+            sorted.PSOChanges += stats.PSOChanges;
+            sorted.MaterialChanges += stats.MaterialChanges;
+            sorted.GeometryChanges += stats.GeometryChanges;
+        }
+        auto endSubmit = Clock::now();
+
+        buildMs += std::chrono::duration<double, std::milli>(endBuild - start).count();
+        sortMs += std::chrono::duration<double, std::milli>(endSort - endBuild).count();
+        submitMs += std::chrono::duration<double, std::milli>(endSubmit - endSort).count();
+    }
+
+    double totalMs = buildMs + sortMs + submitMs;
+    printf("render queue: %u draws per frame, build %.3f ms, sort %.3f ms, submit %.3f ms, %.2f M draws/sec\n"
+        , sorted.Draws, buildMs / frameCount, sortMs / frameCount, submitMs / frameCount
+        , totalMs > 0.0 ? (double)sorted.Draws * frameCount / (totalMs * 1000.0) : 0.0);
+    printf("state changes: pso %u -> %u, material %u -> %u, index format %u -> %u, %d fewer than file order\n"
+        , fileOrder.PSOChanges, sorted.PSOChanges, fileOrder.MaterialChanges, sorted.MaterialChanges
+        , fileOrder.GeometryChanges, sorted.GeometryChanges
+        , (int)sorted.StateChangesAvoided() - (int)fileOrder.StateChangesAvoided());
+    printf("\n");
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    if (argc >= 3 && strcmp(argv[1], "-benchmark") == 0)
+    {
+        for (int n = 2; n < argc; n++)
+        {
+            printf("benchmarking %s\n", argv[n]);
+            AssimpModelLoader assimpLoader;
+            std::unique_ptr<Model> model = assimpLoader.LoadModel(argv[n]);
+            if (!model)
+            {
+                printf("failed to load model: %s\n", argv[n]);
+                return -1;
+            }
+            BenchmarkOptimizeFaces(model.get());
+            BenchmarkRenderQueue(model.get());
+        }
+        return 0;
+    }
+
+	AssimpModelLoader assimpLoader;
+    bool optimize = false;
+    bool optimizeOverdraw = false;
+    bool optimizeVertexFetch = true;
+    bool quantize = false;
+    bool buildMeshlets = false;
+    uint32_t lodCount = 0;
+    float lodRatio = 0.5f;
+    int argn = 1;
+    for (; argn < argc && argv[argn][0] == '-'; argn++)
+    {
+        if (strcmp(argv[argn], "-optimize") == 0)
+        {
+            optimize = true;
+        }
+        else if (strcmp(argv[argn], "-overdraw") == 0)
+        {
+            optimize = true;
+            optimizeOverdraw = true;
+        }
+        else if (strcmp(argv[argn], "-no_vertex_fetch") == 0)
+        {
+            optimizeVertexFetch = false;
+        }
+        else if (strcmp(argv[argn], "-weld_epsilon") == 0 && argn + 1 < argc)
+        {
+            float weldEpsilon = (float)atof(argv[++argn]);
+            if (!(weldEpsilon >= 0.0f))
+            {
+                printf("weld epsilon can't be negative: %s\n", argv[argn]);
+                return -1;
+            }
+            optimize = true;
+            assimpLoader.SetWeldEpsilon(weldEpsilon);
+        }
+        else if (strcmp(argv[argn], "-index32") == 0)
+        {
+            assimpLoader.SetSplitLargeMeshes(false);
+        }
+        else if (strcmp(argv[argn], "-quantize") == 0)
+        {
+            quantize = true;
+        }
+        else if (strcmp(argv[argn], "-lods") == 0 && argn + 1 < argc)
+        {
+            lodCount = (uint32_t)atoi(argv[++argn]);
+        }
+        else if (strcmp(argv[argn], "-lod_ratio") == 0 && argn + 1 < argc)
+        {
+            lodRatio = (float)atof(argv[++argn]);
+            if (!(lodRatio > 0.0f && lodRatio < 1.0f))
+            {
+                printf("lod ratio must be between 0 and 1: %s\n", argv[argn]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[argn], "-meshlets") == 0)
+        {
+            buildMeshlets = true;
+        }
+        else
+        {
+            printf("unknown option: %s\n", argv[argn]);
+            PrintHelp();
+            return -1;
+        }
+    }
+    assimpLoader.SetOptimize(optimize);
+    assimpLoader.SetOptimizeOverdraw(optimizeOverdraw);
+    assimpLoader.SetOptimizeVertexFetch(optimizeVertexFetch);
+    assimpLoader.SetLodChain(lodCount, lodRatio);
+    assimpLoader.SetBuildMeshlets(buildMeshlets);
+    assimpLoader.SetQuantizeVertices(quantize);
+
+    if (argc - argn != 2)
     {
         PrintHelp();
         return -1;
     }
 
-    const char *input_file = argv[1];
-    const char *output_file = argv[2];
+    const char *input_file = argv[argn];
+    const char *output_file = argv[argn + 1];
     printf("input file %s\n", input_file);
     printf("output file %s\n", output_file);
 
     printf("loading...\n");
-	AssimpModelLoader assimpLoader;
 	std::unique_ptr<Model> model = assimpLoader.LoadModel(input_file);
     if (!model)
     {
@@ -133,6 +464,30 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    const AssimpModelLoader::OptimizeStats &optimizeStats = assimpLoader.GetOptimizeStats();
+    if (optimizeOverdraw)
+    {
+        printf("overdraw stage: overdraw %.3f -> %.3f, acmr %.3f -> %.3f (fifo %d)\n"
+            , optimizeStats.overdrawBefore, optimizeStats.overdrawAfter
+            , optimizeStats.overdrawAcmrBefore, optimizeStats.overdrawAcmrAfter, (int)statsCacheSize);
+    }
+    if (optimize && optimizeVertexFetch)
+    {
+        printf("vertex fetch stage: overfetch %.3f -> %.3f\n"
+            , optimizeStats.overfetchBefore, optimizeStats.overfetchAfter);
+    }
+
+    if (quantize)
+    {
+        const QuantizeStats &quantizeStats = assimpLoader.GetQuantizeStats();
+        printf("quantize: position error %g (bound %g), normal error %.4f deg, tangent error %.4f deg, texcoord error %g\n"
+            , quantizeStats.positionError, quantizeStats.positionErrorBound
+            , quantizeStats.normalError, quantizeStats.tangentError, quantizeStats.texcoordError);
+    }
+
+    if (buildMeshlets)
+        PrintMeshletCullStats(model.get());
+
     printf("saving...\n");
 	H3DModelLoader h3dLoader;
     if (!h3dLoader.Save(model.get(), output_file))
@@ -15,3 +15,15 @@ dxc.exe /Zi /E"main" /Vn"g_pDepthViewerVS_SM6" /Tvs_6_0 /Fh"DepthViewerVS_SM6.h"
 copy DepthViewerVS_SM6.h ..\Build_VS14\x64\Debug\Output\ModelViewer\CompiledShaders
 copy DepthViewerVS_SM6.h ..\Build_VS14\x64\Profile\Output\ModelViewer\CompiledShaders
 copy DepthViewerVS_SM6.h ..\Build_VS14\x64\Release\Output\ModelViewer\CompiledShaders
+
+dxc.exe /Zi /E"main" /Vn"g_pModelViewerQuantizedVS_SM6" /Tvs_6_0 /Fh"ModelViewerQuantizedVS_SM6.h" /nologo Shaders/ModelViewerQuantizedVS.hlsl
+
+copy ModelViewerQuantizedVS_SM6.h ..\Build_VS14\x64\Debug\Output\ModelViewer\CompiledShaders
+copy ModelViewerQuantizedVS_SM6.h ..\Build_VS14\x64\Profile\Output\ModelViewer\CompiledShaders
+copy ModelViewerQuantizedVS_SM6.h ..\Build_VS14\x64\Release\Output\ModelViewer\CompiledShaders
+
+dxc.exe /Zi /E"main" /Vn"g_pDepthViewerQuantizedVS_SM6" /Tvs_6_0 /Fh"DepthViewerQuantizedVS_SM6.h" /nologo Shaders/DepthViewerQuantizedVS.hlsl
+
+copy DepthViewerQuantizedVS_SM6.h ..\Build_VS14\x64\Debug\Output\ModelViewer\CompiledShaders
+copy DepthViewerQuantizedVS_SM6.h ..\Build_VS14\x64\Profile\Output\ModelViewer\CompiledShaders
+copy DepthViewerQuantizedVS_SM6.h ..\Build_VS14\x64\Release\Output\ModelViewer\CompiledShaders
@@ -19,6 +19,7 @@
 #include "Camera.h"
 #include "Model.h"
 #include "ModelLoader.h"
+#include "MeshCuller.h"
 #include "GpuBuffer.h"
 #include "CommandContext.h"
 #include "SamplerManager.h"
@@ -31,21 +32,27 @@
 #include "SystemTime.h"
 #include "TextRenderer.h"
 #include "ShadowCamera.h"
+#include "RenderQueue.h"
 #include "ParticleEffectManager.h"
 #include "GameInput.h"
 #include "./ForwardPlusLighting.h"
+#include <ppl.h>
 
 // To enable wave intrinsics, uncomment this macro and #define DXIL in Core/GraphcisCore.cpp.
 // Run CompileSM6Test.bat to compile the relevant shaders with DXC.
 //#define _WAVE_OP
 
 #include "CompiledShaders/DepthViewerVS.h"
+#include "CompiledShaders/DepthViewerQuantizedVS.h"
 #include "CompiledShaders/DepthViewerPS.h"
 #include "CompiledShaders/ModelViewerVS.h"
+#include "CompiledShaders/ModelViewerQuantizedVS.h"
 #include "CompiledShaders/ModelViewerPS.h"
 #ifdef _WAVE_OP
 #include "CompiledShaders/DepthViewerVS_SM6.h"
+#include "CompiledShaders/DepthViewerQuantizedVS_SM6.h"
 #include "CompiledShaders/ModelViewerVS_SM6.h"
+#include "CompiledShaders/ModelViewerQuantizedVS_SM6.h"
 #include "CompiledShaders/ModelViewerPS_SM6.h"
 #endif
 #include "CompiledShaders/WaveTileCountPS.h"
@@ -70,8 +77,15 @@ private:
 
     void RenderLightShadows(GraphicsContext& gfxContext);
 
-    enum eObjectFilter { kOpaque = 0x1, kCutout = 0x2, kTransparent = 0x4, kAll = 0xF, kNone = 0x0 };
-    void RenderObjects( GraphicsContext& Context, const Matrix4& ViewProjMat, eObjectFilter Filter = kAll );
+    // The views meshes are culled for each frame, all at once
+    enum eView { kCameraView, kSunShadowView, kLightShadowView, kViewCount };
+    void CullViews( void );
+
+    // The passes the render queue sorts draws into, each drawing one of the views
+    enum ePass { kLightShadowPass, kDepthPass, kSunShadowPass, kColorPass, kPassCount };
+    void QueueDraws( void );
+
+    void RenderObjects( GraphicsContext& Context, const Matrix4& ViewProjMat, ePass Pass, const GraphicsPSO& OpaquePSO, const GraphicsPSO& CutoutPSO );
     void CreateParticleEffects();
     Camera m_Camera;
     std::unique_ptr<CameraController> m_CameraController;
@@ -99,6 +113,11 @@ private:
     D3D12_CPU_DESCRIPTOR_HANDLE m_ExtraTextures[6];
     std::unique_ptr<Model> m_Model;
     std::vector<bool> m_pMaterialIsCutout;
+    MeshCuller m_MeshCuller;
+    std::vector<uint32_t> m_VisibleMeshes[kViewCount];
+    uint32_t m_LightShadowIndex = 0;
+    RenderQueue m_RenderQueue;
+    RenderQueue::SubmitStats m_SubmitStats[kPassCount];
 
     Vector3 m_SunDirection;
     ShadowCamera m_SunShadow;
@@ -115,6 +134,7 @@ NumVar ShadowDimY("Application/Lighting/Shadow Dim Y", 3000, 1000, 10000, 100 );
 NumVar ShadowDimZ("Application/Lighting/Shadow Dim Z", 3000, 1000, 10000, 100 );
 
 BoolVar ShowWaveTileCounts("Application/Forward+/Show Wave Tile Counts", false);
+BoolVar EnableMeshCulling("Application/Culling/Frustum Cull Meshes", true);
 #ifdef _WAVE_OP
 BoolVar EnableWaveOps("Application/Forward+/Enable Wave Ops", true);
 #endif
@@ -124,6 +144,16 @@ void ModelViewer::Startup( void )
     SamplerDesc DefaultSamplerDesc;
     DefaultSamplerDesc.MaxAnisotropy = 8;
 
+    // The vertex format of the model decides which shaders the PSOs use
+    TextureManager::Initialize(L"Textures/");
+	ModelLoaderFactory modelLoaderFactory;
+	//std::unique_ptr<IModelLoader> h3dModelLoader = modelLoaderFactory.CreateModelLoader(EModelLoaderType::H3D);
+	//m_Model = h3dModelLoader->LoadModel("Models/sponza.h3d");
+	std::unique_ptr<IModelLoader> assimpModelLoader = modelLoaderFactory.CreateModelLoader(EModelLoaderType::Assimp);
+	m_Model = assimpModelLoader->LoadSkinnedModel("Models/Running.fbx");
+    ASSERT(m_Model, "Failed to load model");
+    ASSERT(m_Model->m_Header.meshCount > 0, "Model contains no meshes");
+
     m_RootSig.Reset(5, 2);
     m_RootSig.InitStaticSampler(0, DefaultSamplerDesc, D3D12_SHADER_VISIBILITY_PIXEL);
     m_RootSig.InitStaticSampler(1, SamplerShadowDesc, D3D12_SHADER_VISIBILITY_PIXEL);
@@ -131,7 +161,7 @@ void ModelViewer::Startup( void )
     m_RootSig[1].InitAsConstantBuffer(0, D3D12_SHADER_VISIBILITY_PIXEL);
     m_RootSig[2].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 0, 6, D3D12_SHADER_VISIBILITY_PIXEL);
     m_RootSig[3].InitAsDescriptorRange(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 64, 6, D3D12_SHADER_VISIBILITY_PIXEL);
-    m_RootSig[4].InitAsConstants(1, 2, D3D12_SHADER_VISIBILITY_VERTEX);
+    m_RootSig[4].InitAsConstants(1, 8, D3D12_SHADER_VISIBILITY_VERTEX);
     m_RootSig.Finalize(L"ModelViewer", D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
 
     DXGI_FORMAT ColorFormat = g_SceneColorBuffer.GetFormat();
@@ -147,15 +177,46 @@ void ModelViewer::Startup( void )
         { "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
     };
 
+    // Models converted with -quantize store unorm positions within the mesh
+    // bounds, a half2 texcoord, octahedral normals and tangents, and the sign
+    // of the bitangent (see GetQuantizedLayout).  The position is read as four
+    // components, the last of which overlaps the bitangent sign and is unused.
+    const Mesh& firstMesh = m_Model->m_pMesh[0];
+    const bool bQuantized = firstMesh.attrib[attrib_position].format == attrib_format_ushort;
+    if (bQuantized)
+    {
+        ASSERT(firstMesh.attrib[attrib_texcoord0].format == attrib_format_half);
+        ASSERT(firstMesh.attrib[attrib_normal].format == attrib_format_short && firstMesh.attrib[attrib_normal].components == 2);
+        ASSERT(firstMesh.attrib[attrib_tangent].format == attrib_format_short && firstMesh.attrib[attrib_tangent].components == 2);
+        ASSERT(firstMesh.attrib[attrib_bitangent].format == attrib_format_short && firstMesh.attrib[attrib_bitangent].components == 1);
+    }
+
+    D3D12_INPUT_ELEMENT_DESC quantizedVertElem[] =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, firstMesh.attrib[attrib_position].offset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, firstMesh.attrib[attrib_texcoord0].offset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, firstMesh.attrib[attrib_normal].offset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, firstMesh.attrib[attrib_tangent].offset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "BITANGENT", 0, DXGI_FORMAT_R16_SNORM, 0, firstMesh.attrib[attrib_bitangent].offset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+    };
+
     // Depth-only (2x rate)
     m_DepthPSO.SetRootSignature(m_RootSig);
     m_DepthPSO.SetRasterizerState(RasterizerDefault);
     m_DepthPSO.SetBlendState(BlendNoColorWrite);
     m_DepthPSO.SetDepthStencilState(DepthStateReadWrite);
-    m_DepthPSO.SetInputLayout(_countof(vertElem), vertElem);
+    if (bQuantized)
+    {
+        m_DepthPSO.SetInputLayout(_countof(quantizedVertElem), quantizedVertElem);
+        m_DepthPSO.SetVertexShader(g_pDepthViewerQuantizedVS, sizeof(g_pDepthViewerQuantizedVS));
+    }
+    else
+    {
+        m_DepthPSO.SetInputLayout(_countof(vertElem), vertElem);
+        m_DepthPSO.SetVertexShader(g_pDepthViewerVS, sizeof(g_pDepthViewerVS));
+    }
     m_DepthPSO.SetPrimitiveTopologyType(D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE);
     m_DepthPSO.SetRenderTargetFormats(0, nullptr, DepthFormat);
-    m_DepthPSO.SetVertexShader(g_pDepthViewerVS, sizeof(g_pDepthViewerVS));
     m_DepthPSO.Finalize();
 
     // Depth-only shading but with alpha testing
@@ -181,17 +242,26 @@ void ModelViewer::Startup( void )
     m_ModelPSO.SetBlendState(BlendDisable);
     m_ModelPSO.SetDepthStencilState(DepthStateTestEqual);
     m_ModelPSO.SetRenderTargetFormats(1, &ColorFormat, DepthFormat);
-    m_ModelPSO.SetVertexShader( g_pModelViewerVS, sizeof(g_pModelViewerVS) );
+    if (bQuantized)
+        m_ModelPSO.SetVertexShader( g_pModelViewerQuantizedVS, sizeof(g_pModelViewerQuantizedVS) );
+    else
+        m_ModelPSO.SetVertexShader( g_pModelViewerVS, sizeof(g_pModelViewerVS) );
     m_ModelPSO.SetPixelShader( g_pModelViewerPS, sizeof(g_pModelViewerPS) );
     m_ModelPSO.Finalize();
 
 #ifdef _WAVE_OP
     m_DepthWaveOpsPSO = m_DepthPSO;
-    m_DepthWaveOpsPSO.SetVertexShader( g_pDepthViewerVS_SM6, sizeof(g_pDepthViewerVS_SM6) );
+    if (bQuantized)
+        m_DepthWaveOpsPSO.SetVertexShader( g_pDepthViewerQuantizedVS_SM6, sizeof(g_pDepthViewerQuantizedVS_SM6) );
+    else
+        m_DepthWaveOpsPSO.SetVertexShader( g_pDepthViewerVS_SM6, sizeof(g_pDepthViewerVS_SM6) );
     m_DepthWaveOpsPSO.Finalize();
 
     m_ModelWaveOpsPSO = m_ModelPSO;
-    m_ModelWaveOpsPSO.SetVertexShader( g_pModelViewerVS_SM6, sizeof(g_pModelViewerVS_SM6) );
+    if (bQuantized)
+        m_ModelWaveOpsPSO.SetVertexShader( g_pModelViewerQuantizedVS_SM6, sizeof(g_pModelViewerQuantizedVS_SM6) );
+    else
+        m_ModelWaveOpsPSO.SetVertexShader( g_pModelViewerVS_SM6, sizeof(g_pModelViewerVS_SM6) );
     m_ModelWaveOpsPSO.SetPixelShader( g_pModelViewerPS_SM6, sizeof(g_pModelViewerPS_SM6) );
     m_ModelWaveOpsPSO.Finalize();
 #endif
@@ -210,16 +280,9 @@ void ModelViewer::Startup( void )
     m_ExtraTextures[0] = g_SSAOFullScreen.GetSRV();
     m_ExtraTextures[1] = g_ShadowBuffer.GetSRV();
 
-    TextureManager::Initialize(L"Textures/");
-	ModelLoaderFactory modelLoaderFactory;
-	//std::unique_ptr<IModelLoader> h3dModelLoader = modelLoaderFactory.CreateModelLoader(EModelLoaderType::H3D);
-	//m_Model = h3dModelLoader->LoadModel("Models/sponza.h3d");
-	std::unique_ptr<IModelLoader> assimpModelLoader = modelLoaderFactory.CreateModelLoader(EModelLoaderType::Assimp);
-	m_Model = assimpModelLoader->LoadSkinnedModel("Models/Running.fbx");
-    ASSERT(m_Model, "Failed to load model");
-    ASSERT(m_Model->m_Header.meshCount > 0, "Model contains no meshes");
-
     // The caller of this function can override which materials are considered cutouts
+    m_MeshCuller.Initialize(*m_Model);
+
     m_pMaterialIsCutout.resize(m_Model->m_Header.materialCount);
     for (uint32_t i = 0; i < m_Model->m_Header.materialCount; ++i)
     {
@@ -309,46 +372,166 @@ void ModelViewer::Update( float deltaT )
     m_MainScissor.bottom = (LONG)g_SceneColorBuffer.GetHeight();
 }
 
-void ModelViewer::RenderObjects( GraphicsContext& gfxContext, const Matrix4& ViewProjMat, eObjectFilter Filter )
+void ModelViewer::CullViews( void )
 {
-    struct VSConstants
+    ScopedTimer _prof(L"Cull Meshes");
+
+    const Matrix4* viewProjMats[kViewCount] =
     {
-        Matrix4 modelToProjection;
-        Matrix4 modelToShadow;
-        XMFLOAT3 viewerPos;
-    } vsConstants;
-    vsConstants.modelToProjection = ViewProjMat;
-    vsConstants.modelToShadow = m_SunShadow.GetShadowMatrix();
-    XMStoreFloat3(&vsConstants.viewerPos, m_Camera.GetPosition());
+        &m_ViewProjMatrix,
+        &m_SunShadow.GetViewProjMatrix(),
+        m_LightShadowIndex < Lighting::MaxLights ? &Lighting::m_LightShadowMatrix[m_LightShadowIndex] : nullptr,
+    };
 
-    gfxContext.SetDynamicConstantBufferView(0, sizeof(vsConstants), &vsConstants);
+    concurrency::parallel_for(0u, (uint32_t)kViewCount, [&](uint32_t View)
+    {
+        std::vector<uint32_t>& visibleMeshes = m_VisibleMeshes[View];
+        if (viewProjMats[View] == nullptr)
+        {
+            visibleMeshes.clear();
+        }
+        else if (EnableMeshCulling)
+        {
+            m_MeshCuller.Cull(*viewProjMats[View], visibleMeshes);
+        }
+        else
+        {
+            visibleMeshes.resize(m_Model->m_Header.meshCount);
+            for (uint32_t meshIndex = 0; meshIndex < m_Model->m_Header.meshCount; meshIndex++)
+                visibleMeshes[meshIndex] = meshIndex;
+        }
+    });
 
-    uint32_t materialIdx = 0xFFFFFFFFul;
+    static const wchar_t* viewNames[kViewCount] = { L"Camera", L"Sun Shadow", L"Light Shadow" };
+    for (uint32_t View = 0; View < kViewCount; View++)
+    {
+        uint32_t tested = viewProjMats[View] != nullptr && EnableMeshCulling ? m_MeshCuller.GetMeshCount() : 0;
+        uint32_t culled = tested - (tested > 0 ? (uint32_t)m_VisibleMeshes[View].size() : 0);
+        EngineProfiling::SetCounter(std::wstring(viewNames[View]) + L" Meshes Tested", tested);
+        EngineProfiling::SetCounter(std::wstring(viewNames[View]) + L" Meshes Culled", culled);
+    }
+}
 
-    uint32_t VertexStride = m_Model->m_VertexStride;
+void ModelViewer::QueueDraws( void )
+{
+    ScopedTimer _prof(L"Queue Draws");
 
-    for (uint32_t meshIndex = 0; meshIndex < m_Model->m_Header.meshCount; meshIndex++)
+    m_RenderQueue.Reset();
+
+    static const eView passViews[kPassCount] = { kLightShadowView, kCameraView, kSunShadowView, kCameraView };
+    for (uint32_t Pass = 0; Pass < kPassCount; ++Pass)
     {
-        const Mesh& mesh = m_Model->m_pMesh[meshIndex];
+        m_SubmitStats[Pass] = {};
 
-        uint32_t indexCount = mesh.indexCount;
-        uint32_t startIndex = mesh.indexDataByteOffset / sizeof(uint16_t);
-        uint32_t baseVertex = mesh.vertexDataByteOffset / VertexStride;
+        // shadow maps are only sorted by state, the camera's passes also front to back
+        bool SortByDepth = passViews[Pass] == kCameraView;
 
-        if (mesh.materialIndex != materialIdx)
+        for (uint32_t meshIndex : m_VisibleMeshes[passViews[Pass]])
         {
-            if ( m_pMaterialIsCutout[mesh.materialIndex] && !(Filter & kCutout) ||
-                !m_pMaterialIsCutout[mesh.materialIndex] && !(Filter & kOpaque) )
+            const Mesh& mesh = m_Model->m_pMesh[meshIndex];
+            bool isCutout = m_pMaterialIsCutout[mesh.materialIndex];
+            if (isCutout && Pass == kColorPass && ShowWaveTileCounts)
                 continue;
 
-            materialIdx = mesh.materialIndex;
-            gfxContext.SetDynamicDescriptors(2, 0, 6, m_Model->GetSRVs(materialIdx) );
+            RenderQueue::DrawPacket packet = {};
+            packet.PSO = isCutout ? 1 : 0;
+            packet.Material = mesh.materialIndex;
+            packet.Geometry = mesh.indexFormat;
+            packet.IndexCount = mesh.indexCount;
+            packet.StartIndex = mesh.indexDataByteOffset / IndexFormatSize(mesh.indexFormat);
+            packet.BaseVertex = mesh.vertexDataByteOffset / m_Model->m_VertexStride;
+            packet.UserData = meshIndex;
+
+            uint32_t depthBucket = 0;
+            if (SortByDepth)
+            {
+                Vector3 center = (mesh.boundingBox.min + mesh.boundingBox.max) * 0.5f;
+                depthBucket = RenderQueue::ComputeDepthBucket(Length(center - m_Camera.GetPosition()),
+                    m_Camera.GetNearClip(), m_Camera.GetFarClip());
+            }
+
+            m_RenderQueue.AddDraw(Pass, depthBucket, packet);
         }
+    }
+
+    m_RenderQueue.Sort();
+}
+
+// Applies the state of the render queue's draws.  PSO 0 is opaque and 1 is cutout.
+struct ModelStateBinder
+{
+    const GraphicsPSO* PSOs[2];
+    const Model* pModel;
+    uint32_t IndexFormat;
+
+    void SetPipelineState( GraphicsContext& Context, uint32_t PSO )
+    {
+        Context.SetPipelineState(*PSOs[PSO]);
+    }
+
+    void SetMaterial( GraphicsContext& Context, uint32_t Material )
+    {
+        Context.SetDynamicDescriptors(2, 0, 6, pModel->GetSRVs(Material));
+    }
+
+    void SetGeometry( GraphicsContext& Context, uint32_t Geometry )
+    {
+        IndexFormat = Geometry;
+        const ByteAddressBuffer& indexBuffer = pModel->m_IndexBuffer;
+        Context.SetIndexBuffer(indexBuffer.IndexBufferView(0, (uint32_t)indexBuffer.GetBufferSize(), IndexFormat == index_format_uint32));
+    }
+
+    void Draw( GraphicsContext& Context, const RenderQueue::DrawPacket& Packet )
+    {
+        // Matches MeshConstants in QuantizedVertex.hlsli.  The shaders for
+        // float vertices don't read these.
+        struct MeshConstants
+        {
+            XMFLOAT3 BoundsMin;
+            uint32_t BaseVertex;
+            XMFLOAT3 BoundsExtent;
+            uint32_t Material;
+        } constants;
+
+        const BoundingBox& bounds = pModel->m_pMesh[Packet.UserData].boundingBox;
+        XMStoreFloat3(&constants.BoundsMin, bounds.min);
+        XMStoreFloat3(&constants.BoundsExtent, bounds.max - bounds.min);
+        constants.BaseVertex = (uint32_t)Packet.BaseVertex;
+        constants.Material = Packet.Material;
+        Context.SetConstantArray(4, sizeof(constants) / 4, &constants);
+        Context.DrawIndexed(Packet.IndexCount, Packet.StartIndex, Packet.BaseVertex);
+    }
+};
+
+void ModelViewer::RenderObjects( GraphicsContext& gfxContext, const Matrix4& ViewProjMat, ePass Pass, const GraphicsPSO& OpaquePSO, const GraphicsPSO& CutoutPSO )
+{
+    struct VSConstants
+    {
+        Matrix4 modelToProjection;
+        Matrix4 modelToShadow;
+        XMFLOAT3 viewerPos;
+    } vsConstants;
+    vsConstants.modelToProjection = ViewProjMat;
+    vsConstants.modelToShadow = m_SunShadow.GetShadowMatrix();
+    XMStoreFloat3(&vsConstants.viewerPos, m_Camera.GetPosition());
 
-        gfxContext.SetConstants(4, baseVertex, materialIdx);
+    gfxContext.SetDynamicConstantBufferView(0, sizeof(vsConstants), &vsConstants);
 
-        gfxContext.DrawIndexed(indexCount, startIndex, baseVertex);
+    // the index buffer is bound with 16-bit indices on entry
+    ModelStateBinder binder = { { &OpaquePSO, &CutoutPSO }, m_Model.get(), index_format_uint16 };
+    RenderQueue::SubmitStats& Stats = m_SubmitStats[Pass];
+    {
+        ScopedTimer _prof(L"Opaque", gfxContext);
+        Stats = m_RenderQueue.Submit(gfxContext, binder, Pass, 0);
+    }
+    {
+        ScopedTimer _prof(L"Cutout", gfxContext);
+        Stats += m_RenderQueue.Submit(gfxContext, binder, Pass, 1);
     }
+
+    // leave the 16-bit view bound for the next pass
+    if (binder.IndexFormat != index_format_uint16)
+        gfxContext.SetIndexBuffer(m_Model->m_IndexBuffer.IndexBufferView());
 }
 
 void ModelViewer::RenderLightShadows(GraphicsContext& gfxContext)
@@ -357,16 +540,13 @@ void ModelViewer::RenderLightShadows(GraphicsContext& gfxContext)
 
     ScopedTimer _prof(L"RenderLightShadows", gfxContext);
 
-    static uint32_t LightIndex = 0;
+    uint32_t LightIndex = m_LightShadowIndex;
     if (LightIndex >= MaxLights)
         return;
 
     m_LightShadowTempBuffer.BeginRendering(gfxContext);
     {
-        gfxContext.SetPipelineState(m_ShadowPSO);
-        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], kOpaque);
-        gfxContext.SetPipelineState(m_CutoutShadowPSO);
-        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], kCutout);
+        RenderObjects(gfxContext, m_LightShadowMatrix[LightIndex], kLightShadowPass, m_ShadowPSO, m_CutoutShadowPSO);
     }
     m_LightShadowTempBuffer.EndRendering(gfxContext);
 
@@ -377,7 +557,7 @@ void ModelViewer::RenderLightShadows(GraphicsContext& gfxContext)
 
     gfxContext.TransitionResource(m_LightShadowArray, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
 
-    ++LightIndex;
+    ++m_LightShadowIndex;
 }
 
 void ModelViewer::RenderScene( void )
@@ -440,6 +620,13 @@ void ModelViewer::RenderScene( void )
 
     pfnSetupGraphicsState();
 
+    // the sun's shadow is culled with the other views, so it is placed first
+    m_SunShadow.UpdateMatrix(-m_SunDirection, Vector3(0, -500.0f, 0), Vector3(ShadowDimX, ShadowDimY, ShadowDimZ),
+        (uint32_t)g_ShadowBuffer.GetWidth(), (uint32_t)g_ShadowBuffer.GetHeight(), 16);
+
+    CullViews();
+    QueueDraws();
+
     RenderLightShadows(gfxContext);
 
     {
@@ -447,26 +634,16 @@ void ModelViewer::RenderScene( void )
 
         gfxContext.SetDynamicConstantBufferView(1, sizeof(psConstants), &psConstants);
 
-        {
-            ScopedTimer _prof(L"Opaque", gfxContext);
-            gfxContext.TransitionResource(g_SceneDepthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE, true);
-            gfxContext.ClearDepth(g_SceneDepthBuffer);
+        gfxContext.TransitionResource(g_SceneDepthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE, true);
+        gfxContext.ClearDepth(g_SceneDepthBuffer);
 
+        gfxContext.SetDepthStencilTarget(g_SceneDepthBuffer.GetDSV());
+        gfxContext.SetViewportAndScissor(m_MainViewport, m_MainScissor);
 #ifdef _WAVE_OP
-            gfxContext.SetPipelineState(EnableWaveOps ? m_DepthWaveOpsPSO : m_DepthPSO );
+        RenderObjects(gfxContext, m_ViewProjMatrix, kDepthPass, EnableWaveOps ? m_DepthWaveOpsPSO : m_DepthPSO, m_CutoutDepthPSO);
 #else
-            gfxContext.SetPipelineState(m_DepthPSO);
+        RenderObjects(gfxContext, m_ViewProjMatrix, kDepthPass, m_DepthPSO, m_CutoutDepthPSO);
 #endif
-            gfxContext.SetDepthStencilTarget(g_SceneDepthBuffer.GetDSV());
-            gfxContext.SetViewportAndScissor(m_MainViewport, m_MainScissor);
-            RenderObjects(gfxContext, m_ViewProjMatrix, kOpaque );
-        }
-
-        {
-            ScopedTimer _prof(L"Cutout", gfxContext);
-            gfxContext.SetPipelineState(m_CutoutDepthPSO);
-            RenderObjects(gfxContext, m_ViewProjMatrix, kCutout );
-        }
     }
 
     SSAO::Render(gfxContext, m_Camera);
@@ -485,14 +662,8 @@ void ModelViewer::RenderScene( void )
         {
             ScopedTimer _prof(L"Render Shadow Map", gfxContext);
 
-            m_SunShadow.UpdateMatrix(-m_SunDirection, Vector3(0, -500.0f, 0), Vector3(ShadowDimX, ShadowDimY, ShadowDimZ),
-                (uint32_t)g_ShadowBuffer.GetWidth(), (uint32_t)g_ShadowBuffer.GetHeight(), 16);
-
             g_ShadowBuffer.BeginRendering(gfxContext);
-            gfxContext.SetPipelineState(m_ShadowPSO);
-            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), kOpaque);
-            gfxContext.SetPipelineState(m_CutoutShadowPSO);
-            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), kCutout);
+            RenderObjects(gfxContext, m_SunShadow.GetViewProjMatrix(), kSunShadowPass, m_ShadowPSO, m_CutoutShadowPSO);
             g_ShadowBuffer.EndRendering(gfxContext);
         }
 
@@ -512,26 +683,32 @@ void ModelViewer::RenderScene( void )
 
             gfxContext.SetDynamicDescriptors(3, 0, _countof(m_ExtraTextures), m_ExtraTextures);
             gfxContext.SetDynamicConstantBufferView(1, sizeof(psConstants), &psConstants);
-#ifdef _WAVE_OP
-            gfxContext.SetPipelineState(EnableWaveOps ? m_ModelWaveOpsPSO : m_ModelPSO );
-#else
-            gfxContext.SetPipelineState(ShowWaveTileCounts ? m_WaveTileCountPSO : m_ModelPSO);
-#endif
             gfxContext.TransitionResource(g_SceneDepthBuffer, D3D12_RESOURCE_STATE_DEPTH_READ);
             gfxContext.SetRenderTarget(g_SceneColorBuffer.GetRTV(), g_SceneDepthBuffer.GetDSV_DepthReadOnly());
             gfxContext.SetViewportAndScissor(m_MainViewport, m_MainScissor);
 
-            RenderObjects( gfxContext, m_ViewProjMatrix, kOpaque );
-
-            if (!ShowWaveTileCounts)
-            {
-                gfxContext.SetPipelineState(m_CutoutModelPSO);
-                RenderObjects( gfxContext, m_ViewProjMatrix, kCutout );
-            }
+            // cutouts are left out of the queue when showing wave tile counts
+#ifdef _WAVE_OP
+            RenderObjects( gfxContext, m_ViewProjMatrix, kColorPass, EnableWaveOps ? m_ModelWaveOpsPSO : m_ModelPSO, m_CutoutModelPSO );
+#else
+            RenderObjects( gfxContext, m_ViewProjMatrix, kColorPass, ShowWaveTileCounts ? m_WaveTileCountPSO : m_ModelPSO, m_CutoutModelPSO );
+#endif
         }
 
     }
 
+    {
+        uint32_t draws = 0;
+        uint32_t changesAvoided = 0;
+        for (uint32_t Pass = 0; Pass < kPassCount; ++Pass)
+        {
+            draws += m_SubmitStats[Pass].Draws;
+            changesAvoided += m_SubmitStats[Pass].StateChangesAvoided();
+        }
+        EngineProfiling::SetCounter(L"Draws Submitted", draws);
+        EngineProfiling::SetCounter(L"State Changes Avoided", changesAvoided);
+    }
+
     // Some systems generate a per-pixel velocity buffer to better track dynamic and skinned meshes.  Everything
     // is static in our scene, so we generate velocity from camera motion and the depth buffer.  A velocity buffer
     // is necessary for all temporal effects (and motion blur).
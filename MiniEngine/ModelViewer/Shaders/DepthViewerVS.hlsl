@@ -13,6 +13,9 @@
 //
 
 #include "ModelViewerRS.hlsli"
+#ifdef QUANTIZED_VERTICES
+#include "QuantizedVertex.hlsli"
+#endif
 
 cbuffer VSConstants : register(b0)
 {
@@ -21,11 +24,16 @@ cbuffer VSConstants : register(b0)
 
 struct VSInput
 {
+#ifdef QUANTIZED_VERTICES
+    float3 position : POSITION;
+    float2 texcoord0 : TEXCOORD;
+#else
     float3 position : POSITION;
     float2 texcoord0 : TEXCOORD;
     float3 normal : NORMAL;
     float3 tangent : TANGENT;
     float3 bitangent : BITANGENT;
+#endif
 };
 
 struct VSOutput
@@ -38,7 +46,11 @@ struct VSOutput
 VSOutput main(VSInput vsInput)
 {
     VSOutput vsOutput;
+#ifdef QUANTIZED_VERTICES
+    vsOutput.pos = mul(modelToProjection, float4(DecodePosition(vsInput.position), 1.0));
+#else
     vsOutput.pos = mul(modelToProjection, float4(vsInput.position, 1.0));
+#endif
     vsOutput.uv = vsInput.texcoord0;
     return vsOutput;
 }
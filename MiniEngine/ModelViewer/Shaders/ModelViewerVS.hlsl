@@ -13,6 +13,9 @@
 //
 
 #include "ModelViewerRS.hlsli"
+#ifdef QUANTIZED_VERTICES
+#include "QuantizedVertex.hlsli"
+#endif
 
 cbuffer VSConstants : register(b0)
 {
@@ -23,11 +26,19 @@ cbuffer VSConstants : register(b0)
 
 struct VSInput
 {
+#ifdef QUANTIZED_VERTICES
+    float3 position : POSITION;
+    float2 texcoord0 : TEXCOORD;
+    float2 normal : NORMAL;
+    float2 tangent : TANGENT;
+    float bitangent : BITANGENT;
+#else
     float3 position : POSITION;
     float2 texcoord0 : TEXCOORD;
     float3 normal : NORMAL;
     float3 tangent : TANGENT;
     float3 bitangent : BITANGENT;
+#endif
 };
 
 struct VSOutput
@@ -47,15 +58,27 @@ VSOutput main(VSInput vsInput)
 {
     VSOutput vsOutput;
 
-    vsOutput.position = mul(modelToProjection, float4(vsInput.position, 1.0));
-    vsOutput.worldPos = vsInput.position;
+#ifdef QUANTIZED_VERTICES
+    float3 position = DecodePosition(vsInput.position);
+    float3 normal = DecodeOctahedral(vsInput.normal);
+    float3 tangent = DecodeOctahedral(vsInput.tangent);
+    float3 bitangent = DecodeBitangent(normal, tangent, vsInput.bitangent);
+#else
+    float3 position = vsInput.position;
+    float3 normal = vsInput.normal;
+    float3 tangent = vsInput.tangent;
+    float3 bitangent = vsInput.bitangent;
+#endif
+
+    vsOutput.position = mul(modelToProjection, float4(position, 1.0));
+    vsOutput.worldPos = position;
     vsOutput.texCoord = vsInput.texcoord0;
-    vsOutput.viewDir = vsInput.position - ViewerPos;
-    vsOutput.shadowCoord = mul(modelToShadow, float4(vsInput.position, 1.0)).xyz;
+    vsOutput.viewDir = position - ViewerPos;
+    vsOutput.shadowCoord = mul(modelToShadow, float4(position, 1.0)).xyz;
 
-    vsOutput.normal = vsInput.normal;
-    vsOutput.tangent = vsInput.tangent;
-    vsOutput.bitangent = vsInput.bitangent;
+    vsOutput.normal = normal;
+    vsOutput.tangent = tangent;
+    vsOutput.bitangent = bitangent;
 
     return vsOutput;
 }
@@ -0,0 +1,43 @@
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+// Developed by Minigraph
+//
+
+//
+// Decodes the compact vertices ModelConverter writes with -quantize (see
+// GetQuantizedLayout in Model/VertexQuantize.h).  Positions are unorm within
+// the bounding box of their mesh, which is set with every draw.  Normals and
+// tangents are octahedral encoded, and only the sign of the bitangent is kept.
+//
+
+cbuffer MeshConstants : register(b1)
+{
+    float3 BoundsMin;
+    uint BaseVertex;
+    float3 BoundsExtent;
+    uint MaterialIdx;
+};
+
+float3 DecodePosition( float3 position )
+{
+    return BoundsMin + position * BoundsExtent;
+}
+
+float3 DecodeOctahedral( float2 encoded )
+{
+    float3 direction = float3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (direction.z < 0.0)
+        direction.xy = (1.0 - abs(direction.yx)) * (step(0.0, direction.xy) * 2.0 - 1.0);
+    return normalize(direction);
+}
+
+float3 DecodeBitangent( float3 normal, float3 tangent, float bitangentSign )
+{
+    return cross(normal, tangent) * (bitangentSign < 0.0 ? -1.0 : 1.0);
+}
@@ -434,13 +434,22 @@ void D3D12HelloTriangle::PopulateCommandList()
 
 	//uint32_t materialIdx = 0xFFFFFFFFul;
 	const uint32_t VertexStride = m_model->m_VertexStride;
+	uint32_t indexFormat = index_format_uint16;
 	for (uint32_t meshIndex = 0; meshIndex < m_model->m_Header.meshCount; meshIndex++)
 	{
 		const Mesh& mesh = m_model->m_pMesh[meshIndex];
 		const uint32_t indexCount = mesh.indexCount;
-		const uint32_t startIndex = mesh.indexDataByteOffset / sizeof(uint16_t);
+		const uint32_t startIndex = mesh.indexDataByteOffset / IndexFormatSize(mesh.indexFormat);
 		const uint32_t baseVertex = mesh.vertexDataByteOffset / VertexStride;
 
+		if (mesh.indexFormat != indexFormat)
+		{
+			indexFormat = mesh.indexFormat;
+			const D3D12_INDEX_BUFFER_VIEW meshIndexBufferView = m_model->m_IndexBuffer.IndexBufferView(
+				0, (uint32_t)m_model->m_IndexBuffer.GetBufferSize(), indexFormat == index_format_uint32);
+			m_commandList->IASetIndexBuffer(&meshIndexBufferView);
+		}
+
 		/*if (mesh.materialIndex != materialIdx)
 		{
 			materialIdx = mesh.materialIndex;